@@ -0,0 +1,824 @@
+#include "yacc.h"
+
+/**
+ ** Built-in assembler.
+ ** Turns the assembly codegen produces into x86-64 machine code, so that a program can be written
+ ** out as an object file or an executable (see elf.c) without going through an external
+ ** assembler. Only the instructions and addressing modes codegen uses are understood.
+ ** Every line is encoded on its own, except for jumps: those start out in their 2-byte rel8 form
+ ** and are relaxed to rel32 whenever their target turns out to be out of reach, until the layout
+ ** stops changing. A jump is never shrunk back, so this always settles. The other references to
+ ** labels, rip-relative addresses and the entries of jump tables, have a fixed size and are filled
+ ** in once the layout is known.
+ **/
+
+enum {
+    OP_REGISTER,
+    OP_MEMORY,
+    OP_IMMEDIATE,
+};
+
+typedef struct {
+    int kind;
+    int reg;        // Register number, for OP_REGISTER
+    int size;       // Size in bytes of a register, or of a memory operand if it was given one
+    int base;       // Registers of a memory operand, or -1 when they are missing
+    int index;
+    int scale;
+    long val;       // Displacement of a memory operand, or the value of an immediate
+    char *label;    // Label a rip-relative memory operand refers to, if any
+} Operand;
+
+// Stands in for rip as the base of a memory operand
+#define REGISTER_RIP 16
+
+// Conditions of the jumps that don't test one
+#define JUMP_ALWAYS -1
+#define JUMP_CALL -2
+
+enum {
+    FRAG_CODE,      // Bytes that don't depend on the layout
+    FRAG_LABEL,
+    FRAG_JUMP,
+    FRAG_ALIGN,
+    FRAG_RELATIVE,  // Bytes that end with the 4-byte distance to a label
+};
+
+typedef struct {
+    int kind;
+    Bytes *code;
+    char *label;        // Label defined here, or the target of a jump or a distance
+    char *base;         // Label a distance is measured from, or NULL for the end of the fragment
+    int condition;      // Condition code of a conditional jump, or JUMP_ALWAYS or JUMP_CALL
+    bool is_long;       // Whether a jump needs a rel32
+    int align;          // Boundary to pad to, for FRAG_ALIGN
+    int offset;
+} Fragment;
+
+char *REGISTERS_64[] = {"rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi", "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15"};
+char *REGISTERS_32[] = {"eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi", "r8d", "r9d", "r10d", "r11d", "r12d", "r13d", "r14d", "r15d"};
+char *REGISTERS_16[] = {"ax", "cx", "dx", "bx", "sp", "bp", "si", "di", "r8w", "r9w", "r10w", "r11w", "r12w", "r13w", "r14w", "r15w"};
+char *REGISTERS_8[] = {"al", "cl", "dl", "bl", "spl", "bpl", "sil", "dil", "r8b", "r9b", "r10b", "r11b", "r12b", "r13b", "r14b", "r15b"};
+char *REGISTERS_XMM[] = {"xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6", "xmm7", "xmm8", "xmm9", "xmm10", "xmm11", "xmm12", "xmm13", "xmm14", "xmm15"};
+char *REGISTERS_YMM[] = {"ymm0", "ymm1", "ymm2", "ymm3", "ymm4", "ymm5", "ymm6", "ymm7", "ymm8", "ymm9", "ymm10", "ymm11", "ymm12", "ymm13", "ymm14", "ymm15"};
+
+// Condition codes, in the order of their encoding, followed by their aliases
+char *CONDITION_NAMES[] = {"o", "no", "b", "ae", "e", "ne", "be", "a", "s", "ns", "p", "np", "l", "ge", "le", "g",
+                           "c", "nae", "nb", "nc", "z", "nz", "na", "nbe", "pe", "po", "nge", "nl", "ng", "nle"};
+int CONDITION_ALIASES[] = {2, 2, 3, 3, 4, 5, 6, 7, 10, 11, 12, 13, 14, 15};
+
+// The ALU operations that share the same encodings, by their opcode extension
+char *ALU_OPERATIONS[] = {"add", "or", "adc", "sbb", "and", "sub", "xor", "cmp"};
+
+// Single-operand operations encoded as F7 /ext
+char *GROUP3_OPERATIONS[] = {NULL, NULL, "not", "neg", "mul", "imul", "div", "idiv"};
+
+// Shifts and rotates, encoded as C1/D1/D3 /ext
+char *SHIFT_OPERATIONS[] = {"rol", "ror", "rcl", "rcr", "shl", "shr", "sal", "sar"};
+
+// Packed integer operations, encoded as 66 0F op, or with a VEX prefix for their v forms
+char *PACKED_OPERATIONS[] = {"paddq", "paddd", "psubq", "psubd", "pand", "por", "pxor", "pcmpeqd", "punpcklqdq"};
+int PACKED_OPCODES[] = {0xd4, 0xfe, 0xfb, 0xfa, 0xdb, 0xeb, 0xef, 0x76, 0x6c};
+
+// Packed shifts by an immediate, encoded as 66 0F op /ext ib
+char *PACKED_SHIFTS[] = {"psllq", "psrlq", "pslld", "psrld"};
+int PACKED_SHIFT_OPCODES[] = {0x73, 0x73, 0x72, 0x72};
+int PACKED_SHIFT_EXTENSIONS[] = {6, 2, 6, 2};
+
+// Recommended no-ops of every length up to 9 bytes, to pad with
+char *NOPS[] = {
+    "",
+    "\x90",
+    "\x66\x90",
+    "\x0f\x1f\x00",
+    "\x0f\x1f\x40\x00",
+    "\x0f\x1f\x44\x00\x00",
+    "\x66\x0f\x1f\x44\x00\x00",
+    "\x0f\x1f\x80\x00\x00\x00\x00",
+    "\x0f\x1f\x84\x00\x00\x00\x00\x00",
+    "\x66\x0f\x1f\x84\x00\x00\x00\x00\x00",
+};
+
+void assembly_error(char *message, char *line) {
+    fprintf(stderr, "Couldn't assemble '%s': %s\n", line, message);
+    exit(ASSEMBLY_ERROR);
+}
+
+int find_name(char **names, int count, char *name) {
+    for(int i = 0; i < count; i++) {
+        if(names[i] && strcmp(names[i], name) == 0) return i;
+    }
+    return -1;
+}
+
+// Returns the encoding of a condition code such as "ge" or "nz", or -1
+int condition_encoding(char *name) {
+    int i = find_name(CONDITION_NAMES, 30, name);
+    if(i < 16) return i;
+    return CONDITION_ALIASES[i - 16];
+}
+
+bool fits_in_byte(long val) {
+    return val >= -128 && val <= 127;
+}
+
+// Reads a register name, setting its number and size. Returns false if it isn't a register.
+bool parse_register(char *name, Operand *op) {
+    char **tables[] = {REGISTERS_64, REGISTERS_32, REGISTERS_16, REGISTERS_8, REGISTERS_XMM, REGISTERS_YMM};
+    int sizes[] = {8, 4, 2, 1, 16, 32};
+    for(int i = 0; i < 6; i++) {
+        int reg = find_name(tables[i], 16, name);
+        if(reg == -1) continue;
+        op->kind = OP_REGISTER;
+        op->reg = reg;
+        op->size = sizes[i];
+        return true;
+    }
+    return false;
+}
+
+bool parse_number(char *text, long *val) {
+    char *end;
+    bool negative = *text == '-';
+    if(*text == '-' || *text == '+') text++;
+    if(!isdigit(*text)) return false;
+    unsigned long magnitude = strtoul(text, &end, 0);
+    if(*end != '\0') return false;
+    *val = negative ? -magnitude : magnitude;
+    return true;
+}
+
+// Reads the inside of a memory operand, such as rbp-8, rax+rbx*4+16 or rip+label
+void parse_address(char *text, Operand *op, char *line) {
+    op->kind = OP_MEMORY;
+    op->base = op->index = -1;
+    op->scale = 1;
+    op->val = 0;
+    op->label = NULL;
+
+    char term[32];
+    for(char *pos = text; *pos;) {
+        int sign = 1;
+        if(*pos == '+' || *pos == '-') sign = *pos++ == '-' ? -1 : 1;
+        int len = strcspn(pos, "+-");
+        if(len == 0 || len >= 32) assembly_error("bad address", line);
+        memcpy(term, pos, len);
+        term[len] = '\0';
+        pos += len;
+
+        Operand reg;
+        long val;
+        char *star = strchr(term, '*');
+        if(star) {
+            *star = '\0';
+            if(!parse_register(term, &reg) || !parse_number(star + 1, &val) || op->index != -1) assembly_error("bad index", line);
+            op->index = reg.reg;
+            op->scale = val;
+        } else if(parse_register(term, &reg)) {
+            if(op->base == -1) {
+                op->base = reg.reg;
+            } else if(op->index == -1) {
+                op->index = reg.reg;
+            } else {
+                assembly_error("too many registers", line);
+            }
+        } else if(strcmp(term, "rip") == 0 && op->base == -1) {
+            op->base = REGISTER_RIP;
+        } else if(parse_number(term, &val)) {
+            op->val += sign * val;
+        } else if(sign == 1 && op->label == NULL && (isalpha(*term) || *term == '_' || *term == '.')) {
+            op->label = malloc(len + 1);
+            strcpy(op->label, term);
+        } else {
+            assembly_error("bad address", line);
+        }
+    }
+    if(op->base == REGISTER_RIP ? op->index != -1 : op->label != NULL) assembly_error("only rip can be added to a label", line);
+    if(op->scale != 1 && op->scale != 2 && op->scale != 4 && op->scale != 8) assembly_error("bad scale", line);
+    if(op->index == 4) assembly_error("rsp can't be an index", line);
+    if(!fits_in_immediate(op->val)) assembly_error("displacement out of range", line);
+}
+
+void parse_operand(char *text, Operand *op, char *line) {
+    while(isspace(*text)) text++;
+    int len = strlen(text);
+    while(len > 0 && isspace(text[len - 1])) text[--len] = '\0';
+
+    op->size = 0;
+    op->label = NULL;
+    char *sizes[] = {"BYTE PTR ", "WORD PTR ", "DWORD PTR ", "QWORD PTR "};
+    for(int i = 0; i < 4; i++) {
+        if(strncmp(text, sizes[i], strlen(sizes[i])) == 0) {
+            op->size = 1 << i;
+            text += strlen(sizes[i]);
+        }
+    }
+
+    if(*text == '[') {
+        char *end = strchr(text, ']');
+        if(end == NULL || end[1] != '\0') assembly_error("unterminated address", line);
+        *end = '\0';
+        int size = op->size;
+        parse_address(text + 1, op, line);
+        op->size = size;
+    } else if(parse_register(text, op)) {
+        return;
+    } else if(parse_number(text, &op->val)) {
+        op->kind = OP_IMMEDIATE;
+    } else {
+        assembly_error("bad operand", line);
+    }
+}
+
+void encode_rm(Bytes *out, int reg, Operand *rm);
+
+// Encodes an instruction that takes a ModRM byte. reg is the register (or opcode extension) that
+// goes in its reg field, and rm the register or memory operand. Opcodes above 0xff are two bytes.
+void encode_modrm(Bytes *out, bool wide, int opcode, int reg, Operand *rm) {
+    int rex = (wide ? 8 : 0) | (reg & 8 ? 4 : 0);
+    if(rm->kind == OP_REGISTER) {
+        rex |= rm->reg & 8 ? 1 : 0;
+        // spl, bpl, sil and dil only exist with a REX prefix
+        if(rex || (rm->size == 1 && rm->reg >= 4 && rm->reg < 8)) bytes_push(out, 0x40 | rex);
+    } else {
+        rex |= (rm->index != -1 && rm->index & 8 ? 2 : 0) | (rm->base != -1 && rm->base & 8 ? 1 : 0);
+        if(rex) bytes_push(out, 0x40 | rex);
+    }
+    if(opcode > 0xff) bytes_push(out, opcode >> 8);
+    bytes_push(out, opcode & 0xff);
+    encode_rm(out, reg, rm);
+}
+
+// The ModRM byte, and the SIB byte and displacement a memory operand may need
+void encode_rm(Bytes *out, int reg, Operand *rm) {
+    if(rm->kind == OP_REGISTER) {
+        bytes_push(out, 0xc0 | (reg & 7) << 3 | (rm->reg & 7));
+        return;
+    }
+
+    // A rip-relative displacement counts from the end of the instruction
+    if(rm->base == REGISTER_RIP) {
+        bytes_push(out, (reg & 7) << 3 | 5);
+        bytes_push_value(out, rm->val, 4);
+        return;
+    }
+
+    int scale = rm->scale == 8 ? 3 : rm->scale == 4 ? 2 : rm->scale == 2 ? 1 : 0;
+    int index = rm->index == -1 ? 4 : rm->index & 7;
+    // Without a base register, the address is a 32-bit displacement plus the index
+    if(rm->base == -1) {
+        bytes_push(out, (reg & 7) << 3 | 4);
+        bytes_push(out, scale << 6 | index << 3 | 5);
+        bytes_push_value(out, rm->val, 4);
+        return;
+    }
+
+    // rbp and r13 can't go without a displacement, and rsp and r12 need a SIB byte
+    int mod = rm->val == 0 && (rm->base & 7) != 5 ? 0 : fits_in_byte(rm->val) ? 1 : 2;
+    if(rm->index == -1 && (rm->base & 7) != 4) {
+        bytes_push(out, mod << 6 | (reg & 7) << 3 | (rm->base & 7));
+    } else {
+        bytes_push(out, mod << 6 | (reg & 7) << 3 | 4);
+        bytes_push(out, scale << 6 | index << 3 | (rm->base & 7));
+    }
+    if(mod == 1) bytes_push_value(out, rm->val, 1);
+    if(mod == 2) bytes_push_value(out, rm->val, 4);
+}
+
+// Instructions that put a register number in the low bits of their opcode, like push and pop
+void encode_short_form(Bytes *out, bool wide, int opcode, int reg) {
+    if(wide || reg & 8) bytes_push(out, 0x40 | (wide ? 8 : 0) | (reg & 8 ? 1 : 0));
+    bytes_push(out, opcode + (reg & 7));
+}
+
+// Encodes an instruction with a VEX prefix, which takes the place of the REX one and of the
+// mandatory prefix, and names a second source register in vvvv. pp is the prefix it stands for
+// (1 for 66, 2 for F3), map the opcode map (1 for 0F, 2 for 0F38), and ymm sets the vector length.
+void encode_vex(Bytes *out, int pp, int map, bool wide, bool ymm, int opcode, int reg, int vvvv, Operand *rm) {
+    bool r = reg & 8, x = false, b;
+    if(rm->kind == OP_REGISTER) {
+        b = rm->reg & 8;
+    } else {
+        x = rm->index != -1 && rm->index & 8;
+        b = rm->base != -1 && rm->base & 8;
+    }
+    // The two-byte form can't extend an index or base register, or take another map or W
+    if(!x && !b && !wide && map == 1) {
+        bytes_push(out, 0xc5);
+        bytes_push(out, !r << 7 | (~vvvv & 15) << 3 | ymm << 2 | pp);
+    } else {
+        bytes_push(out, 0xc4);
+        bytes_push(out, !r << 7 | !x << 6 | !b << 5 | map);
+        bytes_push(out, wide << 7 | (~vvvv & 15) << 3 | ymm << 2 | pp);
+    }
+    bytes_push(out, opcode);
+    encode_rm(out, reg, rm);
+}
+
+bool is_register(Operand *op) {
+    return op->kind == OP_REGISTER;
+}
+
+bool is_vector_register(Operand *op) {
+    return op->kind == OP_REGISTER && op->size >= 16;
+}
+
+bool is_register_or_memory(Operand *op) {
+    return op->kind == OP_REGISTER || op->kind == OP_MEMORY;
+}
+
+// The size an instruction works on: that of its register operand, or whatever its memory operand says
+int operand_size(Operand *ops, int count) {
+    for(int i = 0; i < count; i++) {
+        if(ops[i].kind == OP_REGISTER) return ops[i].size;
+    }
+    for(int i = 0; i < count; i++) {
+        if(ops[i].kind == OP_MEMORY && ops[i].size) return ops[i].size;
+    }
+    return 8;
+}
+
+// Whether an immediate can be given to an instruction that works on the given size, whether it is
+// read as signed or unsigned
+bool fits_in_size(long val, int size) {
+    if(size >= 4) return fits_in_immediate(val);
+    return val >= -(1L << (size * 8 - 1)) && val < (1L << size * 8);
+}
+
+// Whether an instruction has forms that work on bytes and words. Those are its 32-bit forms behind
+// an operand-size prefix for words, and opcodes of their own, one below those, for bytes.
+bool has_narrow_forms(char *mnemonic) {
+    if(find_name(ALU_OPERATIONS, 8, mnemonic) != -1 || find_name(GROUP3_OPERATIONS, 8, mnemonic) != -1) return true;
+    if(find_name(SHIFT_OPERATIONS, 8, mnemonic) != -1) return true;
+    char *names[] = {"mov", "inc", "dec", "test"};
+    return find_name(names, 4, mnemonic) != -1;
+}
+
+// The SSE2 and AVX2 instructions the vectorizer uses. A v form takes its destination, then its two
+// sources, and works on ymm registers, or xmm ones where it moves a single value. Memory operands
+// are only ever loaded and stored with movdqu, which doesn't care about alignment.
+bool encode_vector_instruction(Bytes *out, char *mnemonic, Operand *ops, int count) {
+    bool vex = mnemonic[0] == 'v';
+    char *name = vex ? mnemonic + 1 : mnemonic;
+    if(strcmp(name, "zeroupper") == 0 && vex && count == 0) {
+        bytes_push(out, 0xc5);
+        bytes_push(out, 0xf8);
+        bytes_push(out, 0x77);
+        return true;
+    }
+    if(count < 2) return false;
+    Operand *dst = &ops[0], *src = &ops[1], *last = &ops[count - 1];
+
+    int i = find_name(PACKED_OPERATIONS, 9, name);
+    if(i != -1) {
+        if(count != (vex ? 3 : 2)) return false;
+        if(!is_vector_register(dst) || !is_vector_register(last) || last->size != dst->size) return false;
+        if(vex) {
+            if(!is_vector_register(src) || src->size != dst->size) return false;
+            encode_vex(out, 1, 1, false, dst->size == 32, PACKED_OPCODES[i], dst->reg, src->reg, last);
+        } else {
+            if(dst->size != 16) return false;
+            bytes_push(out, 0x66);
+            encode_modrm(out, false, 0x0f00 | PACKED_OPCODES[i], dst->reg, src);
+        }
+        return true;
+    }
+    i = find_name(PACKED_SHIFTS, 4, name);
+    if(i != -1) {
+        if(count != (vex ? 3 : 2)) return false;
+        if(!is_vector_register(dst) || last->kind != OP_IMMEDIATE || !fits_in_size(last->val, 1)) return false;
+        if(vex) {
+            if(!is_vector_register(src) || src->size != dst->size) return false;
+            encode_vex(out, 1, 1, false, dst->size == 32, PACKED_SHIFT_OPCODES[i], PACKED_SHIFT_EXTENSIONS[i], dst->reg, src);
+        } else {
+            if(dst->size != 16) return false;
+            bytes_push(out, 0x66);
+            encode_modrm(out, false, 0x0f00 | PACKED_SHIFT_OPCODES[i], PACKED_SHIFT_EXTENSIONS[i], dst);
+        }
+        bytes_push_value(out, last->val, 1);
+        return true;
+    }
+
+    // Moves: 6F loads, 7F stores, with F3 in front for movdqu and 66 for movdqa
+    if((strcmp(name, "movdqu") == 0 || strcmp(name, "movdqa") == 0) && count == 2) {
+        int prefix = name[5] == 'u' ? 0xf3 : 0x66;
+        Operand *reg = is_vector_register(dst) ? dst : src, *rm = is_vector_register(dst) ? src : dst;
+        // Between two registers, the store form keeps a high source out of rm, where the two-byte VEX can't reach
+        if(vex && is_register(rm) && rm->reg & 8 && !(reg->reg & 8)) {
+            reg = src;
+            rm = dst;
+        }
+        if(!is_vector_register(reg) || rm->kind == OP_IMMEDIATE || (is_register(rm) && rm->size != reg->size)) return false;
+        if(vex ? reg->size != 16 && reg->size != 32 : reg->size != 16) return false;
+        int opcode = reg == dst ? 0x6f : 0x7f;
+        if(vex) {
+            encode_vex(out, prefix == 0xf3 ? 2 : 1, 1, false, reg->size == 32, opcode, reg->reg, 0, rm);
+        } else {
+            bytes_push(out, prefix);
+            encode_modrm(out, false, 0x0f00 | opcode, reg->reg, rm);
+        }
+        return true;
+    }
+    // A general register into the low lane of an xmm one
+    if((strcmp(name, "movq") == 0 || strcmp(name, "movd") == 0) && count == 2) {
+        bool wide = name[3] == 'q';
+        if(!is_vector_register(dst) || dst->size != 16 || !is_register(src) || is_vector_register(src) || src->size != (wide ? 8 : 4)) return false;
+        if(vex) {
+            encode_vex(out, 1, 1, wide, false, 0x6e, dst->reg, 0, src);
+        } else {
+            bytes_push(out, 0x66);
+            encode_modrm(out, wide, 0x0f6e, dst->reg, src);
+        }
+        return true;
+    }
+    if(strcmp(name, "pshufd") == 0 && !vex && count == 3) {
+        if(!is_vector_register(dst) || dst->size != 16 || !is_vector_register(src) || src->size != 16 || last->kind != OP_IMMEDIATE) return false;
+        bytes_push(out, 0x66);
+        encode_modrm(out, false, 0x0f70, dst->reg, src);
+        bytes_push_value(out, last->val, 1);
+        return true;
+    }
+    // The low lane of an xmm register copied to every lane of a ymm one
+    if((strcmp(name, "pbroadcastq") == 0 || strcmp(name, "pbroadcastd") == 0) && vex && count == 2) {
+        if(!is_vector_register(dst) || dst->size != 32 || !is_vector_register(src) || src->size != 16) return false;
+        encode_vex(out, 1, 2, false, true, name[10] == 'q' ? 0x59 : 0x58, dst->reg, 0, src);
+        return true;
+    }
+    return false;
+}
+
+// Encodes an instruction that doesn't refer to any label. Returns false if it isn't understood.
+bool encode_instruction(Bytes *out, char *mnemonic, Operand *ops, int count) {
+    if(encode_vector_instruction(out, mnemonic, ops, count)) return true;
+    int size = operand_size(ops, count);
+    // A shift by cl is as wide as what it shifts
+    if(count == 2 && find_name(SHIFT_OPERATIONS, 8, mnemonic) != -1) size = operand_size(ops, 1);
+    bool wide = size == 8;
+    Operand *dst = &ops[0], *src = &ops[1];
+    // The byte forms of the opcodes are one below the others
+    int byte = size == 1 ? 1 : 0;
+    if(count > 0 && size != 8 && size != 4) {
+        if(has_narrow_forms(mnemonic)) {
+            if(size == 2) bytes_push(out, 0x66);
+        } else if(strncmp(mnemonic, "set", 3) != 0 && strncmp(mnemonic, "mov", 3) != 0) {
+            return false;
+        }
+    }
+
+    int ext = find_name(ALU_OPERATIONS, 8, mnemonic);
+    if(ext != -1 && count == 2) {
+        if(is_register_or_memory(dst) && is_register(src)) {
+            encode_modrm(out, wide, ext * 8 + 1 - byte, src->reg, dst);
+        } else if(is_register(dst) && src->kind == OP_MEMORY) {
+            encode_modrm(out, wide, ext * 8 + 3 - byte, dst->reg, src);
+        } else if(is_register_or_memory(dst) && src->kind == OP_IMMEDIATE && fits_in_size(src->val, size)) {
+            // Bytes only come with a byte immediate, which is 0x80 rather than 0x82
+            bool short_imm = byte || fits_in_byte(src->val);
+            encode_modrm(out, wide, byte ? 0x80 : short_imm ? 0x83 : 0x81, ext, dst);
+            bytes_push_value(out, src->val, short_imm ? 1 : size == 2 ? 2 : 4);
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    ext = find_name(GROUP3_OPERATIONS, 8, mnemonic);
+    if(ext != -1 && count == 1 && is_register_or_memory(dst)) {
+        encode_modrm(out, wide, 0xf7 - byte, ext, dst);
+        return true;
+    }
+
+    ext = find_name(SHIFT_OPERATIONS, 8, mnemonic);
+    if(ext != -1 && count == 2 && is_register_or_memory(dst)) {
+        if(ext == 6) ext = 4;   // sal is shl
+        if(src->kind == OP_REGISTER && src->reg == 1 && src->size == 1) {
+            encode_modrm(out, wide, 0xd3 - byte, ext, dst);
+        } else if(src->kind == OP_IMMEDIATE && src->val == 1) {
+            encode_modrm(out, wide, 0xd1 - byte, ext, dst);
+        } else if(src->kind == OP_IMMEDIATE) {
+            encode_modrm(out, wide, 0xc1 - byte, ext, dst);
+            bytes_push_value(out, src->val, 1);
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    if(strncmp(mnemonic, "set", 3) == 0 && condition_encoding(mnemonic + 3) != -1) {
+        if(count != 1 || !is_register_or_memory(dst) || size != 1) return false;
+        encode_modrm(out, false, 0x0f90 + condition_encoding(mnemonic + 3), 0, dst);
+        return true;
+    }
+    if(strncmp(mnemonic, "cmov", 4) == 0 && condition_encoding(mnemonic + 4) != -1) {
+        if(count != 2 || !is_register(dst) || !is_register_or_memory(src)) return false;
+        encode_modrm(out, wide, 0x0f40 + condition_encoding(mnemonic + 4), dst->reg, src);
+        return true;
+    }
+
+    if(strcmp(mnemonic, "mov") == 0 && count == 2) {
+        if(is_register_or_memory(dst) && is_register(src)) {
+            encode_modrm(out, wide, 0x89 - byte, src->reg, dst);
+        } else if(is_register(dst) && src->kind == OP_MEMORY) {
+            encode_modrm(out, wide, 0x8b - byte, dst->reg, src);
+        } else if(size < 4 && src->kind == OP_IMMEDIATE && fits_in_size(src->val, size)) {
+            encode_modrm(out, false, 0xc7 - byte, 0, dst);
+            bytes_push_value(out, src->val, size);
+        } else if(is_register(dst) && size == 4 && src->kind == OP_IMMEDIATE && src->val >= INT_MIN && src->val <= UINT_MAX) {
+            // A 32-bit register has a form without a ModRM byte
+            encode_short_form(out, false, 0xb8, dst->reg);
+            bytes_push_value(out, src->val, 4);
+        } else if(size < 4) {
+            return false;
+        } else if(src->kind == OP_IMMEDIATE && (fits_in_immediate(src->val) || (!wide && src->val <= UINT_MAX))) {
+            // The 32-bit immediate of a 64-bit mov is sign-extended
+            encode_modrm(out, wide, 0xc7, 0, dst);
+            bytes_push_value(out, src->val, 4);
+        } else if(is_register(dst) && src->kind == OP_IMMEDIATE && src->val > 0 && src->val <= UINT_MAX) {
+            // Writing the 32-bit register clears the upper half
+            encode_short_form(out, false, 0xb8, dst->reg);
+            bytes_push_value(out, src->val, 4);
+        } else if(is_register(dst) && src->kind == OP_IMMEDIATE) {
+            encode_short_form(out, true, 0xb8, dst->reg);
+            bytes_push_value(out, src->val, 8);
+        } else {
+            return false;
+        }
+        return true;
+    }
+    if(strcmp(mnemonic, "movabs") == 0) {
+        if(count != 2 || !is_register(dst) || dst->size != 8 || src->kind != OP_IMMEDIATE) return false;
+        encode_short_form(out, true, 0xb8, dst->reg);
+        bytes_push_value(out, src->val, 8);
+        return true;
+    }
+    if(strcmp(mnemonic, "movsxd") == 0) {
+        if(count != 2 || !is_register(dst) || dst->size != 8 || !is_register_or_memory(src)) return false;
+        if(src->kind == OP_REGISTER ? src->size != 4 : src->size != 4 && src->size != 0) return false;
+        encode_modrm(out, true, 0x63, dst->reg, src);
+        return true;
+    }
+    // A byte or word extended to a 32- or 64-bit register, with zeroes or its sign bit
+    bool zero_extend = strcmp(mnemonic, "movzb") == 0 || strcmp(mnemonic, "movzx") == 0;
+    if(zero_extend || strcmp(mnemonic, "movsx") == 0) {
+        if(count != 2 || !is_register(dst) || dst->size < 4 || !is_register_or_memory(src)) return false;
+        int from = src->kind == OP_REGISTER || src->size ? src->size : 1;
+        if(from != 1 && from != 2) return false;
+        encode_modrm(out, dst->size == 8, (zero_extend ? 0x0fb6 : 0x0fbe) + (from == 2), dst->reg, src);
+        return true;
+    }
+    if(strcmp(mnemonic, "lea") == 0) {
+        if(count != 2 || !is_register(dst) || src->kind != OP_MEMORY) return false;
+        encode_modrm(out, wide, 0x8d, dst->reg, src);
+        return true;
+    }
+    if(strcmp(mnemonic, "test") == 0) {
+        if(count != 2 || !is_register_or_memory(dst) || !is_register(src)) return false;
+        encode_modrm(out, wide, 0x85 - byte, src->reg, dst);
+        return true;
+    }
+    if(strcmp(mnemonic, "imul") == 0 && count >= 2) {
+        if(!is_register(dst) || !is_register_or_memory(src)) return false;
+        if(count == 2) {
+            encode_modrm(out, wide, 0x0faf, dst->reg, src);
+            return true;
+        }
+        if(count != 3 || ops[2].kind != OP_IMMEDIATE || !fits_in_immediate(ops[2].val)) return false;
+        bool short_imm = fits_in_byte(ops[2].val);
+        encode_modrm(out, wide, short_imm ? 0x6b : 0x69, dst->reg, src);
+        bytes_push_value(out, ops[2].val, short_imm ? 1 : 4);
+        return true;
+    }
+    if((strcmp(mnemonic, "inc") == 0 || strcmp(mnemonic, "dec") == 0) && count == 1 && is_register_or_memory(dst)) {
+        encode_modrm(out, wide, 0xff - byte, mnemonic[0] == 'd', dst);
+        return true;
+    }
+
+    // push and pop always move 8 bytes
+    if(strcmp(mnemonic, "push") == 0 && count == 1) {
+        if(is_register(dst) && dst->size == 8) {
+            encode_short_form(out, false, 0x50, dst->reg);
+        } else if(dst->kind == OP_MEMORY) {
+            encode_modrm(out, false, 0xff, 6, dst);
+        } else if(dst->kind == OP_IMMEDIATE && fits_in_byte(dst->val)) {
+            bytes_push(out, 0x6a);
+            bytes_push_value(out, dst->val, 1);
+        } else if(dst->kind == OP_IMMEDIATE && fits_in_immediate(dst->val)) {
+            bytes_push(out, 0x68);
+            bytes_push_value(out, dst->val, 4);
+        } else {
+            return false;
+        }
+        return true;
+    }
+    if(strcmp(mnemonic, "pop") == 0 && count == 1) {
+        if(is_register(dst) && dst->size == 8) {
+            encode_short_form(out, false, 0x58, dst->reg);
+        } else if(dst->kind == OP_MEMORY) {
+            encode_modrm(out, false, 0x8f, 0, dst);
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    if(count == 0) {
+        char *names[] = {"ret", "nop", "cqo", "syscall"};
+        char *encodings[] = {"\xc3", "\x90", "\x48\x99", "\x0f\x05"};
+        int i = find_name(names, 4, mnemonic);
+        if(i == -1) return false;
+        for(char *byte = encodings[i]; *byte; byte++) bytes_push(out, (unsigned char)*byte);
+        return true;
+    }
+    return false;
+}
+
+Fragment *new_fragment(Vector *fragments, int kind) {
+    Fragment *fragment = calloc(1, sizeof(Fragment));
+    fragment->kind = kind;
+    vec_push(fragments, fragment);
+    return fragment;
+}
+
+// Splits a line into labels, a directive or an instruction, and adds what it holds to the fragments
+void assemble_line(char *original, Vector *fragments, Map *labels) {
+    char *line = malloc(strlen(original) + 1);
+    strcpy(line, original);
+    char *comment = strchr(line, ';');
+    if(comment) *comment = '\0';
+
+    char *pos = line;
+    while(true) {
+        while(isspace(*pos)) pos++;
+        int len = 0;
+        while(isalnum(pos[len]) || pos[len] == '_' || pos[len] == '.') len++;
+        if(len == 0 || pos[len] != ':') break;
+
+        pos[len] = '\0';
+        if(map_get(labels, pos) != NULL) assembly_error("label defined twice", original);
+        Fragment *label = new_fragment(fragments, FRAG_LABEL);
+        label->label = pos;
+        map_put(labels, pos, label);
+        pos += len + 1;
+    }
+    if(*pos == '\0') return;
+
+    int len = strcspn(pos, " \t");
+    char *mnemonic = pos;
+    char *operands = pos + len;
+    if(*operands) *operands++ = '\0';
+
+    if(*mnemonic == '.') {
+        if(strcmp(mnemonic, ".p2align") == 0) {
+            Fragment *align = new_fragment(fragments, FRAG_ALIGN);
+            align->align = 1 << atoi(operands);
+            return;
+        }
+        // An entry of a jump table: the distance from one label to another
+        if(strcmp(mnemonic, ".long") == 0) {
+            char *minus = strchr(operands, '-');
+            if(minus == NULL) assembly_error("only differences of labels are supported", original);
+            *minus = '\0';
+            Fragment *entry = new_fragment(fragments, FRAG_RELATIVE);
+            entry->label = strtok(operands, " \t");
+            entry->base = strtok(minus + 1, " \t");
+            if(entry->label == NULL || entry->base == NULL) assembly_error("missing label", original);
+            entry->code = new_bytes();
+            bytes_push_value(entry->code, 0, 4);
+            return;
+        }
+        // Whatever else there is says how to read the assembly, which is already the way we read it
+        if(strcmp(mnemonic, ".intel_syntax") == 0 || strcmp(mnemonic, ".global") == 0 || strcmp(mnemonic, ".text") == 0) return;
+        assembly_error("unknown directive", original);
+    }
+
+    // The operand of a jump or call is a label, except that a jmp to a 64-bit register goes to the
+    // address in it. A call only comes with a rel32.
+    bool is_call = strcmp(mnemonic, "call") == 0;
+    Operand target;
+    if(strcmp(mnemonic, "jmp") == 0 && parse_register(operands, &target) && target.size == 8) {
+        Fragment *code = new_fragment(fragments, FRAG_CODE);
+        code->code = new_bytes();
+        encode_modrm(code->code, false, 0xff, 4, &target);
+        return;
+    }
+    if(is_call || strcmp(mnemonic, "jmp") == 0 || (mnemonic[0] == 'j' && condition_encoding(mnemonic + 1) != -1)) {
+        Fragment *jump = new_fragment(fragments, FRAG_JUMP);
+        jump->label = strtok(operands, " \t");
+        jump->condition = is_call ? JUMP_CALL : strcmp(mnemonic, "jmp") == 0 ? JUMP_ALWAYS : condition_encoding(mnemonic + 1);
+        jump->is_long = is_call;
+        if(jump->label == NULL) assembly_error("missing jump target", original);
+        return;
+    }
+
+    Operand ops[3];
+    int count = 0;
+    for(char *op = strtok(operands, ","); op; op = strtok(NULL, ",")) {
+        while(isspace(*op)) op++;
+        if(*op == '\0') continue;
+        if(count == 3) assembly_error("too many operands", original);
+        parse_operand(op, &ops[count++], original);
+    }
+
+    Fragment *code = new_fragment(fragments, FRAG_CODE);
+    code->code = new_bytes();
+    if(!encode_instruction(code->code, mnemonic, ops, count)) assembly_error("unsupported instruction", original);
+
+    // The displacement is at the very end of an instruction that has no immediate
+    for(int i = 0; i < count; i++) {
+        if(ops[i].kind != OP_MEMORY || ops[i].label == NULL) continue;
+        if(ops[count - 1].kind == OP_IMMEDIATE) assembly_error("a label can't be used along with an immediate", original);
+        code->kind = FRAG_RELATIVE;
+        code->label = ops[i].label;
+    }
+}
+
+int fragment_size(Fragment *fragment) {
+    switch(fragment->kind) {
+        case FRAG_CODE:
+        case FRAG_RELATIVE:
+            return fragment->code->len;
+        case FRAG_JUMP:
+            if(!fragment->is_long) return 2;
+            return fragment->condition < 0 ? 5 : 6;
+        case FRAG_ALIGN:
+            return -fragment->offset & (fragment->align - 1);
+        default:
+            return 0;
+    }
+}
+
+Fragment *find_label(Map *labels, char *name) {
+    Fragment *label = map_get(labels, name);
+    if(label == NULL) {
+        fprintf(stderr, "Couldn't assemble a reference to undefined label %s\n", name);
+        exit(ASSEMBLY_ERROR);
+    }
+    return label;
+}
+
+// Gives every fragment its offset. Returns true if a jump had to be made longer.
+bool lay_out_fragments(Vector *fragments, Map *labels) {
+    int offset = 0;
+    for(int i = 0; i < fragments->len; i++) {
+        Fragment *fragment = fragments->data[i];
+        fragment->offset = offset;
+        offset += fragment_size(fragment);
+    }
+
+    bool grew = false;
+    for(int i = 0; i < fragments->len; i++) {
+        Fragment *jump = fragments->data[i];
+        if(jump->kind != FRAG_JUMP) continue;
+        Fragment *target = find_label(labels, jump->label);
+        if(!jump->is_long && !fits_in_byte(target->offset - (jump->offset + 2))) {
+            jump->is_long = true;
+            grew = true;
+        }
+    }
+    return grew;
+}
+
+// Assembles a whole program. The code starts at offset 0 and refers to nothing outside of itself.
+Bytes *assemble(Vector *lines) {
+    Vector *fragments = new_vector();
+    Map *labels = new_map(NULL);
+    for(int i = 0; i < lines->len; i++) {
+        assemble_line(lines->data[i], fragments, labels);
+    }
+    while(lay_out_fragments(fragments, labels));
+
+    Bytes *out = new_bytes();
+    for(int i = 0; i < fragments->len; i++) {
+        Fragment *fragment = fragments->data[i];
+        if(fragment->kind == FRAG_CODE) {
+            for(int j = 0; j < fragment->code->len; j++) bytes_push(out, fragment->code->data[j]);
+        } else if(fragment->kind == FRAG_RELATIVE) {
+            int from = fragment->base ? find_label(labels, fragment->base)->offset : fragment->offset + fragment->code->len;
+            for(int j = 0; j < fragment->code->len - 4; j++) bytes_push(out, fragment->code->data[j]);
+            bytes_push_value(out, find_label(labels, fragment->label)->offset - from, 4);
+        } else if(fragment->kind == FRAG_ALIGN) {
+            for(int pad = fragment_size(fragment); pad > 0; pad -= 9) {
+                char *nop = NOPS[pad < 9 ? pad : 9];
+                for(int j = 0; j < (pad < 9 ? pad : 9); j++) bytes_push(out, (unsigned char)nop[j]);
+            }
+        } else if(fragment->kind == FRAG_JUMP) {
+            Fragment *target = map_get(labels, fragment->label);
+            int end = fragment->offset + fragment_size(fragment);
+            if(!fragment->is_long) {
+                bytes_push(out, fragment->condition == JUMP_ALWAYS ? 0xeb : 0x70 + fragment->condition);
+                bytes_push_value(out, target->offset - end, 1);
+            } else {
+                if(fragment->condition == JUMP_CALL) {
+                    bytes_push(out, 0xe8);
+                } else if(fragment->condition == JUMP_ALWAYS) {
+                    bytes_push(out, 0xe9);
+                } else {
+                    bytes_push(out, 0x0f);
+                    bytes_push(out, 0x80 + fragment->condition);
+                }
+                bytes_push_value(out, target->offset - end, 4);
+            }
+        }
+    }
+    return out;
+}
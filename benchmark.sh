@@ -0,0 +1,20 @@
+#!/bin/bash
+
+# Compares how fast the bytecode interpreter (-interp) and native code (-run) get through each
+# program in test_programs/. Both run it -bench=N times in the same process, so start-up isn't
+# counted. Optimizations fold most of these programs down to a constant, so they're off unless
+# BENCHMARK_FLAGS says otherwise (set it empty to benchmark optimized code).
+runs=${BENCHMARK_RUNS-100000}
+flags=${BENCHMARK_FLAGS--O0}
+
+time_per_run() {
+    ./yacc $flags -bench=$runs "$@" 2>&1 >/dev/null | awk '{ print $2 }'
+}
+
+printf "%-28s %18s %18s %10s\n" "program" "interpreter (ns)" "native (ns)" "slowdown"
+for file_name in test_programs/*.yacc; do
+    interpreted=$(time_per_run -interp "$file_name")
+    native=$(time_per_run -run "$file_name")
+    awk -v name="$(basename "$file_name")" -v interpreted="$interpreted" -v native="$native" \
+        'BEGIN { printf "%-28s %18.1f %18.1f %9.1fx\n", name, interpreted, native, interpreted / native }'
+done
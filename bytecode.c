@@ -0,0 +1,623 @@
+#include "yacc.h"
+
+/**
+ ** Bytecode compiler for the interpreter (-interp).
+ ** The tree is compiled to register bytecode, which starts running right away instead of going
+ ** through the assembler. Every variable has a register of its own in the frame of the function
+ ** it's in, so scopes need no frames and a goto is a plain jump. An array has one register per
+ ** element, in a row, that LOADX and STOREX index into. Temporaries get the registers after the
+ ** variables, and each statement starts over with the first one.
+ ** An expression is computed straight into the register it's headed for: x = y + 1 is a single
+ ** ADDI x, y, 1. Conditions compile to fused compare-and-branch instructions, and a loop that
+ ** counts by one ends in an instruction that steps the counter and jumps back while it's in range.
+ ** Loops are rotated the way codegen does it, so each iteration runs a single jump.
+ ** The arguments of a call are computed into consecutive temporaries, where the frame of the
+ ** function then starts, so they already are its parameters. Functions follow main's code.
+ **/
+
+typedef struct {
+    Bytecode *bytecode;
+    int temps;                  // Temporaries used so far by the statement being compiled
+    Vector *labels;             // Instruction each label is placed at, or -1 while it's still ahead
+    Map *named_labels;          // Label of each label in the program, plus one, by name
+    Vector *loops;              // Loops being compiled, innermost last,
+    Vector *break_labels;       // and the labels a break
+    Vector *continue_labels;    // or a continue out of each of them goes to
+    Scope *scope;               // Innermost scope with a frame in the generated code
+    Node *result;               // Statement whose value the program exits with
+    int result_register;
+    Node *function;             // Function being compiled, or NULL for main
+    int *registers_of;          // Register of each variable in its frame, by id
+    int variables;              // Registers the frame's variables take up
+} BytecodeCompiler;
+
+void push_instruction(BytecodeCompiler *c, int op, int a, int b, int target) {
+    Bytecode *bytecode = c->bytecode;
+    if(bytecode->len == bytecode->capacity) {
+        bytecode->capacity *= 2;
+        bytecode->code = realloc(bytecode->code, sizeof(Instruction) * bytecode->capacity);
+    }
+    bytecode->code[bytecode->len++] = (Instruction){op, a, b, target};
+}
+
+int bytecode_label(BytecodeCompiler *c) {
+    vec_push(c->labels, (void *)-1L);
+    return c->labels->len - 1;
+}
+
+void place_bytecode_label(BytecodeCompiler *c, int label) {
+    c->labels->data[label] = (void *)(long)c->bytecode->len;
+}
+
+int named_label(BytecodeCompiler *c, char *name) {
+    long label = (long)map_get(c->named_labels, name);
+    if(label == 0) {
+        label = bytecode_label(c) + 1;
+        map_put(c->named_labels, name, (void *)label);
+    }
+    return label - 1;
+}
+
+int temporary(BytecodeCompiler *c) {
+    int reg = c->variables + c->temps++;
+    if(reg >= c->bytecode->registers) c->bytecode->registers = reg + 1;
+    return reg;
+}
+
+int register_of(BytecodeCompiler *c, Node *ident) {
+    return c->registers_of[variable_of(ident)];
+}
+
+// Gives registers to the variables of a scope and every scope in it, in the order they were declared
+void number_registers(BytecodeCompiler *c, Scope *scope) {
+    for(int i = 0; i < scope->variable_ids->vals->len; i++) {
+        long id = (long)scope->variable_ids->vals->data[i];
+        if(c->registers_of[id] != -1) continue;
+        c->registers_of[id] = c->variables;
+        c->variables += variable_length(id) ? variable_length(id) : 1;
+    }
+    for(int i = 0; i < scope->sub_scopes->len; i++) number_registers(c, scope->sub_scopes->data[i]);
+}
+
+// Operations on two registers. Adding IMMEDIATE_FORM gives the one that takes a constant instead.
+#define IMMEDIATE_FORM (BC_ADDI - BC_ADD)
+
+int bytecode_operation(int op) {
+    switch(op) {
+        case '+': return BC_ADD;
+        case '-': return BC_SUB;
+        case '*': return BC_MUL;
+        case '/': return BC_DIV;
+        case '%': return BC_MOD;
+        case ND_LEFT_SHIFT: return BC_SHL;
+        case ND_RIGHT_SHIFT: return BC_SHR;
+        case '&': return BC_AND;
+        case '|': return BC_OR;
+        case '^': return BC_XOR;
+        case ND_EQUAL: return BC_EQ;
+        case ND_NEQUAL: return BC_NE;
+        case '<': return BC_LT;
+        case ND_LEQUAL: return BC_LE;
+        case '>': return BC_GT;
+        default: return BC_GE;
+    }
+}
+
+// The compare-and-branch that jumps when the comparison holds
+int branch_operation(int op, bool immediate) {
+    return (immediate ? BC_JEQI : BC_JEQ) + bytecode_operation(op) - BC_EQ;
+}
+
+void compile_into(BytecodeCompiler *c, Node *node, int dst);
+void compile_branch(BytecodeCompiler *c, Node *cond, bool jump_when, int label);
+void compile_statement(BytecodeCompiler *c, Node *node);
+
+// Returns the register holding the value of an expression. A variable is used where it is.
+int compile_value(BytecodeCompiler *c, Node *node) {
+    if(node->ty == ND_IDENT) return register_of(c, node);
+    int reg = temporary(c);
+    compile_into(c, node, reg);
+    return reg;
+}
+
+// The left operand is read before the right one runs, so a variable the right one might assign to
+// is copied first
+int compile_left_operand(BytecodeCompiler *c, Node *left, Node *right) {
+    int reg = compile_value(c, left);
+    if(left->ty == ND_IDENT && has_side_effects(right)) {
+        int copy = temporary(c);
+        push_instruction(c, BC_MOVE, copy, reg, 0);
+        return copy;
+    }
+    return reg;
+}
+
+// A constant can only be the right operand of an instruction, so one on the left trades places
+// when the operation allows it
+void order_operands(int *op, Node **left, Node **right) {
+    if((*left)->ty != ND_NUM || (*right)->ty == ND_NUM) return;
+    if(!is_commutative(*op) && !is_comparison(*op)) return;
+    Node *swap = *left;
+    *left = *right;
+    *right = swap;
+    *op = swap_comparison(*op);
+}
+
+// A variable narrower than a long only keeps the low bytes of what is written to its register
+void truncate_register(BytecodeCompiler *c, Node *ident, int reg) {
+    int size = variable_size(variable_of(ident));
+    if(size < 8) push_instruction(c, size == 1 ? BC_EXT8 : size == 2 ? BC_EXT16 : BC_EXT32, reg, reg, 0);
+}
+
+// Stores to an element, index first, and returns the register holding the value it stored
+int compile_element_store(BytecodeCompiler *c, Node *node) {
+    int index = compile_left_operand(c, node->left->middle, node->right);
+    int value = temporary(c);
+    compile_into(c, node->right, value);
+    truncate_register(c, node->left, value);
+    push_instruction(c, BC_STOREX, value, register_of(c, node->left), index);
+    return value;
+}
+
+// Computes an expression into a register. Nothing is written to dst until the expression's own
+// operation runs, so dst can be a variable the expression reads.
+void compile_into(BytecodeCompiler *c, Node *node, int dst) {
+    int reg, old, otherwise, end;
+    int op = node->ty;
+    Node *left = node->left, *right = node->right;
+
+    switch(op) {
+        case ND_NUM:
+            push_instruction(c, BC_LOAD, dst, node->val, 0);
+            return;
+        case ND_IDENT:
+            reg = register_of(c, node);
+            if(reg != dst) push_instruction(c, BC_MOVE, dst, reg, 0);
+            return;
+        case ND_INDEX:
+            push_instruction(c, BC_LOADX, dst, register_of(c, node), compile_value(c, node->middle));
+            return;
+        case '=':
+            if(left->ty == ND_INDEX) {
+                push_instruction(c, BC_MOVE, dst, compile_element_store(c, node), 0);
+                return;
+            }
+            reg = register_of(c, left);
+            compile_into(c, right, reg);
+            truncate_register(c, left, reg);
+            if(reg != dst) push_instruction(c, BC_MOVE, dst, reg, 0);
+            return;
+        case ND_PRE_INCREMENT:
+        case ND_PRE_DECREMENT:
+            reg = register_of(c, node->middle);
+            push_instruction(c, BC_ADDI, reg, reg, op == ND_PRE_INCREMENT ? 1 : -1);
+            truncate_register(c, node->middle, reg);
+            if(reg != dst) push_instruction(c, BC_MOVE, dst, reg, 0);
+            return;
+        case ND_POST_INCREMENT:
+        case ND_POST_DECREMENT:
+            reg = register_of(c, node->middle);
+            old = reg == dst ? temporary(c) : dst;
+            push_instruction(c, BC_MOVE, old, reg, 0);
+            push_instruction(c, BC_ADDI, reg, reg, op == ND_POST_INCREMENT ? 1 : -1);
+            truncate_register(c, node->middle, reg);
+            if(old != dst) push_instruction(c, BC_MOVE, dst, old, 0);
+            return;
+        case ND_LAND:
+        case ND_LOR:
+            otherwise = bytecode_label(c);
+            end = bytecode_label(c);
+            compile_branch(c, node, false, otherwise);
+            push_instruction(c, BC_LOAD, dst, 1, 0);
+            push_instruction(c, BC_JMP, 0, 0, end);
+            place_bytecode_label(c, otherwise);
+            push_instruction(c, BC_LOAD, dst, 0, 0);
+            place_bytecode_label(c, end);
+            return;
+        case ND_TERNARY_CONDITIONAL:
+            otherwise = bytecode_label(c);
+            end = bytecode_label(c);
+            compile_branch(c, left, false, otherwise);
+            compile_into(c, node->middle, dst);
+            push_instruction(c, BC_JMP, 0, 0, end);
+            place_bytecode_label(c, otherwise);
+            compile_into(c, right, dst);
+            place_bytecode_label(c, end);
+            return;
+        case ND_CALL:
+            // The arguments go where the function's frame is going to start
+            reg = c->variables + c->temps;
+            for(Node *argument = node->middle; argument != NULL; argument = argument->right) temporary(c);
+            old = reg;
+            for(Node *argument = node->middle; argument != NULL; argument = argument->right) compile_into(c, argument->left, old++);
+            push_instruction(c, BC_CALL, dst, named_label(c, node->name), reg);
+            return;
+        case ND_UNARY_POS:
+            compile_into(c, node->middle, dst);
+            return;
+        case ND_UNARY_NEG:
+        case ND_UNARY_BIT_COMPLEMENT:
+        case ND_UNARY_BOOLEAN_NOT:
+            reg = compile_value(c, node->middle);
+            push_instruction(c, op == ND_UNARY_NEG ? BC_NEG : op == ND_UNARY_BIT_COMPLEMENT ? BC_NOT : BC_LNOT, dst, reg, 0);
+            return;
+        default:
+            break;
+    }
+
+    if(node->arity != 2) {
+        fprintf(stderr, "Could not compile node of type %d to bytecode\n", op);
+        exit(CODEGEN_ERROR);
+    }
+    order_operands(&op, &left, &right);
+    reg = compile_left_operand(c, left, right);
+    if(right->ty == ND_NUM) {
+        push_instruction(c, bytecode_operation(op) + IMMEDIATE_FORM, dst, reg, right->val);
+    } else {
+        push_instruction(c, bytecode_operation(op), dst, reg, compile_value(c, right));
+    }
+}
+
+// Jumps to the label when the condition is (or isn't) true, the same way gen_branch does
+void compile_branch(BytecodeCompiler *c, Node *cond, bool jump_when, int label) {
+    int op = cond->ty;
+    Node *left = cond->left, *right = cond->right;
+
+    switch(op) {
+        case ND_UNARY_BOOLEAN_NOT:
+            compile_branch(c, cond->middle, !jump_when, label);
+            return;
+        case ND_NUM:
+            if((cond->val != 0) == jump_when) push_instruction(c, BC_JMP, 0, 0, label);
+            return;
+        case ND_LAND:
+        case ND_LOR:
+            if((op == ND_LOR) == jump_when) {
+                compile_branch(c, left, jump_when, label);
+                compile_branch(c, right, jump_when, label);
+            } else {
+                int skip = bytecode_label(c);
+                compile_branch(c, left, !jump_when, skip);
+                compile_branch(c, right, jump_when, label);
+                place_bytecode_label(c, skip);
+            }
+            return;
+        default:
+            break;
+    }
+
+    if(is_comparison(op)) {
+        if(!jump_when) op = inverse_comparison(op);
+        order_operands(&op, &left, &right);
+        int reg = compile_left_operand(c, left, right);
+        if(right->ty == ND_NUM) {
+            push_instruction(c, branch_operation(op, true), reg, right->val, label);
+        } else {
+            push_instruction(c, branch_operation(op, false), reg, compile_value(c, right), label);
+        }
+        return;
+    }
+    push_instruction(c, jump_when ? BC_JNZ : BC_JZ, compile_value(c, cond), 0, label);
+}
+
+// A missing condition, as in for(;;), always holds
+void compile_loop_test(BytecodeCompiler *c, Node *cond, bool jump_when, int label) {
+    if(places_on_stack(cond->ty)) {
+        compile_branch(c, cond, jump_when, label);
+    } else if(jump_when) {
+        push_instruction(c, BC_JMP, 0, 0, label);
+    }
+}
+
+// How far a loop's step moves its counter, when it counts up or down by one. Returns 0 otherwise.
+int counting_step(Node *step, Node **counter) {
+    Node *sum;
+    long delta;
+
+    switch(step->ty) {
+        case ND_PRE_INCREMENT:
+        case ND_POST_INCREMENT:
+            *counter = step->middle;
+            return 1;
+        case ND_PRE_DECREMENT:
+        case ND_POST_DECREMENT:
+            *counter = step->middle;
+            return -1;
+        case '=':
+            sum = step->right;
+            if((sum->ty != '+' && sum->ty != '-') || sum->left->ty != ND_IDENT || sum->right->ty != ND_NUM) return 0;
+            if(variable_of(sum->left) != variable_of(step->left)) return 0;
+            delta = sum->ty == '+' ? sum->right->val : -(long)sum->right->val;
+            if(delta != 1 && delta != -1) return 0;
+            *counter = step->left;
+            return delta;
+        default:
+            return 0;
+    }
+}
+
+// The end of an iteration that steps a counter by one and then compares it, as in
+// for(...; i < n; i++) or do ... while(--i > 0), is a single instruction. Returns false if the
+// loop doesn't end like that.
+bool compile_counted_step(BytecodeCompiler *c, Node *cond, Node *step, int top) {
+    Node *counter = NULL;
+    int delta;
+
+    if(!is_comparison(cond->ty) || (cond->right->ty != ND_NUM && cond->right->ty != ND_IDENT)) return false;
+    if(step) {
+        if(step->unreachable || cond->left->ty != ND_IDENT) return false;
+        delta = counting_step(step, &counter);
+        if(delta == 0 || variable_of(counter) != variable_of(cond->left)) return false;
+    } else if(cond->left->ty == ND_PRE_INCREMENT || cond->left->ty == ND_PRE_DECREMENT) {
+        counter = cond->left->middle;
+        delta = cond->left->ty == ND_PRE_INCREMENT ? 1 : -1;
+    } else {
+        return false;
+    }
+    // A narrower counter would have to wrap around before it is compared
+    if(variable_size(variable_of(counter)) != 8) return false;
+
+    int op;
+    switch(cond->ty) {
+        case '<': op = BC_INCJLT; break;
+        case ND_LEQUAL: op = BC_INCJLE; break;
+        case '>': op = BC_DECJGT; break;
+        case ND_GEQUAL: op = BC_DECJGE; break;
+        case ND_NEQUAL: op = delta == 1 ? BC_INCJNE : BC_DECJNE; break;
+        default: return false;
+    }
+    if((op >= BC_DECJGT) != (delta == -1)) return false;
+
+    int reg = register_of(c, counter);
+    if(cond->right->ty == ND_NUM) {
+        push_instruction(c, op + BC_INCJLTI - BC_INCJLT, reg, cond->right->val, top);
+    } else {
+        push_instruction(c, op, reg, register_of(c, cond->right), top);
+    }
+    return true;
+}
+
+void compile_loop(BytecodeCompiler *c, Node *loop, Node *cond, Node *body, Node *step, bool test_first) {
+    int top = bytecode_label(c);
+    int next = bytecode_label(c);
+    int end = bytecode_label(c);
+    vec_push(c->loops, loop);
+    vec_push(c->break_labels, (void *)(long)end);
+    vec_push(c->continue_labels, (void *)(long)next);
+
+    if(test_first) compile_loop_test(c, cond, false, end);
+    place_bytecode_label(c, top);
+    compile_statement(c, body);
+    place_bytecode_label(c, next);
+    c->temps = 0;
+    if(!compile_counted_step(c, cond, step, top)) {
+        compile_statement(c, step);
+        c->temps = 0;
+        compile_loop_test(c, cond, true, top);
+    }
+    place_bytecode_label(c, end);
+
+    c->loops->len--;
+    c->break_labels->len--;
+    c->continue_labels->len--;
+}
+
+// An expression whose value isn't needed
+void compile_effect(BytecodeCompiler *c, Node *node) {
+    int reg;
+
+    switch(node->ty) {
+        case '=':
+            if(node->left->ty == ND_INDEX) {
+                compile_element_store(c, node);
+                return;
+            }
+            reg = register_of(c, node->left);
+            compile_into(c, node->right, reg);
+            truncate_register(c, node->left, reg);
+            return;
+        case ND_PRE_INCREMENT:
+        case ND_POST_INCREMENT:
+        case ND_PRE_DECREMENT:
+        case ND_POST_DECREMENT:
+            reg = register_of(c, node->middle);
+            push_instruction(c, BC_ADDI, reg, reg, node->ty == ND_PRE_INCREMENT || node->ty == ND_POST_INCREMENT ? 1 : -1);
+            truncate_register(c, node->middle, reg);
+            return;
+        default:
+            // Dividing by zero still has to trap
+            if(has_side_effects(node)) compile_value(c, node);
+            return;
+    }
+}
+
+void compile_jump_out_of_loop(BytecodeCompiler *c, Node *node) {
+    // Codegen ignores a break or continue outside of a loop
+    if(node->jump_target == NULL) return;
+    int i = c->loops->len - 1;
+    while(c->loops->data[i] != node->jump_target) i--;
+    Vector *labels = node->ty == ND_BREAK ? c->break_labels : c->continue_labels;
+    push_instruction(c, BC_JMP, 0, 0, (long)labels->data[i]);
+}
+
+void compile_case_chain(BytecodeCompiler *c, int selector, Vector *cases, int lo, int hi, int otherwise) {
+    for(int i = lo; i < hi; i++) {
+        Node *label = cases->data[i];
+        push_instruction(c, BC_JEQI, selector, label->val, named_label(c, label->middle->name));
+    }
+    push_instruction(c, BC_JMP, 0, 0, otherwise);
+}
+
+void compile_case_tree(BytecodeCompiler *c, int selector, Vector *cases, int lo, int hi, int otherwise) {
+    if(hi - lo <= SWITCH_CHAIN_LENGTH) {
+        compile_case_chain(c, selector, cases, lo, hi, otherwise);
+        return;
+    }
+    int mid = (lo + hi) / 2;
+    int right = bytecode_label(c);
+    Node *label = cases->data[mid];
+    push_instruction(c, BC_JEQI, selector, label->val, named_label(c, label->middle->name));
+    push_instruction(c, BC_JGTI, selector, label->val, right);
+    compile_case_tree(c, selector, cases, lo, mid, otherwise);
+    place_bytecode_label(c, right);
+    compile_case_tree(c, selector, cases, mid + 1, hi, otherwise);
+}
+
+// A switch picks its case the way codegen does. The jump table is a TABLE instruction followed by
+// a JMP for every value from the lowest case to the highest.
+void compile_switch(BytecodeCompiler *c, Node *node) {
+    int otherwise = named_label(c, node->jump_target->middle->name);
+    if(node->middle->ty == ND_NUM) {
+        push_instruction(c, BC_JMP, 0, 0, named_label(c, matching_case(node, node->middle->val)->middle->name));
+        return;
+    }
+
+    Vector *cases = sorted_cases(node);
+    int selector = compile_value(c, node->middle);
+    switch(switch_lowering(cases)) {
+        case SWITCH_TREE:
+            compile_case_tree(c, selector, cases, 0, cases->len, otherwise);
+            return;
+        case SWITCH_CHAIN:
+            compile_case_chain(c, selector, cases, 0, cases->len, otherwise);
+            return;
+        default:
+            break;
+    }
+
+    int low = ((Node *)cases->data[0])->val, high = ((Node *)cases->data[cases->len - 1])->val;
+    int index = selector;
+    if(low != 0) {
+        index = temporary(c);
+        push_instruction(c, BC_SUBI, index, selector, low);
+    }
+    push_instruction(c, BC_TABLE, index, high - low + 1, otherwise);
+    int next = 0;
+    for(long value = low; value <= high; value++) {
+        Node *label = cases->data[next];
+        int target = otherwise;
+        if(label->val == value) {
+            target = named_label(c, label->middle->name);
+            next++;
+        }
+        push_instruction(c, BC_JMP, 0, 0, target);
+    }
+}
+
+void compile_statement(BytecodeCompiler *c, Node *node) {
+    int otherwise, end;
+    Scope *outer;
+
+    // A label nothing reaches is still placed, since the jump table of a switch may name it
+    if(node == NULL || (node->unreachable && node->ty != ND_LABEL)) return;
+    c->temps = 0;
+
+    switch(node->ty) {
+        case ND_SCOPE:
+            outer = c->scope;
+            if(node->descend) c->scope = node->scope;
+            for(int i = 0; i < node->statements->len; i++) {
+                compile_statement(c, node->statements->data[i]);
+            }
+            c->scope = outer;
+            return;
+        case ND_NOOP:
+            return;
+        case ND_LABEL:
+            place_bytecode_label(c, named_label(c, node->middle->name));
+            return;
+        case ND_GOTO:
+            // The same gotos codegen accepts: only to labels in scopes that enclose the goto
+            if(scopes_to_clear_on_jump(c->scope, node->middle->name, 0) == -1) {
+                fprintf(stderr, "Could not jump to label %s either because it could not be found or required entering a non-parent scope!\n", node->middle->name);
+                exit(CODEGEN_ERROR);
+            }
+            push_instruction(c, BC_JMP, 0, 0, named_label(c, node->middle->name));
+            return;
+        case ND_BREAK:
+        case ND_CONTINUE:
+            compile_jump_out_of_loop(c, node);
+            return;
+        case ND_SWITCH:
+            compile_switch(c, node);
+            return;
+        case ND_RETURN:
+            push_instruction(c, c->function ? BC_RET : BC_HALT, compile_value(c, node->middle), 0, 0);
+            return;
+        case ND_IF:
+            otherwise = bytecode_label(c);
+            end = bytecode_label(c);
+            compile_branch(c, node->left, false, otherwise);
+            compile_statement(c, node->middle);
+            if(node->right && node->right->ty != ND_NOOP) push_instruction(c, BC_JMP, 0, 0, end);
+            place_bytecode_label(c, otherwise);
+            compile_statement(c, node->right);
+            place_bytecode_label(c, end);
+            return;
+        case ND_WHILE:
+            compile_loop(c, node, node->left, node->right, NULL, true);
+            return;
+        case ND_DO:
+            compile_loop(c, node, node->right, node->left, NULL, false);
+            return;
+        case ND_FOR:
+            compile_statement(c, node->left);
+            compile_loop(c, node, node->middle, node->extra, node->right, true);
+            return;
+        default:
+            if(node == c->result) {
+                c->result_register = compile_value(c, node);
+            } else {
+                compile_effect(c, node);
+            }
+            return;
+    }
+}
+
+// Starts the frame of main or of a function, whose parameters come first
+void start_frame(BytecodeCompiler *c, Node *function, Scope *scope) {
+    c->function = function;
+    c->scope = scope;
+    c->variables = 0;
+    for(int i = 0; i < variable_count(); i++) c->registers_of[i] = -1;
+    number_registers(c, scope);
+    if(c->variables > c->bytecode->registers) c->bytecode->registers = c->variables;
+}
+
+Bytecode *compile_bytecode(Node *program) {
+    Bytecode *bytecode = malloc(sizeof(Bytecode));
+    bytecode->capacity = 64;
+    bytecode->len = 0;
+    bytecode->code = malloc(sizeof(Instruction) * bytecode->capacity);
+    bytecode->registers = 0;
+
+    BytecodeCompiler c = { bytecode, 0, new_vector(), new_map(NULL), new_vector(), new_vector(), new_vector(), program->scope, result_statement(program), -1, NULL, malloc(sizeof(int) * (variable_count() + 1)), 0 };
+    start_frame(&c, NULL, program->scope);
+    compile_statement(&c, program);
+    // A program that doesn't end with an expression exits with whatever rax held, so 0 will do
+    if(c.result_register == -1) {
+        c.result_register = temporary(&c);
+        push_instruction(&c, BC_LOAD, c.result_register, 0, 0);
+    }
+    push_instruction(&c, BC_HALT, c.result_register, 0, 0);
+
+    // Running off the end of a function returns 0
+    Vector *functions = called_functions(program);
+    for(int i = 0; i < functions->len; i++) {
+        Node *function = functions->data[i];
+        start_frame(&c, function, function->middle->scope);
+        place_bytecode_label(&c, named_label(&c, function->name));
+        compile_statement(&c, function->middle);
+        c.temps = 0;
+        int zero = temporary(&c);
+        push_instruction(&c, BC_LOAD, zero, 0, 0);
+        push_instruction(&c, BC_RET, zero, 0, 0);
+    }
+
+    for(int i = 0; i < bytecode->len; i++) {
+        Instruction *instruction = &bytecode->code[i];
+        if(instruction->op >= BC_JMP) instruction->c = (long)c.labels->data[instruction->c];
+        if(instruction->op == BC_CALL) instruction->b = (long)c.labels->data[instruction->b];
+    }
+    return bytecode;
+}
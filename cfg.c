@@ -0,0 +1,479 @@
+#include "yacc.h"
+
+/**
+ ** Control flow graph over the generated assembly.
+ ** Codegen writes one construct at a time, each with the labels it invents for itself (wlb_N, fle_N,
+ ** cond_f_N...), so the result has jumps to jumps, jumps to the very next instruction, and code that
+ ** nothing can reach, like whatever follows a break, continue or goto. Here the emitted lines are
+ ** split into basic blocks at labels and jumps. A jump to a block that does nothing but jump again
+ ** is threaded straight to the final target, and a conditional jump over an unconditional one is
+ ** inverted. Blocks that can't be reached from the entry are dropped, then jumps to the block laid
+ ** out right after them, and finally the labels nothing jumps to, which merges empty blocks into
+ ** the ones that follow.
+ ** Before that last step the blocks are laid out along the path they are statically expected to
+ ** take. Backward jumps are loop back edges and are expected to be taken. A branch around code that
+ ** only runs when a value equals a constant, or that leaves the innermost loop, is expected to skip
+ ** it, so that code is moved out of line, past the end of the program, and the hot path falls
+ ** through. The heads of loops are aligned to 16 bytes.
+ ** A switch's jump table stays with the block whose indirect jmp goes through it, and every label in
+ ** the table counts as a target of that jmp.
+ **/
+
+// The only indirect jump codegen writes, which the table of a switch follows
+#define TABLE_JUMP "\tjmp rax"
+
+typedef struct Block {
+    Vector *labels;         // Names of the labels the block starts with
+    Vector *code;           // Instructions, not counting the jump or ret that ends the block
+    char *jump;             // Mnemonic of the jump that ends the block, or NULL if it falls through
+    char *target;           // and the label it jumps to
+    bool returns;           // Whether the block ends with a ret
+    char *table;            // Label of the jump table the block ends by jumping through, if any
+    Vector *cases;          // and the labels in that table
+    bool reachable;
+    int position;           // Index of the block before any were moved
+    bool loop_head;         // Whether a back edge jumps to the block
+    bool cold;              // Whether the block was moved out of line
+} Block;
+
+typedef struct {
+    Vector *blocks;         // In the order they are laid out
+    Map *block_of;          // Index of the block each label starts, by label name
+    Vector *loop_heads;     // Positions of the first and last block of every loop
+    Vector *loop_tails;
+} Graph;
+
+Block *new_basic_block() {
+    Block *block = calloc(1, sizeof(Block));
+    block->labels = new_vector();
+    block->code = new_vector();
+    return block;
+}
+
+bool ends_block(Block *block) {
+    return block->jump || block->returns || block->cases;
+}
+
+bool is_empty(Block *block) {
+    return block->code->len == 0;
+}
+
+char *copy_text(char *start, int len) {
+    char *text = malloc(len + 1);
+    memcpy(text, start, len);
+    text[len] = '\0';
+    return text;
+}
+
+// Labels are written at the start of a line, instructions are indented
+char *read_label(char **line) {
+    char *colon = strchr(*line, ':');
+    if((*line)[0] == '\t' || (*line)[0] == '\0' || colon == NULL) return NULL;
+    char *label = copy_text(*line, colon - *line);
+    *line = colon + 1;
+    return label;
+}
+
+void add_instruction(Block *block, char *line) {
+    if(strcmp(line, "\tret") == 0) {
+        block->returns = true;
+    } else if(line[0] == '\t' && line[1] == 'j') {
+        char *space = strchr(line, ' ');
+        block->jump = copy_text(line + 1, space - line - 1);
+        block->target = copy_text(space + 1, strlen(space + 1));
+    } else {
+        vec_push(block->code, line);
+    }
+}
+
+Graph *build_graph(Vector *lines) {
+    Graph *graph = malloc(sizeof(Graph));
+    graph->blocks = new_vector();
+    graph->block_of = new_map((void *)-1);
+
+    Block *block = new_basic_block();
+    vec_push(graph->blocks, block);
+    for(int i = 0; i < lines->len; i++) {
+        char *line = lines->data[i];
+        if(strcmp(line, TABLE_JUMP) == 0) {
+            block->cases = new_vector();
+            continue;
+        }
+        // The label of the table, then a .long label-table line for each of its entries
+        if(block->cases && block->table == NULL) {
+            block->table = read_label(&line);
+            continue;
+        }
+        if(block->cases && strncmp(line, "\t.long ", 7) == 0) {
+            vec_push(block->cases, copy_text(line + 7, strchr(line, '-') - line - 7));
+            continue;
+        }
+
+        for(char *label = read_label(&line); label; label = read_label(&line)) {
+            if(ends_block(block) || !is_empty(block)) {
+                block = new_basic_block();
+                vec_push(graph->blocks, block);
+            }
+            vec_push(block->labels, label);
+            map_put(graph->block_of, label, (void *)(long)(graph->blocks->len - 1));
+        }
+        if(line[0] == '\0') continue;
+
+        if(ends_block(block)) {
+            block = new_basic_block();
+            vec_push(graph->blocks, block);
+        }
+        add_instruction(block, line);
+    }
+    return graph;
+}
+
+Block *block_at(Graph *graph, char *label) {
+    long index = (long)map_get(graph->block_of, label);
+    return index < 0 ? NULL : graph->blocks->data[index];
+}
+
+// The block control reaches by falling off the end of the one at index i
+Block *next_block(Graph *graph, int i) {
+    return i + 1 < graph->blocks->len ? graph->blocks->data[i + 1] : NULL;
+}
+
+char *inverse_jump(char *jump) {
+    static char *pairs[][2] = {
+        {"jz", "jnz"}, {"je", "jne"}, {"jl", "jge"}, {"jle", "jg"}, {"jb", "jae"}, {"jbe", "ja"}, {"js", "jns"},
+    };
+    for(int i = 0; i < sizeof(pairs) / sizeof(pairs[0]); i++) {
+        if(strcmp(jump, pairs[i][0]) == 0) return pairs[i][1];
+        if(strcmp(jump, pairs[i][1]) == 0) return pairs[i][0];
+    }
+    return NULL;
+}
+
+// Follows a label through empty blocks until it reaches one that does something. Gives up on a
+// cycle of empty blocks, which is an infinite loop that has to stay.
+char *final_target(Graph *graph, char *start) {
+    char *label = start;
+    for(int steps = 0; steps < graph->blocks->len; steps++) {
+        long index = (long)map_get(graph->block_of, label);
+        if(index < 0) return label;
+        Block *block = graph->blocks->data[index];
+        if(!is_empty(block) || block->returns || block->cases) return label;
+
+        if(block->jump && strcmp(block->jump, "jmp") == 0) {
+            label = block->target;
+        } else if(block->jump == NULL) {
+            Block *next = next_block(graph, index);
+            if(next == NULL || next->labels->len == 0) return label;
+            label = next->labels->data[0];
+        } else {
+            return label;
+        }
+    }
+    return start;
+}
+
+// Returns true if anything changed
+bool thread_jumps(Graph *graph) {
+    bool changed = false;
+    for(int i = 0; i < graph->blocks->len; i++) {
+        Block *block = graph->blocks->data[i];
+        for(int j = 0; block->cases && j < block->cases->len; j++) {
+            char *target = final_target(graph, block->cases->data[j]);
+            if(target != block->cases->data[j]) {
+                block->cases->data[j] = target;
+                changed = true;
+            }
+        }
+        if(block->jump == NULL) continue;
+
+        char *target = final_target(graph, block->target);
+        if(target != block->target) {
+            block->target = target;
+            changed = true;
+        }
+
+        // A jmp to a lone ret might as well return
+        Block *destination = block_at(graph, block->target);
+        if(strcmp(block->jump, "jmp") == 0 && destination && is_empty(destination) && destination->returns) {
+            block->jump = block->target = NULL;
+            block->returns = true;
+            changed = true;
+            continue;
+        }
+
+        // jcc a; jmp b; a: becomes jncc b; a:
+        Block *next = next_block(graph, i);
+        char *inverse = inverse_jump(block->jump);
+        if(inverse && next && is_empty(next) && next->labels->len == 0 && next->jump && strcmp(next->jump, "jmp") == 0
+           && i + 2 < graph->blocks->len && block_at(graph, block->target) == graph->blocks->data[i + 2]) {
+            block->jump = inverse;
+            block->target = next->target;
+            next->jump = next->target = NULL;
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+void mark_reachable(Graph *graph, int index) {
+    while(index >= 0 && index < graph->blocks->len) {
+        Block *block = graph->blocks->data[index];
+        if(block->reachable) return;
+        block->reachable = true;
+        if(block->returns) return;
+        if(block->cases) {
+            for(int i = 0; i < block->cases->len; i++) mark_reachable(graph, (long)map_get(graph->block_of, block->cases->data[i]));
+            return;
+        }
+        if(block->jump) {
+            long target = (long)map_get(graph->block_of, block->target);
+            if(strcmp(block->jump, "jmp") == 0) {
+                index = target;
+                continue;
+            }
+            mark_reachable(graph, target);
+        }
+        index++;
+    }
+}
+
+// Lays the blocks out in a new order
+void reorder_blocks(Graph *graph, Vector *blocks) {
+    graph->blocks = blocks;
+    graph->block_of = new_map((void *)-1);
+    for(int i = 0; i < blocks->len; i++) {
+        Block *block = blocks->data[i];
+        for(int j = 0; j < block->labels->len; j++) map_put(graph->block_of, block->labels->data[j], (void *)(long)i);
+    }
+}
+
+void remove_unreachable_blocks(Graph *graph) {
+    for(int i = 0; i < graph->blocks->len; i++) ((Block *)graph->blocks->data[i])->reachable = false;
+    mark_reachable(graph, 0);
+
+    Vector *blocks = new_vector();
+    for(int i = 0; i < graph->blocks->len; i++) {
+        Block *block = graph->blocks->data[i];
+        if(block->reachable) vec_push(blocks, block);
+    }
+    reorder_blocks(graph, blocks);
+}
+
+// Codegen lays every loop out in one piece, so a jump backwards is the back edge of a loop that
+// spans every block from its target to the jump
+void find_loops_in_graph(Graph *graph) {
+    graph->loop_heads = new_vector();
+    graph->loop_tails = new_vector();
+    for(int i = 0; i < graph->blocks->len; i++) ((Block *)graph->blocks->data[i])->position = i;
+    for(int i = 0; i < graph->blocks->len; i++) {
+        Block *block = graph->blocks->data[i];
+        long head = block->jump ? (long)map_get(graph->block_of, block->target) : -1;
+        if(head < 0 || head > i) continue;
+        ((Block *)graph->blocks->data[head])->loop_head = true;
+        vec_push(graph->loop_heads, (void *)head);
+        vec_push(graph->loop_tails, (void *)(long)i);
+    }
+}
+
+// Whether jumping from one block to another leaves the innermost loop the first one is in
+bool exits_loop(Graph *graph, Block *from, Block *to) {
+    int innermost = -1;
+    for(int i = 0; i < graph->loop_heads->len; i++) {
+        long head = (long)graph->loop_heads->data[i], tail = (long)graph->loop_tails->data[i];
+        if(head > from->position || tail < from->position) continue;
+        if(innermost < 0 || head > (long)graph->loop_heads->data[innermost]) innermost = i;
+    }
+    if(innermost < 0) return false;
+    return to->position < (long)graph->loop_heads->data[innermost] || to->position > (long)graph->loop_tails->data[innermost];
+}
+
+// Whether the block ends by comparing a value to a constant, or testing it against zero
+bool compares_to_constant(Block *block) {
+    if(block->code->len == 0) return false;
+    char *last = block->code->data[block->code->len - 1];
+    if(strncmp(last, "\ttest ", 6) == 0) return true;
+    if(strncmp(last, "\tcmp ", 5) != 0) return false;
+
+    char *operand = strrchr(last, ' ') + 1, *end;
+    strtol(operand, &end, 10);
+    return end != operand && *end == '\0';
+}
+
+// The blocks from first to last are what the conditional jump at the end of the block before them
+// skips. They are cold if they only run when a value equals a constant, or if they leave the loop.
+bool is_cold_path(Graph *graph, int first, int last) {
+    Block *branch = graph->blocks->data[first - 1], *end = graph->blocks->data[last];
+    // Moved out of line, they need a jmp back, and there's no room for one after a conditional jump
+    // or a jump table
+    if((end->jump && strcmp(end->jump, "jmp") != 0) || end->cases) return false;
+    if((strcmp(branch->jump, "jne") == 0 || strcmp(branch->jump, "jnz") == 0) && compares_to_constant(branch)) return true;
+    if(end->jump == NULL || strcmp(end->jump, "jmp") != 0) return false;
+    Block *exit = block_at(graph, end->target);
+    return exit && exits_loop(graph, branch, exit) && !exits_loop(graph, branch, graph->blocks->data[last + 1]);
+}
+
+// Whether anything besides falling off the block before them enters the blocks from first to last
+bool has_other_entries(Graph *graph, int first, int last) {
+    for(int i = 0; i < graph->blocks->len; i++) {
+        Block *block = graph->blocks->data[i];
+        if(i >= first && i <= last) continue;
+        for(int j = 0; block->cases && j < block->cases->len; j++) {
+            long target = (long)map_get(graph->block_of, block->cases->data[j]);
+            if(target >= first && target <= last) return true;
+        }
+        if(block->jump == NULL) continue;
+        long target = (long)map_get(graph->block_of, block->target);
+        if(target >= first && target <= last) return true;
+    }
+    return false;
+}
+
+// Moves the blocks from first to last past the end of the program. The branch in front of them
+// now jumps to them when it used to fall through, and they jump back once they're done.
+void move_out_of_line(Graph *graph, int first, int last) {
+    Block *branch = graph->blocks->data[first - 1], *start = graph->blocks->data[first], *end = graph->blocks->data[last];
+    Block *after = graph->blocks->data[last + 1];
+    if(start->labels->len == 0) {
+        char *label = malloc(sizeof(char) * 32);
+        snprintf(label, 32, "cold_%d", LABELS_GENERATED++);
+        vec_push(start->labels, label);
+    }
+    if(!end->jump && !end->returns) {
+        end->jump = "jmp";
+        end->target = after->labels->data[0];
+    }
+    branch->jump = inverse_jump(branch->jump);
+    branch->target = start->labels->data[0];
+
+    Vector *blocks = new_vector();
+    for(int i = 0; i < graph->blocks->len; i++) {
+        if(i < first || i > last) vec_push(blocks, graph->blocks->data[i]);
+    }
+    for(int i = first; i <= last; i++) {
+        ((Block *)graph->blocks->data[i])->cold = true;
+        vec_push(blocks, graph->blocks->data[i]);
+    }
+    reorder_blocks(graph, blocks);
+}
+
+void lay_out_blocks(Graph *graph) {
+    find_loops_in_graph(graph);
+    // Blocks moved past the end must not be fallen into
+    Block *final = graph->blocks->data[graph->blocks->len - 1];
+    if(!final->returns && !final->cases && (final->jump == NULL || strcmp(final->jump, "jmp") != 0)) return;
+
+    for(int i = 0; i < graph->blocks->len; i++) {
+        Block *block = graph->blocks->data[i];
+        if(block->cold || block->jump == NULL || strcmp(block->jump, "jmp") == 0 || inverse_jump(block->jump) == NULL) continue;
+
+        // Only forward branches around a piece of code, which the branch lands right after
+        long target = (long)map_get(graph->block_of, block->target);
+        if(target <= i + 1) continue;
+        if(is_cold_path(graph, i + 1, target - 1) && !has_other_entries(graph, i + 1, target - 1)) {
+            move_out_of_line(graph, i + 1, target - 1);
+        }
+    }
+}
+
+// Whether control falling off the end of the block at index i ends up at target without running
+// anything on the way
+bool falls_into(Graph *graph, int i, Block *target) {
+    for(Block *next = next_block(graph, i); next; next = next_block(graph, ++i)) {
+        if(next == target) return true;
+        if(!is_empty(next) || ends_block(next)) return false;
+    }
+    return false;
+}
+
+// Drops jumps to whatever is laid out next, and labels that are no longer jumped to
+void remove_redundant_jumps(Graph *graph) {
+    for(int i = 0; i < graph->blocks->len; i++) {
+        Block *block = graph->blocks->data[i];
+        if(block->jump && falls_into(graph, i, block_at(graph, block->target))) block->jump = block->target = NULL;
+    }
+
+    Map *used = new_map(NULL);
+    for(int i = 0; i < graph->blocks->len; i++) {
+        Block *block = graph->blocks->data[i];
+        if(block->jump) map_put(used, block->target, block);
+        for(int j = 0; block->cases && j < block->cases->len; j++) map_put(used, block->cases->data[j], block);
+    }
+    for(int i = 0; i < graph->blocks->len; i++) {
+        Block *block = graph->blocks->data[i];
+        Vector *labels = new_vector();
+        for(int j = 0; j < block->labels->len; j++) {
+            if(map_get(used, block->labels->data[j])) vec_push(labels, block->labels->data[j]);
+        }
+        block->labels = labels;
+    }
+}
+
+Vector *write_graph(Graph *graph) {
+    Vector *lines = new_vector();
+    for(int i = 0; i < graph->blocks->len; i++) {
+        Block *block = graph->blocks->data[i];
+        if(block->loop_head && !block->cold) vec_push(lines, "\t.p2align 4");
+        for(int j = 0; j < block->labels->len; j++) {
+            char *label = malloc(strlen(block->labels->data[j]) + 2);
+            sprintf(label, "%s:", (char *)block->labels->data[j]);
+            vec_push(lines, label);
+        }
+        for(int j = 0; j < block->code->len; j++) vec_push(lines, block->code->data[j]);
+        if(block->jump) {
+            char *jump = malloc(strlen(block->jump) + strlen(block->target) + 3);
+            sprintf(jump, "\t%s %s", block->jump, block->target);
+            vec_push(lines, jump);
+        }
+        if(block->returns) vec_push(lines, "\tret");
+        if(block->cases) {
+            vec_push(lines, TABLE_JUMP);
+            char *table = malloc(strlen(block->table) + 2);
+            sprintf(table, "%s:", block->table);
+            vec_push(lines, table);
+            for(int j = 0; j < block->cases->len; j++) {
+                char *entry = malloc(strlen(block->cases->data[j]) + strlen(block->table) + 9);
+                sprintf(entry, "\t.long %s-%s", (char *)block->cases->data[j], block->table);
+                vec_push(lines, entry);
+            }
+        }
+    }
+    return lines;
+}
+
+Vector *optimize_control_flow(Vector *lines) {
+    Graph *graph = build_graph(lines);
+    // Inverting a jump can leave a block empty, which gives threading more to do
+    while(thread_jumps(graph)) {}
+    remove_unreachable_blocks(graph);
+    lay_out_blocks(graph);
+    remove_redundant_jumps(graph);
+    return write_graph(graph);
+}
+
+// Whether a line is the label a function starts at
+bool is_entry(char *line, char *name) {
+    int len = strlen(name);
+    return strncmp(line, name, len) == 0 && strcmp(line + len, ":") == 0;
+}
+
+// Main and every function after it are separate graphs: nothing jumps from one into another, and
+// a function is only entered through the label it starts at, which its graph is built after
+Vector *optimize_sections(Vector *lines, Vector *entries) {
+    Vector *optimized = new_vector();
+    Vector *section = new_vector();
+    int next = 0;
+    for(int i = 0; i <= lines->len; i++) {
+        if(i < lines->len && (next == entries->len || !is_entry(lines->data[i], entries->data[next]))) {
+            vec_push(section, lines->data[i]);
+            continue;
+        }
+        Vector *code = optimize_control_flow(section);
+        for(int j = 0; j < code->len; j++) vec_push(optimized, code->data[j]);
+        if(i < lines->len) {
+            vec_push(optimized, lines->data[i]);
+            next++;
+        }
+        section = new_vector();
+    }
+    return optimized;
+}
@@ -1,12 +1,45 @@
 #include "yacc.h"
 
 int LABELS_GENERATED = 0;
-void gen(Node *statement_tree, Scope **local_scope);
+
+// Codegen writes into a buffer rather than straight to stdout, so that the control flow stage
+// can rework the assembly once the whole program has been generated
+char *ASSEMBLY = NULL;
+int ASSEMBLY_LEN = 0;
+int ASSEMBLY_CAPACITY = 0;
+
+void emit(char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+
+    if(ASSEMBLY_LEN + len + 1 > ASSEMBLY_CAPACITY) {
+        ASSEMBLY_CAPACITY = (ASSEMBLY_LEN + len + 1) * 2;
+        ASSEMBLY = realloc(ASSEMBLY, ASSEMBLY_CAPACITY);
+    }
+    va_start(args, format);
+    vsnprintf(ASSEMBLY + ASSEMBLY_LEN, len + 1, format, args);
+    va_end(args);
+    ASSEMBLY_LEN += len;
+}
+
+// Everything emitted so far, one line per element
+Vector *emitted_lines() {
+    Vector *lines = new_vector();
+    char *line = ASSEMBLY;
+    for(char *end = ASSEMBLY ? strchr(line, '\n') : NULL; end; end = strchr(line, '\n')) {
+        *end = '\0';
+        vec_push(lines, line);
+        line = end + 1;
+    }
+    return lines;
+}
 
 # ifdef DEBUG
-    # define comment(s, ...) printf("\t\t\t; "); printf(s, ##__VA_ARGS__); printf("\n")
+    # define comment(s, ...) emit("\t\t\t; "); emit(s, ##__VA_ARGS__); emit("\n")
 # else
-    # define comment(s, ...) printf("\n")
+    # define comment(s, ...) emit("\n")
 # endif
 
 bool places_on_stack(int ty) {
@@ -20,21 +53,84 @@ bool places_on_stack(int ty) {
         case ND_NOOP:
         case ND_LABEL:
         case ND_GOTO:
+        case ND_FOR:
+        case ND_SWITCH:
+        case ND_RETURN:
             return false;
         default:
             return true;
     }
 }
 
+// The function being generated, which is NULL for main
+Node *CURRENT_FUNCTION = NULL;
+
+// The statement whose value main returns
+Node *RESULT_STATEMENT = NULL;
+
+void scope_prologue(Scope *scope) {
+    emit("\tpush rbp\n");
+    emit("\tmov rbp, rsp\n");
+
+    emit("\tsub rsp, %d", scope->frame_size);
+    comment("Allocate %d variables to the stack", scope->variables_declared->keys->len);
+}
+
+// The parts of the registers codegen keeps values in, by the log of their size in bytes
+char *SIZED_REGISTERS[][4] = {
+    {"al", "ax", "eax", "rax"},
+    {"bl", "bx", "ebx", "rbx"},
+    {"r11b", "r11w", "r11d", "r11"},
+};
+
+// The low bytes of a 64-bit register that a variable of the given size is stored from
+char *sized_register(char *name, int size) {
+    int log = size == 8 ? 3 : size == 4 ? 2 : size == 2 ? 1 : 0;
+    for(int i = 0; i < 3; i++) {
+        if(strcmp(SIZED_REGISTERS[i][3], name) == 0) return SIZED_REGISTERS[i][log];
+    }
+    fprintf(stderr, "No sized forms of register %s\n", name);
+    exit(CODEGEN_ERROR);
+}
+
+char *size_keyword(int size) {
+    return size == 8 ? "QWORD" : size == 4 ? "DWORD" : size == 2 ? "WORD" : "BYTE";
+}
+
+// The instruction that loads a variable of the given size into a 64-bit register, sign-extending it
+char *load_instruction(int size) {
+    return size == 8 ? "mov" : size == 4 ? "movsxd" : "movsx";
+}
+
+// The stack machine reads and writes variables through an address in rax
+void gen_load_from_address(char *reg, int size) {
+    if(size == 8) {
+        emit("\tmov %s, [rax]\n", reg);
+    } else {
+        emit("\t%s %s, %s PTR [rax]\n", load_instruction(size), reg, size_keyword(size));
+    }
+}
+
+// A narrower variable keeps the low bytes of what is stored in it, so the stored value in rbx is
+// sign-extended from them as well
+void gen_store_to_address(int size) {
+    if(size == 8) {
+        emit("\tmov [rax], rbx\n");
+        return;
+    }
+    emit("\tmov %s PTR [rax], %s\n", size_keyword(size), sized_register("rbx", size));
+    emit("\t%s rbx, %s\n", load_instruction(size), sized_register("rbx", size));
+}
+
 void scope_epilogue() {
-    printf("\tmov rsp, rbp\n");
-    printf("\tpop rbp\n");
+    emit("\tmov rsp, rbp\n");
+    emit("\tpop rbp\n");
 }
 
 // // Returns how many times we need to unwind the stack before we can jump to a certain label
 // // If the label is not reachable, returns -1
 // // A label is reachable iff it is in a scope that is a direct superset of the starting scope
-bool scopes_to_clear_on_jump(Scope *starting_scope, char *label_name, int acc) {
+int scopes_to_clear_on_jump(Scope *starting_scope, char *label_name, int acc) {
     if(starting_scope == NULL) return -1;
     
     Vector *labels = starting_scope->labels_declared;
@@ -49,58 +145,132 @@ bool scopes_to_clear_on_jump(Scope *starting_scope, char *label_name, int acc) {
 
 // Generate the code to put an lval's address on the stack.
 void gen_lval(Node *node, Scope **local_scope) {
-    if(node->ty == ND_IDENT) {
-        printf("\tmov rax, rbp\n");
+    if(node->ty == ND_IDENT || node->ty == ND_INDEX) {
+        // The index of an element is worked out first, then added to the address of its array
+        if(node->ty == ND_INDEX) gen(node->middle, local_scope);
+        emit("\tmov rax, rbp\n");
 
         // Look up the address of our local variables
         VariableAddress *referenced_var_add = get_variable_location(*local_scope, node->name);
 
         for(int i = 0; i < referenced_var_add->scopes_up; i ++) {
-            printf("\tmov rax, [rax]\n"); // Climb up one base pointer
+            emit("\tmov rax, [rax]\n"); // Climb up one base pointer
         }
 
-        printf("\tsub rax, %d\n", referenced_var_add->offset);
+        if(node->ty == ND_INDEX) {
+            emit("\tpop rbx\n");
+            emit("\tlea rax, [rax+rbx*%d-%d]\n", referenced_var_add->size, referenced_var_add->offset);
+        } else {
+            emit("\tsub rax, %d\n", referenced_var_add->offset);
+        }
 
         // Push the memory address of our variable onto the stack
-        printf("\tpush rax\n");
+        emit("\tpush rax\n");
     } else {
         fprintf(stderr, "Expected an lval but found %d\n", node->ty);
         exit(CODEGEN_ERROR);
     }
 }
 
+void gen_call(Node *node, Scope **local_scope);
+
+// Generate an expression, leaving its value in rax rather than on the stack
+void gen_value(Node *node, Scope **local_scope) {
+    if(OPTIMIZATIONS_ENABLED && select_instructions(node, local_scope, 8)) return;
+    // A call already leaves its value in rax
+    if(node->ty == ND_CALL) {
+        gen_call(node, local_scope);
+        return;
+    }
+    gen(node, local_scope);
+    emit("\tpop rax\n");
+}
+
+// Generate a jump to the target that is taken when the condition's truth is jump_when.
+// && and || become chains of jumps, so that their right side only runs when the left one doesn't decide.
+void gen_branch(Node *condition, bool jump_when, char *target, Scope **local_scope) {
+    char skip[32];
+
+    switch(condition->ty) {
+        case ND_UNARY_BOOLEAN_NOT:
+            gen_branch(condition->middle, !jump_when, target, local_scope);
+            return;
+        case ND_LAND:
+        case ND_LOR:
+            // a && b is false as soon as a is, and a || b is true as soon as a is
+            if(jump_when == (condition->ty == ND_LOR)) {
+                gen_branch(condition->left, jump_when, target, local_scope);
+                gen_branch(condition->right, jump_when, target, local_scope);
+                return;
+            }
+            // Otherwise, the left side can only rule the jump out
+            snprintf(skip, 32, "%s_s_%d", condition->ty == ND_LAND ? "land" : "lor", LABELS_GENERATED++);
+            gen_branch(condition->left, !jump_when, skip, local_scope);
+            gen_branch(condition->right, jump_when, target, local_scope);
+            emit("%s:\n", skip);
+            return;
+        default:
+            break;
+    }
+
+    if(OPTIMIZATIONS_ENABLED) {
+        select_branch(condition, jump_when, target, local_scope);
+        return;
+    }
+    gen_value(condition, local_scope);
+    emit("\ttest rax, rax\n");
+    emit("\t%s %s\n", jump_when ? "jnz" : "jz", target);
+}
+
+// Generate a statement, discarding any value it leaves on the stack. Statements that can never be reached aren't generated at all.
+void gen_statement(Node *node, Scope **local_scope) {
+    // A label nothing reaches is still written out, since the jump table of a switch may name it
+    if(node->unreachable && node->ty != ND_LABEL) return;
+    if(!places_on_stack(node->ty)) {
+        gen(node, local_scope);
+        return;
+    }
+    // The only value of a statement that is used is the one the program exits with
+    if(OPTIMIZATIONS_ENABLED && select_instructions(node, local_scope, node == RESULT_STATEMENT ? 8 : 0)) return;
+    gen_value(node, local_scope);
+}
+
+// Generate a condition whose outcome is already known, only keeping the side effects it may have
+void gen_side_effects(Node *node, Scope **local_scope) {
+    if(has_side_effects(node)) gen_statement(node, local_scope);
+}
+
+// Generate the jump for a break/continue, unwinding every scope opened since the start of the loop
+void gen_loop_jump(Node *loop, char *label, Scope **local_scope) {
+    for(Scope *scope = *local_scope; scope != loop->scope; scope = scope->parent_scope) {
+        scope_epilogue();
+    }
+    emit("\tjmp %s\n", label);
+}
+
+// Whether optimizing left nothing in a scope, which then doesn't need a frame either
+bool is_empty_scope(Node *node) {
+    for(int i = 0; i < node->statements->len; i++) {
+        if(((Node *)node->statements->data[i])->ty != ND_NOOP) return false;
+    }
+    return true;
+}
+
 void gen_scope(Node *node, Scope **local_scope) {
+    if(node->descend && is_empty_scope(node)) return;
+
     // Go into our new scope
     if(node->descend) {
-        *local_scope = get_next_child_scope(*local_scope);
-    }
-
-    if(node->parent) {
-        switch(node->parent->ty) {
-            case ND_WHILE:
-            case ND_DO:
-            case ND_FOR:
-                (*local_scope)->break_label = node->parent->break_label;
-                (*local_scope)->continue_label = node->parent->continue_label;
-                break;
-            default:
-                break;
-        }
+        *local_scope = node->scope;
     }
 
     // Function prologue:
-    printf("\tpush rbp\n");
-    printf("\tmov rbp, rsp\n");
-
-    printf("\tsub rsp, %d", (*local_scope)->variables_declared->keys->len * 8);
-    comment("Allocate %d variables to the stack", (*local_scope)->variables_declared->keys->len);
+    scope_prologue(*local_scope);
 
     // Generate every statement in this scope
     for(int i = 0; i < node->statements->len; i++) {
-        Node *current_node = (Node *)node->statements->data[i];
-        gen(current_node, local_scope);
         // Before we can return, we have to keep our stack balanced. But we can't pop after things that act like scopes (as recusively they've already been balanced).
-        if(places_on_stack(current_node->ty)) printf("\tpop rax\n");
+        gen_statement((Node *)node->statements->data[i], local_scope);
     }
 
     // Function epilogue:
@@ -109,21 +279,205 @@ void gen_scope(Node *node, Scope **local_scope) {
     if(node->descend) {
         // Leave our scope
         *local_scope = (*local_scope)->parent_scope;
-        // Mark that we've completed traversing this scope
-        (*local_scope)->scopes_traversed = (*local_scope)->scopes_traversed + 1;
     }
 }
 
+#define SWITCH_TABLE_SPARSITY 3     // Most entries of a jump table per case
+
+int compare_case_values(const void *a, const void *b) {
+    int left = (*(Node **)a)->val, right = (*(Node **)b)->val;
+    return (left > right) - (left < right);
+}
+
+// The case labels of a switch, from the lowest value to the highest
+Vector *sorted_cases(Node *node) {
+    Vector *cases = new_vector();
+    for(int i = 0; i < node->statements->len; i++) vec_push(cases, node->statements->data[i]);
+    qsort(cases->data, cases->len, sizeof(void *), compare_case_values);
+    return cases;
+}
+
+// A few cases are compared one by one. Past that, a table pays off when at least a third of its
+// entries are cases, and a binary search over the values is taken otherwise.
+int switch_lowering(Vector *cases) {
+    if(cases->len <= SWITCH_CHAIN_LENGTH) return SWITCH_CHAIN;
+    long span = (long)((Node *)cases->data[cases->len - 1])->val - ((Node *)cases->data[0])->val + 1;
+    return span <= (long)cases->len * SWITCH_TABLE_SPARSITY ? SWITCH_TABLE : SWITCH_TREE;
+}
+
+void gen_case_chain(Vector *cases, int lo, int hi, char *otherwise) {
+    for(int i = lo; i < hi; i++) {
+        Node *label = cases->data[i];
+        emit("\tcmp rax, %d\n", label->val);
+        emit("\tje %s\n", label->middle->name);
+    }
+    emit("\tjmp %s\n", otherwise);
+}
+
+// Every compare either finds its case or halves the cases that are left
+void gen_case_tree(Vector *cases, int lo, int hi, char *otherwise) {
+    if(hi - lo <= SWITCH_CHAIN_LENGTH) {
+        gen_case_chain(cases, lo, hi, otherwise);
+        return;
+    }
+    int mid = (lo + hi) / 2;
+    int current_label = LABELS_GENERATED++;
+    Node *label = cases->data[mid];
+    emit("\tcmp rax, %d\n", label->val);
+    emit("\tje %s\n", label->middle->name);
+    emit("\tjg swr_%d\n", current_label);
+    gen_case_tree(cases, lo, mid, otherwise);
+    emit("swr_%d:\n", current_label);
+    gen_case_tree(cases, mid + 1, hi, otherwise);
+}
+
+// The table holds the distance from itself to the label for every value from the lowest case to
+// the highest, so it doesn't need relocating wherever the code is loaded. Values outside of that
+// range wrap around to large unsigned ones, and a single compare sends them to otherwise.
+void gen_jump_table(Vector *cases, char *otherwise) {
+    int current_label = LABELS_GENERATED++;
+    int low = ((Node *)cases->data[0])->val, high = ((Node *)cases->data[cases->len - 1])->val;
+    if(low != 0) emit("\tsub rax, %d\n", low);
+    emit("\tcmp rax, %ld\n", (long)high - low);
+    emit("\tja %s\n", otherwise);
+    emit("\tlea rcx, [rip+swt_%d]\n", current_label);
+    emit("\tmovsxd rax, DWORD PTR [rcx+rax*4]\n");
+    emit("\tadd rax, rcx\n");
+    emit("\tjmp rax\n");
+    emit("swt_%d:\n", current_label);
+    int next = 0;
+    for(long value = low; value <= high; value++) {
+        Node *label = cases->data[next];
+        char *target = otherwise;
+        if(label->val == value) {
+            target = label->middle->name;
+            next++;
+        }
+        emit("\t.long %s-swt_%d\n", target, current_label);
+    }
+}
+
+// Jumps to the label of the case the selector matches
+void gen_switch(Node *node, Scope **local_scope) {
+    char *otherwise = node->jump_target->middle->name;
+    if(node->middle->ty == ND_NUM) {
+        emit("\tjmp %s\n", matching_case(node, node->middle->val)->middle->name);
+        return;
+    }
+
+    Vector *cases = sorted_cases(node);
+    gen_value(node->middle, local_scope);
+    switch(switch_lowering(cases)) {
+        case SWITCH_TABLE:
+            gen_jump_table(cases, otherwise);
+            break;
+        case SWITCH_TREE:
+            gen_case_tree(cases, 0, cases->len, otherwise);
+            break;
+        default:
+            gen_case_chain(cases, 0, cases->len, otherwise);
+            break;
+    }
+}
+
+char *ARGUMENT_REGISTERS[] = {"rdi", "rsi", "rdx", "rcx", "r8", "r9"};
+
+// Calls follow the System V ABI: the first six arguments go in registers, the rest on the stack,
+// which is 16-byte aligned at the call. The stack machine can leave rsp anywhere, so it is aligned
+// here and the old one saved right above the arguments, to be restored from once the call returns.
+// Register arguments are pushed as they are worked out, since working out the next one can call.
+void gen_call(Node *node, Scope **local_scope) {
+    int count = node->val;
+    int on_stack = count > 6 ? count - 6 : 0;
+    int reserved = on_stack * 8 + (on_stack % 2 == 0 ? 8 : 0);
+
+    emit("\tmov rax, rsp\n");
+    emit("\tand rsp, -16\n");
+    emit("\tpush rax\n");
+    emit("\tsub rsp, %d\n", reserved);
+    int i = 0, pushed = 0;
+    for(Node *argument = node->middle; argument != NULL; argument = argument->right, i++) {
+        gen_value(argument->left, local_scope);
+        if(i >= 6) {
+            // Above the six pushed for the registers
+            emit("\tmov [rsp+%d], rax\n", 48 + (i - 6) * 8);
+        } else if(i == count - 1) {
+            // Nothing is worked out after the last one, so it can go straight to its register
+            emit("\tmov %s, rax\n", ARGUMENT_REGISTERS[i]);
+        } else {
+            emit("\tpush rax\n");
+            pushed++;
+        }
+    }
+    while(pushed-- > 0) emit("\tpop %s\n", ARGUMENT_REGISTERS[pushed]);
+    emit("\tcall %s\n", node->name);
+    emit("\tmov rsp, [rsp+%d]\n", reserved);
+}
+
+// Closes every frame opened since the function was entered, then returns its value in rax
+void gen_return(Node *node, Scope **local_scope) {
+    gen_value(node->middle, local_scope);
+    for(Scope *scope = *local_scope; scope != NULL; scope = scope->parent_scope) scope_epilogue();
+    if(CURRENT_FUNCTION != NULL) emit("\tpop rbx\n");
+    emit("\tret\n");
+}
+
+// A function saves rbx, which its caller expects to keep but codegen uses freely, then opens the
+// frame of its body and stores the parameters in it. The ones after the sixth sit above the
+// return address and the saved rbx and rbp.
+void gen_function(Node *function) {
+    Scope *scope = function->middle->scope;
+    CURRENT_FUNCTION = function;
+    emit("%s:\n", function->name);
+    emit("\tpush rbx\n");
+    scope_prologue(scope);
+    for(int i = 0; i < function->statements->len; i++) {
+        int offset = get_variable_location(scope, ((Node *)function->statements->data[i])->name)->offset;
+        if(i < 6) {
+            emit("\tmov [rbp-%d], %s\n", offset, ARGUMENT_REGISTERS[i]);
+        } else {
+            emit("\tmov rax, [rbp+%d]\n", 24 + (i - 6) * 8);
+            emit("\tmov [rbp-%d], rax\n", offset);
+        }
+    }
+    for(int i = 0; i < function->middle->statements->len; i++) {
+        gen_statement((Node *)function->middle->statements->data[i], &scope);
+    }
+    // Running off the end returns 0
+    emit("\txor eax, eax\n");
+    scope_epilogue();
+    emit("\tpop rbx\n");
+    emit("\tret\n");
+    CURRENT_FUNCTION = NULL;
+}
+
+// Generates every function the program still calls, after the code of main. Returns their names,
+// in the order they are written out.
+Vector *gen_functions(Node *program) {
+    Vector *functions = called_functions(program);
+    Vector *names = new_vector();
+    for(int i = 0; i < functions->len; i++) {
+        gen_function(functions->data[i]);
+        vec_push(names, ((Node *)functions->data[i])->name);
+    }
+    return names;
+}
+
 void gen_unary(Node *statement_tree, Scope **local_scope) {
-    int scopes_to_unwind;
+    int scopes_to_unwind, size = 8;
+    bool is_step = statement_tree->ty == ND_PRE_INCREMENT || statement_tree->ty == ND_PRE_DECREMENT
+        || statement_tree->ty == ND_POST_INCREMENT || statement_tree->ty == ND_POST_DECREMENT;
+    if(is_step && statement_tree->middle->ty == ND_IDENT) {
+        size = get_variable_location(*local_scope, statement_tree->middle->name)->size;
+    }
 
     switch(statement_tree->ty) {
         // Unary negation
         case ND_UNARY_NEG:
             gen(statement_tree->middle, local_scope);
-            printf("\tpop rax\n");
-            printf("\tneg rax\n");
-            printf("\tpush rax\n");
+            emit("\tpop rax\n");
+            emit("\tneg rax\n");
+            emit("\tpush rax\n");
             break;
         // This case is sort of like a no-op, but it can have some side effects in compilation (like co-ercing an lvalue to an rvalue)
         case ND_UNARY_POS:
@@ -131,61 +485,59 @@ void gen_unary(Node *statement_tree, Scope **local_scope) {
             break;
         case ND_UNARY_BIT_COMPLEMENT:
             gen(statement_tree->middle, local_scope);
-            printf("\tpop rax\n");
-            printf("\tnot rax\n");
-            printf("\tpush rax\n");
+            emit("\tpop rax\n");
+            emit("\tnot rax\n");
+            emit("\tpush rax\n");
             break;
         // TODO: Find if there's a more canonical way to perform boolean !
         case ND_UNARY_BOOLEAN_NOT:
             gen(statement_tree->middle, local_scope);
-            printf("\tpop rax\n");
-            printf("\tcmp rax, 0\n");
-            printf("\tsete al\n");
-            printf("\tmovzb rax, al\n");
-            printf("\tpush rax\n");
+            emit("\tpop rax\n");
+            emit("\tcmp rax, 0\n");
+            emit("\tsete al\n");
+            emit("\tmovzb rax, al\n");
+            emit("\tpush rax\n");
             break;
         case ND_PRE_INCREMENT:
             gen_lval(statement_tree->middle, local_scope);
             // Load the address into rax
-            printf("\tpop rax\n");
+            emit("\tpop rax\n");
             // Then, get the value inside rax and increment it 
-            printf("\tmov rbx, [rax]\n");
-            printf("\tinc rbx\n");
+            gen_load_from_address("rbx", size);
+            emit("\tinc rbx\n");
             // Store it back into rax's address and put the new value on the stack
-            printf("\tmov [rax], rbx\n");
-            printf("\tpush rbx\n");
+            gen_store_to_address(size);
+            emit("\tpush rbx\n");
             break;
         case ND_PRE_DECREMENT:
             gen_lval(statement_tree->middle, local_scope);
-            printf("\tpop rax\n");
+            emit("\tpop rax\n");
             // Then, get the value inside rax and decrement it 
-            printf("\tmov rbx, [rax]\n");
-            printf("\tdec rbx\n");
+            gen_load_from_address("rbx", size);
+            emit("\tdec rbx\n");
             // Store it back into rax's address and put the new value on the stack
-            printf("\tmov [rax], rbx\n");
-            printf("\tpush rbx\n");
+            gen_store_to_address(size);
+            emit("\tpush rbx\n");
             break;
         case ND_POST_DECREMENT:
             gen_lval(statement_tree->middle, local_scope);
-            // Keep the value in rax on the stack
-            printf("\tpop rax\n");
-            printf("\tpush [rax]\n");
-            // Load the value in rax
-            printf("\tmov rbx, [rax]\n");
+            emit("\tpop rax\n");
+            // Load the value in rax, and keep it on the stack
+            gen_load_from_address("rbx", size);
+            emit("\tpush rbx\n");
             // Decrement the value and store it in [rax] (value on stack is unchanged)
-            printf("\tdec rbx\n");
-            printf("\tmov [rax], rbx\n");
+            emit("\tdec rbx\n");
+            gen_store_to_address(size);
             break;
         case ND_POST_INCREMENT:
             gen_lval(statement_tree->middle, local_scope);
-            // Keep the value in rax on the stack
-            printf("\tpop rax\n");
-            printf("\tpush [rax]\n");
-            // Load the value in rax
-            printf("\tmov rbx, [rax]\n");
+            emit("\tpop rax\n");
+            // Load the value in rax, and keep it on the stack
+            gen_load_from_address("rbx", size);
+            emit("\tpush rbx\n");
             // Increment the value and store it in [rax] (value on stack is unchanged)
-            printf("\tinc rbx\n");
-            printf("\tmov [rax], rbx\n");
+            emit("\tinc rbx\n");
+            gen_store_to_address(size);
             break;
         case ND_GOTO:
             scopes_to_unwind = scopes_to_clear_on_jump(*local_scope, statement_tree->middle->name, 0);
@@ -196,10 +548,26 @@ void gen_unary(Node *statement_tree, Scope **local_scope) {
             while(scopes_to_unwind-- > 0) {
                 scope_epilogue();
             }
-            printf("\tjmp %s\n", statement_tree->middle->name);
+            emit("\tjmp %s\n", statement_tree->middle->name);
             break;
         case ND_LABEL:
-            printf("%s:", statement_tree->middle->name);
+            emit("%s:", statement_tree->middle->name);
+            break;
+        case ND_SWITCH:
+            gen_switch(statement_tree, local_scope);
+            break;
+        case ND_CALL:
+            gen_call(statement_tree, local_scope);
+            emit("\tpush rax\n");
+            break;
+        case ND_RETURN:
+            gen_return(statement_tree, local_scope);
+            break;
+        case ND_INDEX:
+            gen_lval(statement_tree, local_scope);
+            emit("\tpop rax\n");
+            gen_load_from_address("rax", get_variable_location(*local_scope, statement_tree->name)->size);
+            emit("\tpush rax\n");
             break;
         default:
             fprintf(stderr, "Unknown unary operation: %d\n", statement_tree->ty);
@@ -211,16 +579,17 @@ void gen_binary(Node *statement_tree, Scope **local_scope) {
     // Special cases that don't follow the "evaluate args, pop args, compute" sequence
     switch(statement_tree->ty) {
         int current_label;
+        char target[32];
         case '=':
             // The left-hand side of any assignment must be an lval
             gen_lval(statement_tree->left, local_scope);
             // Generate the value that we want to put into this lval
             gen(statement_tree->right, local_scope);
-            printf("\tpop rbx\n");
-            printf("\tpop rax\n");
-            printf("\tmov [rax], rbx\n");
+            emit("\tpop rbx\n");
+            emit("\tpop rax\n");
+            gen_store_to_address(get_variable_location(*local_scope, statement_tree->left->name)->size);
             // By storing our value back on the stack we can chain assignments
-            printf("\tpush rbx\n");
+            emit("\tpush rbx\n");
             return;
         case ND_WHILE:
             current_label = LABELS_GENERATED++;
@@ -228,20 +597,36 @@ void gen_binary(Node *statement_tree, Scope **local_scope) {
             snprintf(statement_tree->break_label, 32, "wle_%d", current_label);
             statement_tree->continue_label = malloc(sizeof(char) * 32);
             snprintf(statement_tree->continue_label, 32, "wlb_%d", current_label);
-            printf("wlb_%d:\n", current_label);
+            // A loop that never runs only needs its condition evaluated once
+            if(statement_tree->static_cond == COND_ALWAYS_FALSE) {
+                gen_side_effects(statement_tree->left, local_scope);
+                return;
+            }
+            // Rotated: the condition is tested once on the way in and then at the bottom of every iteration,
+            // so each trip around the loop takes a single conditional branch back to the top
+            if(OPTIMIZATIONS_ENABLED && statement_tree->static_cond == COND_UNKNOWN) {
+                snprintf(statement_tree->continue_label, 32, "wlc_%d", current_label);
+                gen_branch(statement_tree->left, false, statement_tree->break_label, local_scope);
+                emit("wlb_%d:\n", current_label);
+                gen_statement(statement_tree->right, local_scope);
+                emit("wlc_%d:\n", current_label);
+                snprintf(target, 32, "wlb_%d", current_label);
+                gen_branch(statement_tree->left, true, target, local_scope);
+                emit("wle_%d:\n", current_label);
+                return;
+            }
+            emit("wlb_%d:\n", current_label);
             // Evaluate the conditional
-            gen(statement_tree->left, local_scope);
-            printf("\tpop rax\n");
-            printf("\ttest rax, rax\n");
-            // If the conditional is false, end the loop
-            printf("\tjz wle_%d\n", current_label);
-            // Before we can generate a child scope, we need to keep track of where that scope should break/continue to
-            statement_tree->right->parent = statement_tree;
-            gen(statement_tree->right, local_scope);
-            if(places_on_stack(statement_tree->right->ty)) printf("\tpop rax\n");
+            if(statement_tree->static_cond == COND_ALWAYS_TRUE) {
+                gen_side_effects(statement_tree->left, local_scope);
+            } else {
+                // If the conditional is false, end the loop
+                gen_branch(statement_tree->left, false, statement_tree->break_label, local_scope);
+            }
+            gen_statement(statement_tree->right, local_scope);
             // After we finish the loop body, jump back to the condition
-            printf("\tjmp wlb_%d\n", current_label);
-            printf("wle_%d:\n", current_label);
+            emit("\tjmp wlb_%d\n", current_label);
+            emit("wle_%d:\n", current_label);
             return;
         case ND_DO:
             current_label = LABELS_GENERATED++;
@@ -249,40 +634,32 @@ void gen_binary(Node *statement_tree, Scope **local_scope) {
             snprintf(statement_tree->break_label, 32, "dwe_%d", current_label);
             statement_tree->continue_label = malloc(sizeof(char) * 32);
             snprintf(statement_tree->continue_label, 32, "dwc_%d", current_label);
-            printf("dwb_%d:\n", current_label);
+            emit("dwb_%d:\n", current_label);
             // Execute the loop body
-            statement_tree->left->parent = statement_tree;
-            gen(statement_tree->left, local_scope);
-            if(places_on_stack(statement_tree->left->ty)) printf("\tpop rax\n");
+            gen_statement(statement_tree->left, local_scope);
             // Evaluate the conditional
-            printf("dwc_%d:\n", current_label);
-            gen(statement_tree->right, local_scope);
-            printf("\tpop rax\n");
-            printf("\ttest rax, rax\n");
-            // If the conditional is true, continue the loop
-            printf("\tjnz dwb_%d\n", current_label);
-            printf("dwe_%d:\n", current_label);
+            emit("dwc_%d:\n", current_label);
+            if(statement_tree->static_cond != COND_UNKNOWN) {
+                gen_side_effects(statement_tree->right, local_scope);
+                if(statement_tree->static_cond == COND_ALWAYS_TRUE) emit("\tjmp dwb_%d\n", current_label);
+            } else {
+                // If the conditional is true, continue the loop
+                snprintf(target, 32, "dwb_%d", current_label);
+                gen_branch(statement_tree->right, true, target, local_scope);
+            }
+            emit("dwe_%d:\n", current_label);
             return;
-        // These operators need to short circuit, so they get special treatment.
+        // These operators need to short circuit, so they are generated as a condition and then turned into 0 or 1
         case ND_LAND:
-            current_label = LABELS_GENERATED++;
-            gen(statement_tree->left, local_scope);
-            printf("\tpop rax\n");
-            printf("\tpush rax\n");
-            printf("\tcmp rax, rax\n");
-            printf("\tjz land_e_%d\n", current_label);
-            gen(statement_tree->right, local_scope);
-            printf("land_e_%d:\n", current_label);
-            return;
         case ND_LOR:
             current_label = LABELS_GENERATED++;
-            gen(statement_tree->left, local_scope);
-            printf("\tpop rax\n");
-            printf("\tpush rax\n");
-            printf("\tcmp rax, rax\n");
-            printf("\tjnz lor_e_%d\n", current_label);
-            gen(statement_tree->right, local_scope);
-            printf("lor_e_%d:\n", current_label);
+            snprintf(target, 32, "logic_f_%d", current_label);
+            gen_branch(statement_tree, false, target, local_scope);
+            emit("\tpush 1\n");
+            emit("\tjmp logic_e_%d\n", current_label);
+            emit("%s:\n", target);
+            emit("\tpush 0\n");
+            emit("logic_e_%d:\n", current_label);
             return;
         default:
             break;
@@ -290,116 +667,122 @@ void gen_binary(Node *statement_tree, Scope **local_scope) {
 
     gen(statement_tree->left, local_scope);
     gen(statement_tree->right, local_scope);
-    printf("\tpop rbx\n");
-    printf("\tpop rax\n");
+    emit("\tpop rbx\n");
+    emit("\tpop rax\n");
     switch(statement_tree->ty) {
         case '*':
-            printf("\tmul rbx\n");
+            emit("\tmul rbx\n");
             break;
         case '/':
-            printf("\tmov rdx, 0\n");
-            printf("\tdiv rbx\n");
+            emit("\tmov rdx, 0\n");
+            emit("\tdiv rbx\n");
             break;
         case '%':
-            printf("\tmov rdx, 0\n");
-            printf("\tdiv rbx\n");
-            printf("\tmovzb rax, dl\n");
+            emit("\tmov rdx, 0\n");
+            emit("\tdiv rbx\n");
+            emit("\tmov rax, rdx\n");
             break;
         case '+':
-            printf("\tadd rax, rbx\n");
+            emit("\tadd rax, rbx\n");
             break;
         case '-':
-            printf("\tsub rax, rbx\n");
+            emit("\tsub rax, rbx\n");
             break;
         case ND_EQUAL:
-            printf("\tcmp rbx, rax\n");
-            printf("\tsete al\n");
-            printf("\tmovzb rax, al\n");
+            emit("\tcmp rbx, rax\n");
+            emit("\tsete al\n");
+            emit("\tmovzb rax, al\n");
             break;
         case ND_NEQUAL:
-            printf("\tcmp rbx, rax\n");
-            printf("\tsetne al\n");
-            printf("\tmovzb rax, al\n");
+            emit("\tcmp rbx, rax\n");
+            emit("\tsetne al\n");
+            emit("\tmovzb rax, al\n");
             break;
         case ND_GEQUAL:
-            printf("\tcmp rax, rbx\n");
-            printf("\tsetge al\n");
-            printf("\tmovzb rax, al\n");
+            emit("\tcmp rax, rbx\n");
+            emit("\tsetge al\n");
+            emit("\tmovzb rax, al\n");
             break;
         case ND_LEQUAL:
-            printf("\tcmp rax, rbx\n");
-            printf("\tsetle al\n");
-            printf("\tmovzb rax, al\n");
+            emit("\tcmp rax, rbx\n");
+            emit("\tsetle al\n");
+            emit("\tmovzb rax, al\n");
             break;
         case '>':
-            printf("\tcmp rax, rbx\n");
-            printf("\tsetg al\n");
-            printf("\tmovzb rax, al\n");
+            emit("\tcmp rax, rbx\n");
+            emit("\tsetg al\n");
+            emit("\tmovzb rax, al\n");
             break;
         case '<':
-            printf("\tcmp rax, rbx\n");
-            printf("\tsetl al\n");
-            printf("\tmovzb rax, al\n");
+            emit("\tcmp rax, rbx\n");
+            emit("\tsetl al\n");
+            emit("\tmovzb rax, al\n");
             break;
         case ND_LEFT_SHIFT:
-            printf("\tmovzb rcx, bl\n");
-            printf("\tshl rax, cl\n");
+            emit("\tmovzb rcx, bl\n");
+            emit("\tshl rax, cl\n");
             break;
         case ND_RIGHT_SHIFT:
-            printf("\tmovzb rcx, bl\n");
-            printf("\tshr rax, cl\n");
+            emit("\tmovzb rcx, bl\n");
+            emit("\tshr rax, cl\n");
             break;
         case '^':
-            printf("\txor rax, rbx\n");
+            emit("\txor rax, rbx\n");
             break;
         case '|':
-            printf("\tor rax, rbx\n");
+            emit("\tor rax, rbx\n");
             break;
         case '&':
-            printf("\tand rax, rbx\n");
+            emit("\tand rax, rbx\n");
             break;
         default:
             fprintf(stderr, "Unknown binary operation: %d\n", statement_tree->ty);
             exit(CODEGEN_ERROR);
     }
-    printf("\tpush rax\n");
+    emit("\tpush rax\n");
 }
 
 void gen_ternary(Node *statement_tree, Scope **local_scope) {
     int current_label;
+    char target[32];
     switch(statement_tree->ty) {
         // Ternary Operation
         case ND_TERNARY_CONDITIONAL:
+            // When we know which way the condition goes, only that side needs to be computed
+            if(statement_tree->static_cond != COND_UNKNOWN) {
+                gen_side_effects(statement_tree->left, local_scope);
+                gen(statement_tree->static_cond == COND_ALWAYS_TRUE ? statement_tree->middle : statement_tree->right, local_scope);
+                break;
+            }
             current_label = LABELS_GENERATED++;
-            // First, we write the code to compute the value of the boolean expression
-            gen(statement_tree->left, local_scope);
-            // Pop the value from the stack and jump to the false condition if 0
-            printf("\tpop rax\n");
-            printf("\ttest rax, rax\n");
-            printf("\tjz cond_f_%d\n", current_label);
+            // First, we write the code for the boolean expression, jumping to the false condition if 0
+            snprintf(target, 32, "cond_f_%d", current_label);
+            gen_branch(statement_tree->left, false, target, local_scope);
             // Assuming we haven't jumped, we're in the true branch
             gen(statement_tree->middle, local_scope);
-            printf("\tjmp cond_end_%d\n", current_label);
-            printf("cond_f_%d:\n", current_label);
+            emit("\tjmp cond_end_%d\n", current_label);
+            emit("cond_f_%d:\n", current_label);
             gen(statement_tree->right, local_scope);
-            printf("cond_end_%d:\n", current_label);
+            emit("cond_end_%d:\n", current_label);
             // Our original assumption is that our recursive trees end by putting their value on the stack, so we don't need to do anything else.
             break;
         case ND_IF:
+            if(statement_tree->static_cond != COND_UNKNOWN) {
+                gen_side_effects(statement_tree->left, local_scope);
+                gen_statement(statement_tree->static_cond == COND_ALWAYS_TRUE ? statement_tree->middle : statement_tree->right, local_scope);
+                break;
+            }
+            // Assigning one of two values to a variable doesn't need to branch at all
+            if(OPTIMIZATIONS_ENABLED && select_conditional_assignment(statement_tree, local_scope)) break;
             // Same as ternary conditionals, but we have to remember to pop the stack when we aren't given a block as an argument
             current_label = LABELS_GENERATED++;
-            gen(statement_tree->left, local_scope);
-            // Pop the value from the stack and jump to the false condition if 0
-            printf("\tpop rax\n");
-            printf("\ttest rax, rax\n");
-            printf("\tjz cond_f_%d\n", current_label);
-            gen(statement_tree->middle, local_scope);
-            if(places_on_stack(statement_tree->middle->ty)) printf("\tpop rax\n");
-            printf("\tjmp cond_end_%d\n", current_label);
-            printf("cond_f_%d:\n", current_label);
-            gen(statement_tree->right, local_scope);
-            if(places_on_stack(statement_tree->right->ty)) printf("\tpop rax\n");
-            printf("cond_end_%d:\n", current_label);
+            snprintf(target, 32, "cond_f_%d", current_label);
+            gen_branch(statement_tree->left, false, target, local_scope);
+            gen_statement(statement_tree->middle, local_scope);
+            emit("\tjmp cond_end_%d\n", current_label);
+            emit("cond_f_%d:\n", current_label);
+            gen_statement(statement_tree->right, local_scope);
+            emit("cond_end_%d:\n", current_label);
             break;
         default: 
             fprintf(stderr, "Unknown ternary operation: %d\n", statement_tree->ty);
@@ -407,6 +790,31 @@ void gen_ternary(Node *statement_tree, Scope **local_scope) {
     }
 }
 
+// Like a rotated while loop, the condition is checked once before the first iteration and then
+// after the post-loop statement, where a single conditional branch takes us back to the body
+void gen_rotated_for(Node *statement_tree, int current_label, Scope **local_scope) {
+    char target[32];
+    snprintf(target, 32, "flb_%d", current_label);
+    bool tested = statement_tree->static_cond != COND_ALWAYS_TRUE && places_on_stack(statement_tree->middle->ty);
+
+    if(tested) {
+        gen_branch(statement_tree->middle, false, statement_tree->break_label, local_scope);
+    } else {
+        gen_side_effects(statement_tree->middle, local_scope);
+    }
+    emit("flb_%d:\n", current_label);
+    gen_statement(statement_tree->extra, local_scope);
+    emit("fli_%d:\n", current_label);
+    gen_statement(statement_tree->right, local_scope);
+    if(tested) {
+        gen_branch(statement_tree->middle, true, target, local_scope);
+    } else {
+        gen_side_effects(statement_tree->middle, local_scope);
+        emit("\tjmp %s\n", target);
+    }
+    emit("fle_%d:\n", current_label);
+}
+
 void gen_quaternary(Node *statement_tree, Scope **local_scope) {
     int current_label;
     switch(statement_tree->ty) {
@@ -415,28 +823,35 @@ void gen_quaternary(Node *statement_tree, Scope **local_scope) {
             statement_tree->break_label = malloc(sizeof(char) * 32);
             snprintf(statement_tree->break_label, 32, "fle_%d", current_label);
             statement_tree->continue_label = malloc(sizeof(char) * 32);
-            snprintf(statement_tree->continue_label, 32, "flc_%d", current_label);
+            snprintf(statement_tree->continue_label, 32, "fli_%d", current_label);
             // Evaluate the initializer
-            gen(statement_tree->left, local_scope);
-            if(places_on_stack(statement_tree->left->ty)) printf("\tpop rax\n");
-            printf("flc_%d:\n", current_label);
+            gen_statement(statement_tree->left, local_scope);
+            if(statement_tree->static_cond == COND_ALWAYS_FALSE) {
+                gen_side_effects(statement_tree->middle, local_scope);
+                break;
+            }
+            if(OPTIMIZATIONS_ENABLED) {
+                // A loop over arrays runs as many of its iterations as it can a vector at a time
+                // first, and then the rest as usual
+                gen_vectorized_loop(statement_tree, local_scope);
+                gen_rotated_for(statement_tree, current_label, local_scope);
+                break;
+            }
+            emit("flc_%d:\n", current_label);
             // Evaluate the conditional
-            gen(statement_tree->middle, local_scope);
-            if(places_on_stack(statement_tree->middle->ty)) {
-                printf("\tpop rax\n");
-                printf("\ttest rax, rax\n");
-                printf("\tjz fle_%d\n", current_label);
+            if(statement_tree->static_cond == COND_ALWAYS_TRUE) {
+                gen_side_effects(statement_tree->middle, local_scope);
+            } else if(places_on_stack(statement_tree->middle->ty)) {
+                gen_branch(statement_tree->middle, false, statement_tree->break_label, local_scope);
             }
-            statement_tree->extra->parent = statement_tree;
             // Evaluate the loop body
-            gen(statement_tree->extra, local_scope);
-            if(places_on_stack(statement_tree->extra->ty)) printf("\tpop rax\n");
-            // Evaluate the post-loop statement
-            gen(statement_tree->right, local_scope);
-            if(places_on_stack(statement_tree->right->ty)) printf("\tpop rax\n");
+            gen_statement(statement_tree->extra, local_scope);
+            // Evaluate the post-loop statement, which is also where a continue takes us
+            emit("fli_%d:\n", current_label);
+            gen_statement(statement_tree->right, local_scope);
             // Go back to conditional
-            printf("\tjmp flc_%d\n", current_label);
-            printf("fle_%d:\n", current_label);
+            emit("\tjmp flc_%d\n", current_label);
+            emit("fle_%d:\n", current_label);
             break;
         default: 
             fprintf(stderr, "Unknown quaternary operation: %d\n", statement_tree->ty);
@@ -445,7 +860,12 @@ void gen_quaternary(Node *statement_tree, Scope **local_scope) {
 }
 
 void gen(Node *statement_tree, Scope **local_scope) {
-    int scopes_to_break = 1;
+    // Expressions that better instructions exist for don't need to go through the stack machine.
+    // Literals are already as cheap as they get with a push.
+    if(OPTIMIZATIONS_ENABLED && places_on_stack(statement_tree->ty) && statement_tree->ty != ND_NUM && select_instructions(statement_tree, local_scope, 8)) {
+        emit("\tpush rax\n");
+        return;
+    }
 
     switch(statement_tree->arity) {
         case 4:
@@ -462,31 +882,19 @@ void gen(Node *statement_tree, Scope **local_scope) {
             break;
         default:
             switch(statement_tree->ty) {
-                case ND_BREAK: ;
-                    Scope *breakable_scope = *local_scope;
-                    while(breakable_scope->break_label == NULL) {
-                        if(breakable_scope->parent_scope == NULL) {
-                            fprintf(stderr, "Could not find a scope to break from. Considering 'break' as a no-op.\n");
-                            return;
-                        }
-                        breakable_scope = breakable_scope->parent_scope;
-                        scopes_to_break++;
+                case ND_BREAK:
+                    if(statement_tree->jump_target == NULL) {
+                        fprintf(stderr, "Could not find a scope to break from. Considering 'break' as a no-op.\n");
+                        return;
                     }
-                    while(scopes_to_break-- > 0) scope_epilogue();
-                    printf("\tjmp %s\n", breakable_scope->break_label);
+                    gen_loop_jump(statement_tree->jump_target, statement_tree->jump_target->break_label, local_scope);
                     break;
-                case ND_CONTINUE: ;
-                    Scope *continuable_scope = *local_scope;
-                    while(continuable_scope->continue_label == NULL) {
-                        if(continuable_scope->parent_scope == NULL) {
-                            fprintf(stderr, "Could not find a scope to continue from. Considering 'continue' as a no-op.\n");
-                            return;
-                        }
-                        continuable_scope = continuable_scope->parent_scope;
-                        scopes_to_break++;
+                case ND_CONTINUE:
+                    if(statement_tree->jump_target == NULL) {
+                        fprintf(stderr, "Could not find a scope to continue from. Considering 'continue' as a no-op.\n");
+                        return;
                     }
-                    while(scopes_to_break-- > 0) scope_epilogue();
-                    printf("\tjmp %s\n", continuable_scope->continue_label);
+                    gen_loop_jump(statement_tree->jump_target, statement_tree->jump_target->continue_label, local_scope);
                     break;
                 case ND_NOOP:
                     break;
@@ -495,15 +903,15 @@ void gen(Node *statement_tree, Scope **local_scope) {
                     break;
                 case ND_NUM:
                     // For numbers, we only push the direct value on the stack
-                    printf("\tpush %d", statement_tree->val);
+                    emit("\tpush %d", statement_tree->val);
                     comment("Place %d onto the stack", statement_tree->val);
                     break;
                 case ND_IDENT:
                     // Fetch the value in that address and store it on the stack
                     gen_lval(statement_tree, local_scope);
-                    printf("\tpop rax\n");
-                    printf("\tmov rax, [rax]\n");
-                    printf("\tpush rax\n");
+                    emit("\tpop rax\n");
+                    gen_load_from_address("rax", get_variable_location(*local_scope, statement_tree->name)->size);
+                    emit("\tpush rax\n");
                     break;
                 default:
                     fprintf(stderr, "Unexpected arity %d for expression of type %d\n", statement_tree->arity, statement_tree->ty);
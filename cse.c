@@ -0,0 +1,366 @@
+#include "yacc.h"
+
+/**
+ ** Common subexpression elimination by local value numbering.
+ ** Within a run of straight-line statements, every expression is given a value number: two
+ ** expressions get the same number when they apply the same operator to operands with the same
+ ** numbers. Assigning to a variable (or incrementing/decrementing it) gives it a new number, which
+ ** is what stops stale values from being reused. An array has a number too, which every store to one
+ ** of its elements replaces, and an element is numbered by the array's number and its index's.
+ ** When a number comes up a second time, the value is taken from a variable that still holds it,
+ ** or else the first computation is made to save its result in a compiler temporary.
+ **/
+
+typedef struct {
+    char *name;
+    Node *wrapped;      // The first computation, rewritten into (temporary = original)
+    Node *original;     // What the first computation looked like before being wrapped
+    int uses;
+} Temporary;
+
+typedef struct {
+    int op;
+    int left;           // Value numbers of the operands
+    int right;
+    long val;           // Constant value, for literals
+    int vn;
+    Node *first;        // First node to compute this value
+    Temporary *temp;
+} Expression;
+
+typedef struct {
+    Scope *scope;
+    Vector *expressions;
+    Vector *assigned;       // Identifiers assigned in this block, which may be holding a value we need later
+    Vector *temporaries;
+    int *variable_vns;      // Current value number of each variable (version, for an array), -1 if not read yet
+    int num_variables;
+} Block;
+
+int VALUE_NUMBERS = 0;
+int TEMPORARIES_CREATED = 0;
+
+Block *new_block(Scope *scope) {
+    Block *block = malloc(sizeof(Block));
+    block->scope = scope;
+    block->expressions = new_vector();
+    block->assigned = new_vector();
+    block->temporaries = new_vector();
+    block->num_variables = variable_count();
+    block->variable_vns = malloc(sizeof(int) * (block->num_variables + 1));
+    for(int i = 0; i < block->num_variables; i++) block->variable_vns[i] = -1;
+    return block;
+}
+
+int variable_vn(Block *block, Node *ident) {
+    int id = get_variable_id(ident->scope, ident->name);
+    if(block->variable_vns[id] == -1) block->variable_vns[id] = VALUE_NUMBERS++;
+    return block->variable_vns[id];
+}
+
+Expression *find_expression(Block *block, int op, int left, int right, long val) {
+    if(is_commutative(op) && left > right) {
+        int tmp = left;
+        left = right;
+        right = tmp;
+    }
+    for(int i = 0; i < block->expressions->len; i++) {
+        Expression *expr = block->expressions->data[i];
+        if(expr->op == op && expr->left == left && expr->right == right && expr->val == val) return expr;
+    }
+
+    Expression *expr = calloc(1, sizeof(Expression));
+    expr->op = op;
+    expr->left = left;
+    expr->right = right;
+    expr->val = val;
+    expr->vn = VALUE_NUMBERS++;
+    vec_push(block->expressions, expr);
+    return expr;
+}
+
+// Reusing a value is only a win when it saves more than loading a variable
+bool worth_reusing(Node *node) {
+    if(node->arity == 2) return true;
+    return node->middle->ty != ND_NUM && node->middle->ty != ND_IDENT;
+}
+
+Temporary *find_temporary(Block *block, char *name) {
+    for(int i = 0; i < block->temporaries->len; i++) {
+        Temporary *temp = block->temporaries->data[i];
+        if(temp->name == name) return temp;
+    }
+    return NULL;
+}
+
+// A computation that was replaced no longer needs the temporaries it was reading
+void release_temporaries(Block *block, Node *node) {
+    if(node == NULL) return;
+    if(node->ty == ND_IDENT) {
+        Temporary *temp = find_temporary(block, node->name);
+        if(temp) temp->uses--;
+        return;
+    }
+    release_temporaries(block, node->left);
+    release_temporaries(block, node->middle);
+    release_temporaries(block, node->right);
+}
+
+// Rewrites the first computation of a value so that it also saves the value in a temporary
+Temporary *save_in_temporary(Block *block, Node *first) {
+    Temporary *temp = calloc(1, sizeof(Temporary));
+    temp->name = malloc(sizeof(char) * 32);
+    snprintf(temp->name, 32, "cse.%d", TEMPORARIES_CREATED++);
+    temp->original = malloc(sizeof(Node));
+    memcpy(temp->original, first, sizeof(Node));
+    temp->wrapped = first;
+    vec_push(block->temporaries, temp);
+
+    first->ty = '=';
+    first->arity = 2;
+    first->left = identifier(temp->name, block->scope);
+    first->middle = NULL;
+    first->right = temp->original;
+    return temp;
+}
+
+Node *reuse(Block *block, Node *node, Expression *expr) {
+    if(expr->first == NULL) {
+        expr->first = node;
+        return node;
+    }
+    // Replacing the computation would also drop whatever it changes along the way
+    if(!worth_reusing(node) || has_side_effects(node)) return node;
+
+    // Prefer a variable the program already stored the value in. Either way the name is resolved
+    // from the scope the variable is declared in rather than from the node's.
+    for(int i = block->assigned->len - 1; i >= 0; i--) {
+        Node *holder = block->assigned->data[i];
+        if(variable_vn(block, holder) == expr->vn) {
+            release_temporaries(block, node);
+            return identifier(holder->name, holder->scope);
+        }
+    }
+
+    if(expr->temp == NULL) expr->temp = save_in_temporary(block, expr->first);
+    expr->temp->uses++;
+    release_temporaries(block, node);
+    return identifier(expr->temp->name, block->scope);
+}
+
+Node *number(Block *block, Node *node, int *vn);
+
+// Numbers a part of an expression that may not run (the arms of a ternary or short circuit).
+// Anything it computes can't be reused afterwards, and anything it assigns is no longer known.
+Node *number_conditionally(Block *block, Node *node) {
+    int expressions_before = block->expressions->len;
+    int assigned_before = block->assigned->len;
+    int *vns_before = malloc(sizeof(int) * (block->num_variables + 1));
+    memcpy(vns_before, block->variable_vns, sizeof(int) * block->num_variables);
+
+    int vn;
+    node = number(block, node, &vn);
+
+    for(int i = 0; i < block->num_variables; i++) {
+        if(block->variable_vns[i] != vns_before[i]) vns_before[i] = VALUE_NUMBERS++;
+    }
+    memcpy(block->variable_vns, vns_before, sizeof(int) * block->num_variables);
+    block->expressions->len = expressions_before;
+    block->assigned->len = assigned_before;
+    return node;
+}
+
+Node *number(Block *block, Node *node, int *vn) {
+    int left, right, id;
+    Expression *expr;
+
+    switch(node->ty) {
+        case ND_NUM:
+            *vn = find_expression(block, ND_NUM, 0, 0, node->val)->vn;
+            return node;
+        case ND_IDENT:
+            *vn = variable_vn(block, node);
+            return node;
+        case ND_INDEX:
+            node->middle = number(block, node->middle, &right);
+            expr = find_expression(block, ND_INDEX, variable_vn(block, node), right, 0);
+            *vn = expr->vn;
+            return reuse(block, node, expr);
+        case '=':
+            if(node->left->ty == ND_INDEX) {
+                node->left->middle = number(block, node->left->middle, &left);
+                node->right = number(block, node->right, vn);
+                id = get_variable_id(node->left->scope, node->left->name);
+                block->variable_vns[id] = VALUE_NUMBERS++;
+                if(variable_size(id) < 8) *vn = VALUE_NUMBERS++;
+                return node;
+            }
+            node->right = number(block, node->right, vn);
+            id = get_variable_id(node->left->scope, node->left->name);
+            // A narrower variable only keeps the low bytes of the value, which is another value
+            if(variable_size(id) < 8) *vn = VALUE_NUMBERS++;
+            block->variable_vns[id] = *vn;
+            vec_push(block->assigned, node->left);
+            return node;
+        case ND_PRE_INCREMENT:
+        case ND_PRE_DECREMENT:
+        case ND_POST_INCREMENT:
+        case ND_POST_DECREMENT:
+            id = get_variable_id(node->middle->scope, node->middle->name);
+            left = variable_vn(block, node->middle);
+            block->variable_vns[id] = VALUE_NUMBERS++;
+            *vn = (node->ty == ND_POST_INCREMENT || node->ty == ND_POST_DECREMENT) ? left : block->variable_vns[id];
+            return node;
+        case ND_TERNARY_CONDITIONAL:
+            // When the outcome is known, codegen may leave the condition out entirely
+            if(node->static_cond == COND_UNKNOWN) {
+                node->left = number(block, node->left, &left);
+            } else {
+                node->left = number_conditionally(block, node->left);
+            }
+            node->middle = number_conditionally(block, node->middle);
+            node->right = number_conditionally(block, node->right);
+            *vn = VALUE_NUMBERS++;
+            return node;
+        case ND_LAND:
+        case ND_LOR:
+            node->left = number(block, node->left, &left);
+            node->right = number_conditionally(block, node->right);
+            *vn = VALUE_NUMBERS++;
+            return node;
+        // A function can't see the caller's variables, so nothing known is lost across a call.
+        // What it returns is never taken to be the same as anything else.
+        case ND_CALL:
+            for(Node *argument = node->middle; argument != NULL; argument = argument->right) {
+                argument->left = number(block, argument->left, &left);
+            }
+            *vn = VALUE_NUMBERS++;
+            return node;
+        case ND_UNARY_NEG:
+        case ND_UNARY_POS:
+        case ND_UNARY_BIT_COMPLEMENT:
+        case ND_UNARY_BOOLEAN_NOT:
+            node->middle = number(block, node->middle, &left);
+            expr = find_expression(block, node->ty, left, -1, 0);
+            *vn = expr->vn;
+            return reuse(block, node, expr);
+        default:
+            node->left = number(block, node->left, &left);
+            node->right = number(block, node->right, &right);
+            expr = find_expression(block, node->ty, left, right, 0);
+            *vn = expr->vn;
+            return reuse(block, node, expr);
+    }
+}
+
+// Temporaries nobody ended up reading are put back the way they were, the rest get a stack slot
+void finish_block(Block *block) {
+    if(block == NULL) return;
+    for(int i = 0; i < block->temporaries->len; i++) {
+        Temporary *temp = block->temporaries->data[i];
+        if(temp->uses > 0) {
+            declare_variable(block->scope, temp->name);
+        } else {
+            memcpy(temp->wrapped, temp->original, sizeof(Node));
+        }
+    }
+}
+
+Node *number_in_block(Block **block, Node *node) {
+    if(*block == NULL) *block = new_block(node->scope);
+    int vn;
+    return number(*block, node, &vn);
+}
+
+void eliminate_in_statements(Vector *statements);
+
+Node *eliminate_in_statement(Node *node) {
+    Block *block = NULL;
+
+    switch(node->ty) {
+        case ND_SCOPE:
+            eliminate_in_statements(node->statements);
+            return node;
+        case ND_NOOP:
+        case ND_LABEL:
+        case ND_GOTO:
+        case ND_BREAK:
+        case ND_CONTINUE:
+        case ND_SWITCH:
+            return node;
+        case ND_IF:
+            node->middle = eliminate_in_statement(node->middle);
+            node->right = eliminate_in_statement(node->right);
+            return node;
+        case ND_WHILE:
+            node->right = eliminate_in_statement(node->right);
+            return node;
+        case ND_DO:
+            node->left = eliminate_in_statement(node->left);
+            return node;
+        case ND_FOR:
+            node->right = eliminate_in_statement(node->right);
+            node->extra = eliminate_in_statement(node->extra);
+            return node;
+        case ND_RETURN:
+            node->middle = number_in_block(&block, node->middle);
+            finish_block(block);
+            return node;
+        default:
+            node = number_in_block(&block, node);
+            finish_block(block);
+            return node;
+    }
+}
+
+// Splits a list of statements into straight-line runs, and numbers each one.
+// The condition of an if and the initializer of a for still belong to the run before them.
+void eliminate_in_statements(Vector *statements) {
+    Block *block = NULL;
+
+    for(int i = 0; i < statements->len; i++) {
+        Node *statement = statements->data[i];
+        if(statement->unreachable) continue;
+
+        switch(statement->ty) {
+            case ND_SCOPE:
+            case ND_NOOP:
+            case ND_LABEL:
+            case ND_GOTO:
+            case ND_BREAK:
+            case ND_CONTINUE:
+            case ND_SWITCH:
+            case ND_WHILE:
+            case ND_DO:
+                finish_block(block);
+                block = NULL;
+                statements->data[i] = eliminate_in_statement(statement);
+                break;
+            case ND_IF:
+                if(statement->static_cond == COND_UNKNOWN) statement->left = number_in_block(&block, statement->left);
+                finish_block(block);
+                block = NULL;
+                eliminate_in_statement(statement);
+                break;
+            case ND_FOR:
+                if(places_on_stack(statement->left->ty)) statement->left = number_in_block(&block, statement->left);
+                finish_block(block);
+                block = NULL;
+                eliminate_in_statement(statement);
+                break;
+            case ND_RETURN:
+                statement->middle = number_in_block(&block, statement->middle);
+                finish_block(block);
+                block = NULL;
+                break;
+            default:
+                statements->data[i] = number_in_block(&block, statement);
+                break;
+        }
+    }
+    finish_block(block);
+}
+
+void eliminate_common_subexpressions(Node *program) {
+    eliminate_in_statement(program);
+}
@@ -0,0 +1,297 @@
+#include "yacc.h"
+
+/**
+ ** Dead store elimination.
+ ** A backward liveness analysis finds, for every statement, the variables whose current value may
+ ** still be read later on. Loops are iterated until the variables live at their head stop changing,
+ ** and the whole program is analysed again for as long as the variables live at a label keep growing
+ ** (a goto sees whatever is live at its label). An assignment to a variable that is dead right after
+ ** it is dropped, leaving just the value it stored, and an expression statement that has no side
+ ** effects is dropped entirely. Increments, decrements and assignments nested inside a larger
+ ** expression are always kept. An array is one variable: reading any element of it keeps it live,
+ ** and storing to an element doesn't make it dead, since the other elements are still there.
+ ** The value of the last statement of the program is its exit code, so that statement is never
+ ** touched. A program that doesn't end with an expression statement is left alone. A function
+ ** hands back nothing but what it returns, so all of its statements are fair game.
+ **/
+
+typedef struct {
+    int words;              // Length of the bitsets, in longs
+    Map *label_live;        // Variables live at each label, by label name
+    bool labels_changed;
+    bool removed;           // Whether the last round removed anything
+    Vector *loops;          // Loops the statement being analysed is in
+    Vector *break_live;     // and what is live at the targets of their breaks
+    Vector *continue_live;  // and continues
+} Liveness;
+
+long *empty_set(Liveness *liveness) {
+    return calloc(liveness->words, sizeof(long));
+}
+
+long *copy_set(Liveness *liveness, long *set) {
+    long *copy = empty_set(liveness);
+    memcpy(copy, set, liveness->words * sizeof(long));
+    return copy;
+}
+
+// Adds everything in src to dst. Returns true if dst grew.
+bool union_into(Liveness *liveness, long *dst, long *src) {
+    bool changed = false;
+    for(int i = 0; i < liveness->words; i++) {
+        if(src[i] & ~dst[i]) changed = true;
+        dst[i] |= src[i];
+    }
+    return changed;
+}
+
+bool is_live(long *set, Node *ident) {
+    int id = variable_of(ident);
+    return (set[id / 64] >> (id % 64)) & 1;
+}
+
+void make_live(long *set, Node *ident) {
+    int id = variable_of(ident);
+    set[id / 64] |= 1L << (id % 64);
+}
+
+void make_dead(long *set, Node *ident) {
+    int id = variable_of(ident);
+    set[id / 64] &= ~(1L << (id % 64));
+}
+
+// Marks every variable the expression reads. The target of an assignment isn't read, but the
+// target of an increment is.
+void add_reads(long *set, Node *node) {
+    if(node == NULL) return;
+
+    switch(node->ty) {
+        case ND_IDENT:
+            make_live(set, node);
+            return;
+        case ND_INDEX:
+            make_live(set, node);
+            add_reads(set, node->middle);
+            return;
+        case '=':
+            if(node->left->ty == ND_INDEX) add_reads(set, node->left->middle);
+            add_reads(set, node->right);
+            return;
+        default:
+            add_reads(set, node->left);
+            add_reads(set, node->middle);
+            add_reads(set, node->right);
+    }
+}
+
+// Only the assignments at the top of an expression statement are sure to happen, and they happen
+// after everything the statement reads
+long *live_before_expression(Liveness *liveness, Node *node, long *after) {
+    long *live = copy_set(liveness, after);
+    for(Node *store = node; store->ty == '='; store = store->right) {
+        if(store->left->ty == ND_IDENT) make_dead(live, store->left);
+    }
+    add_reads(live, node);
+    return live;
+}
+
+long *live_before(Liveness *liveness, Node *node, long *after);
+
+long *live_before_loop_body(Liveness *liveness, Node *loop, Node *body, long *after, long *at_continue) {
+    vec_push(liveness->loops, loop);
+    vec_push(liveness->break_live, after);
+    vec_push(liveness->continue_live, at_continue);
+    long *live = live_before(liveness, body, at_continue);
+    liveness->loops->len--;
+    liveness->break_live->len--;
+    liveness->continue_live->len--;
+    return live;
+}
+
+long *jump_target_live(Liveness *liveness, Node *node, long *after) {
+    for(int i = liveness->loops->len - 1; i >= 0; i--) {
+        if(liveness->loops->data[i] != node->jump_target) continue;
+        return copy_set(liveness, (node->ty == ND_BREAK ? liveness->break_live : liveness->continue_live)->data[i]);
+    }
+    // Codegen ignores a break or continue outside of a loop
+    return copy_set(liveness, after);
+}
+
+// Where the condition of a loop is tested, what it reads is live, and so is whatever is live once
+// the loop exits. The loops below add what is live at the start of another iteration.
+long *live_at_test(Liveness *liveness, Node *cond, long *after) {
+    long *live = copy_set(liveness, after);
+    add_reads(live, cond);
+    return live;
+}
+
+long *live_before(Liveness *liveness, Node *node, long *after) {
+    // Sets only grow as the analysis iterates, so the last one recorded is the largest
+    if(node->live_after == NULL) node->live_after = empty_set(liveness);
+    union_into(liveness, node->live_after, after);
+
+    long *live, *test, *body, *iteration;
+    switch(node->ty) {
+        case ND_SCOPE:
+            live = after;
+            for(int i = node->statements->len - 1; i >= 0; i--) {
+                live = live_before(liveness, node->statements->data[i], live);
+            }
+            return live;
+        case ND_NOOP:
+            return after;
+        case ND_LABEL:
+            live = map_get(liveness->label_live, node->middle->name);
+            if(live == NULL) {
+                live = empty_set(liveness);
+                map_put(liveness->label_live, node->middle->name, live);
+            }
+            if(union_into(liveness, live, after)) liveness->labels_changed = true;
+            return after;
+        case ND_GOTO:
+            live = map_get(liveness->label_live, node->middle->name);
+            return live ? copy_set(liveness, live) : empty_set(liveness);
+        case ND_SWITCH:
+            // Whatever is live at any of the labels it may go to
+            live = empty_set(liveness);
+            for(int i = 0; i <= node->statements->len; i++) {
+                Node *label = i < node->statements->len ? node->statements->data[i] : node->jump_target;
+                long *at_label = map_get(liveness->label_live, label->middle->name);
+                if(at_label) union_into(liveness, live, at_label);
+            }
+            return live_before_expression(liveness, node->middle, live);
+        case ND_BREAK:
+        case ND_CONTINUE:
+            return jump_target_live(liveness, node, after);
+        case ND_RETURN:
+            return live_before_expression(liveness, node->middle, empty_set(liveness));
+        case ND_IF:
+            live = copy_set(liveness, live_before(liveness, node->middle, after));
+            union_into(liveness, live, live_before(liveness, node->right, after));
+            add_reads(live, node->left);
+            return live;
+        case ND_WHILE:
+            test = live_at_test(liveness, node->left, after);
+            do {
+                body = live_before_loop_body(liveness, node, node->right, after, test);
+            } while(union_into(liveness, test, body));
+            return test;
+        case ND_DO:
+            test = live_at_test(liveness, node->right, after);
+            do {
+                body = live_before_loop_body(liveness, node, node->left, after, test);
+            } while(union_into(liveness, test, body));
+            return body;
+        case ND_FOR:
+            test = live_at_test(liveness, node->middle, after);
+            do {
+                iteration = live_before(liveness, node->right, test);
+                body = live_before_loop_body(liveness, node, node->extra, after, iteration);
+            } while(union_into(liveness, test, body));
+            return live_before(liveness, node->left, test);
+        default:
+            return live_before_expression(liveness, node, after);
+    }
+}
+
+// Strips the stores nobody reads from an expression statement. Returns NULL if nothing is left.
+Node *without_dead_stores(Node *node, long *after) {
+    while(node->ty == '=' && !is_live(after, node->left)) {
+        // The index of an element is worked out even if nothing reads the array
+        if(node->left->ty == ND_INDEX && has_side_effects(node->left->middle)) break;
+        node = node->right;
+    }
+
+    switch(node->ty) {
+        case ND_PRE_INCREMENT:
+        case ND_PRE_DECREMENT:
+        case ND_POST_INCREMENT:
+        case ND_POST_DECREMENT:
+            return is_live(after, node->middle) ? node : NULL;
+        default:
+            return has_side_effects(node) ? node : NULL;
+    }
+}
+
+// Removes what the analysis found to be dead, and forgets its results so it can run again
+Node *remove_dead_stores(Liveness *liveness, Node *node, Node *result) {
+    if(node == NULL) return NULL;
+    long *after = node->live_after;
+    node->live_after = NULL;
+    if(node == result) return node;
+
+    switch(node->ty) {
+        case ND_SCOPE:
+            for(int i = 0; i < node->statements->len; i++) {
+                node->statements->data[i] = remove_dead_stores(liveness, node->statements->data[i], result);
+            }
+            return node;
+        case ND_NOOP:
+        case ND_LABEL:
+        case ND_GOTO:
+        case ND_BREAK:
+        case ND_CONTINUE:
+        case ND_SWITCH:
+        case ND_RETURN:
+            return node;
+        case ND_IF:
+            node->middle = remove_dead_stores(liveness, node->middle, result);
+            node->right = remove_dead_stores(liveness, node->right, result);
+            return node;
+        case ND_WHILE:
+            node->right = remove_dead_stores(liveness, node->right, result);
+            return node;
+        case ND_DO:
+            node->left = remove_dead_stores(liveness, node->left, result);
+            return node;
+        case ND_FOR:
+            node->left = remove_dead_stores(liveness, node->left, result);
+            node->middle->live_after = NULL;
+            node->right = remove_dead_stores(liveness, node->right, result);
+            node->extra = remove_dead_stores(liveness, node->extra, result);
+            return node;
+        default:
+            break;
+    }
+
+    Node *kept = without_dead_stores(node, after);
+    if(kept == node) return node;
+    liveness->removed = true;
+    if(kept == NULL) {
+        kept = nullary_operation_node(ND_NOOP);
+        kept->scope = node->scope;
+    }
+    return kept;
+}
+
+// The statement whose value ends up in rax when the program exits
+Node *result_statement(Node *program) {
+    Node *node = program;
+    while(node->ty == ND_SCOPE) {
+        if(node->statements->len == 0) return NULL;
+        node = node->statements->data[node->statements->len - 1];
+    }
+    return places_on_stack(node->ty) ? node : NULL;
+}
+
+// Removing a store can make what it stored dead in turn, so this goes on until nothing changes
+void eliminate_dead_stores(Node *program, bool is_function) {
+    Node *result = is_function ? NULL : result_statement(program);
+    if(result == NULL && !is_function) return;
+
+    Liveness liveness;
+    liveness.words = variable_count() / 64 + 1;
+    liveness.loops = new_vector();
+    liveness.break_live = new_vector();
+    liveness.continue_live = new_vector();
+    do {
+        liveness.label_live = new_map(NULL);
+        do {
+            liveness.labels_changed = false;
+            live_before(&liveness, program, empty_set(&liveness));
+        } while(liveness.labels_changed);
+
+        liveness.removed = false;
+        remove_dead_stores(&liveness, program, result);
+    } while(liveness.removed);
+}
@@ -0,0 +1,137 @@
+#include "yacc.h"
+#include <elf.h>
+#include <sys/stat.h>
+
+/**
+ ** ELF output for the built-in assembler.
+ ** -c writes a relocatable object that defines main, to be linked like the output of any other
+ ** compiler. -o writes a static executable that needs nothing else: a _start stub calls main and
+ ** hands what it returns to the exit system call. The code never refers to anything outside of
+ ** itself, so neither needs relocations.
+ **/
+
+#define LOAD_ADDRESS 0x400000
+
+// _start: call main; mov edi, eax; mov eax, 60 (exit); syscall. main follows, 16-byte aligned.
+unsigned char START_STUB[] = {0xe8, 0, 0, 0, 0, 0x89, 0xc7, 0xb8, 60, 0, 0, 0, 0x0f, 0x05};
+
+int align_to(int offset, int alignment) {
+    return (offset + alignment - 1) / alignment * alignment;
+}
+
+void pad_to(Bytes *out, int offset) {
+    while(out->len < offset) bytes_push(out, 0);
+}
+
+void append(Bytes *out, void *data, int len) {
+    for(int i = 0; i < len; i++) bytes_push(out, ((unsigned char *)data)[i]);
+}
+
+void write_file(char *filename, Bytes *contents, int mode) {
+    FILE *file = fopen(filename, "wb");
+    if(file == NULL || fwrite(contents->data, 1, contents->len, file) != (size_t)contents->len) {
+        fprintf(stderr, "Could not write %s\n", filename);
+        exit(EXTERNAL_ERROR);
+    }
+    fclose(file);
+    chmod(filename, mode);
+}
+
+void init_header(Elf64_Ehdr *header, int type) {
+    memset(header, 0, sizeof(Elf64_Ehdr));
+    memcpy(header->e_ident, ELFMAG, SELFMAG);
+    header->e_ident[EI_CLASS] = ELFCLASS64;
+    header->e_ident[EI_DATA] = ELFDATA2LSB;
+    header->e_ident[EI_VERSION] = EV_CURRENT;
+    header->e_ident[EI_OSABI] = ELFOSABI_SYSV;
+    header->e_type = type;
+    header->e_machine = EM_X86_64;
+    header->e_version = EV_CURRENT;
+    header->e_ehsize = sizeof(Elf64_Ehdr);
+}
+
+// Sections of the object, in order: the null section, .text, .symtab, .strtab, .shstrtab, and an
+// empty .note.GNU-stack so the linker doesn't make the stack executable
+void write_object(char *filename, Bytes *code) {
+    char strtab[] = "\0main";
+    char shstrtab[] = "\0.text\0.symtab\0.strtab\0.shstrtab\0.note.GNU-stack";
+    Elf64_Sym symbols[2];
+    memset(symbols, 0, sizeof(symbols));
+    symbols[1].st_name = 1;
+    symbols[1].st_info = ELF64_ST_INFO(STB_GLOBAL, STT_FUNC);
+    symbols[1].st_shndx = 1;
+    symbols[1].st_size = code->len;
+
+    Bytes *out = new_bytes();
+    Elf64_Ehdr header;
+    init_header(&header, ET_REL);
+    append(out, &header, sizeof(header));
+
+    Elf64_Shdr sections[6];
+    memset(sections, 0, sizeof(sections));
+    int names[] = {0, 1, 7, 15, 23, 33};
+    void *contents[] = {NULL, code->data, symbols, strtab, shstrtab, NULL};
+    int sizes[] = {0, code->len, sizeof(symbols), sizeof(strtab), sizeof(shstrtab), 0};
+    int types[] = {SHT_NULL, SHT_PROGBITS, SHT_SYMTAB, SHT_STRTAB, SHT_STRTAB, SHT_PROGBITS};
+    int alignments[] = {0, 16, 8, 1, 1, 1};
+    for(int i = 1; i < 6; i++) {
+        pad_to(out, align_to(out->len, alignments[i]));
+        sections[i].sh_name = names[i];
+        sections[i].sh_type = types[i];
+        sections[i].sh_offset = out->len;
+        sections[i].sh_size = sizes[i];
+        sections[i].sh_addralign = alignments[i];
+        append(out, contents[i], sizes[i]);
+    }
+    sections[1].sh_flags = SHF_ALLOC | SHF_EXECINSTR;
+    sections[2].sh_link = 3;        // Names of the symbols are in .strtab
+    sections[2].sh_info = 1;        // and every one after the null symbol is global
+    sections[2].sh_entsize = sizeof(Elf64_Sym);
+
+    pad_to(out, align_to(out->len, 8));
+    int section_headers = out->len;
+    append(out, sections, sizeof(sections));
+    Elf64_Ehdr *final_header = (Elf64_Ehdr *)out->data;
+    final_header->e_shoff = section_headers;
+    final_header->e_shentsize = sizeof(Elf64_Shdr);
+    final_header->e_shnum = 6;
+    final_header->e_shstrndx = 4;
+    write_file(filename, out, 0644);
+}
+
+// The whole file is loaded as a single read-only, executable segment, and a second program header
+// asks for a stack that isn't executable
+void write_executable(char *filename, Bytes *code) {
+    Bytes *out = new_bytes();
+    Elf64_Ehdr header;
+    init_header(&header, ET_EXEC);
+    int start = sizeof(Elf64_Ehdr) + 2 * sizeof(Elf64_Phdr);
+    int main_offset = align_to(start + sizeof(START_STUB), 16);
+    header.e_entry = LOAD_ADDRESS + start;
+    header.e_phoff = sizeof(Elf64_Ehdr);
+    header.e_phentsize = sizeof(Elf64_Phdr);
+    header.e_phnum = 2;
+    append(out, &header, sizeof(header));
+
+    Elf64_Phdr segments[2];
+    memset(segments, 0, sizeof(segments));
+    segments[0].p_type = PT_LOAD;
+    segments[0].p_flags = PF_R | PF_X;
+    segments[0].p_vaddr = segments[0].p_paddr = LOAD_ADDRESS;
+    segments[0].p_filesz = segments[0].p_memsz = main_offset + code->len;
+    segments[0].p_align = 0x1000;
+    segments[1].p_type = PT_GNU_STACK;
+    segments[1].p_flags = PF_R | PF_W;
+    segments[1].p_align = 16;
+    append(out, segments, sizeof(segments));
+
+    int call_end = start + 5;
+    unsigned char stub[sizeof(START_STUB)];
+    memcpy(stub, START_STUB, sizeof(stub));
+    int displacement = main_offset - call_end;
+    memcpy(stub + 1, &displacement, 4);
+    append(out, stub, sizeof(stub));
+    pad_to(out, main_offset);
+    append(out, code->data, code->len);
+    write_file(filename, out, 0755);
+}
@@ -0,0 +1,376 @@
+#include "yacc.h"
+
+/**
+ ** Compile-time evaluation (-Oeval).
+ ** A program takes no input, so running its tree at compile time gives the value it exits with,
+ ** and the whole program can be replaced by that value. The evaluator follows the semantics of the
+ ** generated code: wrapping 64-bit arithmetic, unsigned division and shifts, signed comparisons,
+ ** and gotos that may land anywhere in a scope that encloses them, including inside the body of a
+ ** loop or an if. A goto unwinds to the scope that declares its label, and the statements of that
+ ** scope are then skipped until the label is found.
+ ** It gives up whenever the outcome depends on something other than the program: reading a
+ ** variable that hasn't been assigned since its scope was entered (the stack holds whatever was
+ ** left there), dividing by zero, a goto codegen would reject, or a program whose last statement
+ ** isn't an expression or a return. It also gives up after a number of steps set by
+ ** -feval-steps=N, so a long-running program just gets compiled as usual, when calls nest
+ ** deeper than it is willing to follow, and when the variables of the calls being run would take
+ ** more than -feval-memory=N slots, or more memory than it can get.
+ ** A call runs the function with variables of its own, since a function can't see the caller's.
+ ** The elements of an array are variables of their own as well, kept after all the others, and
+ ** reading or writing one outside of the array gives up.
+ **/
+
+bool EVALUATE_PROGRAM = false;
+long EVAL_STEP_BUDGET = 10000000;
+long EVAL_MEMORY_BUDGET = 1 << 22;  // Variables, array elements included, held across all frames
+
+#define MAX_EVAL_CALL_DEPTH 1000
+
+int *ELEMENT_SLOTS;     // Where the elements of each array start in Evaluation.vars
+int EVAL_SLOTS;         // How many values Evaluation.vars holds
+
+enum {
+    RUN_NORMAL = 0,     // Went on past the statement
+    RUN_BREAK,          // Left through a break, toward the loop in Evaluation.loop
+    RUN_CONTINUE,       // Left through a continue, toward the same
+    RUN_GOTO,           // Left through a goto, toward the label in Evaluation.label
+    RUN_RETURN,         // Left through a return, with the value in Evaluation.returned
+    RUN_FAILED,         // Can't be evaluated at compile time
+};
+
+typedef struct {
+    long *vars;
+    bool *assigned;         // Whether each variable was assigned since its scope was entered
+    long steps;
+    long last_value;        // Value of the last expression statement, which is what rax holds
+    Node *loop;             // Loop a pending break or continue belongs to
+    char *label;            // Label a pending goto is headed to
+    char *seeking;          // Label execution resumes at. Statements are skipped until it's found.
+    long returned;          // Value of a pending return
+    int depth;              // Calls being run
+    long slots;             // Variables held by the program and the calls being run
+} Evaluation;
+
+bool declares_label(Scope *scope, char *label) {
+    for(int i = 0; i < scope->labels_declared->len; i++) {
+        if(strcmp(scope->labels_declared->data[i], label) == 0) return true;
+    }
+    return false;
+}
+
+void lay_out_elements() {
+    ELEMENT_SLOTS = malloc(sizeof(int) * (variable_count() + 1));
+    EVAL_SLOTS = variable_count();
+    for(int id = 0; id < variable_count(); id++) {
+        ELEMENT_SLOTS[id] = EVAL_SLOTS;
+        EVAL_SLOTS += variable_length(id);
+    }
+}
+
+// Returns the value the slot holds afterwards, which for a narrower one is the low bytes of it
+long store_slot(Evaluation *ev, long slot, int size, long value) {
+    ev->vars[slot] = truncate_to_size(value, size);
+    ev->assigned[slot] = true;
+    return ev->vars[slot];
+}
+
+long store_variable(Evaluation *ev, Node *ident, long value) {
+    int id = variable_of(ident);
+    return store_slot(ev, id, variable_size(id), value);
+}
+
+bool run_value(Evaluation *ev, Node *node, long *value);
+
+// Works out the index of an element. Returns false if it can't, or if it is out of bounds.
+bool element_slot(Evaluation *ev, Node *element, long *slot) {
+    long index;
+    if(!run_value(ev, element->middle, &index)) return false;
+    int id = variable_of(element);
+    if((unsigned long)index >= (unsigned long)variable_length(id)) return false;
+    *slot = ELEMENT_SLOTS[id] + index;
+    return true;
+}
+
+bool run_call(Evaluation *ev, Node *call, long *value);
+
+// Computes the value of an expression. Returns false if it can't be computed.
+bool run_value(Evaluation *ev, Node *node, long *value) {
+    long left, right, slot;
+    int id;
+    if(++ev->steps > EVAL_STEP_BUDGET) return false;
+
+    switch(node->ty) {
+        case ND_NUM:
+            *value = node->val;
+            return true;
+        case ND_IDENT:
+            id = variable_of(node);
+            *value = ev->vars[id];
+            return ev->assigned[id];
+        case ND_INDEX:
+            if(!element_slot(ev, node, &slot)) return false;
+            *value = ev->vars[slot];
+            return ev->assigned[slot];
+        case '=':
+            // The index of an element is worked out before the value stored in it
+            if(node->left->ty == ND_INDEX) {
+                if(!element_slot(ev, node->left, &slot) || !run_value(ev, node->right, value)) return false;
+                *value = store_slot(ev, slot, variable_size(variable_of(node->left)), *value);
+                return true;
+            }
+            if(!run_value(ev, node->right, value)) return false;
+            *value = store_variable(ev, node->left, *value);
+            return true;
+        case ND_PRE_INCREMENT:
+        case ND_PRE_DECREMENT:
+        case ND_POST_INCREMENT:
+        case ND_POST_DECREMENT:
+            if(!run_value(ev, node->middle, &left)) return false;
+            right = (unsigned long)left + (node->ty == ND_PRE_INCREMENT || node->ty == ND_POST_INCREMENT ? 1 : -1);
+            right = store_variable(ev, node->middle, right);
+            *value = node->ty == ND_PRE_INCREMENT || node->ty == ND_PRE_DECREMENT ? right : left;
+            return true;
+        case ND_LAND:
+        case ND_LOR:
+            if(!run_value(ev, node->left, &left)) return false;
+            // The right side only runs when the left one doesn't decide
+            if((left != 0) == (node->ty == ND_LOR)) {
+                *value = node->ty == ND_LOR;
+                return true;
+            }
+            if(!run_value(ev, node->right, &right)) return false;
+            *value = right != 0;
+            return true;
+        case ND_TERNARY_CONDITIONAL:
+            if(!run_value(ev, node->left, &left)) return false;
+            return run_value(ev, left ? node->middle : node->right, value);
+        case ND_CALL:
+            return run_call(ev, node, value);
+        default:
+            break;
+    }
+
+    if(node->arity == 1) {
+        return run_value(ev, node->middle, &left) && fold_unary(node->ty, left, value);
+    }
+    // Division by zero traps, which fold_binary refuses to compute
+    return node->arity == 2 && run_value(ev, node->left, &left) && run_value(ev, node->right, &right) && fold_binary(node->ty, left, right, value);
+}
+
+// A missing condition, as in for(;;), always holds
+bool run_condition(Evaluation *ev, Node *cond, bool *holds) {
+    long value = 1;
+    if(places_on_stack(cond->ty) && !run_value(ev, cond, &value)) return false;
+    *holds = value != 0;
+    return true;
+}
+
+int run_statement(Evaluation *ev, Node *node);
+
+// Runs the iterations of a loop. When a label in its body is being looked for, the loop is entered
+// partway through an iteration, and skipped altogether if the label isn't in there.
+int run_loop(Evaluation *ev, Node *loop, Node *cond, Node *body, Node *step, bool test_first) {
+    bool resuming = ev->seeking != NULL;
+    bool holds;
+
+    while(true) {
+        if(test_first && !resuming) {
+            if(!run_condition(ev, cond, &holds)) return RUN_FAILED;
+            if(!holds) return RUN_NORMAL;
+        }
+        int result = run_statement(ev, body);
+        if(ev->seeking) return RUN_NORMAL;
+        resuming = false;
+
+        if(result == RUN_BREAK && ev->loop == loop) return RUN_NORMAL;
+        if(result != RUN_NORMAL && !(result == RUN_CONTINUE && ev->loop == loop)) return result;
+        if(step) {
+            result = run_statement(ev, step);
+            if(result != RUN_NORMAL) return result;
+        }
+        if(!test_first) {
+            if(!run_condition(ev, cond, &holds)) return RUN_FAILED;
+            if(!holds) return RUN_NORMAL;
+        }
+    }
+}
+
+int run_statements(Evaluation *ev, Node *node) {
+    for(int i = 0; i < node->statements->len; i++) {
+        int result = run_statement(ev, node->statements->data[i]);
+        // A goto to one of our labels starts over from the top of the scope, looking for the label
+        if(result == RUN_GOTO && node->descend && declares_label(node->scope, ev->label)) {
+            ev->seeking = ev->label;
+            i = -1;
+            continue;
+        }
+        if(result != RUN_NORMAL) return result;
+    }
+    return RUN_NORMAL;
+}
+
+int run_scope(Evaluation *ev, Node *node) {
+    // Each time a scope is entered, its variables start out as whatever is on the stack
+    if(node->descend && ev->seeking == NULL) {
+        for(int i = 0; i < node->scope->variable_ids->vals->len; i++) {
+            int id = (long)node->scope->variable_ids->vals->data[i];
+            ev->assigned[id] = false;
+            for(int j = 0; j < variable_length(id); j++) ev->assigned[ELEMENT_SLOTS[id] + j] = false;
+        }
+    }
+    return run_statements(ev, node);
+}
+
+// Runs a function with variables of its own, which start out as just the parameters. Running off
+// the end returns 0, and a goto can't leave it.
+bool run_call(Evaluation *ev, Node *call, long *value) {
+    Node *function = find_function(call->name);
+    long *arguments = malloc(sizeof(long) * (call->val + 1));
+    int count = 0;
+    for(Node *argument = call->middle; argument != NULL; argument = argument->right) {
+        if(!run_value(ev, argument->left, &arguments[count++])) {
+            free(arguments);
+            return false;
+        }
+    }
+    long *vars = NULL;
+    bool *assigned = NULL;
+    if(ev->depth < MAX_EVAL_CALL_DEPTH && ev->slots + EVAL_SLOTS <= EVAL_MEMORY_BUDGET) {
+        vars = calloc(EVAL_SLOTS, sizeof(long));
+        assigned = calloc(EVAL_SLOTS, sizeof(bool));
+    }
+    if(vars == NULL || assigned == NULL) {
+        free(vars);
+        free(assigned);
+        free(arguments);
+        return false;
+    }
+
+    long *caller_vars = ev->vars;
+    bool *caller_assigned = ev->assigned;
+    ev->vars = vars;
+    ev->assigned = assigned;
+    for(int i = 0; i < count; i++) store_variable(ev, function->statements->data[i], arguments[i]);
+    ev->depth++;
+    ev->slots += EVAL_SLOTS;
+    int outcome = run_statements(ev, function->middle);
+    ev->slots -= EVAL_SLOTS;
+    ev->depth--;
+    free(ev->vars);
+    free(ev->assigned);
+    free(arguments);
+    ev->vars = caller_vars;
+    ev->assigned = caller_assigned;
+
+    if(outcome == RUN_RETURN) {
+        *value = ev->returned;
+        return true;
+    }
+    *value = 0;
+    return outcome == RUN_NORMAL;
+}
+
+// Skips a statement while looking for a label. Once the label is found, whatever follows it in
+// the statement runs as usual.
+int seek_label(Evaluation *ev, Node *node) {
+    int result;
+
+    switch(node->ty) {
+        case ND_LABEL:
+            if(strcmp(node->middle->name, ev->seeking) == 0) ev->seeking = NULL;
+            return RUN_NORMAL;
+        case ND_SCOPE:
+            // The labels of a scope that opens a frame can only be reached from inside of it
+            return node->descend ? RUN_NORMAL : run_scope(ev, node);
+        case ND_IF:
+            result = run_statement(ev, node->middle);
+            if(ev->seeking == NULL) return result;
+            return run_statement(ev, node->right);
+        case ND_WHILE:
+            return run_loop(ev, node, node->left, node->right, NULL, true);
+        case ND_DO:
+            return run_loop(ev, node, node->right, node->left, NULL, false);
+        case ND_FOR:
+            return run_loop(ev, node, node->middle, node->extra, node->right, true);
+        default:
+            return RUN_NORMAL;
+    }
+}
+
+int run_statement(Evaluation *ev, Node *node) {
+    long cond;
+    int result;
+
+    if(node == NULL) return RUN_NORMAL;
+    if(++ev->steps > EVAL_STEP_BUDGET) return RUN_FAILED;
+    if(ev->seeking) return seek_label(ev, node);
+
+    switch(node->ty) {
+        case ND_SCOPE:
+            return run_scope(ev, node);
+        case ND_NOOP:
+        case ND_LABEL:
+            return RUN_NORMAL;
+        case ND_GOTO:
+            ev->label = node->middle->name;
+            return RUN_GOTO;
+        case ND_RETURN:
+            return run_value(ev, node->middle, &ev->returned) ? RUN_RETURN : RUN_FAILED;
+        case ND_SWITCH:
+            // Its labels are in the scope it starts, which then looks for the one it goes to
+            if(!run_value(ev, node->middle, &cond)) return RUN_FAILED;
+            ev->label = matching_case(node, cond)->middle->name;
+            return RUN_GOTO;
+        case ND_BREAK:
+        case ND_CONTINUE:
+            // Codegen ignores a break or continue outside of a loop
+            if(node->jump_target == NULL) return RUN_NORMAL;
+            ev->loop = node->jump_target;
+            return node->ty == ND_BREAK ? RUN_BREAK : RUN_CONTINUE;
+        case ND_IF:
+            if(!run_value(ev, node->left, &cond)) return RUN_FAILED;
+            return run_statement(ev, cond ? node->middle : node->right);
+        case ND_WHILE:
+            return run_loop(ev, node, node->left, node->right, NULL, true);
+        case ND_DO:
+            return run_loop(ev, node, node->right, node->left, NULL, false);
+        case ND_FOR:
+            result = run_statement(ev, node->left);
+            if(result != RUN_NORMAL) return result;
+            return run_loop(ev, node, node->middle, node->extra, node->right, true);
+        default:
+            return run_value(ev, node, &ev->last_value) ? RUN_NORMAL : RUN_FAILED;
+    }
+}
+
+// Runs the whole program. Returns false if the value it exits with can't be known at compile time.
+bool evaluate_program(Node *program, long *result) {
+    // The program has to end with an expression or a return for rax to hold a known value
+    Node *last = program->statements->len > 0 ? program->statements->data[program->statements->len - 1] : NULL;
+    if(result_statement(program) == NULL && (last == NULL || last->ty != ND_RETURN)) return false;
+
+    lay_out_elements();
+    if(EVAL_SLOTS > EVAL_MEMORY_BUDGET) return false;
+    Evaluation ev = { calloc(EVAL_SLOTS, sizeof(long)), calloc(EVAL_SLOTS, sizeof(bool)), 0, 0, NULL, NULL, NULL, 0, 0, EVAL_SLOTS };
+    if(ev.vars == NULL || ev.assigned == NULL) {
+        free(ev.vars);
+        free(ev.assigned);
+        return false;
+    }
+    int outcome = run_statement(&ev, program);
+    // The global scope doesn't open a frame of its own, so its labels are looked for from here
+    while(outcome == RUN_GOTO && declares_label(program->scope, ev.label)) {
+        ev.seeking = ev.label;
+        outcome = run_statement(&ev, program);
+    }
+    free(ev.vars);
+    free(ev.assigned);
+
+    if(outcome == RUN_RETURN) {
+        *result = ev.returned;
+        return true;
+    }
+    if(outcome != RUN_NORMAL || ev.seeking || result_statement(program) == NULL) return false;
+    *result = ev.last_value;
+    return true;
+}
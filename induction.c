@@ -0,0 +1,593 @@
+#include "yacc.h"
+
+/**
+ ** Induction variables.
+ ** A basic induction variable is changed by its loop in exactly one place, by a constant step:
+ ** `i++`, `i--` or `i = i + c`. Comparing it against a bound the loop doesn't change gives the trip
+ ** count of the loop as an expression that can be evaluated before the loop starts. When all the
+ ** loop does besides stepping the induction variable is add affine functions of it to accumulators
+ ** (`s = s + k`, `s = s + 2 * i + k`, `n++`), the loop is replaced by its closed form: the trip
+ ** count, the sums it would have added up, and the final value of the induction variable.
+ ** Loops that have to stay get their derived induction variables (multiples of a basic one, like
+ ** `i * 12`) strength-reduced into a temporary that is stepped right along with it.
+ **/
+
+typedef struct {
+    Scope *scope;       // Scope of the statements the loop is one of
+    int *writes;        // How many places in the loop write to each variable, indexed by variable id
+    int num_variables;
+    bool has_labels;
+    bool has_jumps;     // Whether the loop contains a break, continue or goto
+    bool has_continues;
+} InductionLoop;
+
+// An expression split into c1 * self + c2 * iv + rest, where the loop doesn't change rest
+typedef struct {
+    long self;
+    long iv;
+    Node *rest;         // NULL when it's 0
+} Linear;
+
+int INDUCTION_TEMPORARIES = 0;
+
+int id_of(Node *ident) {
+    return get_variable_id(ident->scope, ident->name);
+}
+
+int writes_to(InductionLoop *loop, Node *ident) {
+    int id = id_of(ident);
+    return id < loop->num_variables ? loop->writes[id] : 0;
+}
+
+void count_writes(InductionLoop *loop, Node *node) {
+    if(node == NULL) return;
+
+    switch(node->ty) {
+        case ND_LABEL:
+            loop->has_labels = true;
+            return;
+        case ND_CONTINUE:
+            loop->has_continues = true;
+            // Fall through
+        case ND_GOTO:
+        case ND_BREAK:
+            loop->has_jumps = true;
+            return;
+        case ND_SWITCH:
+        case ND_RETURN:
+            loop->has_jumps = true;
+            count_writes(loop, node->middle);
+            return;
+        case '=':
+            loop->writes[id_of(node->left)]++;
+            count_writes(loop, node->left->middle);
+            count_writes(loop, node->right);
+            return;
+        case ND_PRE_INCREMENT:
+        case ND_PRE_DECREMENT:
+        case ND_POST_INCREMENT:
+        case ND_POST_DECREMENT:
+            loop->writes[id_of(node->middle)]++;
+            return;
+        case ND_SCOPE:
+            for(int i = 0; i < node->statements->len; i++) count_writes(loop, node->statements->data[i]);
+            return;
+        default:
+            count_writes(loop, node->left);
+            count_writes(loop, node->middle);
+            count_writes(loop, node->right);
+            count_writes(loop, node->extra);
+            return;
+    }
+}
+
+// Counts the writes of everything that runs on each iteration. The initializer of a for loop doesn't.
+InductionLoop *summarize_loop(Node *node, Scope *scope) {
+    InductionLoop *loop = calloc(1, sizeof(InductionLoop));
+    loop->scope = scope;
+    loop->num_variables = variable_count();
+    loop->writes = calloc(loop->num_variables + 1, sizeof(int));
+    if(node->ty == ND_FOR) {
+        count_writes(loop, node->middle);
+        count_writes(loop, node->right);
+        count_writes(loop, node->extra);
+    } else {
+        count_writes(loop, node->left);
+        count_writes(loop, node->right);
+    }
+    return loop;
+}
+
+// A variable declared inside the loop would be a different one on each iteration
+bool visible_outside(InductionLoop *loop, Node *ident) {
+    return variable_already_declared(loop->scope, ident->name) && get_variable_id(loop->scope, ident->name) == id_of(ident);
+}
+
+// An element of an array is unchanged when nothing in the loop stores to the array
+bool unchanged_by_loop(InductionLoop *loop, Node *node) {
+    if(node == NULL) return true;
+    if(node->ty == ND_IDENT) return writes_to(loop, node) == 0 && visible_outside(loop, node);
+    if(node->ty == ND_INDEX && (writes_to(loop, node) > 0 || !visible_outside(loop, node))) return false;
+    return unchanged_by_loop(loop, node->left) && unchanged_by_loop(loop, node->middle) && unchanged_by_loop(loop, node->right);
+}
+
+bool is_loop_invariant(InductionLoop *loop, Node *node) {
+    return !has_side_effects(node) && unchanged_by_loop(loop, node);
+}
+
+bool fits_in_immediate_value(long val) {
+    return val >= -2147483648L && val <= 2147483647L;
+}
+
+// Matches i++, i--, ++i, --i, i = i + c, i = c + i and i = i - c, for an i that is a long. A
+// narrower variable wraps around at its own size, which the values derived from it wouldn't.
+bool constant_step(Node *statement, Node **var, long *step) {
+    switch(statement->ty) {
+        case ND_PRE_INCREMENT:
+        case ND_POST_INCREMENT:
+            *var = statement->middle;
+            *step = 1;
+            return variable_size(id_of(*var)) == 8;
+        case ND_PRE_DECREMENT:
+        case ND_POST_DECREMENT:
+            *var = statement->middle;
+            *step = -1;
+            return variable_size(id_of(*var)) == 8;
+        case '=':
+            break;
+        default:
+            return false;
+    }
+
+    Node *value = statement->right;
+    if(value->ty != '+' && value->ty != '-') return false;
+    Node *same = value->left, *constant = value->right;
+    if(value->ty == '+' && same->ty == ND_NUM) {
+        same = value->right;
+        constant = value->left;
+    }
+    if(constant->ty != ND_NUM || same->ty != ND_IDENT || statement->left->ty != ND_IDENT || id_of(same) != id_of(statement->left)) return false;
+
+    *var = statement->left;
+    *step = value->ty == '+' ? constant->val : -(long)constant->val;
+    return *step != 0 && variable_size(id_of(*var)) == 8;
+}
+
+Node *in_scope(Node *node, Scope *scope) {
+    node->scope = scope;
+    return node;
+}
+
+Node *literal(long val, Scope *scope) {
+    return in_scope(new_numeric_node(val), scope);
+}
+
+Node *operation(int op, Node *left, Node *right, Scope *scope) {
+    return in_scope(binary_operation_node(op, left, right), scope);
+}
+
+// Adds two parts of an expression, where NULL stands for 0
+Node *add_parts(Node *left, Node *right, int op, Scope *scope) {
+    if(right == NULL) return left;
+    if(left == NULL) return op == '+' ? right : in_scope(unary_operation_node(ND_UNARY_NEG, right), scope);
+    return operation(op, left, right, scope);
+}
+
+bool linear_form(InductionLoop *loop, Node *node, int self, int iv, Linear *result) {
+    Linear left, right;
+
+    // The rest is computed once before the loop, even if the loop doesn't run, which an element
+    // can't be read ahead of
+    if(is_loop_invariant(loop, node) && !reads_element(node)) {
+        result->self = result->iv = 0;
+        result->rest = node;
+        return true;
+    }
+
+    switch(node->ty) {
+        case ND_IDENT:
+            result->self = id_of(node) == self;
+            result->iv = id_of(node) == iv;
+            result->rest = NULL;
+            return result->self || result->iv;
+        case '+':
+        case '-':
+            if(!linear_form(loop, node->left, self, iv, &left) || !linear_form(loop, node->right, self, iv, &right)) return false;
+            result->self = node->ty == '+' ? left.self + right.self : left.self - right.self;
+            result->iv = node->ty == '+' ? left.iv + right.iv : left.iv - right.iv;
+            result->rest = add_parts(left.rest, right.rest, node->ty, node->scope);
+            return fits_in_immediate_value(result->self) && fits_in_immediate_value(result->iv);
+        case ND_UNARY_NEG:
+            if(!linear_form(loop, node->middle, self, iv, &left)) return false;
+            result->self = -left.self;
+            result->iv = -left.iv;
+            result->rest = add_parts(NULL, left.rest, '-', node->scope);
+            return true;
+        case '*':
+            if(node->right->ty == ND_NUM) {
+                if(!linear_form(loop, node->left, self, iv, &left)) return false;
+                right.rest = node->right;
+            } else if(node->left->ty == ND_NUM) {
+                if(!linear_form(loop, node->right, self, iv, &left)) return false;
+                right.rest = node->left;
+            } else {
+                return false;
+            }
+            result->self = left.self * right.rest->val;
+            result->iv = left.iv * right.rest->val;
+            result->rest = left.rest ? operation('*', left.rest, right.rest, node->scope) : NULL;
+            return fits_in_immediate_value(result->self) && fits_in_immediate_value(result->iv);
+        default:
+            return false;
+    }
+}
+
+// The comparison that gives the same result with its operands swapped
+int mirrored_comparison(int op) {
+    switch(op) {
+        case '<': return '>';
+        case '>': return '<';
+        case ND_LEQUAL: return ND_GEQUAL;
+        case ND_GEQUAL: return ND_LEQUAL;
+        default: return op;
+    }
+}
+
+// Finds the induction variable a loop condition compares against a bound the loop doesn't change.
+// Returns the comparison, written as `iv op bound`, or 0 if the condition isn't one.
+int compared_induction_variable(InductionLoop *loop, Node *cond, Node **iv, Node **bound) {
+    if(!is_comparison(cond->ty) || cond->ty == ND_EQUAL || has_side_effects(cond)) return 0;
+
+    int op = cond->ty;
+    *iv = cond->left;
+    *bound = cond->right;
+    if((*iv)->ty != ND_IDENT || writes_to(loop, *iv) != 1) {
+        op = mirrored_comparison(op);
+        *iv = cond->right;
+        *bound = cond->left;
+    }
+    if((*iv)->ty != ND_IDENT || writes_to(loop, *iv) != 1 || !visible_outside(loop, *iv)) return 0;
+    if(!is_loop_invariant(loop, *bound)) return 0;
+    return op;
+}
+
+// How many times `iv op bound` holds while iv is stepped from its current value, as an expression.
+// Comparisons are signed but the count is unsigned, so bound - iv is exact even when it overflows.
+// Steps other than 1 need a constant bound, so that iv can't wrap around before passing it.
+Node *trip_count(int op, Node *iv, Node *bound, long step, Scope *scope) {
+    Node *distance;
+    long round_up;
+    long stride = step > 0 ? step : -step;
+    bool counting_up = step > 0;
+
+    if(op == ND_NEQUAL) {
+        if(stride != 1) return NULL;
+        if(counting_up) return operation('-', bound, identifier(iv->name, scope), scope);
+        return operation('-', identifier(iv->name, scope), bound, scope);
+    }
+    if(counting_up != (op == '<' || op == ND_LEQUAL)) return NULL;
+    if(bound->ty != ND_NUM && (stride != 1 || op == ND_LEQUAL || op == ND_GEQUAL)) return NULL;
+
+    distance = counting_up ? operation('-', bound, identifier(iv->name, scope), scope) : operation('-', identifier(iv->name, scope), bound, scope);
+    round_up = (op == '<' || op == '>') ? stride - 1 : stride;
+    if(round_up) distance = operation('+', distance, literal(round_up, scope), scope);
+    if(stride != 1) distance = operation('/', distance, literal(stride, scope), scope);
+
+    Node *cond = operation(op, identifier(iv->name, scope), copy_expression(bound), scope);
+    return in_scope(ternary_operation_node(ND_TERNARY_CONDITIONAL, cond, distance, literal(0, scope)), scope);
+}
+
+// Finds the induction variable that decides how many times a for or while loop runs: one that the
+// condition compares against a bound, and that is stepped exactly once on every iteration
+bool find_loop_counter(Node *node, Scope *scope, LoopCounter *counter) {
+    if((node->ty != ND_FOR && node->ty != ND_WHILE) || node->static_cond != COND_UNKNOWN) return false;
+    Node *cond = node->ty == ND_FOR ? node->middle : node->left;
+    if(!places_on_stack(cond->ty)) return false;
+
+    InductionLoop *loop = summarize_loop(node, scope);
+    if(loop->has_labels) return false;
+    counter->op = compared_induction_variable(loop, cond, &counter->iv, &counter->bound);
+    if(!counter->op) return false;
+
+    Node *stepped;
+    if(node->ty == ND_FOR && constant_step(node->right, &stepped, &counter->step) && id_of(stepped) == id_of(counter->iv)) {
+        return true;
+    }
+    // A continue could skip past an update in the body
+    if(loop->has_continues) return false;
+    Node *body = node->ty == ND_FOR ? node->extra : node->right;
+    Vector *statements = body->ty == ND_SCOPE ? body->statements : NULL;
+    if(statements == NULL) return constant_step(body, &stepped, &counter->step) && id_of(stepped) == id_of(counter->iv);
+    for(int i = 0; i < statements->len; i++) {
+        Node *statement = statements->data[i];
+        if(!statement->unreachable && constant_step(statement, &stepped, &counter->step) && id_of(stepped) == id_of(counter->iv)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// n * (n - 1) / 2, computed so that it doesn't lose the top bit when n * (n - 1) overflows
+Node *triangular_number(char *n, Scope *scope) {
+    Node *odd = operation('&', identifier(n, scope), literal(1, scope), scope);
+    Node *n_minus_one = operation('-', identifier(n, scope), literal(1, scope), scope);
+    Node *when_odd = operation('*', identifier(n, scope), operation(ND_RIGHT_SHIFT, n_minus_one, literal(1, scope), scope), scope);
+    Node *when_even = operation('*', operation(ND_RIGHT_SHIFT, identifier(n, scope), literal(1, scope), scope),
+                                operation('-', identifier(n, scope), literal(1, scope), scope), scope);
+    return in_scope(ternary_operation_node(ND_TERNARY_CONDITIONAL, odd, when_odd, when_even), scope);
+}
+
+char *induction_temporary(Scope *scope) {
+    char *name = malloc(sizeof(char) * 32);
+    snprintf(name, 32, "iv.%d", INDUCTION_TEMPORARIES++);
+    declare_variable(scope, name);
+    return name;
+}
+
+Node *assignment(char *name, Node *value, Scope *scope) {
+    return operation('=', identifier(name, scope), value, scope);
+}
+
+// The statements one iteration runs, in order, if they are all plain expressions
+Vector *iteration_statements(Node *node) {
+    Vector *statements = new_vector();
+    Node *body = node->ty == ND_FOR ? node->extra : node->right;
+
+    if(body->ty == ND_SCOPE) {
+        for(int i = 0; i < body->statements->len; i++) vec_push(statements, body->statements->data[i]);
+    } else {
+        vec_push(statements, body);
+    }
+    if(node->ty == ND_FOR) vec_push(statements, node->right);
+
+    Vector *expressions = new_vector();
+    for(int i = 0; i < statements->len; i++) {
+        Node *statement = statements->data[i];
+        if(statement->unreachable || statement->ty == ND_NOOP) continue;
+        if(!places_on_stack(statement->ty)) return NULL;
+        vec_push(expressions, statement);
+    }
+    return expressions;
+}
+
+// Turns a loop that only steps an induction variable and adds to accumulators into the values it
+// ends up with. Returns the statements that replace the loop, or NULL if it isn't such a loop.
+Vector *closed_form(Node *node, Scope *scope) {
+    Node *cond = node->ty == ND_FOR ? node->middle : node->left;
+    if(node->ty == ND_DO || node->static_cond != COND_UNKNOWN || !places_on_stack(cond->ty)) return NULL;
+
+    InductionLoop *loop = summarize_loop(node, scope);
+    Vector *statements = iteration_statements(node);
+    if(loop->has_labels || loop->has_jumps || statements == NULL) return NULL;
+
+    Node *iv, *bound, *stepped;
+    long step;
+    int op = compared_induction_variable(loop, cond, &iv, &bound);
+    if(!op) return NULL;
+
+    int update = -1;
+    for(int i = 0; i < statements->len && update == -1; i++) {
+        if(constant_step(statements->data[i], &stepped, &step) && id_of(stepped) == id_of(iv)) update = i;
+    }
+    if(update == -1) return NULL;
+    Node *trips = trip_count(op, iv, bound, step, scope);
+    if(trips == NULL) return NULL;
+
+    Vector *replacement = new_vector();
+    if(node->ty == ND_FOR) vec_push(replacement, node->left);
+    char *count = induction_temporary(scope);
+    vec_push(replacement, assignment(count, trips, scope));
+
+    for(int i = 0; i < statements->len; i++) {
+        if(i == update) continue;
+        Node *statement = statements->data[i];
+        Node *target, *value;
+        Linear form;
+        long increment;
+
+        if(constant_step(statement, &target, &increment) && statement->ty != '=') {
+            form.self = 1;
+            form.iv = 0;
+            form.rest = literal(increment, scope);
+        } else if(statement->ty == '=' && statement->left->ty == ND_IDENT) {
+            target = statement->left;
+            if(!linear_form(loop, statement->right, id_of(target), id_of(iv), &form)) return NULL;
+        } else {
+            return NULL;
+        }
+        if(form.self != 1 || writes_to(loop, target) != 1 || !visible_outside(loop, target)) return NULL;
+
+        // target + count * rest + iv_coefficient * (count * first_iv + step * count * (count - 1) / 2)
+        value = NULL;
+        if(form.rest) value = operation('*', identifier(count, scope), form.rest, scope);
+        if(form.iv) {
+            Node *first = identifier(iv->name, scope);
+            if(i > update) first = operation('+', first, literal(step, scope), scope);
+            if(!fits_in_immediate_value(form.iv * step)) return NULL;
+            Node *sum = operation('*', operation('*', identifier(count, scope), first, scope), literal(form.iv, scope), scope);
+            sum = operation('+', sum, operation('*', triangular_number(count, scope), literal(form.iv * step, scope), scope), scope);
+            value = add_parts(value, sum, '+', scope);
+        }
+        if(value) vec_push(replacement, assignment(target->name, operation('+', identifier(target->name, scope), value, scope), scope));
+    }
+
+    Node *distance = identifier(count, scope);
+    if(step != 1) distance = operation('*', distance, literal(step, scope), scope);
+    vec_push(replacement, assignment(iv->name, operation('+', identifier(iv->name, scope), distance, scope), scope));
+    return replacement;
+}
+
+typedef struct {
+    int iv;
+    long step;
+    Vector *factors;        // The constants the induction variable is multiplied by
+    Vector *temporaries;    // and the temporaries holding each product
+    Scope *scope;
+} Derived;
+
+bool is_derived(Derived *derived, Node *node, Node **iv, long *factor) {
+    if(node->ty != '*') return false;
+    *iv = node->left;
+    Node *constant = node->right;
+    if(constant->ty != ND_NUM) {
+        *iv = node->right;
+        constant = node->left;
+    }
+    if(constant->ty != ND_NUM || (*iv)->ty != ND_IDENT || id_of(*iv) != derived->iv) return false;
+    // Multiplying by a power of two is already a single shift
+    *factor = constant->val;
+    return !is_power_of_two(*factor > 0 ? *factor : -(unsigned long)*factor) && fits_in_immediate_value(*factor * derived->step);
+}
+
+// Replaces every multiple of the induction variable with the temporary that tracks it
+Node *reduce_derived(Derived *derived, Node *node) {
+    Node *iv;
+    long factor;
+
+    if(node == NULL) return NULL;
+    if(is_derived(derived, node, &iv, &factor)) {
+        for(int i = 0; i < derived->factors->len; i++) {
+            if((long)derived->factors->data[i] == factor) return identifier(derived->temporaries->data[i], node->scope);
+        }
+        vec_push(derived->factors, (void *)factor);
+        vec_push(derived->temporaries, induction_temporary(derived->scope));
+        return identifier(derived->temporaries->data[derived->temporaries->len - 1], node->scope);
+    }
+
+    node->left = reduce_derived(derived, node->left);
+    node->middle = reduce_derived(derived, node->middle);
+    node->right = reduce_derived(derived, node->right);
+    node->extra = reduce_derived(derived, node->extra);
+    if(node->ty == ND_SCOPE) {
+        for(int i = 0; i < node->statements->len; i++) {
+            node->statements->data[i] = reduce_derived(derived, node->statements->data[i]);
+        }
+    }
+    return node;
+}
+
+// The statements that step every derived induction variable along with the basic one
+Vector *derived_steps(Derived *derived, Scope *scope) {
+    Vector *steps = new_vector();
+    for(int i = 0; i < derived->factors->len; i++) {
+        char *name = derived->temporaries->data[i];
+        long stride = (long)derived->factors->data[i] * derived->step;
+        vec_push(steps, assignment(name, operation('+', identifier(name, scope), literal(stride, scope), scope), scope));
+    }
+    return steps;
+}
+
+Vector *insert_statements(Vector *statements, int position, Vector *inserted) {
+    Vector *result = new_vector();
+    for(int i = 0; i < statements->len; i++) {
+        if(i == position) {
+            for(int j = 0; j < inserted->len; j++) vec_push(result, inserted->data[j]);
+        }
+        vec_push(result, statements->data[i]);
+    }
+    if(position == statements->len) {
+        for(int j = 0; j < inserted->len; j++) vec_push(result, inserted->data[j]);
+    }
+    return result;
+}
+
+// Strength-reduces the derived induction variables of a loop that stays. Each product gets a
+// temporary that is stepped by factor * step right after the induction variable is. When that
+// happens in the iteration statement of a for loop, which continue also jumps to, the temporary
+// is stepped at the start of the body instead, and so starts out one step behind. Pushes the
+// statements that have to run before the loop (and the loop itself) onto out.
+void reduce_loop(Node *node, Scope *scope, Vector *out) {
+    InductionLoop *loop = summarize_loop(node, scope);
+    Node *body = node->ty == ND_FOR ? node->extra : (node->ty == ND_WHILE ? node->right : node->left);
+    Node *iv = NULL;
+    long step;
+    int update = -1;
+
+    if(!loop->has_labels && body->ty == ND_SCOPE) {
+        if(node->ty == ND_FOR && constant_step(node->right, &iv, &step) && writes_to(loop, iv) == 1) {
+            update = 0;
+        } else {
+            iv = NULL;
+            for(int i = 0; i < body->statements->len && iv == NULL; i++) {
+                if(constant_step(body->statements->data[i], &iv, &step) && writes_to(loop, iv) == 1) update = i + 1;
+                else iv = NULL;
+            }
+        }
+    }
+    if(iv == NULL || !visible_outside(loop, iv)) {
+        vec_push(out, node);
+        return;
+    }
+
+    Derived derived = { id_of(iv), step, new_vector(), new_vector(), scope };
+    body = reduce_derived(&derived, body);
+    // With the temporaries stepped at the start of the body, they are out of date in the condition
+    if(update != 0 && node->ty == ND_WHILE) node->left = reduce_derived(&derived, node->left);
+    if(update != 0 && node->ty == ND_DO) node->right = reduce_derived(&derived, node->right);
+    if(derived.factors->len == 0) {
+        vec_push(out, node);
+        return;
+    }
+
+    body->statements = insert_statements(body->statements, update, derived_steps(&derived, body->scope));
+    if(node->ty == ND_FOR) {
+        vec_push(out, node->left);
+        node->left = in_scope(nullary_operation_node(ND_NOOP), scope);
+    }
+    for(int i = 0; i < derived.factors->len; i++) {
+        Node *start = identifier(iv->name, scope);
+        if(update == 0) start = operation('-', start, literal(step, scope), scope);
+        Node *product = operation('*', start, literal((long)derived.factors->data[i], scope), scope);
+        vec_push(out, assignment(derived.temporaries->data[i], product, scope));
+    }
+    vec_push(out, node);
+}
+
+bool find_induction_loops(Node *node);
+
+// Loops that are statements of a scope have somewhere to put their closed form or preheader
+bool reduce_in_statements(Node *node) {
+    bool changed = false;
+    Vector *statements = new_vector();
+
+    for(int i = 0; i < node->statements->len; i++) {
+        Node *statement = node->statements->data[i];
+        changed |= find_induction_loops(statement);
+
+        if(statement->unreachable || (statement->ty != ND_WHILE && statement->ty != ND_DO && statement->ty != ND_FOR)) {
+            vec_push(statements, statement);
+            continue;
+        }
+        Vector *replacement = closed_form(statement, node->scope);
+        if(replacement) {
+            for(int j = 0; j < replacement->len; j++) vec_push(statements, replacement->data[j]);
+            changed = true;
+        } else {
+            reduce_loop(statement, node->scope, statements);
+        }
+    }
+    node->statements = statements;
+    return changed;
+}
+
+bool find_induction_loops(Node *node) {
+    switch(node->ty) {
+        case ND_SCOPE:
+            return reduce_in_statements(node);
+        case ND_IF:
+            return find_induction_loops(node->middle) | find_induction_loops(node->right);
+        case ND_WHILE:
+            return find_induction_loops(node->right);
+        case ND_DO:
+            return find_induction_loops(node->left);
+        case ND_FOR:
+            return find_induction_loops(node->extra);
+        default:
+            return false;
+    }
+}
+
+// Returns true if any loop was replaced by its closed form
+bool reduce_induction_variables(Node *program) {
+    return find_induction_loops(program);
+}
@@ -0,0 +1,355 @@
+#include "yacc.h"
+
+/**
+ ** Function inlining.
+ ** A call is replaced by a copy of the function's body when that costs little: the body is small,
+ ** or the call is the only one left to the function. Functions are considered callees first, so a
+ ** body is sized once whatever it calls has been inlined into it. Recursive functions are never
+ ** inlined, though what they call can be.
+ ** The copy goes in a scope of its own right before the statement the call is in, with its
+ ** variables and labels renamed apart. The parameters are assigned the arguments, every return
+ ** stores to a variable of the caller and jumps past the copy, and the call becomes a read of that
+ ** variable. Only a call that runs before anything else in its statement that has side effects
+ ** can be moved in front of it, and only out of an expression that runs first thing in its
+ ** statement: an expression statement, a return, or the start of an if, switch or for.
+ **/
+
+#define INLINE_SIZE_LIMIT 40    // Most nodes a function may have to be inlined wherever it's called
+
+int FUNCTIONS_INLINED = 0;
+
+typedef struct {
+    char *suffix;           // What every name in the copy ends with
+    Scope *into;            // Scope of the call, which the copy's outermost scope goes in
+    Vector *scopes;         // Scopes of the function
+    Vector *scope_copies;   // and the ones made for the copy
+    Vector *nodes;          // Loops and labels of the function
+    Vector *node_copies;    // and their copies, for the jumps and switches that refer to them
+    Vector *switches;       // Copied switches, whose labels are only all copied at the end
+    char *result;           // Variable each return stores to
+    char *end;              // Label past the copy, which a return jumps to
+    bool used_end;
+} Inlining;
+
+int function_index(char *name) {
+    for(int i = 0; i < FUNCTIONS->len; i++) {
+        if(strcmp(((Node *)FUNCTIONS->data[i])->name, name) == 0) return i;
+    }
+    return -1;
+}
+
+void find_calls(Node *node, Vector *calls) {
+    if(node == NULL) return;
+    if(node->ty == ND_CALL) vec_push(calls, node);
+    find_calls(node->left, calls);
+    find_calls(node->middle, calls);
+    find_calls(node->right, calls);
+    find_calls(node->extra, calls);
+    if(node->ty == ND_SCOPE) {
+        for(int i = 0; i < node->statements->len; i++) find_calls(node->statements->data[i], calls);
+    }
+}
+
+// Marks every function the node calls, and whatever those call in turn. Once marked, a function is
+// pushed onto order after everything it calls.
+void mark_called(Node *node, bool *called, Vector *order) {
+    Vector *calls = new_vector();
+    find_calls(node, calls);
+    for(int i = 0; i < calls->len; i++) {
+        int index = function_index(((Node *)calls->data[i])->name);
+        if(called[index]) continue;
+        called[index] = true;
+        mark_called(((Node *)FUNCTIONS->data[index])->middle, called, order);
+        vec_push(order, FUNCTIONS->data[index]);
+    }
+}
+
+// Every function that can still be reached from the program, in the order they were defined
+Vector *called_functions(Node *program) {
+    bool *called = calloc(FUNCTIONS->len + 1, sizeof(bool));
+    mark_called(program, called, new_vector());
+    Vector *functions = new_vector();
+    for(int i = 0; i < FUNCTIONS->len; i++) {
+        if(called[i]) vec_push(functions, FUNCTIONS->data[i]);
+    }
+    return functions;
+}
+
+bool is_recursive(Node *function) {
+    bool *called = calloc(FUNCTIONS->len + 1, sizeof(bool));
+    mark_called(function->middle, called, new_vector());
+    return called[function_index(function->name)];
+}
+
+int count_calls(Node *node, char *name) {
+    Vector *calls = new_vector();
+    find_calls(node, calls);
+    int count = 0;
+    for(int i = 0; i < calls->len; i++) {
+        if(strcmp(((Node *)calls->data[i])->name, name) == 0) count++;
+    }
+    return count;
+}
+
+char *inlined_name(Inlining *inlining, char *name) {
+    char *renamed = malloc(strlen(name) + strlen(inlining->suffix) + 1);
+    sprintf(renamed, "%s%s", name, inlining->suffix);
+    return renamed;
+}
+
+// The copy of one of the function's scopes, which declares everything the original does
+Scope *copied_scope(Inlining *inlining, Scope *scope) {
+    for(int i = 0; i < inlining->scopes->len; i++) {
+        if(inlining->scopes->data[i] == scope) return inlining->scope_copies->data[i];
+    }
+    Scope *copy = new_scope(scope->parent_scope ? copied_scope(inlining, scope->parent_scope) : inlining->into);
+    for(int i = 0; i < scope->variables_declared->keys->len; i++) {
+        int id = (long)scope->variable_ids->vals->data[i];
+        declare_array(copy, inlined_name(inlining, scope->variables_declared->keys->data[i]), variable_size(id), variable_length(id));
+    }
+    for(int i = 0; i < scope->labels_declared->len; i++) {
+        declare_label(copy, inlined_name(inlining, scope->labels_declared->data[i]));
+    }
+    vec_push(inlining->scopes, scope);
+    vec_push(inlining->scope_copies, copy);
+    return copy;
+}
+
+Node *copied_node(Inlining *inlining, Node *node) {
+    for(int i = 0; i < inlining->nodes->len; i++) {
+        if(inlining->nodes->data[i] == node) return inlining->node_copies->data[i];
+    }
+    return NULL;
+}
+
+Node *copy_inlined(Inlining *inlining, Node *node);
+
+Node *store_result(Inlining *inlining, Node *value, Scope *scope) {
+    Node *store = binary_operation_node('=', identifier(inlining->result, scope), value);
+    store->scope = scope;
+    return store;
+}
+
+// A return becomes a store of its value, then a jump past the copy
+void copy_return(Inlining *inlining, Node *node, Vector *statements) {
+    Scope *scope = copied_scope(inlining, node->scope);
+    vec_push(statements, store_result(inlining, copy_inlined(inlining, node->middle), scope));
+    vec_push(statements, goto_node(inlining->end, scope));
+    inlining->used_end = true;
+}
+
+void copy_statements(Inlining *inlining, Vector *statements, int count, Vector *into) {
+    for(int i = 0; i < count; i++) {
+        Node *statement = statements->data[i];
+        if(statement->ty == ND_RETURN) {
+            copy_return(inlining, statement, into);
+        } else {
+            vec_push(into, copy_inlined(inlining, statement));
+        }
+    }
+}
+
+Node *copy_inlined(Inlining *inlining, Node *node) {
+    if(node == NULL) return NULL;
+
+    // A return that isn't in a list of statements gets a scope to put the two it becomes in
+    if(node->ty == ND_RETURN) {
+        Node *block = new_scope_node(true);
+        block->scope = new_scope(copied_scope(inlining, node->scope));
+        copy_return(inlining, node, block->statements);
+        return block;
+    }
+
+    Node *copy = malloc(sizeof(Node));
+    memcpy(copy, node, sizeof(Node));
+    copy->scope = copied_scope(inlining, node->scope);
+    if(node->ty == ND_IDENT || node->ty == ND_INDEX) copy->name = inlined_name(inlining, node->name);
+    if(node->ty == ND_WHILE || node->ty == ND_DO || node->ty == ND_FOR || node->ty == ND_LABEL) {
+        vec_push(inlining->nodes, node);
+        vec_push(inlining->node_copies, copy);
+    }
+    // Loops come before the breaks and continues in them
+    if(node->ty == ND_BREAK || node->ty == ND_CONTINUE) copy->jump_target = copied_node(inlining, node->jump_target);
+    if(node->ty == ND_SWITCH) {
+        copy->break_label = inlined_name(inlining, node->break_label);
+        vec_push(inlining->switches, copy);
+    }
+
+    copy->left = copy_inlined(inlining, node->left);
+    copy->middle = copy_inlined(inlining, node->middle);
+    copy->right = copy_inlined(inlining, node->right);
+    copy->extra = copy_inlined(inlining, node->extra);
+    if(node->ty == ND_SCOPE) {
+        copy->statements = new_vector();
+        copy_statements(inlining, node->statements, node->statements->len, copy->statements);
+    }
+    return copy;
+}
+
+// An argument moves into the copy's scope along with the store to its parameter. It has no scopes
+// of its own, so every node of it is simply rebound there.
+void move_into(Node *node, Scope *scope) {
+    if(node == NULL) return;
+    node->scope = scope;
+    move_into(node->left, scope);
+    move_into(node->middle, scope);
+    move_into(node->right, scope);
+    move_into(node->extra, scope);
+}
+
+// Makes the scope that runs in place of the call, and turns the call into a read of its result
+Node *inline_call(Node *call, Node *function) {
+    Inlining inlining = { malloc(16), call->scope, new_vector(), new_vector(), new_vector(), new_vector(), new_vector(), NULL, NULL, false };
+    snprintf(inlining.suffix, 16, ".inl%d", FUNCTIONS_INLINED++);
+    inlining.result = inlined_name(&inlining, "ret");
+    inlining.end = inlined_name(&inlining, "end");
+    declare_variable(call->scope, inlining.result);
+
+    Node *body = function->middle;
+    Scope *scope = copied_scope(&inlining, body->scope);
+    Node *block = new_scope_node(true);
+    block->scope = scope;
+    int i = 0;
+    for(Node *argument = call->middle; argument != NULL; argument = argument->right, i++) {
+        Node *parameter = function->statements->data[i];
+        move_into(argument->left, scope);
+        Node *store = binary_operation_node('=', identifier(inlined_name(&inlining, parameter->name), scope), argument->left);
+        store->scope = scope;
+        vec_push(block->statements, store);
+    }
+
+    // A return at the very end has nowhere to jump to, and running off the end returns 0
+    int count = body->statements->len;
+    Node *last = count > 0 ? body->statements->data[count - 1] : NULL;
+    bool returns_at_end = last != NULL && last->ty == ND_RETURN;
+    copy_statements(&inlining, body->statements, returns_at_end ? count - 1 : count, block->statements);
+    Node *value;
+    if(returns_at_end) {
+        value = copy_inlined(&inlining, last->middle);
+    } else {
+        value = new_numeric_node(0);
+        value->scope = scope;
+    }
+    vec_push(block->statements, store_result(&inlining, value, scope));
+    // A label would keep the loops around the copy from being unrolled, so there's only one if needed
+    if(inlining.used_end) vec_push(block->statements, label_node(inlining.end, scope));
+
+    for(int i = 0; i < inlining.switches->len; i++) {
+        Node *dispatch = inlining.switches->data[i];
+        Vector *labels = new_vector();
+        for(int j = 0; j < dispatch->statements->len; j++) vec_push(labels, copied_node(&inlining, dispatch->statements->data[j]));
+        dispatch->statements = labels;
+        dispatch->jump_target = copied_node(&inlining, dispatch->jump_target);
+    }
+
+    call->ty = ND_IDENT;
+    call->arity = 0;
+    call->name = inlining.result;
+    call->middle = NULL;
+    return block;
+}
+
+// Finds the first call to the function that can run ahead of its statement, going through the
+// expression in the order it is computed. Stops at anything with side effects, and at the parts of
+// the expression that may not run at all.
+Node *hoistable_call(Node *node, char *name, bool *blocked) {
+    if(node == NULL || *blocked) return NULL;
+
+    Node *found;
+    switch(node->ty) {
+        case ND_TERNARY_CONDITIONAL:
+        case ND_LAND:
+        case ND_LOR:
+            found = hoistable_call(node->left, name, blocked);
+            *blocked = true;
+            return found;
+        default:
+            break;
+    }
+
+    // The arguments of a call are in middle, and run before it
+    if((found = hoistable_call(node->left, name, blocked)) != NULL) return found;
+    if((found = hoistable_call(node->middle, name, blocked)) != NULL) return found;
+    if((found = hoistable_call(node->right, name, blocked)) != NULL) return found;
+    if(*blocked) return NULL;
+    if(node->ty == ND_CALL && strcmp(node->name, name) == 0) return node;
+    if(has_side_effects(node)) *blocked = true;
+    return NULL;
+}
+
+// The expression that a statement runs before anything else
+Node *leading_expression(Node *statement) {
+    switch(statement->ty) {
+        case ND_RETURN:
+        case ND_SWITCH:
+            return statement->middle;
+        case ND_IF:
+            return statement->left;
+        case ND_FOR:
+            return places_on_stack(statement->left->ty) ? statement->left : NULL;
+        default:
+            return places_on_stack(statement->ty) ? statement : NULL;
+    }
+}
+
+void inline_in_statement(Node *node, Node *function);
+
+void inline_in_statements(Node *node, Node *function) {
+    Vector *statements = new_vector();
+    for(int i = 0; i < node->statements->len; i++) {
+        Node *statement = node->statements->data[i];
+        inline_in_statement(statement, function);
+
+        Node *expression = leading_expression(statement);
+        Node *call;
+        bool blocked = false;
+        while(expression != NULL && (call = hoistable_call(expression, function->name, &blocked)) != NULL) {
+            vec_push(statements, inline_call(call, function));
+            blocked = false;
+        }
+        vec_push(statements, statement);
+    }
+    node->statements = statements;
+}
+
+void inline_in_statement(Node *node, Node *function) {
+    switch(node->ty) {
+        case ND_SCOPE:
+            inline_in_statements(node, function);
+            return;
+        case ND_IF:
+            inline_in_statement(node->middle, function);
+            inline_in_statement(node->right, function);
+            return;
+        case ND_WHILE:
+            inline_in_statement(node->right, function);
+            return;
+        case ND_DO:
+            inline_in_statement(node->left, function);
+            return;
+        case ND_FOR:
+            inline_in_statement(node->extra, function);
+            return;
+        default:
+            return;
+    }
+}
+
+void inline_functions(Node *program) {
+    Vector *order = new_vector();
+    mark_called(program, calloc(FUNCTIONS->len + 1, sizeof(bool)), order);
+
+    for(int i = 0; i < order->len; i++) {
+        Node *function = order->data[i];
+        if(is_recursive(function)) continue;
+
+        int sites = count_calls(program, function->name);
+        for(int j = 0; j < order->len; j++) sites += count_calls(((Node *)order->data[j])->middle, function->name);
+        if(count_nodes(function->middle) > INLINE_SIZE_LIMIT && sites != 1) continue;
+
+        inline_in_statement(program, function);
+        for(int j = 0; j < order->len; j++) {
+            if(order->data[j] != function) inline_in_statement(((Node *)order->data[j])->middle, function);
+        }
+    }
+}
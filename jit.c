@@ -0,0 +1,35 @@
+#include "yacc.h"
+#include <sys/mman.h>
+
+/**
+ ** In-memory execution (-run).
+ ** The program's code is assembled into a buffer that is mapped writable, then switched to
+ ** executable (but no longer writable) before it is called. It never refers to anything outside
+ ** of itself, so it runs wherever the buffer ends up.
+ ** The generated code uses rbx freely, which the caller expects to be preserved, so it is called
+ ** through a stub that saves rbx around it.
+ **/
+
+char *JIT_ENTRY[] = {"\tpush rbx", "\tcall main", "\tpop rbx", "\tret", "main:"};
+
+// Maps the program into memory. Calling it runs the program, and returns the value it leaves in rax.
+NativeProgram load_in_memory(Vector *assembly) {
+    Vector *lines = new_vector();
+    for(int i = 0; i < 5; i++) vec_push(lines, JIT_ENTRY[i]);
+    for(int i = 0; i < assembly->len; i++) vec_push(lines, assembly->data[i]);
+    Bytes *code = assemble(lines);
+
+    long page_size = sysconf(_SC_PAGESIZE);
+    size_t size = (code->len + page_size - 1) / page_size * page_size;
+    void *memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(memory == MAP_FAILED) {
+        fprintf(stderr, "Could not map memory for the program\n");
+        exit(EXTERNAL_ERROR);
+    }
+    memcpy(memory, code->data, code->len);
+    if(mprotect(memory, size, PROT_READ | PROT_EXEC) != 0) {
+        fprintf(stderr, "Could not make the program executable\n");
+        exit(EXTERNAL_ERROR);
+    }
+    return (NativeProgram)memory;
+}
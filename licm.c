@@ -0,0 +1,265 @@
+#include "yacc.h"
+
+/**
+ ** Loop-invariant code motion.
+ ** For every loop, we find the variables written anywhere in its condition, body or iteration
+ ** statement, including through ++/-- and inside nested scopes and loops. An expression in the loop
+ ** that has no side effects and reads none of those variables computes the same value on every
+ ** iteration. It is evaluated once in a preheader placed right before the loop, and saved in a
+ ** compiler temporary that the loop reads instead. Inner loops are handled first, so an expression
+ ** that is invariant in a whole nest moves out one preheader at a time.
+ **/
+
+typedef struct {
+    Scope *scope;           // Scope the preheader is evaluated in
+    bool *assigned;         // Whether the loop writes to a variable, indexed by variable id
+    int num_variables;
+    Vector *hoisted;        // Expressions moved into the preheader
+    Vector *temporaries;    // and the names of the temporaries they are saved in
+} Loop;
+
+int INVARIANTS_HOISTED = 0;
+
+void mark_assigned(Loop *loop, Node *ident) {
+    int id = get_variable_id(ident->scope, ident->name);
+    if(id < loop->num_variables) loop->assigned[id] = true;
+}
+
+// Records every variable the node writes to. Returns false if the node contains a label: a goto
+// to it could enter the loop without going through the preheader.
+bool find_assigned(Loop *loop, Node *node) {
+    if(node == NULL) return true;
+
+    switch(node->ty) {
+        case ND_LABEL:
+            return false;
+        case ND_GOTO:
+            return true;
+        case '=':
+            mark_assigned(loop, node->left);
+            return find_assigned(loop, node->left->middle) && find_assigned(loop, node->right);
+        case ND_PRE_INCREMENT:
+        case ND_PRE_DECREMENT:
+        case ND_POST_INCREMENT:
+        case ND_POST_DECREMENT:
+            mark_assigned(loop, node->middle);
+            return true;
+        case ND_SCOPE:
+            for(int i = 0; i < node->statements->len; i++) {
+                if(!find_assigned(loop, node->statements->data[i])) return false;
+            }
+            return true;
+        default:
+            return find_assigned(loop, node->left) && find_assigned(loop, node->middle)
+                && find_assigned(loop, node->right) && find_assigned(loop, node->extra);
+    }
+}
+
+// An expression is invariant when every variable it reads is left alone by the loop, and is the
+// same variable when looked up from the preheader
+bool is_invariant(Loop *loop, Node *node) {
+    if(node == NULL) return true;
+
+    switch(node->ty) {
+        case ND_NUM:
+            return true;
+        case ND_IDENT: {
+            int id = get_variable_id(node->scope, node->name);
+            if(id < loop->num_variables && loop->assigned[id]) return false;
+            return variable_already_declared(loop->scope, node->name) && get_variable_id(loop->scope, node->name) == id;
+        }
+        // An element is never read ahead of the loop, whose index could be out of bounds until
+        // the loop checks it
+        case ND_INDEX:
+            return false;
+        default:
+            return is_invariant(loop, node->left) && is_invariant(loop, node->middle) && is_invariant(loop, node->right);
+    }
+}
+
+// Hoisting only pays off when it saves more than loading a variable
+bool worth_hoisting(Node *node) {
+    if(node->ty == ND_NUM || node->ty == ND_IDENT) return false;
+    if(node->arity != 1) return true;
+    return node->middle->ty != ND_NUM && node->middle->ty != ND_IDENT;
+}
+
+Node *temporary_for(Loop *loop, Node *node) {
+    for(int i = 0; i < loop->hoisted->len; i++) {
+        if(same_expression(loop->hoisted->data[i], node)) return identifier(loop->temporaries->data[i], node->scope);
+    }
+
+    char *name = malloc(sizeof(char) * 32);
+    snprintf(name, 32, "licm.%d", INVARIANTS_HOISTED++);
+    declare_variable(loop->scope, name);
+    vec_push(loop->hoisted, node);
+    vec_push(loop->temporaries, name);
+    return identifier(name, node->scope);
+}
+
+Node *hoist_expression(Loop *loop, Node *node) {
+    if(node == NULL) return NULL;
+
+    switch(node->ty) {
+        case ND_NUM:
+        case ND_IDENT:
+            return node;
+        // The targets of assignments and increments have to stay lvals, though the index of an
+        // element can be hoisted
+        case '=':
+            if(node->left->ty == ND_INDEX) node->left->middle = hoist_expression(loop, node->left->middle);
+            node->right = hoist_expression(loop, node->right);
+            return node;
+        case ND_PRE_INCREMENT:
+        case ND_PRE_DECREMENT:
+        case ND_POST_INCREMENT:
+        case ND_POST_DECREMENT:
+            return node;
+        // The arguments of a call can be hoisted, but not the call or the chain that holds them
+        case ND_CALL:
+            node->middle = hoist_expression(loop, node->middle);
+            return node;
+        case ND_ARG:
+            node->left = hoist_expression(loop, node->left);
+            node->right = hoist_expression(loop, node->right);
+            return node;
+        default:
+            break;
+    }
+
+    // Expressions that can trap (like dividing by a variable) count as having side effects, so
+    // nothing is evaluated in the preheader that the loop might never have run
+    if(worth_hoisting(node) && !has_side_effects(node) && is_invariant(loop, node)) {
+        return temporary_for(loop, node);
+    }
+    node->left = hoist_expression(loop, node->left);
+    node->middle = hoist_expression(loop, node->middle);
+    node->right = hoist_expression(loop, node->right);
+    return node;
+}
+
+Node *hoist_statement(Loop *loop, Node *node) {
+    if(node->unreachable) return node;
+
+    switch(node->ty) {
+        case ND_SCOPE:
+            for(int i = 0; i < node->statements->len; i++) {
+                node->statements->data[i] = hoist_statement(loop, node->statements->data[i]);
+            }
+            return node;
+        case ND_NOOP:
+        case ND_LABEL:
+        case ND_GOTO:
+        case ND_BREAK:
+        case ND_CONTINUE:
+        case ND_SWITCH:
+            return node;
+        case ND_IF:
+            node->left = hoist_expression(loop, node->left);
+            node->middle = hoist_statement(loop, node->middle);
+            node->right = hoist_statement(loop, node->right);
+            return node;
+        case ND_WHILE:
+            node->left = hoist_expression(loop, node->left);
+            node->right = hoist_statement(loop, node->right);
+            return node;
+        case ND_DO:
+            node->left = hoist_statement(loop, node->left);
+            node->right = hoist_expression(loop, node->right);
+            return node;
+        case ND_FOR:
+            node->left = hoist_statement(loop, node->left);
+            node->middle = hoist_statement(loop, node->middle);
+            node->right = hoist_statement(loop, node->right);
+            node->extra = hoist_statement(loop, node->extra);
+            return node;
+        default:
+            return hoist_expression(loop, node);
+    }
+}
+
+// Moves the invariant expressions of a loop out of it. Returns the statements of its preheader.
+Vector *hoist_from_loop(Node *node, Scope *scope) {
+    Loop loop;
+    loop.scope = scope;
+    loop.num_variables = variable_count();
+    loop.assigned = calloc(loop.num_variables + 1, sizeof(bool));
+    loop.hoisted = new_vector();
+    loop.temporaries = new_vector();
+
+    Vector *preheader = new_vector();
+    if(node->static_cond == COND_ALWAYS_FALSE || !find_assigned(&loop, node)) return preheader;
+
+    // The initializer of a for loop only runs once anyway
+    switch(node->ty) {
+        case ND_WHILE:
+            node->left = hoist_expression(&loop, node->left);
+            node->right = hoist_statement(&loop, node->right);
+            break;
+        case ND_DO:
+            node->left = hoist_statement(&loop, node->left);
+            node->right = hoist_expression(&loop, node->right);
+            break;
+        case ND_FOR:
+            node->middle = hoist_statement(&loop, node->middle);
+            node->right = hoist_statement(&loop, node->right);
+            node->extra = hoist_statement(&loop, node->extra);
+            break;
+    }
+
+    for(int i = 0; i < loop.hoisted->len; i++) {
+        Node *assignment = binary_operation_node('=', identifier(loop.temporaries->data[i], scope), loop.hoisted->data[i]);
+        assignment->scope = scope;
+        vec_push(preheader, assignment);
+    }
+    return preheader;
+}
+
+void hoist_in_statements(Node *node);
+
+// Finds the lists of statements that loops are part of
+void find_loops(Node *node) {
+    switch(node->ty) {
+        case ND_SCOPE:
+            hoist_in_statements(node);
+            break;
+        case ND_IF:
+            find_loops(node->middle);
+            find_loops(node->right);
+            break;
+        case ND_WHILE:
+            find_loops(node->right);
+            break;
+        case ND_DO:
+            find_loops(node->left);
+            break;
+        case ND_FOR:
+            find_loops(node->extra);
+            break;
+        default:
+            break;
+    }
+}
+
+// Loops that are statements of a scope get a preheader inserted right before them. (A loop that is
+// the whole body of an if or another loop has nowhere to put one, but its invariants still move out
+// of the loop around it.)
+void hoist_in_statements(Node *node) {
+    Vector *statements = new_vector();
+
+    for(int i = 0; i < node->statements->len; i++) {
+        Node *statement = node->statements->data[i];
+        find_loops(statement);
+
+        if(!statement->unreachable && (statement->ty == ND_WHILE || statement->ty == ND_DO || statement->ty == ND_FOR)) {
+            Vector *preheader = hoist_from_loop(statement, node->scope);
+            for(int j = 0; j < preheader->len; j++) vec_push(statements, preheader->data[j]);
+        }
+        vec_push(statements, statement);
+    }
+    node->statements = statements;
+}
+
+void hoist_loop_invariants(Node *program) {
+    find_loops(program);
+}
@@ -1,4 +1,31 @@
 #include "yacc.h"
+#include <time.h>
+
+// -bench=N runs the program N times over, and reports on stderr how long a run takes
+int BENCHMARK_RUNS = 0;
+
+long run_native(void *program) {
+    return ((NativeProgram)program)();
+}
+
+long run_interpreted(void *program) {
+    return run_bytecode(program);
+}
+
+long run_program_with(char *engine, long (*run)(void *), void *program) {
+    if(BENCHMARK_RUNS <= 0) return run(program);
+
+    long result = 0;
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(int i = 0; i < BENCHMARK_RUNS; i++) {
+        result = run(program);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double elapsed = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+    fprintf(stderr, "%s: %.1f ns per run\n", engine, elapsed / BENCHMARK_RUNS);
+    return result;
+}
 
 int main(int argc, char **argv) {
     // First check to see if we're testing. We don't run anything.
@@ -14,9 +41,13 @@ int main(int argc, char **argv) {
 
     char *filename = NULL;
     char *string_literal = NULL;
+    char *output_filename = NULL;
+    bool object_only = false;
+    bool run_program = false;
+    bool interpret_program = false;
     for(int i = 1; i < argc; i++) {
         // If we have something which isn't a flag or flag argument, it's our file.
-        if(argv[i][0] != '-' && argv[i-1][0] != '-') {
+        if(argv[i][0] != '-' && strcmp(argv[i-1], "-l") != 0 && strcmp(argv[i-1], "-o") != 0) {
             if(string_literal) fprintf(stderr, "You shouldn't use both file input and literal input. Preferring file input.\n");
             filename = argv[i];
         }
@@ -27,6 +58,55 @@ int main(int argc, char **argv) {
                 string_literal = NULL;
             }
         }
+        if(strcmp(argv[i], "-O0") == 0) {
+            OPTIMIZATIONS_ENABLED = false;
+        }
+        if(strncmp(argv[i], "-funroll=", 9) == 0) {
+            UNROLL_FACTOR = atoi(argv[i] + 9);
+        }
+        if(strcmp(argv[i], "-fno-vectorize") == 0) {
+            VECTORIZE_LOOPS = false;
+        }
+        if(strcmp(argv[i], "-mavx2") == 0) {
+            USE_AVX2 = true;
+        }
+        if(strcmp(argv[i], "-fsuperopt") == 0) {
+            SUPEROPTIMIZE = true;
+        }
+        if(strncmp(argv[i], "-fsuperopt=", 11) == 0) {
+            SUPEROPTIMIZE = true;
+            SUPEROPT_LENGTH = atoi(argv[i] + 11);
+        }
+        if(strncmp(argv[i], "-fsuperopt-table=", 17) == 0) {
+            SUPEROPT_TABLE = argv[i] + 17;
+        }
+        if(strcmp(argv[i], "-Oeval") == 0) {
+            EVALUATE_PROGRAM = true;
+        }
+        if(strncmp(argv[i], "-feval-steps=", 13) == 0) {
+            EVAL_STEP_BUDGET = atol(argv[i] + 13);
+        }
+        if(strncmp(argv[i], "-feval-memory=", 14) == 0) {
+            EVAL_MEMORY_BUDGET = atol(argv[i] + 14);
+        }
+        // With -c or -o, the built-in assembler writes an object file or an executable instead of printing assembly
+        if(strcmp(argv[i], "-c") == 0) {
+            object_only = true;
+        }
+        if(strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            output_filename = argv[i+1];
+        }
+        // With -run, the program runs straight from memory and its result becomes our exit code
+        if(strcmp(argv[i], "-run") == 0) {
+            run_program = true;
+        }
+        // With -interp, it runs as bytecode instead
+        if(strcmp(argv[i], "-interp") == 0) {
+            interpret_program = true;
+        }
+        if(strncmp(argv[i], "-bench=", 7) == 0) {
+            BENCHMARK_RUNS = atoi(argv[i] + 7);
+        }
     }
 
     FILE *input_file;
@@ -37,15 +117,8 @@ int main(int argc, char **argv) {
             exit(EXTERNAL_ERROR);
         }
     } else if(string_literal) {
-        filename = "yacc_temp.yacc";
-        if(access(filename, F_OK) != -1) {
-            fprintf(stderr, "Please delete any files named \"yacc_temp.yacc\" when using literal input.\n");
-            exit(EXTERNAL_ERROR);
-        }
-        input_file = fopen(filename, "w");
-        fprintf(input_file, "%s", string_literal);
-        fclose(input_file);
-        input_file = fopen(filename, "r");
+        // Literal input is read straight from memory, so nothing touches the disk
+        input_file = fmemopen(string_literal, strlen(string_literal), "r");
     } else {
         fprintf(stderr, "Couldn't understand input. Terminating.\n");
         exit(EXTERNAL_ERROR);
@@ -55,19 +128,55 @@ int main(int argc, char **argv) {
     Vector *token_stream = tokenize(input_file);
     Node *global_scope_node = parse_code(token_stream);
 
-    // Preliminary headers for assembly
-    printf(".intel_syntax noprefix\n");
-    printf(".global main\n");
-    printf("main:\n");
-    
     Scope *scope = construct_scope_from_token_stream(token_stream);
+    bind_scopes(global_scope_node, scope);
+    for(int i = 0; i < FUNCTIONS->len; i++) {
+        bind_function(FUNCTIONS->data[i], FUNCTION_SCOPES->data[i]);
+    }
 
-    gen_scope(global_scope_node, &scope);
+    if(interpret_program) {
+        if(OPTIMIZATIONS_ENABLED) {
+            optimize(global_scope_node);
+        }
+        return run_program_with("interpreter", run_interpreted, compile_bytecode(global_scope_node));
+    }
 
-    printf("\tret\n");
+    // A program that can be run at compile time only needs to return its result
+    long result;
+    // The functions still called come after main, each starting at its name
+    Vector *functions;
+    if(EVALUATE_PROGRAM && evaluate_program(global_scope_node, &result)) {
+        emit("\tmov rax, %ld\n", result);
+        emit("\tret\n");
+        functions = new_vector();
+    } else {
+        if(OPTIMIZATIONS_ENABLED) {
+            optimize(global_scope_node);
+        }
+        RESULT_STATEMENT = result_statement(global_scope_node);
+        gen_scope(global_scope_node, &scope);
+        emit("\tret\n");
+        functions = gen_functions(global_scope_node);
+    }
 
-    if(string_literal) {
-        remove(filename);
+    Vector *assembly = emitted_lines();
+    if(OPTIMIZATIONS_ENABLED) {
+        assembly = optimize_sections(assembly, functions);
+    }
+    if(run_program) {
+        return run_program_with("native", run_native, load_in_memory(assembly));
+    } else if(object_only) {
+        write_object(output_filename ? output_filename : "a.o", assemble(assembly));
+    } else if(output_filename) {
+        write_executable(output_filename, assemble(assembly));
+    } else {
+        // Preliminary headers for assembly
+        printf(".intel_syntax noprefix\n");
+        printf(".global main\n");
+        printf("main:\n");
+        for(int i = 0; i < assembly->len; i++) {
+            printf("%s\n", (char *)assembly->data[i]);
+        }
     }
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,235 @@
+#include "yacc.h"
+
+/**
+ ** Helpers shared by the optimization passes, and the order in which those passes run
+ **/
+
+bool OPTIMIZATIONS_ENABLED = true;
+
+// Returns true if evaluating the node could change the state of the program. 
+// Division counts too, since dividing by zero traps at runtime.
+bool has_side_effects(Node *node) {
+    if(node == NULL) return false;
+
+    switch(node->ty) {
+        case ND_NUM:
+        case ND_IDENT:
+        case ND_NOOP:
+            return false;
+        case '=':
+        case ND_PRE_INCREMENT:
+        case ND_PRE_DECREMENT:
+        case ND_POST_INCREMENT:
+        case ND_POST_DECREMENT:
+        case ND_SCOPE:
+        case ND_IF:
+        case ND_WHILE:
+        case ND_DO:
+        case ND_FOR:
+        case ND_BREAK:
+        case ND_CONTINUE:
+        case ND_GOTO:
+        case ND_LABEL:
+        case ND_SWITCH:
+        case ND_CALL:
+        case ND_RETURN:
+            return true;
+        case '/':
+        case '%':
+            if(node->right->ty != ND_NUM || node->right->val == 0) return true;
+            break;
+        default:
+            break;
+    }
+
+    return has_side_effects(node->left) || has_side_effects(node->middle) || has_side_effects(node->right);
+}
+
+// Whether the node reads an element of an array. Indexes aren't checked, so one that is out of
+// bounds can read memory that isn't there: an element is never read where the program wouldn't.
+bool reads_element(Node *node) {
+    if(node == NULL) return false;
+    if(node->ty == ND_INDEX) return true;
+    return reads_element(node->left) || reads_element(node->middle) || reads_element(node->right);
+}
+
+Node *identifier(char *name, Scope *scope) {
+    Node *node = calloc(1, sizeof(Node));
+    node->ty = ND_IDENT;
+    node->name = name;
+    node->scope = scope;
+    return node;
+}
+
+Node *copy_expression(Node *node) {
+    if(node == NULL) return NULL;
+    Node *copy = malloc(sizeof(Node));
+    memcpy(copy, node, sizeof(Node));
+    copy->left = copy_expression(node->left);
+    copy->middle = copy_expression(node->middle);
+    copy->right = copy_expression(node->right);
+    return copy;
+}
+
+// Whether a op b is always b op a
+bool is_commutative(int op) {
+    switch(op) {
+        case '+':
+        case '*':
+        case '&':
+        case '|':
+        case '^':
+        case ND_EQUAL:
+        case ND_NEQUAL:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Checks whether two expressions are written the same way and refer to the same variables
+bool same_expression(Node *a, Node *b) {
+    if(a == NULL || b == NULL) return a == b;
+    if(a->ty != b->ty) return false;
+
+    switch(a->ty) {
+        case ND_NUM:
+            return a->val == b->val;
+        case ND_IDENT:
+            return get_variable_id(a->scope, a->name) == get_variable_id(b->scope, b->name);
+        case ND_INDEX:
+            return get_variable_id(a->scope, a->name) == get_variable_id(b->scope, b->name) && same_expression(a->middle, b->middle);
+        case ND_SCOPE:
+        case ND_FOR:
+        case ND_CALL:
+            return false;
+        default:
+            return same_expression(a->left, b->left) && same_expression(a->middle, b->middle) && same_expression(a->right, b->right);
+    }
+}
+
+// Computes a unary operation the same way the generated code would. Returns false if it can't be computed.
+bool fold_unary(int op, long operand, long *result) {
+    switch(op) {
+        case ND_UNARY_NEG:
+            *result = -(unsigned long)operand;
+            return true;
+        case ND_UNARY_POS:
+            *result = operand;
+            return true;
+        case ND_UNARY_BIT_COMPLEMENT:
+            *result = ~operand;
+            return true;
+        case ND_UNARY_BOOLEAN_NOT:
+            *result = operand == 0;
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Computes a binary operation the same way the generated code would. Returns false if it can't be computed.
+bool fold_binary(int op, long left, long right, long *result) {
+    unsigned long l = left, r = right;
+    switch(op) {
+        case '*':
+            *result = l * r;
+            return true;
+        case '/':
+            if(r == 0) return false;
+            *result = l / r;
+            return true;
+        case '%':
+            if(r == 0) return false;
+            *result = l % r;
+            return true;
+        case '+':
+            *result = l + r;
+            return true;
+        case '-':
+            *result = l - r;
+            return true;
+        case ND_EQUAL:
+            *result = left == right;
+            return true;
+        case ND_NEQUAL:
+            *result = left != right;
+            return true;
+        case ND_GEQUAL:
+            *result = left >= right;
+            return true;
+        case ND_LEQUAL:
+            *result = left <= right;
+            return true;
+        case '>':
+            *result = left > right;
+            return true;
+        case '<':
+            *result = left < right;
+            return true;
+        // The shift count is read from cl, which the processor masks to 6 bits
+        case ND_LEFT_SHIFT:
+            *result = l << (r & 63);
+            return true;
+        case ND_RIGHT_SHIFT:
+            *result = l >> (r & 63);
+            return true;
+        case '^':
+            *result = l ^ r;
+            return true;
+        case '|':
+            *result = l | r;
+            return true;
+        case '&':
+            *result = l & r;
+            return true;
+        default:
+            return false;
+    }
+}
+
+// The label a switch jumps to when its selector has the given value
+Node *matching_case(Node *node, long value) {
+    for(int i = 0; i < node->statements->len; i++) {
+        Node *label = node->statements->data[i];
+        if(label->val == value) return label;
+    }
+    return node->jump_target;
+}
+
+void optimize_body(Node *program, bool is_function) {
+    simplify(program);
+    propagate_constants(program);
+    // Constants found by propagation give the identities more to work with
+    simplify(program);
+    if(reduce_induction_variables(program)) {
+        // The closed forms of loops often turn out to be constants
+        propagate_constants(program);
+        simplify(program);
+    }
+    if(unroll_loops(program)) {
+        propagate_constants(program);
+        simplify(program);
+    }
+    if(narrow_ranges(program)) {
+        // Comparisons that the ranges decide can settle branches
+        propagate_constants(program);
+        simplify(program);
+    }
+    hoist_loop_invariants(program);
+    eliminate_common_subexpressions(program);
+    eliminate_dead_stores(program, is_function);
+    // Codegen looks at the ranges of the final trees
+    analyze_ranges(program);
+}
+
+// Functions are inlined first, so that their code gets optimized along with where it ended up.
+// The ones still called afterwards are optimized on their own.
+void optimize(Node *program) {
+    inline_functions(program);
+    optimize_body(program, false);
+    Vector *functions = called_functions(program);
+    for(int i = 0; i < functions->len; i++) {
+        optimize_body(((Node *)functions->data[i])->middle, true);
+    }
+}
@@ -21,7 +21,7 @@ Node *parse_error(Node *node, char *hint, int line_num, int pos) {
 }
 
 Node *quaternary_operation_node(int op, Node *left, Node *middle, Node *right, Node *extra) {
-    Node *node = malloc(sizeof(Node));
+    Node *node = calloc(1, sizeof(Node));
     node->ty = op;
     node->arity = 4;
     node->left = left;
@@ -32,7 +32,7 @@ Node *quaternary_operation_node(int op, Node *left, Node *middle, Node *right, N
 }
 
 Node *ternary_operation_node(int op, Node *left, Node *middle, Node *right) {
-    Node *node = malloc(sizeof(Node));
+    Node *node = calloc(1, sizeof(Node));
     node->ty = op;
     node->arity = 3;
     node->left = left;
@@ -42,7 +42,7 @@ Node *ternary_operation_node(int op, Node *left, Node *middle, Node *right) {
 }
 
 Node *binary_operation_node(int op, Node *left, Node *right) {
-    Node *node = malloc(sizeof(Node));
+    Node *node = calloc(1, sizeof(Node));
     node->ty = op;
     node->arity = 2;
     node->left = left;
@@ -51,7 +51,7 @@ Node *binary_operation_node(int op, Node *left, Node *right) {
 }
 
 Node *unary_operation_node(int op, Node *child) {
-    Node *node = malloc(sizeof(Node));
+    Node *node = calloc(1, sizeof(Node));
     node->ty = op;
     node->arity = 1;
     node->middle = child;
@@ -59,14 +59,14 @@ Node *unary_operation_node(int op, Node *child) {
 }
 
 Node *nullary_operation_node(int op) {
-    Node *node = malloc(sizeof(Node));
+    Node *node = calloc(1, sizeof(Node));
     node->ty = op;
     node->arity = 0;
     return node;
 }
 
 Node *new_identifier_node(char *name) {
-    Node *node = malloc(sizeof(Node));
+    Node *node = calloc(1, sizeof(Node));
     node->ty = ND_IDENT;
     node->arity = 0;
     node->name = name;
@@ -74,7 +74,7 @@ Node *new_identifier_node(char *name) {
 }
 
 Node *new_numeric_node(int val) {
-    Node *node = malloc(sizeof(Node));
+    Node *node = calloc(1, sizeof(Node));
     node->ty = ND_NUM;
     node->arity = 0;
     node->val = val;
@@ -82,7 +82,7 @@ Node *new_numeric_node(int val) {
 }
 
 Node *new_scope_node(bool descend) {
-    Node *node = malloc(sizeof(Node));
+    Node *node = calloc(1, sizeof(Node));
     node->ty = ND_SCOPE;
     node->arity = 0;
     node->statements = new_vector();
@@ -93,7 +93,7 @@ Node *new_scope_node(bool descend) {
 }
 
 Node *no_op() {
-    Node *node = malloc(sizeof(Node));
+    Node *node = calloc(1, sizeof(Node));
     node->ty = ND_NOOP;
     node->arity = 0;
     return node;
@@ -114,9 +114,239 @@ void expect_token(Vector *tokens, int *pos, int line_num, int type) {
     *pos = *pos + 1;
 }
 
-// Prototypes for back-referencing/mutual recursion
 Node *parse_statement(Vector *tokens, int *pos, Node **current_scope_node);
+void parse_statement_into(Vector *statements, Vector *tokens, int *pos, Node **current_scope_node);
+
+// The innermost loop being parsed, so break/continue statements know where they jump to
+Node *current_loop = NULL;
+// and the innermost switch, unless it's outside of that loop, so a break leaves the switch instead
+Node *current_switch = NULL;
+
+// Parses the body of a loop, with break/continue statements inside of it bound to that loop
+Node *parse_loop_body(Vector *tokens, int *pos, Node **current_scope_node, Node *loop) {
+    Node *enclosing_loop = current_loop;
+    Node *enclosing_switch = current_switch;
+    current_loop = loop;
+    current_switch = NULL;
+    Node *loop_body = parse_statement(tokens, pos, current_scope_node);
+    current_loop = enclosing_loop;
+    current_switch = enclosing_switch;
+    return loop_body;
+}
+
+// Prototypes for back-referencing/mutual recursion
 Node *precedence_12(Vector *tokens, int *pos);
+Node *parse_expression(Vector *tokens, int *pos);
+Node *parse_scope(Vector *tokens, int *pos, Node **current_scope_node);
+
+// Every function defined in the program, in the order they were defined
+Vector *FUNCTIONS = NULL;
+// Every call parsed, so they can be checked against the functions once all of them are known
+Vector *calls_parsed = NULL;
+
+Node *find_function(char *name) {
+    for(int i = 0; i < FUNCTIONS->len; i++) {
+        Node *function = FUNCTIONS->data[i];
+        if(strcmp(function->name, name) == 0) return function;
+    }
+    return NULL;
+}
+
+// Whether the tokens at pos start the definition of a function: name(a, b) {
+bool is_function_definition(Vector *tokens, int pos) {
+    if(((Token *)tokens->data[pos])->ty != TK_IDENT || ((Token *)tokens->data[pos + 1])->ty != '(') return false;
+    pos += 2;
+    if(((Token *)tokens->data[pos])->ty == TK_IDENT) {
+        pos++;
+        while(((Token *)tokens->data[pos])->ty == ',' && ((Token *)tokens->data[pos + 1])->ty == TK_IDENT) pos += 2;
+    }
+    return ((Token *)tokens->data[pos])->ty == ')' && ((Token *)tokens->data[pos + 1])->ty == '{';
+}
+
+// Labels in a function are named after it, so that different functions can use the same labels.
+// The dot keeps them apart from the labels of the program, which can't have one.
+void rename_labels(Vector *tokens, int pos, char *function) {
+    int depth = 0;
+    for(; ((Token *)tokens->data[pos])->ty != TK_EOF; pos++) {
+        Token *token = tokens->data[pos];
+        if(token->ty == '{') depth++;
+        if(token->ty == '}' && --depth == 0) return;
+        if(token->ty == TK_LABEL || (token->ty == TK_IDENT && ((Token *)tokens->data[pos - 1])->ty == TK_GOTO)) {
+            char *name = malloc(strlen(function) + strlen(token->name) + 2);
+            sprintf(name, "%s.%s", function, token->name);
+            token->name = name;
+        }
+    }
+}
+
+// Parses a definition, whose body becomes a scope of its own that nothing else in the program is in
+void parse_function(Vector *tokens, int *pos) {
+    Node *function = nullary_operation_node(ND_FUNCTION);
+    function->name = get_token(tokens, pos)->name;
+    function->statements = new_vector();
+    *pos = *pos + 2;
+    while(get_token(tokens, pos)->ty == TK_IDENT) {
+        Node *parameter = new_identifier_node(get_token(tokens, pos)->name);
+        for(int i = 0; i < function->statements->len; i++) {
+            if(strcmp(((Node *)function->statements->data[i])->name, parameter->name) == 0) {
+                parse_error(function, "Each parameter of a function needs a different name", __LINE__, *pos);
+            }
+        }
+        vec_push(function->statements, parameter);
+        *pos = *pos + 1;
+        if(get_token(tokens, pos)->ty == ',') *pos = *pos + 1;
+    }
+    expect_token(tokens, pos, __LINE__, ')');
+
+    if(strcmp(function->name, "main") == 0) {
+        parse_error(function, "The program itself is main, so no function can be called that", __LINE__, *pos);
+    }
+    if(find_function(function->name) != NULL) {
+        parse_error(function, "A function can only be defined once", __LINE__, *pos);
+    }
+    rename_labels(tokens, *pos, function->name);
+    expect_token(tokens, pos, __LINE__, '{');
+    Node *outside = NULL;
+    function->middle = parse_scope(tokens, pos, &outside);
+    vec_push(FUNCTIONS, function);
+}
+
+// Parses the arguments of a call, which follow one another down a chain of ND_ARG nodes
+Node *parse_call(Vector *tokens, int *pos, char *name) {
+    Node *call = unary_operation_node(ND_CALL, NULL);
+    call->name = name;
+    Node **next = &call->middle;
+    *pos = *pos + 1;
+    while(get_token(tokens, pos)->ty != ')') {
+        if(call->val > 0) expect_token(tokens, pos, __LINE__, ',');
+        *next = binary_operation_node(ND_ARG, parse_expression(tokens, pos), NULL);
+        next = &(*next)->right;
+        call->val++;
+    }
+    *pos = *pos + 1;
+    vec_push(calls_parsed, call);
+    return call;
+}
+
+// Parses the index of an element of an array: a[i]
+Node *parse_index(Vector *tokens, int *pos, char *name) {
+    *pos = *pos + 1;
+    Node *element = unary_operation_node(ND_INDEX, parse_expression(tokens, pos));
+    element->name = name;
+    expect_token(tokens, pos, __LINE__, ']');
+    return element;
+}
+
+// Checks every call against the function it calls, and that no label of the program takes the
+// name of a function, since both end up as labels in the assembly
+void check_calls(Vector *tokens) {
+    char hint[256];
+    for(int i = 0; i < calls_parsed->len; i++) {
+        Node *call = calls_parsed->data[i];
+        Node *function = find_function(call->name);
+        if(function == NULL) {
+            snprintf(hint, 256, "No function named %s is defined", call->name);
+            parse_error(call, hint, __LINE__, i);
+        }
+        if(function->statements->len != call->val) {
+            snprintf(hint, 256, "%s takes %d arguments, but is called with %d", call->name, function->statements->len, call->val);
+            parse_error(call, hint, __LINE__, i);
+        }
+    }
+    for(int pos = 0; pos < tokens->len; pos++) {
+        Token *token = tokens->data[pos];
+        if(token->ty == TK_LABEL && find_function(token->name) != NULL) {
+            unexpected_token(*token, "A label can't have the same name as a function", __LINE__, pos);
+        }
+    }
+}
+
+int SWITCHES_PARSED = 0;
+
+// The labels a switch makes for itself have dots in their names, which labels in the code can't have
+Node *switch_label(char *kind, int switch_id, int case_id) {
+    char *name = malloc(sizeof(char) * 32);
+    snprintf(name, 32, "%s.%d.%d", kind, switch_id, case_id);
+    return unary_operation_node(ND_LABEL, new_identifier_node(name));
+}
+
+// Computes the value of a case label, which has to be known while parsing
+bool case_value(Node *node, long *value) {
+    long left, right;
+    if(node->ty == ND_CALL) return false;
+    switch(node->arity) {
+        case 0:
+            *value = node->val;
+            return node->ty == ND_NUM;
+        case 1:
+            return case_value(node->middle, &left) && fold_unary(node->ty, left, value);
+        case 2:
+            return case_value(node->left, &left) && case_value(node->right, &right) && fold_binary(node->ty, left, right, value);
+        default:
+            if(node->ty != ND_TERNARY_CONDITIONAL || !case_value(node->left, &left)) return false;
+            return case_value(left ? node->middle : node->right, value);
+    }
+}
+
+// Parses the braces of a switch into a scope of their own. The scope starts with the switch, which
+// jumps to one of the labels its cases became, and ends with the label that a break out of it goes
+// to. Case labels are only allowed right inside of those braces.
+Node *parse_switch_body(Vector *tokens, int *pos, Node **current_scope_node, Node *selector) {
+    int id = SWITCHES_PARSED++;
+    Node *body = new_scope_node(true);
+    Node *dispatch = unary_operation_node(ND_SWITCH, selector);
+    Node *end = switch_label("break", id, 0);
+    dispatch->statements = new_vector();
+    dispatch->break_label = end->middle->name;
+    vec_push(body->statements, dispatch);
+
+    Node *enclosing_switch = current_switch;
+    current_switch = dispatch;
+    Token *current_token = get_token(tokens, pos);
+    Node *expression, *label;
+    long value;
+    while(current_token->ty != '}') {
+        if(current_token->ty == TK_CASE) {
+            *pos = *pos + 1;
+            // A variable followed by the colon is read as a goto label
+            if(get_token(tokens, pos)->ty == TK_LABEL) {
+                return unexpected_token(*get_token(tokens, pos), "Case labels must be constant expressions that fit in 32 bits", __LINE__, *pos);
+            }
+            expression = precedence_12(tokens, pos);
+            if(!case_value(expression, &value) || value != (int)value) {
+                return parse_error(expression, "Case labels must be constant expressions that fit in 32 bits", __LINE__, *pos);
+            }
+            expect_token(tokens, pos, __LINE__, ':');
+            for(int i = 0; i < dispatch->statements->len; i++) {
+                if(((Node *)dispatch->statements->data[i])->val == value) {
+                    return parse_error(expression, "Each case of a switch needs a different value", __LINE__, *pos);
+                }
+            }
+            label = switch_label("case", id, dispatch->statements->len);
+            label->val = value;
+            vec_push(dispatch->statements, label);
+            vec_push(body->statements, label);
+        } else if(current_token->ty == TK_DEFAULT) {
+            *pos = *pos + 1;
+            expect_token(tokens, pos, __LINE__, ':');
+            if(dispatch->jump_target != NULL) {
+                return unexpected_token(*current_token, "A switch can only have one default label", __LINE__, *pos);
+            }
+            dispatch->jump_target = switch_label("default", id, 0);
+            vec_push(body->statements, dispatch->jump_target);
+        } else {
+            parse_statement_into(body->statements, tokens, pos, &body);
+        }
+        current_token = get_token(tokens, pos);
+    }
+    *pos = *pos + 1;
+    current_switch = enclosing_switch;
+
+    vec_push(body->statements, end);
+    if(dispatch->jump_target == NULL) dispatch->jump_target = end;
+    body->parent = *current_scope_node;
+    return body;
+}
 
 Node *parse_code(Vector *tokens) {
     int *pos = malloc(sizeof(int));
@@ -124,12 +354,19 @@ Node *parse_code(Vector *tokens) {
 
     Node *global_scope = new_scope_node(false);
     Node **current_scope_node = &global_scope;
+    FUNCTIONS = new_vector();
+    calls_parsed = new_vector();
     Token *tk = get_token(tokens, pos);
     while(tk->ty != TK_EOF) {
-        vec_push(global_scope->statements, parse_statement(tokens, pos, current_scope_node));
+        if(is_function_definition(tokens, *pos)) {
+            parse_function(tokens, pos);
+        } else {
+            parse_statement_into(global_scope->statements, tokens, pos, current_scope_node);
+        }
         tk = get_token(tokens, pos);
     }
 
+    check_calls(tokens);
     return global_scope;
 }
 
@@ -138,7 +375,7 @@ Node *parse_scope(Vector *tokens, int *pos, Node **current_scope_node) {
     Token *current_token = get_token(tokens, pos);
 
     while(current_token->ty != '}') {
-        vec_push(new_scope->statements, parse_statement(tokens, pos, &new_scope));
+        parse_statement_into(new_scope->statements, tokens, pos, &new_scope);
         current_token = get_token(tokens, pos);
     }
 
@@ -161,13 +398,64 @@ Node *parse_expression(Vector *tokens, int *pos) {
     }
 }
 
+// The size of the variables a type declares, or 0 if the token isn't a type
+int size_of_type(int token_type) {
+    switch(token_type) {
+        case TK_CHAR: return 1;
+        case TK_SHORT: return 2;
+        case TK_INT: return 4;
+        case TK_LONG: return 8;
+        default: return 0;
+    }
+}
+
+// Parses a declaration like int a = 1, b, c[4]; into an assignment for every variable it initializes.
+// The variables themselves were already given their sizes when the scopes were built.
+void parse_declaration(Vector *tokens, int *pos, Vector *statements) {
+    *pos = *pos + 1;
+    while(true) {
+        Token *name = get_token(tokens, pos);
+        if(name->ty != TK_IDENT) unexpected_token(*name, "Expected the name of a variable to declare.", __LINE__, *pos);
+        *pos = *pos + 1;
+        if(get_token(tokens, pos)->ty == '[') {
+            *pos = *pos + 1;
+            Token *length = get_token(tokens, pos);
+            if(length->ty != TK_NUM || length->val <= 0 || length->val > ARRAY_LENGTH_LIMIT) {
+                unexpected_token(*length, "The length of an array has to be a number from 1 to 65536.", __LINE__, *pos);
+            }
+            *pos = *pos + 1;
+            expect_token(tokens, pos, __LINE__, ']');
+            if(get_token(tokens, pos)->ty == '=') {
+                unexpected_token(*get_token(tokens, pos), "Arrays can't be initialized, assign to their elements instead.", __LINE__, *pos);
+            }
+        }
+        if(get_token(tokens, pos)->ty == '=') {
+            *pos = *pos + 1;
+            vec_push(statements, binary_operation_node('=', new_identifier_node(name->name), parse_expression(tokens, pos)));
+        }
+        Token *next_token = get_token(tokens, pos);
+        if(next_token->ty != ',' && next_token->ty != ';') unexpected_token(*next_token, "Expected semicolon.", __LINE__, *pos);
+        *pos = *pos + 1;
+        if(next_token->ty == ';') return;
+    }
+}
+
+// Adds the next statement to a list of them, or as many as a declaration turns into
+void parse_statement_into(Vector *statements, Vector *tokens, int *pos, Node **current_scope_node) {
+    if(size_of_type(get_token(tokens, pos)->ty)) {
+        parse_declaration(tokens, pos, statements);
+    } else {
+        vec_push(statements, parse_statement(tokens, pos, current_scope_node));
+    }
+}
+
 Node *parse_statement(Vector *tokens, int *pos, Node **current_scope_node) {
     Token *current_token = get_token(tokens, pos);
     Token *next_token;
 
     switch(current_token->ty) {
         // A statement might be opening new scope
-        Node *cond_expression, *loop_body, *true_condition, *false_condition, *initializer, *iteration, *label;
+        Node *cond_expression, *loop, *true_condition, *false_condition, *initializer, *iteration, *label, *jump;
         case '{':
             *pos = *pos + 1;
             return parse_scope(tokens, pos, current_scope_node);
@@ -178,11 +466,19 @@ Node *parse_statement(Vector *tokens, int *pos, Node **current_scope_node) {
         case TK_BREAK:
             *pos = *pos + 1;
             expect_token(tokens, pos, __LINE__, ';');
-            return nullary_operation_node(ND_BREAK);
+            // Leaving a switch is a goto to the label at its end
+            if(current_switch != NULL) {
+                return unary_operation_node(ND_GOTO, new_identifier_node(current_switch->break_label));
+            }
+            jump = nullary_operation_node(ND_BREAK);
+            jump->jump_target = current_loop;
+            return jump;
         case TK_CONTINUE:
             *pos = *pos + 1;
             expect_token(tokens, pos, __LINE__, ';');
-            return nullary_operation_node(ND_CONTINUE);
+            jump = nullary_operation_node(ND_CONTINUE);
+            jump->jump_target = current_loop;
+            return jump;
         case TK_IF:
             *pos = *pos + 1;
             expect_token(tokens, pos, __LINE__, '(');
@@ -201,17 +497,19 @@ Node *parse_statement(Vector *tokens, int *pos, Node **current_scope_node) {
             expect_token(tokens, pos, __LINE__, '(');
             cond_expression = parse_expression(tokens, pos);
             expect_token(tokens, pos, __LINE__, ')');
-            loop_body = parse_statement(tokens, pos, current_scope_node);
-            return binary_operation_node(ND_WHILE, cond_expression, loop_body);
+            loop = binary_operation_node(ND_WHILE, cond_expression, NULL);
+            loop->right = parse_loop_body(tokens, pos, current_scope_node, loop);
+            return loop;
         case TK_DO:
             *pos = *pos + 1;
-            loop_body = parse_statement(tokens, pos, current_scope_node);
+            loop = binary_operation_node(ND_DO, NULL, NULL);
+            loop->left = parse_loop_body(tokens, pos, current_scope_node, loop);
             expect_token(tokens, pos, __LINE__, TK_WHILE);
             expect_token(tokens, pos, __LINE__, '(');
-            cond_expression = parse_expression(tokens, pos);
+            loop->right = parse_expression(tokens, pos);
             expect_token(tokens, pos, __LINE__, ')');
             expect_token(tokens, pos, __LINE__, ';');
-            return binary_operation_node(ND_DO, loop_body, cond_expression);
+            return loop;
         case TK_FOR:
             *pos = *pos + 1;
             expect_token(tokens, pos, __LINE__, '(');
@@ -225,8 +523,23 @@ Node *parse_statement(Vector *tokens, int *pos, Node **current_scope_node) {
                 iteration = parse_expression(tokens, pos);
                 expect_token(tokens, pos, __LINE__, ')');
             }
-            loop_body = parse_statement(tokens, pos, current_scope_node);
-            return quaternary_operation_node(ND_FOR, initializer, cond_expression, iteration, loop_body);
+            loop = quaternary_operation_node(ND_FOR, initializer, cond_expression, iteration, NULL);
+            loop->extra = parse_loop_body(tokens, pos, current_scope_node, loop);
+            return loop;
+        case TK_SWITCH:
+            *pos = *pos + 1;
+            expect_token(tokens, pos, __LINE__, '(');
+            cond_expression = parse_expression(tokens, pos);
+            expect_token(tokens, pos, __LINE__, ')');
+            next_token = get_token(tokens, pos);
+            if(next_token->ty != '{') {
+                unexpected_token(*next_token, "The body of a switch must be enclosed in braces.", __LINE__, *pos);
+            }
+            *pos = *pos + 1;
+            return parse_switch_body(tokens, pos, current_scope_node, cond_expression);
+        case TK_CASE:
+        case TK_DEFAULT:
+            return unexpected_token(*current_token, "Case labels can only appear directly inside the braces of a switch.", __LINE__, *pos);
         // Otherwise, treat it as an expression separated by semicolons
         case TK_GOTO:
             *pos = *pos + 1;
@@ -240,7 +553,28 @@ Node *parse_statement(Vector *tokens, int *pos, Node **current_scope_node) {
             label = new_identifier_node(current_token->name);
             *pos = *pos + 1;
             return unary_operation_node(ND_LABEL, label);
+        // Where a single statement goes, like the initializer of a for loop, a declaration can
+        // initialize one variable at most
+        case TK_CHAR:
+        case TK_SHORT:
+        case TK_INT:
+        case TK_LONG: ;
+            Vector *assignments = new_vector();
+            parse_declaration(tokens, pos, assignments);
+            if(assignments->len > 1) {
+                return parse_error(assignments->data[1], "Only one variable can be initialized by a declaration here", __LINE__, *pos);
+            }
+            return assignments->len == 1 ? assignments->data[0] : no_op();
+        // A bare return gives back 0
+        case TK_RETURN:
+            *pos = *pos + 1;
+            cond_expression = get_token(tokens, pos)->ty == ';' ? new_numeric_node(0) : parse_expression(tokens, pos);
+            expect_token(tokens, pos, __LINE__, ';');
+            return unary_operation_node(ND_RETURN, cond_expression);
         default: ;
+            if(is_function_definition(tokens, *pos)) {
+                return unexpected_token(*current_token, "Functions can only be defined at the top level.", __LINE__, *pos);
+            }
             Node *expression = parse_expression(tokens, pos);
             next_token = get_token(tokens, pos);
             if (next_token->ty != ';') {
@@ -269,6 +603,8 @@ Node *precedence_0(Vector *tokens, int *pos) {
             return new_numeric_node(current_token->val);
         case TK_IDENT:
             *pos = *pos + 1;
+            if(get_token(tokens, pos)->ty == '(') return parse_call(tokens, pos, current_token->name);
+            if(get_token(tokens, pos)->ty == '[') return parse_index(tokens, pos, current_token->name);
             return new_identifier_node(current_token->name);
         case '(':
             *pos = *pos + 1;
@@ -284,6 +620,13 @@ Node *precedence_0(Vector *tokens, int *pos) {
     }
 }
 
+// Only variables can be incremented or decremented. An element of an array is assigned instead.
+Node *step_node(int op, Node *operand, int pos) {
+    Node *node = unary_operation_node(op, operand);
+    if(operand->ty == ND_INDEX) parse_error(node, "Write a[i] = a[i] + 1 to step an element of an array.", __LINE__, pos);
+    return node;
+}
+
 // Precedence 1 (Right-to-left associative):
 //  Prefix increment/decrement, unary plus/minus, logical negation, 
 //  bitwise complement, casts, dereference, address, sizeof
@@ -294,12 +637,17 @@ Node *precedence_1(Vector *tokens, int *pos) {
     switch (current_token->ty) {
         case TK_DECREMENT:
             *pos = *pos + 1;
-            return unary_operation_node(ND_PRE_DECREMENT, precedence_1(tokens, pos));
+            return step_node(ND_PRE_DECREMENT, precedence_1(tokens, pos), *pos);
         case TK_INCREMENT:
             *pos = *pos + 1;
-            return unary_operation_node(ND_PRE_INCREMENT, precedence_1(tokens, pos));
+            return step_node(ND_PRE_INCREMENT, precedence_1(tokens, pos), *pos);
         case '-':
             *pos = *pos + 1;
+            // 2147483648 only fits in 32 bits once negated, so the minus goes into the literal
+            if(get_token(tokens, pos)->ty == TK_NUM && get_token(tokens, pos)->val == INT_MIN) {
+                *pos = *pos + 1;
+                return new_numeric_node(INT_MIN);
+            }
             return unary_operation_node(ND_UNARY_NEG, precedence_1(tokens, pos));
         case '+':
             *pos = *pos + 1;
@@ -316,10 +664,10 @@ Node *precedence_1(Vector *tokens, int *pos) {
             switch (next_token->ty) {
                 case TK_INCREMENT:
                     *pos = *pos + 1;
-                    return unary_operation_node(ND_POST_INCREMENT, next_node);
+                    return step_node(ND_POST_INCREMENT, next_node, *pos);
                 case TK_DECREMENT:
                     *pos = *pos + 1;
-                    return unary_operation_node(ND_POST_DECREMENT, next_node);
+                    return step_node(ND_POST_DECREMENT, next_node, *pos);
                 default:
                     return next_node;
             }
@@ -492,7 +840,7 @@ Node *precedence_11(Vector *tokens, int *pos) {
     switch (current_token->ty) {
         case TK_LOR:
             *pos = *pos + 1;
-            return binary_operation_node(ND_LAND, lhs, precedence_11(tokens, pos));
+            return binary_operation_node(ND_LOR, lhs, precedence_11(tokens, pos));
         default:
             return lhs;
     }
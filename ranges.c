@@ -0,0 +1,754 @@
+#include "yacc.h"
+
+/**
+ ** Value range analysis.
+ ** Like constant propagation, the statement trees are abstractly interpreted, but every variable
+ ** and expression is tracked as an interval of the (signed) values it can hold. Intervals start out
+ ** at the literals, and branches narrow them: inside `if(i < n)`, i is at most the largest n minus
+ ** one, and so is the counter inside a loop that tests it. Loops and labels are iterated until
+ ** their entry state settles. Since intervals can keep growing one step at a time, a bound that is
+ ** still moving after a few iterations is pushed all the way out.
+ ** Every node keeps the interval of all values it was seen to take, which range_of() reports. The
+ ** optimizer uses it to replace expressions that can only have one value (like comparisons the
+ ** ranges decide), and masks or remainders that can't change their operand. Codegen uses it to skip
+ ** turning values that are already 0 or 1 into booleans.
+ **/
+
+// Iterations of a loop or label before bounds that keep moving are widened
+#define WIDEN_AFTER 3
+
+typedef struct {
+    bool reachable;
+    Range *vars;            // Indexed by variable id
+    int updates;            // How many times the state at a loop head or label grew
+} RangeEnvironment;
+
+typedef struct {
+    Node *loop;
+    RangeEnvironment *break_env;
+    RangeEnvironment *continue_env;
+} RangeLoop;
+
+int RANGE_VARIABLES;
+Vector *range_loops;
+Map *range_labels;
+bool range_labels_changed;
+
+Range empty_range() {
+    Range range = { RANGE_EMPTY, 0, 0 };
+    return range;
+}
+
+Range interval(long lo, long hi) {
+    if(lo > hi) return empty_range();
+    Range range = { RANGE_BOUNDED, lo, hi };
+    return range;
+}
+
+Range single_value(long val) {
+    return interval(val, val);
+}
+
+Range any_value() {
+    return interval(LONG_MIN, LONG_MAX);
+}
+
+Range range_of(Node *node) {
+    return node->range.state == RANGE_UNKNOWN ? any_value() : node->range;
+}
+
+bool is_known_boolean(Node *node) {
+    Range range = range_of(node);
+    return range.state == RANGE_BOUNDED && range.lo >= 0 && range.hi <= 1;
+}
+
+Range join(Range a, Range b) {
+    if(a.state == RANGE_EMPTY) return b;
+    if(b.state == RANGE_EMPTY) return a;
+    return interval(a.lo < b.lo ? a.lo : b.lo, a.hi > b.hi ? a.hi : b.hi);
+}
+
+Range intersect(Range a, Range b) {
+    if(a.state == RANGE_EMPTY || b.state == RANGE_EMPTY) return empty_range();
+    return interval(a.lo > b.lo ? a.lo : b.lo, a.hi < b.hi ? a.hi : b.hi);
+}
+
+// Pushes the bounds that moved since the last iteration as far as they go
+Range widen(Range old, Range grown) {
+    if(old.state == RANGE_EMPTY || grown.state == RANGE_EMPTY) return grown;
+    return interval(grown.lo < old.lo ? LONG_MIN : grown.lo, grown.hi > old.hi ? LONG_MAX : grown.hi);
+}
+
+bool same_range(Range a, Range b) {
+    if(a.state != b.state) return false;
+    return a.state != RANGE_BOUNDED || (a.lo == b.lo && a.hi == b.hi);
+}
+
+bool may_be_zero(Range range) {
+    return range.state == RANGE_BOUNDED && range.lo <= 0 && range.hi >= 0;
+}
+
+bool may_be_nonzero(Range range) {
+    return range.state == RANGE_BOUNDED && (range.lo != 0 || range.hi != 0);
+}
+
+// The 0 or 1 that logical operators turn a value into
+Range truth_range(Range range) {
+    if(range.state == RANGE_EMPTY) return range;
+    return interval(may_be_zero(range) ? 0 : 1, may_be_nonzero(range) ? 1 : 0);
+}
+
+// Smallest 2^k - 1 that is at least val, for a val that isn't negative
+long all_ones_through(long val) {
+    return val == 0 ? 0 : (long)((~0UL) >> __builtin_clzl(val));
+}
+
+Range add_ranges(Range a, Range b, bool subtract) {
+    long lo, hi;
+    bool overflow = subtract
+        ? __builtin_sub_overflow(a.lo, b.hi, &lo) || __builtin_sub_overflow(a.hi, b.lo, &hi)
+        : __builtin_add_overflow(a.lo, b.lo, &lo) || __builtin_add_overflow(a.hi, b.hi, &hi);
+    return overflow ? any_value() : interval(lo, hi);
+}
+
+Range multiply_ranges(Range a, Range b) {
+    long corners[4];
+    if(__builtin_mul_overflow(a.lo, b.lo, &corners[0]) || __builtin_mul_overflow(a.lo, b.hi, &corners[1])
+       || __builtin_mul_overflow(a.hi, b.lo, &corners[2]) || __builtin_mul_overflow(a.hi, b.hi, &corners[3])) {
+        return any_value();
+    }
+    Range result = single_value(corners[0]);
+    for(int i = 1; i < 4; i++) result = join(result, single_value(corners[i]));
+    return result;
+}
+
+// Division and modulo are unsigned. A divisor that may be zero only matters when it isn't, since
+// the program traps otherwise.
+Range divide_ranges(int op, Range a, Range b) {
+    if(b.lo < 0) return any_value();
+    if(b.hi == 0) return empty_range();
+    long divisor_lo = b.lo > 0 ? b.lo : 1;
+
+    if(op == '/') {
+        if(a.lo >= 0) return interval(a.lo / b.hi, a.hi / divisor_lo);
+        return divisor_lo >= 2 ? interval(0, (long)(~0UL / divisor_lo)) : any_value();
+    }
+    if(a.lo >= 0 && a.hi < divisor_lo) return a;
+    if(a.lo >= 0) return interval(0, a.hi < b.hi - 1 ? a.hi : b.hi - 1);
+    return interval(0, b.hi - 1);
+}
+
+Range bitwise_ranges(int op, Range a, Range b) {
+    switch(op) {
+        case '&':
+            // Masking with a value that isn't negative can't give anything bigger than it
+            if(a.lo >= 0 && b.lo >= 0) return interval(0, a.hi < b.hi ? a.hi : b.hi);
+            if(a.lo >= 0) return interval(0, a.hi);
+            if(b.lo >= 0) return interval(0, b.hi);
+            return any_value();
+        case '|':
+            if(a.lo < 0 || b.lo < 0) return any_value();
+            return interval(a.lo > b.lo ? a.lo : b.lo, all_ones_through(a.hi > b.hi ? a.hi : b.hi));
+        default:
+            if(a.lo < 0 || b.lo < 0) return any_value();
+            return interval(0, all_ones_through(a.hi > b.hi ? a.hi : b.hi));
+    }
+}
+
+// Shifts are logical, and only look at the low 6 bits of the count
+Range shift_ranges(int op, Range a, Range b) {
+    bool count_known = b.lo >= 0 && b.hi <= 63;
+    if(op == ND_LEFT_SHIFT) {
+        if(b.lo != b.hi) return any_value();
+        int count = b.lo & 63;
+        if(a.lo < 0 || a.hi > (LONG_MAX >> count)) return any_value();
+        return interval(a.lo << count, a.hi << count);
+    }
+    if(a.lo >= 0) return count_known ? interval(a.lo >> b.hi, a.hi >> b.lo) : interval(0, a.hi);
+    if(count_known && b.lo >= 1) return interval(0, (long)(~0UL >> b.lo));
+    return any_value();
+}
+
+// Comparisons are signed
+Range compare_ranges(int op, Range a, Range b) {
+    switch(op) {
+        case '<':
+            if(a.hi < b.lo) return single_value(1);
+            if(a.lo >= b.hi) return single_value(0);
+            break;
+        case ND_LEQUAL:
+            if(a.hi <= b.lo) return single_value(1);
+            if(a.lo > b.hi) return single_value(0);
+            break;
+        case '>':
+            return compare_ranges('<', b, a);
+        case ND_GEQUAL:
+            return compare_ranges(ND_LEQUAL, b, a);
+        case ND_EQUAL:
+            if(a.lo == a.hi && b.lo == b.hi && a.lo == b.lo) return single_value(1);
+            if(a.hi < b.lo || b.hi < a.lo) return single_value(0);
+            break;
+        case ND_NEQUAL: {
+            Range equal = compare_ranges(ND_EQUAL, a, b);
+            return equal.lo == equal.hi ? single_value(!equal.lo) : equal;
+        }
+    }
+    return interval(0, 1);
+}
+
+Range binary_range(int op, Range a, Range b) {
+    if(a.state == RANGE_EMPTY || b.state == RANGE_EMPTY) return empty_range();
+
+    switch(op) {
+        case '+':
+            return add_ranges(a, b, false);
+        case '-':
+            return add_ranges(a, b, true);
+        case '*':
+            return multiply_ranges(a, b);
+        case '/':
+        case '%':
+            return divide_ranges(op, a, b);
+        case '&':
+        case '|':
+        case '^':
+            return bitwise_ranges(op, a, b);
+        case ND_LEFT_SHIFT:
+        case ND_RIGHT_SHIFT:
+            return shift_ranges(op, a, b);
+        default:
+            return compare_ranges(op, a, b);
+    }
+}
+
+Range unary_range(int op, Range a) {
+    if(a.state == RANGE_EMPTY) return a;
+
+    switch(op) {
+        case ND_UNARY_NEG:
+            return a.lo == LONG_MIN ? any_value() : interval(-a.hi, -a.lo);
+        case ND_UNARY_BIT_COMPLEMENT:
+            return interval(~a.hi, ~a.lo);
+        case ND_UNARY_BOOLEAN_NOT:
+            return interval(may_be_nonzero(a) ? 0 : 1, may_be_zero(a) ? 1 : 0);
+        default:
+            return a;
+    }
+}
+
+RangeEnvironment *new_range_environment(bool reachable) {
+    RangeEnvironment *env = malloc(sizeof(RangeEnvironment));
+    env->reachable = reachable;
+    env->updates = 0;
+    env->vars = malloc(sizeof(Range) * (RANGE_VARIABLES + 1));
+    for(int i = 0; i < RANGE_VARIABLES; i++) {
+        // Variables start out holding whatever was on the stack before
+        env->vars[i] = reachable ? any_value() : empty_range();
+    }
+    return env;
+}
+
+RangeEnvironment *copy_range_environment(RangeEnvironment *env) {
+    RangeEnvironment *copy = new_range_environment(env->reachable);
+    memcpy(copy->vars, env->vars, sizeof(Range) * RANGE_VARIABLES);
+    return copy;
+}
+
+// Merges the state of src into dst. Returns true if dst changed.
+bool merge_into(RangeEnvironment *dst, RangeEnvironment *src, bool widening) {
+    if(!src->reachable) return false;
+    if(!dst->reachable) {
+        dst->reachable = true;
+        memcpy(dst->vars, src->vars, sizeof(Range) * RANGE_VARIABLES);
+        return true;
+    }
+
+    bool changed = false;
+    for(int i = 0; i < RANGE_VARIABLES; i++) {
+        Range merged = join(dst->vars[i], src->vars[i]);
+        if(widening && dst->updates >= WIDEN_AFTER) merged = widen(dst->vars[i], merged);
+        if(!same_range(merged, dst->vars[i])) {
+            dst->vars[i] = merged;
+            changed = true;
+        }
+    }
+    if(changed) dst->updates++;
+    return changed;
+}
+
+bool join_into(RangeEnvironment *dst, RangeEnvironment *src) {
+    return merge_into(dst, src, false);
+}
+
+// For the state at loop heads and labels, which may keep growing
+bool widen_into(RangeEnvironment *dst, RangeEnvironment *src) {
+    return merge_into(dst, src, true);
+}
+
+void record_range(Node *node, RangeEnvironment *env, Range range) {
+    if(env->reachable) node->range = join(node->range, range);
+}
+
+// Narrows a variable to the values it can have when `variable op bound` holds
+void constrain_variable(RangeEnvironment *env, Node *variable, int op, Range bound) {
+    int id = variable_of(variable);
+    Range range = env->vars[id];
+    if(bound.state == RANGE_EMPTY) op = 0;
+    switch(op) {
+        case '<':
+            range = bound.hi == LONG_MIN ? empty_range() : intersect(range, interval(LONG_MIN, bound.hi - 1));
+            break;
+        case ND_LEQUAL:
+            range = intersect(range, interval(LONG_MIN, bound.hi));
+            break;
+        case '>':
+            range = bound.lo == LONG_MAX ? empty_range() : intersect(range, interval(bound.lo + 1, LONG_MAX));
+            break;
+        case ND_GEQUAL:
+            range = intersect(range, interval(bound.lo, LONG_MAX));
+            break;
+        case ND_EQUAL:
+            range = intersect(range, bound);
+            break;
+        case ND_NEQUAL:
+            if(bound.lo != bound.hi || range.state == RANGE_EMPTY) break;
+            if(range.lo == bound.lo) range = range.lo == LONG_MAX ? empty_range() : interval(range.lo + 1, range.hi);
+            else if(range.hi == bound.lo) range = interval(range.lo, range.hi - 1);
+            break;
+        default:
+            // Nothing satisfies a comparison with an operand that has no value
+            range = empty_range();
+            break;
+    }
+    env->vars[id] = range;
+    if(range.state == RANGE_EMPTY) env->reachable = false;
+}
+
+Range operand_range(Node *node, RangeEnvironment *env) {
+    if(node->ty == ND_NUM) return single_value(node->val);
+    if(node->ty == ND_IDENT) return env->vars[variable_of(node)];
+    return any_value();
+}
+
+// Narrows the variables of a condition (that has no side effects) to the values they can have
+// when it evaluates to the given outcome
+void constrain(RangeEnvironment *env, Node *cond, bool outcome) {
+    if(!env->reachable) return;
+
+    switch(cond->ty) {
+        case ND_IDENT:
+            constrain_variable(env, cond, outcome ? ND_NEQUAL : ND_EQUAL, single_value(0));
+            return;
+        case ND_UNARY_BOOLEAN_NOT:
+            constrain(env, cond->middle, !outcome);
+            return;
+        case ND_LAND:
+        case ND_LOR:
+            // Both sides are only known when && is true or || is false
+            if(outcome != (cond->ty == ND_LAND)) return;
+            constrain(env, cond->left, outcome);
+            constrain(env, cond->right, outcome);
+            return;
+        default:
+            break;
+    }
+    if(!is_comparison(cond->ty)) return;
+
+    int op = outcome ? cond->ty : inverse_comparison(cond->ty);
+    Range left = operand_range(cond->left, env), right = operand_range(cond->right, env);
+    if(cond->left->ty == ND_IDENT) constrain_variable(env, cond->left, op, right);
+    if(cond->right->ty == ND_IDENT) constrain_variable(env, cond->right, swap_comparison(op), left);
+}
+
+// The state on the side of a branch where the condition had the given outcome
+RangeEnvironment *assume(RangeEnvironment *env, Node *cond, Range value, bool outcome) {
+    RangeEnvironment *result = copy_range_environment(env);
+    result->reachable = env->reachable && (outcome ? may_be_nonzero(value) : may_be_zero(value));
+    if(!has_side_effects(cond)) constrain(result, cond, outcome);
+    return result;
+}
+
+RangeLoop *push_range_loop(Node *loop) {
+    RangeLoop *context = malloc(sizeof(RangeLoop));
+    context->loop = loop;
+    context->break_env = new_range_environment(false);
+    context->continue_env = new_range_environment(false);
+    vec_push(range_loops, context);
+    return context;
+}
+
+RangeLoop *find_range_loop(Node *loop) {
+    for(int i = range_loops->len - 1; i >= 0; i--) {
+        RangeLoop *context = range_loops->data[i];
+        if(context->loop == loop) return context;
+    }
+    return NULL;
+}
+
+Range evaluate_range(Node *node, RangeEnvironment *env);
+void interpret_ranges(Node *node, RangeEnvironment *env);
+
+// A variable narrower than a long keeps the low bytes of what is stored in it. Values that don't
+// fit wrap around, anywhere in the range of its type unless there is only one.
+Range stored_range(int id, Range value) {
+    int size = variable_size(id);
+    if(size == 8 || value.state == RANGE_EMPTY) return value;
+    long lo = -(1L << (size * 8 - 1)), hi = (1L << (size * 8 - 1)) - 1;
+    if(value.lo >= lo && value.hi <= hi) return value;
+    if(value.lo == value.hi) return single_value(truncate_to_size(value.lo, size));
+    return interval(lo, hi);
+}
+
+Range step_range(Node *node, RangeEnvironment *env, int delta, bool return_old) {
+    // lvals have to stay lvals, so nothing is ever known about them
+    record_range(node->middle, env, any_value());
+    int id = variable_of(node->middle);
+    Range old = env->vars[id];
+    env->vars[id] = old.state == RANGE_EMPTY ? old : stored_range(id, add_ranges(old, single_value(delta), false));
+    return return_old ? old : env->vars[id];
+}
+
+Range evaluate_range_uncached(Node *node, RangeEnvironment *env) {
+    Range left, right;
+    RangeEnvironment *true_env, *false_env;
+
+    switch(node->ty) {
+        case ND_NUM:
+            return single_value(node->val);
+        case ND_IDENT:
+            return env->vars[variable_of(node)];
+        // Nothing is tracked of the elements of an array but what they have room for
+        case ND_INDEX:
+            if(evaluate_range(node->middle, env).state == RANGE_EMPTY) return empty_range();
+            return stored_range(get_variable_id(node->scope, node->name), any_value());
+        case '=':
+            record_range(node->left, env, any_value());
+            if(node->left->ty == ND_INDEX) {
+                evaluate_range(node->left->middle, env);
+                return stored_range(get_variable_id(node->left->scope, node->left->name), evaluate_range(node->right, env));
+            }
+            right = stored_range(variable_of(node->left), evaluate_range(node->right, env));
+            if(env->reachable) env->vars[variable_of(node->left)] = right;
+            return right;
+        case ND_PRE_INCREMENT:
+            return step_range(node, env, 1, false);
+        case ND_PRE_DECREMENT:
+            return step_range(node, env, -1, false);
+        case ND_POST_INCREMENT:
+            return step_range(node, env, 1, true);
+        case ND_POST_DECREMENT:
+            return step_range(node, env, -1, true);
+        case ND_UNARY_NEG:
+        case ND_UNARY_POS:
+        case ND_UNARY_BIT_COMPLEMENT:
+        case ND_UNARY_BOOLEAN_NOT:
+            return unary_range(node->ty, evaluate_range(node->middle, env));
+        case ND_LAND:
+        case ND_LOR:
+            // The right hand side only runs when the left one doesn't already decide the result
+            left = evaluate_range(node->left, env);
+            true_env = assume(env, node->left, left, node->ty == ND_LAND);
+            false_env = assume(env, node->left, left, node->ty != ND_LAND);
+            right = evaluate_range(node->right, true_env);
+            env->reachable = false;
+            join_into(env, true_env);
+            join_into(env, false_env);
+            return join(true_env->reachable ? truth_range(right) : empty_range(),
+                        false_env->reachable ? single_value(node->ty == ND_LOR) : empty_range());
+        case ND_TERNARY_CONDITIONAL:
+            left = evaluate_range(node->left, env);
+            true_env = assume(env, node->left, left, true);
+            false_env = assume(env, node->left, left, false);
+            left = evaluate_range(node->middle, true_env);
+            right = evaluate_range(node->right, false_env);
+            env->reachable = false;
+            join_into(env, true_env);
+            join_into(env, false_env);
+            return join(true_env->reachable ? left : empty_range(), false_env->reachable ? right : empty_range());
+        case ND_CALL:
+            if(node->middle) evaluate_range(node->middle, env);
+            return any_value();
+        case ND_ARG:
+            evaluate_range(node->left, env);
+            if(node->right) evaluate_range(node->right, env);
+            return any_value();
+        default:
+            left = evaluate_range(node->left, env);
+            right = evaluate_range(node->right, env);
+            return binary_range(node->ty, left, right);
+    }
+}
+
+Range evaluate_range(Node *node, RangeEnvironment *env) {
+    if(!env->reachable) return empty_range();
+    Range range = evaluate_range_uncached(node, env);
+    record_range(node, env, range);
+    return range;
+}
+
+void interpret_while_ranges(Node *loop, RangeEnvironment *env) {
+    RangeEnvironment *entry = copy_range_environment(env);
+    RangeEnvironment *head = copy_range_environment(env);
+    RangeEnvironment *exit_env;
+    RangeLoop *context;
+
+    while(true) {
+        context = push_range_loop(loop);
+        RangeEnvironment *cond_env = copy_range_environment(head);
+        Range cond = evaluate_range(loop->left, cond_env);
+        RangeEnvironment *body_env = assume(cond_env, loop->left, cond, true);
+        exit_env = assume(cond_env, loop->left, cond, false);
+        interpret_ranges(loop->right, body_env);
+        range_loops->len--;
+
+        RangeEnvironment *next_head = copy_range_environment(entry);
+        join_into(next_head, body_env);
+        join_into(next_head, context->continue_env);
+        if(!widen_into(head, next_head)) break;
+    }
+
+    *env = *exit_env;
+    join_into(env, context->break_env);
+}
+
+void interpret_do_ranges(Node *loop, RangeEnvironment *env) {
+    RangeEnvironment *entry = copy_range_environment(env);
+    RangeEnvironment *head = copy_range_environment(env);
+    RangeEnvironment *exit_env;
+    RangeLoop *context;
+
+    while(true) {
+        context = push_range_loop(loop);
+        RangeEnvironment *body_env = copy_range_environment(head);
+        interpret_ranges(loop->left, body_env);
+        range_loops->len--;
+
+        join_into(body_env, context->continue_env);
+        Range cond = evaluate_range(loop->right, body_env);
+        exit_env = assume(body_env, loop->right, cond, false);
+
+        RangeEnvironment *next_head = copy_range_environment(entry);
+        join_into(next_head, assume(body_env, loop->right, cond, true));
+        if(!widen_into(head, next_head)) break;
+    }
+
+    *env = *exit_env;
+    join_into(env, context->break_env);
+}
+
+void interpret_for_ranges(Node *loop, RangeEnvironment *env) {
+    interpret_ranges(loop->left, env);
+    RangeEnvironment *entry = copy_range_environment(env);
+    RangeEnvironment *head = copy_range_environment(env);
+    RangeEnvironment *exit_env;
+    RangeLoop *context;
+
+    while(true) {
+        context = push_range_loop(loop);
+        RangeEnvironment *cond_env = copy_range_environment(head);
+        RangeEnvironment *body_env;
+        if(loop->middle->ty == ND_NOOP) {
+            // A missing condition is always true
+            body_env = copy_range_environment(cond_env);
+            exit_env = new_range_environment(false);
+        } else {
+            Range cond = evaluate_range(loop->middle, cond_env);
+            body_env = assume(cond_env, loop->middle, cond, true);
+            exit_env = assume(cond_env, loop->middle, cond, false);
+        }
+        interpret_ranges(loop->extra, body_env);
+        range_loops->len--;
+
+        join_into(body_env, context->continue_env);
+        interpret_ranges(loop->right, body_env);
+
+        RangeEnvironment *next_head = copy_range_environment(entry);
+        join_into(next_head, body_env);
+        if(!widen_into(head, next_head)) break;
+    }
+
+    *env = *exit_env;
+    join_into(env, context->break_env);
+}
+
+// Widens what the label a jump goes to starts with by the state at the jump
+void widen_at_label(char *name, RangeEnvironment *env) {
+    RangeEnvironment *label_env = map_get(range_labels, name);
+    if(label_env == NULL) {
+        label_env = new_range_environment(false);
+        map_put(range_labels, name, label_env);
+    }
+    if(widen_into(label_env, env)) range_labels_changed = true;
+}
+
+void interpret_ranges(Node *node, RangeEnvironment *env) {
+    RangeEnvironment *true_env, *false_env, *label_env;
+    RangeLoop *context;
+    Range cond;
+
+    switch(node->ty) {
+        case ND_SCOPE:
+            if(node->descend && env->reachable) {
+                for(int i = 0; i < node->scope->variable_ids->vals->len; i++) {
+                    env->vars[(long)node->scope->variable_ids->vals->data[i]] = any_value();
+                }
+            }
+            for(int i = 0; i < node->statements->len; i++) {
+                interpret_ranges(node->statements->data[i], env);
+            }
+            return;
+        case ND_NOOP:
+            return;
+        case ND_LABEL:
+            label_env = map_get(range_labels, node->middle->name);
+            if(label_env) join_into(env, label_env);
+            return;
+        case ND_GOTO:
+            widen_at_label(node->middle->name, env);
+            env->reachable = false;
+            return;
+        case ND_SWITCH:
+            evaluate_range(node->middle, env);
+            for(int i = 0; i < node->statements->len; i++) {
+                widen_at_label(((Node *)node->statements->data[i])->middle->name, env);
+            }
+            widen_at_label(node->jump_target->middle->name, env);
+            env->reachable = false;
+            return;
+        case ND_BREAK:
+        case ND_CONTINUE:
+            if(node->jump_target == NULL) return;
+            context = find_range_loop(node->jump_target);
+            join_into(node->ty == ND_BREAK ? context->break_env : context->continue_env, env);
+            env->reachable = false;
+            return;
+        case ND_RETURN:
+            evaluate_range(node->middle, env);
+            env->reachable = false;
+            return;
+        case ND_IF:
+            cond = evaluate_range(node->left, env);
+            true_env = assume(env, node->left, cond, true);
+            false_env = assume(env, node->left, cond, false);
+            interpret_ranges(node->middle, true_env);
+            interpret_ranges(node->right, false_env);
+            env->reachable = false;
+            join_into(env, true_env);
+            join_into(env, false_env);
+            return;
+        case ND_WHILE:
+            interpret_while_ranges(node, env);
+            return;
+        case ND_DO:
+            interpret_do_ranges(node, env);
+            return;
+        case ND_FOR:
+            interpret_for_ranges(node, env);
+            return;
+        default:
+            evaluate_range(node, env);
+            return;
+    }
+}
+
+void clear_ranges(Node *node) {
+    if(node == NULL) return;
+    node->range = empty_range();
+    clear_ranges(node->left);
+    clear_ranges(node->middle);
+    clear_ranges(node->right);
+    clear_ranges(node->extra);
+    if(node->ty == ND_SCOPE) {
+        for(int i = 0; i < node->statements->len; i++) clear_ranges(node->statements->data[i]);
+    }
+}
+
+// Records the range of every node in the program
+void analyze_ranges(Node *program) {
+    RANGE_VARIABLES = variable_count();
+    clear_ranges(program);
+    range_loops = new_vector();
+    range_labels = new_map(NULL);
+
+    do {
+        range_labels_changed = false;
+        interpret_ranges(program, new_range_environment(true));
+    } while(range_labels_changed);
+}
+
+// Whether the operation leaves its left operand as it is: x & mask where the mask keeps every
+// bit x can have, or x % c where x is always smaller than c
+bool keeps_operand(Node *node) {
+    if(node->right == NULL || node->right->ty != ND_NUM || node->right->val <= 0) return false;
+    Range operand = range_of(node->left);
+    if(operand.state != RANGE_BOUNDED || operand.lo < 0) return false;
+
+    long constant = node->right->val;
+    if(node->ty == '&') return (all_ones_through(operand.hi) & ~constant) == 0;
+    if(node->ty == '%') return operand.hi < constant;
+    return false;
+}
+
+bool narrow_expression(Node *node) {
+    if(node == NULL) return false;
+
+    Range range = node->range;
+    if(range.state == RANGE_BOUNDED && range.lo == range.hi && node->ty != ND_NUM && fits_in_immediate(range.lo) && !has_side_effects(node)) {
+        node->ty = ND_NUM;
+        node->arity = 0;
+        node->val = range.lo;
+        node->left = node->middle = node->right = NULL;
+        return true;
+    }
+    if(node->range.state != RANGE_EMPTY && keeps_operand(node)) {
+        memcpy(node, node->left, sizeof(Node));
+        narrow_expression(node);
+        return true;
+    }
+
+    bool changed = narrow_expression(node->left);
+    changed |= narrow_expression(node->middle);
+    changed |= narrow_expression(node->right);
+    return changed;
+}
+
+bool narrow_statement(Node *node) {
+    bool changed = false;
+    switch(node->ty) {
+        case ND_SCOPE:
+            for(int i = 0; i < node->statements->len; i++) changed |= narrow_statement(node->statements->data[i]);
+            return changed;
+        case ND_NOOP:
+        case ND_LABEL:
+        case ND_GOTO:
+        case ND_BREAK:
+        case ND_CONTINUE:
+            return false;
+        case ND_SWITCH:
+        case ND_RETURN:
+            return narrow_expression(node->middle);
+        case ND_IF:
+            changed = narrow_expression(node->left);
+            changed |= narrow_statement(node->middle);
+            return narrow_statement(node->right) | changed;
+        case ND_WHILE:
+            changed = narrow_expression(node->left);
+            return narrow_statement(node->right) | changed;
+        case ND_DO:
+            changed = narrow_statement(node->left);
+            return narrow_expression(node->right) | changed;
+        case ND_FOR:
+            changed = narrow_statement(node->left);
+            changed |= narrow_expression(node->middle);
+            changed |= narrow_statement(node->right);
+            return narrow_statement(node->extra) | changed;
+        default:
+            return narrow_expression(node);
+    }
+}
+
+// Replaces what the ranges show to be constant or redundant. Returns true if anything changed.
+bool narrow_ranges(Node *program) {
+    analyze_ranges(program);
+    return narrow_statement(program);
+}
@@ -0,0 +1,555 @@
+#include "yacc.h"
+
+/**
+ ** Sparse conditional constant propagation.
+ ** The statement trees are abstractly interpreted, tracking for every variable whether it is
+ ** unassigned, a known constant, or varying. Only paths that can actually be taken are followed,
+ ** so a branch that is never taken can't spoil the values seen after it. Loops and labels are
+ ** iterated until the values flowing into them stop changing.
+ **/
+
+typedef struct {
+    bool reachable;
+    LatticeValue *vars;     // Indexed by variable id
+} Environment;
+
+typedef struct {
+    Node *loop;
+    Environment *break_env;     // Everything that leaves the loop through a break
+    Environment *continue_env;  // Everything that skips to the next iteration through a continue
+} LoopContext;
+
+int NUM_VARIABLES;
+Vector *loop_contexts;
+Map *label_environments;
+bool labels_changed;
+
+LatticeValue undefined() {
+    LatticeValue value = { LAT_UNDEF, 0 };
+    return value;
+}
+
+LatticeValue constant(long val) {
+    LatticeValue value = { LAT_CONST, val };
+    return value;
+}
+
+LatticeValue varying() {
+    LatticeValue value = { LAT_VARYING, 0 };
+    return value;
+}
+
+LatticeValue meet(LatticeValue a, LatticeValue b) {
+    if(a.state == LAT_UNDEF) return b;
+    if(b.state == LAT_UNDEF) return a;
+    if(a.state == LAT_CONST && b.state == LAT_CONST && a.val == b.val) return a;
+    return varying();
+}
+
+Environment *new_environment(bool reachable) {
+    Environment *env = malloc(sizeof(Environment));
+    env->reachable = reachable;
+    env->vars = malloc(sizeof(LatticeValue) * (NUM_VARIABLES + 1));
+    for(int i = 0; i < NUM_VARIABLES; i++) {
+        // Variables start out holding whatever was on the stack before
+        env->vars[i] = reachable ? varying() : undefined();
+    }
+    return env;
+}
+
+Environment *copy_environment(Environment *env) {
+    Environment *copy = new_environment(env->reachable);
+    memcpy(copy->vars, env->vars, sizeof(LatticeValue) * NUM_VARIABLES);
+    return copy;
+}
+
+// Merges the state of src into dst. Returns true if dst changed.
+bool meet_into(Environment *dst, Environment *src) {
+    if(!src->reachable) return false;
+    if(!dst->reachable) {
+        dst->reachable = true;
+        memcpy(dst->vars, src->vars, sizeof(LatticeValue) * NUM_VARIABLES);
+        return true;
+    }
+
+    bool changed = false;
+    for(int i = 0; i < NUM_VARIABLES; i++) {
+        LatticeValue merged = meet(dst->vars[i], src->vars[i]);
+        if(merged.state != dst->vars[i].state || merged.val != dst->vars[i].val) {
+            dst->vars[i] = merged;
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+// Keeps track of every value a node was seen evaluating to
+void record(Node *node, Environment *env, LatticeValue value) {
+    if(env->reachable) {
+        node->lattice = meet(node->lattice, value);
+    }
+}
+
+bool may_be_true(LatticeValue value) {
+    return value.state == LAT_VARYING || (value.state == LAT_CONST && value.val != 0);
+}
+
+bool may_be_false(LatticeValue value) {
+    return value.state == LAT_VARYING || (value.state == LAT_CONST && value.val == 0);
+}
+
+// The 0 or 1 that && and || turn a value into
+LatticeValue truth_of(LatticeValue value) {
+    if(value.state == LAT_CONST) return constant(value.val != 0);
+    return value;
+}
+
+// Only lets the environment continue if the branch could be taken
+Environment *branch(Environment *env, bool taken) {
+    Environment *result = copy_environment(env);
+    result->reachable = env->reachable && taken;
+    return result;
+}
+
+LoopContext *push_loop(Node *loop) {
+    LoopContext *context = malloc(sizeof(LoopContext));
+    context->loop = loop;
+    context->break_env = new_environment(false);
+    context->continue_env = new_environment(false);
+    vec_push(loop_contexts, context);
+    return context;
+}
+
+void pop_loop() {
+    loop_contexts->len--;
+}
+
+LoopContext *find_loop(Node *loop) {
+    for(int i = loop_contexts->len - 1; i >= 0; i--) {
+        LoopContext *context = loop_contexts->data[i];
+        if(context->loop == loop) return context;
+    }
+    return NULL;
+}
+
+int variable_of(Node *node) {
+    if(node->ty != ND_IDENT && node->ty != ND_INDEX) {
+        fprintf(stderr, "Expected an lval but found %d\n", node->ty);
+        exit(CODEGEN_ERROR);
+    }
+    return get_variable_id(node->scope, node->name);
+}
+
+LatticeValue evaluate(Node *node, Environment *env);
+void interpret(Node *node, Environment *env);
+
+// A variable narrower than a long only keeps the low bytes of a constant stored in it
+LatticeValue stored_value(int id, LatticeValue value) {
+    return value.state == LAT_CONST ? constant(truncate_to_size(value.val, variable_size(id))) : value;
+}
+
+// Applies an increment/decrement to a variable, returning the values before and after
+LatticeValue step_variable(Node *node, Environment *env, int delta, bool return_old) {
+    // lvals are never turned into constants
+    record(node->middle, env, varying());
+    int id = variable_of(node->middle);
+    LatticeValue old = env->vars[id];
+    LatticeValue updated = old.state == LAT_CONST ? stored_value(id, constant((unsigned long)old.val + delta)) : old;
+    env->vars[id] = updated;
+    return return_old ? old : updated;
+}
+
+LatticeValue evaluate_uncached(Node *node, Environment *env) {
+    LatticeValue left, right, cond;
+    Environment *true_env, *false_env;
+    long result;
+
+    switch(node->ty) {
+        case ND_NUM:
+            return constant(node->val);
+        case ND_IDENT:
+            return env->vars[variable_of(node)];
+        // The elements of arrays aren't tracked, only what their indexes are
+        case ND_INDEX:
+            left = evaluate(node->middle, env);
+            return left.state == LAT_UNDEF ? undefined() : varying();
+        case '=':
+            record(node->left, env, varying());
+            if(node->left->ty == ND_INDEX) {
+                evaluate(node->left->middle, env);
+                return stored_value(get_variable_id(node->left->scope, node->left->name), evaluate(node->right, env));
+            }
+            right = stored_value(variable_of(node->left), evaluate(node->right, env));
+            if(env->reachable) env->vars[variable_of(node->left)] = right;
+            return right;
+        case ND_PRE_INCREMENT:
+            return step_variable(node, env, 1, false);
+        case ND_PRE_DECREMENT:
+            return step_variable(node, env, -1, false);
+        case ND_POST_INCREMENT:
+            return step_variable(node, env, 1, true);
+        case ND_POST_DECREMENT:
+            return step_variable(node, env, -1, true);
+        case ND_UNARY_NEG:
+        case ND_UNARY_POS:
+        case ND_UNARY_BIT_COMPLEMENT:
+        case ND_UNARY_BOOLEAN_NOT:
+            left = evaluate(node->middle, env);
+            if(left.state == LAT_CONST && fold_unary(node->ty, left.val, &result)) return constant(result);
+            return left.state == LAT_UNDEF ? undefined() : varying();
+        case ND_LAND:
+        case ND_LOR:
+            // The right hand side only runs when the left one doesn't already decide the result
+            cond = evaluate(node->left, env);
+            true_env = branch(env, node->ty == ND_LAND ? may_be_true(cond) : may_be_false(cond));
+            false_env = branch(env, node->ty == ND_LAND ? may_be_false(cond) : may_be_true(cond));
+            right = evaluate(node->right, true_env);
+            env->reachable = false;
+            meet_into(env, true_env);
+            meet_into(env, false_env);
+            return meet(true_env->reachable ? truth_of(right) : undefined(), false_env->reachable ? constant(node->ty == ND_LOR) : undefined());
+        case ND_TERNARY_CONDITIONAL:
+            cond = evaluate(node->left, env);
+            true_env = branch(env, may_be_true(cond));
+            false_env = branch(env, may_be_false(cond));
+            left = evaluate(node->middle, true_env);
+            right = evaluate(node->right, false_env);
+            env->reachable = false;
+            meet_into(env, true_env);
+            meet_into(env, false_env);
+            return meet(true_env->reachable ? left : undefined(), false_env->reachable ? right : undefined());
+        // Nothing is known of what a function returns, only of its arguments
+        case ND_CALL:
+            if(node->middle) evaluate(node->middle, env);
+            return varying();
+        case ND_ARG:
+            evaluate(node->left, env);
+            if(node->right) evaluate(node->right, env);
+            return varying();
+        default:
+            left = evaluate(node->left, env);
+            right = evaluate(node->right, env);
+            if(left.state == LAT_CONST && right.state == LAT_CONST && fold_binary(node->ty, left.val, right.val, &result)) {
+                return constant(result);
+            }
+            return (left.state == LAT_UNDEF || right.state == LAT_UNDEF) ? undefined() : varying();
+    }
+}
+
+LatticeValue evaluate(Node *node, Environment *env) {
+    if(!env->reachable) return undefined();
+    LatticeValue value = evaluate_uncached(node, env);
+    record(node, env, value);
+    return value;
+}
+
+// Loops are run until the state at their head stops changing
+void interpret_while(Node *loop, Environment *env) {
+    Environment *entry = copy_environment(env);
+    Environment *head = copy_environment(env);
+    Environment *exit_env;
+    LoopContext *context;
+
+    while(true) {
+        context = push_loop(loop);
+        Environment *cond_env = copy_environment(head);
+        LatticeValue cond = evaluate(loop->left, cond_env);
+        Environment *body_env = branch(cond_env, may_be_true(cond));
+        exit_env = branch(cond_env, may_be_false(cond));
+        interpret(loop->right, body_env);
+        pop_loop();
+
+        Environment *next_head = copy_environment(entry);
+        meet_into(next_head, body_env);
+        meet_into(next_head, context->continue_env);
+        if(!meet_into(head, next_head)) break;
+    }
+
+    *env = *exit_env;
+    meet_into(env, context->break_env);
+}
+
+void interpret_do(Node *loop, Environment *env) {
+    Environment *entry = copy_environment(env);
+    Environment *head = copy_environment(env);
+    Environment *exit_env;
+    LoopContext *context;
+
+    while(true) {
+        context = push_loop(loop);
+        Environment *body_env = copy_environment(head);
+        interpret(loop->left, body_env);
+        pop_loop();
+
+        meet_into(body_env, context->continue_env);
+        LatticeValue cond = evaluate(loop->right, body_env);
+        exit_env = branch(body_env, may_be_false(cond));
+
+        Environment *next_head = copy_environment(entry);
+        meet_into(next_head, branch(body_env, may_be_true(cond)));
+        if(!meet_into(head, next_head)) break;
+    }
+
+    *env = *exit_env;
+    meet_into(env, context->break_env);
+}
+
+void interpret_for(Node *loop, Environment *env) {
+    interpret(loop->left, env);
+    Environment *entry = copy_environment(env);
+    Environment *head = copy_environment(env);
+    Environment *exit_env;
+    LoopContext *context;
+
+    while(true) {
+        context = push_loop(loop);
+        Environment *cond_env = copy_environment(head);
+        // A missing condition is always true
+        LatticeValue cond = constant(1);
+        if(loop->middle->ty != ND_NOOP) {
+            cond = evaluate(loop->middle, cond_env);
+        }
+        Environment *body_env = branch(cond_env, may_be_true(cond));
+        exit_env = branch(cond_env, may_be_false(cond));
+        interpret(loop->extra, body_env);
+        pop_loop();
+
+        meet_into(body_env, context->continue_env);
+        interpret(loop->right, body_env);
+
+        Environment *next_head = copy_environment(entry);
+        meet_into(next_head, body_env);
+        if(!meet_into(head, next_head)) break;
+    }
+
+    *env = *exit_env;
+    meet_into(env, context->break_env);
+}
+
+// Adds the state at a jump to what the label it goes to starts with
+void meet_at_label(char *name, Environment *env) {
+    Environment *label_env = map_get(label_environments, name);
+    if(label_env == NULL) {
+        label_env = new_environment(false);
+        map_put(label_environments, name, label_env);
+    }
+    if(meet_into(label_env, env)) labels_changed = true;
+}
+
+// Interprets a statement, leaving env as the state after it. Unreachable statements are still
+// walked, since labels inside of them can be jumped to.
+void interpret(Node *node, Environment *env) {
+    Environment *true_env, *false_env, *label_env;
+    LatticeValue cond;
+    LoopContext *context;
+
+    switch(node->ty) {
+        case ND_SCOPE:
+            record(node, env, varying());
+            if(node->descend && env->reachable) {
+                // Variables in a new scope hold whatever was left on the stack
+                for(int i = 0; i < node->scope->variable_ids->vals->len; i++) {
+                    env->vars[(long)node->scope->variable_ids->vals->data[i]] = varying();
+                }
+            }
+            for(int i = 0; i < node->statements->len; i++) {
+                interpret(node->statements->data[i], env);
+            }
+            return;
+        case ND_NOOP:
+            record(node, env, varying());
+            return;
+        case ND_LABEL:
+            label_env = map_get(label_environments, node->middle->name);
+            if(label_env) meet_into(env, label_env);
+            record(node, env, varying());
+            return;
+        case ND_GOTO:
+            record(node, env, varying());
+            meet_at_label(node->middle->name, env);
+            env->reachable = false;
+            return;
+        case ND_SWITCH:
+            record(node, env, varying());
+            cond = evaluate(node->middle, env);
+            // A known selector only ever goes to one of the labels
+            if(cond.state == LAT_CONST) {
+                meet_at_label(matching_case(node, cond.val)->middle->name, env);
+            } else {
+                for(int i = 0; i < node->statements->len; i++) {
+                    meet_at_label(((Node *)node->statements->data[i])->middle->name, env);
+                }
+                meet_at_label(node->jump_target->middle->name, env);
+            }
+            env->reachable = false;
+            return;
+        case ND_BREAK:
+        case ND_CONTINUE:
+            record(node, env, varying());
+            // Breaks outside of loops are ignored by codegen
+            if(node->jump_target == NULL) return;
+            context = find_loop(node->jump_target);
+            meet_into(node->ty == ND_BREAK ? context->break_env : context->continue_env, env);
+            env->reachable = false;
+            return;
+        case ND_RETURN:
+            record(node, env, varying());
+            evaluate(node->middle, env);
+            env->reachable = false;
+            return;
+        case ND_IF:
+            record(node, env, varying());
+            cond = evaluate(node->left, env);
+            true_env = branch(env, may_be_true(cond));
+            false_env = branch(env, may_be_false(cond));
+            interpret(node->middle, true_env);
+            interpret(node->right, false_env);
+            env->reachable = false;
+            meet_into(env, true_env);
+            meet_into(env, false_env);
+            return;
+        case ND_WHILE:
+            record(node, env, varying());
+            interpret_while(node, env);
+            return;
+        case ND_DO:
+            record(node, env, varying());
+            interpret_do(node, env);
+            return;
+        case ND_FOR:
+            record(node, env, varying());
+            interpret_for(node, env);
+            return;
+        default:
+            evaluate(node, env);
+            return;
+    }
+}
+
+// Checks that no part of a statement can run, not even a label inside of it
+bool is_dead(Node *node) {
+    if(node == NULL) return true;
+    if(node->lattice.state != LAT_UNDEF) return false;
+    if(node->ty == ND_SCOPE) {
+        for(int i = 0; i < node->statements->len; i++) {
+            if(!is_dead(node->statements->data[i])) return false;
+        }
+    }
+    return is_dead(node->left) && is_dead(node->middle) && is_dead(node->right) && is_dead(node->extra);
+}
+
+// A known condition lets codegen drop whatever it skips over, so it's only reported as known
+// when the skipped statements can't be reached some other way.
+int static_condition(Node *cond, Node *skipped_if_true, Node *skipped_if_false) {
+    if(cond->lattice.state != LAT_CONST) return COND_UNKNOWN;
+    if(cond->lattice.val) {
+        return is_dead(skipped_if_true) ? COND_ALWAYS_TRUE : COND_UNKNOWN;
+    }
+    return is_dead(skipped_if_false) ? COND_ALWAYS_FALSE : COND_UNKNOWN;
+}
+
+bool fits_in_immediate(long val) {
+    return val >= -2147483648L && val <= 2147483647L;
+}
+
+// Replaces expressions that always compute the same value with that value
+void rewrite_expression(Node *node) {
+    if(node == NULL) return;
+
+    if(node->lattice.state == LAT_CONST && node->ty != ND_NUM && fits_in_immediate(node->lattice.val) && !has_side_effects(node)) {
+        node->ty = ND_NUM;
+        node->arity = 0;
+        node->val = node->lattice.val;
+        node->left = node->middle = node->right = NULL;
+        return;
+    }
+
+    if(node->ty == ND_TERNARY_CONDITIONAL) {
+        node->static_cond = static_condition(node->left, NULL, NULL);
+    }
+
+    rewrite_expression(node->left);
+    rewrite_expression(node->middle);
+    rewrite_expression(node->right);
+}
+
+void rewrite_statement(Node *node) {
+    // A statement that is never reached from above still has to be generated if a goto can land in it
+    if(is_dead(node)) {
+        node->unreachable = true;
+        return;
+    }
+
+    switch(node->ty) {
+        case ND_SCOPE:
+            for(int i = 0; i < node->statements->len; i++) {
+                rewrite_statement(node->statements->data[i]);
+            }
+            return;
+        case ND_NOOP:
+        case ND_LABEL:
+        case ND_GOTO:
+        case ND_BREAK:
+        case ND_CONTINUE:
+            return;
+        case ND_SWITCH:
+            rewrite_expression(node->middle);
+            return;
+        case ND_IF:
+            node->static_cond = static_condition(node->left, node->right, node->middle);
+            rewrite_expression(node->left);
+            rewrite_statement(node->middle);
+            rewrite_statement(node->right);
+            return;
+        case ND_WHILE:
+            node->static_cond = static_condition(node->left, NULL, node->right);
+            rewrite_expression(node->left);
+            rewrite_statement(node->right);
+            return;
+        case ND_DO:
+            node->static_cond = static_condition(node->right, NULL, NULL);
+            rewrite_statement(node->left);
+            rewrite_expression(node->right);
+            return;
+        case ND_FOR:
+            rewrite_statement(node->left);
+            if(node->middle->ty != ND_NOOP) {
+                node->static_cond = static_condition(node->middle, NULL, node->extra);
+                rewrite_expression(node->middle);
+            }
+            rewrite_statement(node->right);
+            rewrite_statement(node->extra);
+            return;
+        default:
+            rewrite_expression(node);
+            return;
+    }
+}
+
+// Forgets what an earlier run found, since the passes in between may have changed what the nodes compute
+void clear_lattice(Node *node) {
+    if(node == NULL) return;
+    node->lattice = undefined();
+    clear_lattice(node->left);
+    clear_lattice(node->middle);
+    clear_lattice(node->right);
+    clear_lattice(node->extra);
+    if(node->ty == ND_SCOPE) {
+        for(int i = 0; i < node->statements->len; i++) clear_lattice(node->statements->data[i]);
+    }
+}
+
+void propagate_constants(Node *program) {
+    NUM_VARIABLES = variable_count();
+    clear_lattice(program);
+    loop_contexts = new_vector();
+    label_environments = new_map(NULL);
+
+    // Gotos can jump backwards, so keep going until the state at every label has settled
+    do {
+        labels_changed = false;
+        interpret(program, new_environment(true));
+    } while(labels_changed);
+
+    rewrite_statement(program);
+}
@@ -1,5 +1,7 @@
 #include "yacc.h"
 
+int VARIABLES_DECLARED = 0;
+
 // Creates and returns a new scope. If the parent scope was passed in, 
 // adds a new reference to this scope in it's sub_scopes variable 
 Scope *new_scope(Scope *parent_scope) {
@@ -7,8 +9,10 @@ Scope *new_scope(Scope *parent_scope) {
     scope->sub_scopes = new_vector();
     scope->variables_declared = new_map((void *)(long)-1);
     scope->labels_declared = new_vector();
+    scope->variable_ids = new_map((void *)(long)-1);
     scope->parent_scope = parent_scope;
     scope->scopes_traversed = 0;
+    scope->frame_size = 0;
 
     if(parent_scope != NULL) {
         vec_push(parent_scope->sub_scopes, (void *)scope);
@@ -29,12 +33,72 @@ bool variable_already_declared(Scope *target_scope, char *variable_name) {
     }
 }
 
+// The size of every variable (of its elements, for an array) and the length of every array,
+// indexed by its id
+int *VARIABLE_SIZES = NULL;
+int *VARIABLE_LENGTHS = NULL;
+int VARIABLE_SIZES_CAPACITY = 0;
+
+int variable_size(int id) {
+    return VARIABLE_SIZES[id];
+}
+
+int variable_length(int id) {
+    return VARIABLE_LENGTHS[id];
+}
+
+// Lays the variables of a scope out on its frame, the widest first. Each offset is then a multiple
+// of the variable's size, so every variable is aligned without padding any of them. An array takes
+// the room of all its elements, the first one at its offset.
+void lay_out_variables(Scope *scope) {
+    int offset = 0;
+    for(int size = 8; size >= 1; size /= 2) {
+        for(int i = 0; i < scope->variables_declared->keys->len; i++) {
+            int id = (long)scope->variable_ids->vals->data[i];
+            if(VARIABLE_SIZES[id] != size) continue;
+            offset += VARIABLE_LENGTHS[id] ? size * VARIABLE_LENGTHS[id] : size;
+            scope->variables_declared->vals->data[i] = (void *)(long)offset;
+        }
+    }
+    scope->frame_size = (offset + 7) & ~7;
+}
+
+// Declares an array of length elements of the given size in the scope itself, even if an enclosing
+// scope already has a variable of the same name. A length of 0 declares a variable that isn't one.
+void declare_array(Scope *target_scope, char *variable_name, int size, int length) {
+    if(VARIABLES_DECLARED == VARIABLE_SIZES_CAPACITY) {
+        VARIABLE_SIZES_CAPACITY = VARIABLE_SIZES_CAPACITY ? VARIABLE_SIZES_CAPACITY * 2 : 64;
+        VARIABLE_SIZES = realloc(VARIABLE_SIZES, sizeof(int) * VARIABLE_SIZES_CAPACITY);
+        VARIABLE_LENGTHS = realloc(VARIABLE_LENGTHS, sizeof(int) * VARIABLE_SIZES_CAPACITY);
+    }
+    VARIABLE_SIZES[VARIABLES_DECLARED] = size;
+    VARIABLE_LENGTHS[VARIABLES_DECLARED] = length;
+    map_put(target_scope->variables_declared, variable_name, (void *)(long)0);
+    map_put(target_scope->variable_ids, variable_name, (void *)(long)VARIABLES_DECLARED++);
+    lay_out_variables(target_scope);
+}
+
+// Declares a variable of the given size in the scope itself
+void declare_sized_variable(Scope *target_scope, char *variable_name, int size) {
+    declare_array(target_scope, variable_name, size, 0);
+}
+
+// Variables that are used without being declared are longs
 void declare_variable(Scope *target_scope, char *variable_name) {
     if (variable_already_declared(target_scope, variable_name)) {
         return;
     } else {
-        // TODO: Eventually add support for types larger than 8 bytes
-        map_put(target_scope->variables_declared, variable_name, (void *)(long)((target_scope->variables_declared->keys->len + 1) * 8));
+        declare_sized_variable(target_scope, variable_name, 8);
+    }
+}
+
+// Keeps the low bytes of a value that is stored in a variable of the given size, sign-extended
+long truncate_to_size(long val, int size) {
+    switch(size) {
+        case 1: return (signed char)val;
+        case 2: return (short)val;
+        case 4: return (int)val;
+        default: return val;
     }
 }
 
@@ -73,6 +137,9 @@ VariableAddress *gvl_helper(Scope *current_scope, char *variable_name, int scope
         VariableAddress *new_address = malloc(sizeof(VariableAddress));
         new_address->offset = lookup_in_current_scope;
         new_address->scopes_up = scopes_climbed;
+        int id = (long)map_get(current_scope->variable_ids, variable_name);
+        new_address->size = VARIABLE_SIZES[id];
+        new_address->length = VARIABLE_LENGTHS[id];
         return new_address;
     } else {
         return gvl_helper(current_scope->parent_scope, variable_name, scopes_climbed + 1);
@@ -83,31 +150,122 @@ VariableAddress *get_variable_location(Scope *current_scope, char *variable_name
     return gvl_helper(current_scope, variable_name, 0);
 }
 
+// Returns an id for the variable that is unique across all scopes, so analyses can tell apart
+// variables of the same name declared in sibling scopes
+int get_variable_id(Scope *current_scope, char *variable_name) {
+    if(current_scope == NULL) {
+        fprintf(stderr, "Use of undeclared variable %s.\n", variable_name);
+        exit(SCOPE_ERROR);
+    }
+
+    int id = (long)map_get(current_scope->variable_ids, variable_name);
+    if(id != -1) {
+        return id;
+    }
+    return get_variable_id(current_scope->parent_scope, variable_name);
+}
+
+int variable_count() {
+    return VARIABLES_DECLARED;
+}
+
+// Whether the name comes up between the brace that opens the scope and the token at pos
+bool used_earlier_in_scope(Vector *tokens, int pos, char *name) {
+    int depth = 0;
+    for(pos--; pos >= 0; pos--) {
+        Token *token = tokens->data[pos];
+        if(token->ty == '}') depth++;
+        if(token->ty == '{' && depth-- == 0) return false;
+        if(token->ty == TK_IDENT && strcmp(token->name, name) == 0) return true;
+    }
+    return false;
+}
+
+// The variable named at pos is declared with a type, and a length if it is an array. It can shadow
+// one of an enclosing scope, but not once the scope has used that one, since every use in a scope
+// refers to the same variable.
+void declare_typed_variable(Scope *scope, Vector *tokens, int pos, int size) {
+    char *name = ((Token *)tokens->data[pos])->name;
+    int length = ((Token *)tokens->data[pos + 1])->ty == '[' ? ((Token *)tokens->data[pos + 2])->val : 0;
+    int id = (long)map_get(scope->variable_ids, name);
+    if(id != -1) {
+        if(VARIABLE_SIZES[id] == size && VARIABLE_LENGTHS[id] == length) return;
+        fprintf(stderr, "Error: Conflicting declarations of variable '%s'\n", name);
+        exit(SCOPE_ERROR);
+    }
+    if(variable_already_declared(scope, name) && used_earlier_in_scope(tokens, pos, name)) {
+        fprintf(stderr, "Error: Variable '%s' is declared after the scope uses the one it shadows\n", name);
+        exit(SCOPE_ERROR);
+    }
+    declare_array(scope, name, size, length);
+}
+
+// The scopes of the function bodies, in the order they are defined. Each is a root of its own,
+// since a function can't see the variables of the program.
+Vector *FUNCTION_SCOPES = NULL;
+
 Scope *construct_scope_from_token_stream(Vector *tokens) {
-    Scope *current_scope = new_scope(NULL);
+    Scope *global_scope = new_scope(NULL);
+    Scope *current_scope = global_scope;
+    FUNCTION_SCOPES = new_vector();
+    // The size of the declaration being read, whether its next identifier is a variable it declares,
+    // and how deep in parentheses its initializer is
+    int declaring = 0, parentheses = 0;
+    bool expecting_name = false;
 
     // Loop through all the tokens
-    for (int pos = 0; tokens->data[pos]; pos++) {
+    for (int pos = 0; ((Token *)tokens->data[pos])->ty != TK_EOF; pos++) {
         Token tk = *((Token *)tokens->data[pos]);
+        // A function's body starts out with its parameters, in order, so their offsets follow them
+        if(current_scope == global_scope && is_function_definition(tokens, pos)) {
+            current_scope = new_scope(NULL);
+            vec_push(FUNCTION_SCOPES, current_scope);
+            for(pos += 2; ((Token *)tokens->data[pos])->ty != ')'; pos++) {
+                Token *parameter = tokens->data[pos];
+                if(parameter->ty == TK_IDENT) declare_variable(current_scope, parameter->name);
+            }
+            // Skips the brace, which the body's scope stands for
+            pos++;
         // Every time we have an open brace, open a new child scope
-        if(tk.ty == '{') {
+        } else if(tk.ty == '{') {
             current_scope = new_scope(current_scope);
         // If we've closed the scope, try to go up one level in the scope.
         } else if(tk.ty == '}') {
+            if(current_scope->parent_scope == NULL && current_scope != global_scope) {
+                current_scope = global_scope;
+                continue;
+            }
             current_scope = current_scope->parent_scope;
             if (current_scope == NULL) {
                 fprintf(stderr, "Mismatched braces!\n");
                 exit(SCOPE_ERROR);
             }
-        // When we find the identifier, try to create it in the current scope.
+        // When we find the identifier, try to create it in the current scope. One followed by a
+        // parenthesis is the function a call is to instead.
         } else if(tk.ty == TK_IDENT) {
-            declare_variable(current_scope, tk.name);
+            if(((Token *)tokens->data[pos + 1])->ty == '(') continue;
+            if(expecting_name) {
+                declare_typed_variable(current_scope, tokens, pos, declaring);
+                expecting_name = false;
+            } else {
+                declare_variable(current_scope, tk.name);
+            }
         } else if(tk.ty == TK_LABEL) {
             declare_label(current_scope, tk.name);
+        } else if(size_of_type(tk.ty)) {
+            declaring = size_of_type(tk.ty);
+            expecting_name = true;
+            parentheses = 0;
+        } else if(declaring && (tk.ty == '(' || tk.ty == ')')) {
+            parentheses += tk.ty == '(' ? 1 : -1;
+        } else if(declaring && tk.ty == ',' && parentheses == 0) {
+            expecting_name = true;
+        } else if(tk.ty == ';') {
+            declaring = 0;
         }
     }
 
-    if(current_scope->parent_scope != NULL) {
+    if(current_scope != global_scope) {
         fprintf(stderr, "Mismatched braces!\n");
         exit(SCOPE_ERROR);
     }
@@ -116,4 +274,70 @@ Scope *construct_scope_from_token_stream(Vector *tokens) {
 
 Scope *get_next_child_scope(Scope *current_scope) {
     return (Scope *)current_scope->sub_scopes->data[current_scope->scopes_traversed];
-}
\ No newline at end of file
+}
+
+// An array is only used through its elements, and only an array has elements
+void check_array_use(Node *node, Scope *scope) {
+    bool is_array = VARIABLE_LENGTHS[get_variable_id(scope, node->name)] > 0;
+    if(is_array && node->ty == ND_IDENT) {
+        fprintf(stderr, "Error: Array '%s' can only be used through its elements, like %s[0]\n", node->name, node->name);
+        exit(SCOPE_ERROR);
+    }
+    if(!is_array && node->ty == ND_INDEX) {
+        fprintf(stderr, "Error: Variable '%s' isn't an array\n", node->name);
+        exit(SCOPE_ERROR);
+    }
+}
+
+// Walks the parsed code in the same order the scopes were constructed from the token stream and
+// records on every node the scope it lives in. Once bound, passes can freely drop or duplicate
+// statements without codegen losing track of which scope comes next.
+void bind_scopes(Node *node, Scope *current_scope) {
+    if(node == NULL) return;
+
+    if(node->ty == ND_SCOPE && node->descend) {
+        Scope *child_scope = get_next_child_scope(current_scope);
+        current_scope->scopes_traversed++;
+        current_scope = child_scope;
+    }
+    node->scope = current_scope;
+
+    // Labels are named by identifiers too, which aren't variables
+    if(node->ty == ND_GOTO || node->ty == ND_LABEL) {
+        node->middle->scope = current_scope;
+        return;
+    }
+    if(node->ty == ND_IDENT || node->ty == ND_INDEX) check_array_use(node, current_scope);
+
+    // The labels of a switch don't come from the token stream, so they are declared here, in the
+    // scope its braces open
+    if(node->ty == ND_SWITCH) {
+        for(int i = 0; i < node->statements->len; i++) {
+            Node *label = node->statements->data[i];
+            declare_label(current_scope, label->middle->name);
+        }
+        if(strcmp(node->jump_target->middle->name, node->break_label) != 0) declare_label(current_scope, node->jump_target->middle->name);
+        declare_label(current_scope, node->break_label);
+    }
+
+    bind_scopes(node->left, current_scope);
+    bind_scopes(node->middle, current_scope);
+    bind_scopes(node->right, current_scope);
+    bind_scopes(node->extra, current_scope);
+    if(node->ty == ND_SCOPE) {
+        for(int i = 0; i < node->statements->len; i++) {
+            bind_scopes(node->statements->data[i], current_scope);
+        }
+    }
+}
+
+// A function's body is bound like the program is, from a scope holding just the one its
+// parameters were declared in
+void bind_function(Node *function, Scope *scope) {
+    Scope *outside = new_scope(NULL);
+    vec_push(outside->sub_scopes, scope);
+    bind_scopes(function->middle, outside);
+    for(int i = 0; i < function->statements->len; i++) {
+        ((Node *)function->statements->data[i])->scope = scope;
+    }
+}
@@ -0,0 +1,870 @@
+#include "yacc.h"
+
+/**
+ ** Instruction selection by tree pattern matching.
+ ** On its own, codegen is a stack machine: every operand gets pushed and popped, even literals and
+ ** variables. Instead, each expression tree is first labelled bottom up with the cheapest rule that
+ ** gets its value into rax, where the rules match small subtrees against x86 instructions that take
+ ** immediate and memory operands. The tree is then covered top down with the rules that were picked.
+ ** Whatever no rule matches falls back to the stack machine.
+ ** Code is written for the width of the value that is needed: all 8 bytes of it, only the low 4
+ ** (when it ends up in an int or narrower variable), or none (when it is thrown away). The 32-bit
+ ** forms of instructions don't need a REX prefix, and writing eax clears the upper half of rax.
+ **/
+
+enum {
+    RULE_NONE = 0,
+    RULE_FALLBACK,      // The generic stack machine code, then pop rax
+    RULE_LOAD,          // mov rax, imm/[mem]
+    RULE_OP_OPERAND,    // Left side into rax, then op rax, imm/[mem]
+    RULE_OP_SWAPPED,    // Right side into rax, then combined with an imm/[mem] left side
+    RULE_OP_REGISTERS,  // Both sides into registers, saving the left one on the stack meanwhile
+    RULE_LEA_INDEX,     // a + (b << k) as lea rax, [rax+rbx*2^k]
+    RULE_LEA_SCALED,    // (a << k) + imm as lea rax, [rax*2^k+imm]
+    RULE_UNARY,
+    RULE_INCREMENT,     // ++/-- directly in memory
+    RULE_STORE,         // Value into rax, then mov [mem], rax
+    RULE_UPDATE,        // x = x op v as op [mem], v
+    RULE_UPDATE_COMMUTED,   // x = v op x, the same way
+    RULE_LOGICAL,       // && and || as a jump on the left side, then setcc on the right one
+    RULE_SELECT,        // c ? a : b computing both sides, then picking one with cmov
+    RULE_ELEMENT,       // Index into rax, then mov rax, [base+rax*size]
+    RULE_STORE_ELEMENT, // Index and value into rax and rbx, then mov [base+rax*size], rbx
+    RULE_SUPEROPT,      // Variables into rax and rcx, then the sequence the superoptimizer found
+};
+
+// The most a side of a ternary may cost for both sides to be computed instead of branching.
+// Branching is cheap when it's predicted right, so this only pays off for small expressions.
+#define MAX_SELECT_ARM_COST 4
+
+void label(Node *node, Scope *scope);
+
+bool is_operand(Node *node) {
+    return node->ty == ND_NUM || node->ty == ND_IDENT;
+}
+
+bool is_binary_operation(int op) {
+    switch(op) {
+        case '+':
+        case '-':
+        case '*':
+        case '/':
+        case '%':
+        case '&':
+        case '|':
+        case '^':
+        case ND_LEFT_SHIFT:
+        case ND_RIGHT_SHIFT:
+        case ND_EQUAL:
+        case ND_NEQUAL:
+        case ND_GEQUAL:
+        case ND_LEQUAL:
+        case '<':
+        case '>':
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Operations that can update a variable in place: op [mem], v
+bool is_update_operation(int op) {
+    switch(op) {
+        case '+':
+        case '-':
+        case '&':
+        case '|':
+        case '^':
+        case ND_LEFT_SHIFT:
+        case ND_RIGHT_SHIFT:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// The comparison to use when the operands trade places: a < b is b > a
+int swap_comparison(int op) {
+    switch(op) {
+        case ND_GEQUAL: return ND_LEQUAL;
+        case ND_LEQUAL: return ND_GEQUAL;
+        case '<': return '>';
+        case '>': return '<';
+        default: return op;
+    }
+}
+
+char *condition_code(int op) {
+    switch(op) {
+        case ND_EQUAL: return "e";
+        case ND_NEQUAL: return "ne";
+        case ND_GEQUAL: return "ge";
+        case ND_LEQUAL: return "le";
+        case '<': return "l";
+        default: return "g";
+    }
+}
+
+// Whether the node is x << k or x * 2^k for a k that an address can scale by
+int scale_of(Node *node) {
+    if(node->right == NULL || node->right->ty != ND_NUM) return 0;
+    if(node->ty == ND_LEFT_SHIFT && node->right->val >= 1 && node->right->val <= 3) return 1 << node->right->val;
+    if(node->ty == '*' && (node->right->val == 2 || node->right->val == 4 || node->right->val == 8)) return node->right->val;
+    return 0;
+}
+
+// Variables of outer scopes are reached by climbing saved base pointers, one instruction per scope.
+// Narrower variables need sign-extending before they can be combined with a value.
+int operand_cost(Node *node, Scope *scope) {
+    if(node->ty == ND_NUM) return 0;
+    VariableAddress *address = get_variable_location(scope, node->name);
+    return address->scopes_up + (address->size < 8);
+}
+
+// The register holding the base pointer of a variable's scope. For variables of outer scopes, this
+// writes the code that puts it in r11, so it has to come right before its use.
+char *base_pointer(VariableAddress *address) {
+    if(address->scopes_up == 0) return "rbp";
+    emit("\tmov r11, [rbp]\n");
+    for(int i = 1; i < address->scopes_up; i++) {
+        emit("\tmov r11, [r11]\n");
+    }
+    return "r11";
+}
+
+// Returns the address of a variable, like [rbp-8], and sets its size
+char *variable_address(Node *node, Scope *scope, int *size) {
+    char *text = malloc(sizeof(char) * 32);
+    VariableAddress *address = get_variable_location(scope, node->name);
+    *size = address->size;
+    snprintf(text, 32, "[%s-%d]", base_pointer(address), address->offset);
+    return text;
+}
+
+// Returns the address of an element of an array whose index is in the register, like
+// [rbp+rax*8-64], and sets the size of the element
+char *element_address(Node *node, Scope *scope, char *index, int *size) {
+    char *text = malloc(sizeof(char) * 48);
+    VariableAddress *address = get_variable_location(scope, node->name);
+    *size = address->size;
+    snprintf(text, 48, "[%s+%s*%d-%d]", base_pointer(address), index, address->size, address->offset);
+    return text;
+}
+
+// The memory operand of a variable, as wide as the variable
+char *variable_memory(Node *node, Scope *scope) {
+    int size;
+    char *address = variable_address(node, scope, &size);
+    char *text = malloc(sizeof(char) * 48);
+    snprintf(text, 48, "%s PTR %s", size_keyword(size), address);
+    return text;
+}
+
+// Writes the code that loads a variable of the given size into rax (or eax, for a width of 4)
+void gen_load(char *address, int size, int width) {
+    if(size >= width) {
+        emit("\tmov %s, %s PTR %s\n", sized_register("rax", width), size_keyword(width), address);
+    } else {
+        emit("\t%s %s, %s PTR %s\n", width == 8 && size == 4 ? "movsxd" : "movsx", sized_register("rax", width), size_keyword(size), address);
+    }
+}
+
+// Returns an imm/[mem] operand for a literal or variable, as wide as the width (8 or 4). A
+// variable narrower than that is sign-extended into r11 first, which then is the operand.
+char *operand(Node *node, Scope *scope, int width) {
+    char *text = malloc(sizeof(char) * 48);
+    if(node->ty == ND_NUM) {
+        snprintf(text, 48, "%d", node->val);
+        return text;
+    }
+
+    int size;
+    char *address = variable_address(node, scope, &size);
+    if(size >= width) {
+        snprintf(text, 48, "%s PTR %s", size_keyword(width), address);
+        return text;
+    }
+    emit("\t%s %s, %s PTR %s\n", width == 8 && size == 4 ? "movsxd" : "movsx", sized_register("r11", width), size_keyword(size), address);
+    return sized_register("r11", width);
+}
+
+// Only the low bytes of the result of these depend on nothing but the low bytes of their operands
+bool keeps_low_bytes(int op) {
+    switch(op) {
+        case '+':
+        case '-':
+        case '*':
+        case '&':
+        case '|':
+        case '^':
+        case ND_UNARY_NEG:
+        case ND_UNARY_POS:
+        case ND_UNARY_BIT_COMPLEMENT:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// The width an operation works at when its value is needed at the given width. When no more than the
+// low half of it is, that is all an operation that keeps low bytes computes from its operands.
+int operation_width(int op, int width) {
+    return width < 8 && keeps_low_bytes(op) ? 4 : 8;
+}
+
+// Roughly how many instructions op rax, right takes on top of getting its operands ready
+int operation_cost(int op, Node *right) {
+    switch(op) {
+        case '*':
+            // imul takes three cycles, about as long as the shifts and leas that replace it
+            if(right && right->ty == ND_NUM) return is_power_of_two(right->val) ? 1 : 2;
+            return 2;
+        case '/':
+        case '%':
+            if(right && right->ty == ND_NUM) return right->val > 0 && is_power_of_two(right->val) ? 1 : 6;
+            return 4;
+        case ND_LEFT_SHIFT:
+        case ND_RIGHT_SHIFT:
+            return right && right->ty == ND_NUM ? 1 : 2;
+        case ND_EQUAL:
+        case ND_NEQUAL:
+        case ND_GEQUAL:
+        case ND_LEQUAL:
+        case '<':
+        case '>':
+            return 3;
+        default:
+            return 1;
+    }
+}
+
+// Writes rax = rax op right, where right is a literal, a variable or (when NULL) rbx. At a width of
+// 4, the operation is done on eax instead.
+void gen_operation(int op, Node *right, Scope *scope, int width) {
+    if(right && right->ty == ND_NUM) {
+        switch(op) {
+            case '*':
+            case '/':
+            case '%':
+                gen_constant_operation(op, right->val);
+                return;
+            case ND_LEFT_SHIFT:
+            case ND_RIGHT_SHIFT:
+                // The hardware only looks at the low 6 bits of the count, so we do the same
+                if(right->val & 63) emit("\t%s rax, %d\n", op == ND_LEFT_SHIFT ? "shl" : "shr", right->val & 63);
+                return;
+            default:
+                break;
+        }
+    }
+
+    char *source = right ? operand(right, scope, width) : sized_register("rbx", width);
+    char *destination = sized_register("rax", width);
+    switch(op) {
+        case '+':
+            emit("\tadd %s, %s\n", destination, source);
+            break;
+        case '-':
+            emit("\tsub %s, %s\n", destination, source);
+            break;
+        case '&':
+            emit("\tand %s, %s\n", destination, source);
+            break;
+        case '|':
+            emit("\tor %s, %s\n", destination, source);
+            break;
+        case '^':
+            emit("\txor %s, %s\n", destination, source);
+            break;
+        case '*':
+            // The low 64 bits of the product don't depend on signedness
+            emit("\timul %s, %s\n", destination, source);
+            break;
+        case '/':
+        case '%':
+            if(right) emit("\tmov rbx, %s\n", source);
+            emit("\txor edx, edx\n");
+            emit("\tdiv rbx\n");
+            if(op == '%') emit("\tmov rax, rdx\n");
+            break;
+        case ND_LEFT_SHIFT:
+        case ND_RIGHT_SHIFT:
+            emit("\tmov rcx, %s\n", source);
+            emit("\t%s rax, cl\n", op == ND_LEFT_SHIFT ? "shl" : "shr");
+            break;
+        default:
+            emit("\tcmp rax, %s\n", source);
+            emit("\tset%s al\n", condition_code(op));
+            emit("\tmovzx eax, al\n");
+            break;
+    }
+}
+
+// Keeps a rule if it is cheaper than the best one found so far
+void consider(Node *node, int rule, int cost) {
+    if(node->rule == RULE_NONE || cost < node->cost) {
+        node->rule = rule;
+        node->cost = cost;
+    }
+}
+
+// The cost of computing the right side first and then combining it with an imm/[mem] left side, or -1
+// if that can't be done. Reading the left side last is only fine when the right one can't change it.
+int swapped_cost(Node *node, Scope *scope) {
+    int op = node->ty;
+    if(!is_operand(node->left) || (node->left->ty != ND_NUM && has_side_effects(node->right))) return -1;
+
+    int combine;
+    switch(op) {
+        case '+':
+        case '*':
+        case '&':
+        case '|':
+        case '^':
+        case ND_EQUAL:
+        case ND_NEQUAL:
+        case ND_GEQUAL:
+        case ND_LEQUAL:
+        case '<':
+        case '>':
+            combine = operation_cost(op, node->left);
+            break;
+        case '-':
+            combine = 2;
+            break;
+        default:
+            combine = 2 + operation_cost(op, NULL);
+            break;
+    }
+    return node->right->cost + operand_cost(node->left, scope) + combine;
+}
+
+void label_binary(Node *node, Scope *scope) {
+    Node *left = node->left;
+    Node *right = node->right;
+    int op = node->ty;
+
+    int swapped = swapped_cost(node, scope);
+    // On a tie, a literal on either side stays an immediate rather than being loaded into rax
+    if(left->ty == ND_NUM && swapped >= 0) consider(node, RULE_OP_SWAPPED, swapped);
+    if(is_operand(right)) {
+        consider(node, RULE_OP_OPERAND, left->cost + operand_cost(right, scope) + operation_cost(op, right));
+    }
+    if(swapped >= 0) consider(node, RULE_OP_SWAPPED, swapped);
+    consider(node, RULE_OP_REGISTERS, left->cost + right->cost + 3 + operation_cost(op, NULL));
+
+    if(op == '+' && (scale_of(left) || scale_of(right))) {
+        Node *first = scale_of(left) ? left->left : left;
+        Node *second = scale_of(left) ? right : right->left;
+        int second_cost = is_operand(second) ? operand_cost(second, scope) + 1 : second->cost + 3;
+        consider(node, RULE_LEA_INDEX, first->cost + second_cost + 1);
+    }
+    if((op == '+' || op == '-') && scale_of(left) && right->ty == ND_NUM && right->val != -2147483648) {
+        consider(node, RULE_LEA_SCALED, left->left->cost + 1);
+    }
+}
+
+void label_assignment(Node *node, Scope *scope) {
+    Node *value = node->right;
+    consider(node, RULE_STORE, value->cost + operand_cost(node->left, scope) + 1);
+
+    // x = x op v can work on x where it is, as long as v leaves x alone. Shifting only the bytes of
+    // a narrower variable would shift in zeroes where its sign extension should go.
+    bool narrow = get_variable_location(scope, node->left->name)->size < 8;
+    if(narrow && (value->ty == ND_LEFT_SHIFT || value->ty == ND_RIGHT_SHIFT)) return;
+    if(is_update_operation(value->ty) && same_expression(node->left, value->left)) {
+        Node *update = value->right;
+        if(update->ty == ND_NUM) {
+            consider(node, RULE_UPDATE, operand_cost(node->left, scope) + 2);
+        } else if(!has_side_effects(update)) {
+            consider(node, RULE_UPDATE, update->cost + operand_cost(node->left, scope) + 2);
+        }
+    }
+    // Here v is computed before x is read anyway
+    if(is_update_operation(value->ty) && is_commutative(value->ty) && same_expression(node->left, value->right)) {
+        consider(node, RULE_UPDATE_COMMUTED, value->left->cost + operand_cost(node->left, scope) + 2);
+    }
+}
+
+// Whether the code for a labelled node stays in the selector's own registers without branching.
+// r8 and r9 hold the sides of a cmov while the rest of it is computed, so nothing may touch them.
+bool is_straight_line(Node *node) {
+    if(node == NULL) return true;
+    if(node->rule == RULE_FALLBACK || node->rule == RULE_LOGICAL || node->rule == RULE_SELECT) return false;
+    return is_straight_line(node->left) && is_straight_line(node->middle) && is_straight_line(node->right);
+}
+
+// Both sides of a ternary can be computed when that can't be told apart from computing one of them:
+// nothing involved changes anything or can fault. They also need to be cheap.
+bool can_select(Node *node) {
+    if(node->static_cond != COND_UNKNOWN) return false;
+    if(has_side_effects(node->left) || has_side_effects(node->middle) || has_side_effects(node->right)) return false;
+    if(reads_element(node->middle) || reads_element(node->right)) return false;
+    if(!is_straight_line(node->left) || !is_straight_line(node->middle) || !is_straight_line(node->right)) return false;
+    return node->middle->cost <= MAX_SELECT_ARM_COST && node->right->cost <= MAX_SELECT_ARM_COST;
+}
+
+// Loading the variables costs what loading them on their own would. Only sequences short enough to
+// beat the rule picked so far are looked for.
+void label_superoptimized(Node *node, Scope *scope) {
+    Superoptimized *found = superoptimize(node, scope, node->cost - 2);
+    if(found == NULL) return;
+    int cost = found->code->len;
+    for(int i = 0; i < found->count; i++) cost += operand_cost(found->variables[i], scope) + 1;
+    consider(node, RULE_SUPEROPT, cost);
+}
+
+// Works out the cheapest way to compute every node of an expression into rax
+void label(Node *node, Scope *scope) {
+    if(node == NULL || node->rule != RULE_NONE) return;
+    label(node->left, scope);
+    label(node->middle, scope);
+    label(node->right, scope);
+
+    switch(node->ty) {
+        case ND_NUM:
+            consider(node, RULE_LOAD, 1);
+            return;
+        case ND_IDENT:
+            consider(node, RULE_LOAD, operand_cost(node, scope) + 1);
+            return;
+        case ND_UNARY_NEG:
+        case ND_UNARY_POS:
+        case ND_UNARY_BIT_COMPLEMENT:
+            consider(node, RULE_UNARY, node->middle->cost + 1);
+            if(SUPEROPTIMIZE) label_superoptimized(node, scope);
+            return;
+        case ND_UNARY_BOOLEAN_NOT:
+            consider(node, RULE_UNARY, node->middle->cost + 3);
+            return;
+        case ND_PRE_INCREMENT:
+        case ND_PRE_DECREMENT:
+        case ND_POST_INCREMENT:
+        case ND_POST_DECREMENT:
+            if(node->middle->ty == ND_IDENT) {
+                consider(node, RULE_INCREMENT, operand_cost(node->middle, scope) + 2);
+                return;
+            }
+            break;
+        case '=':
+            if(node->left->ty == ND_IDENT) {
+                label_assignment(node, scope);
+                return;
+            }
+            if(node->left->ty == ND_INDEX) {
+                consider(node, RULE_STORE_ELEMENT, node->left->middle->cost + node->right->cost + 3);
+                return;
+            }
+            break;
+        case ND_INDEX:
+            consider(node, RULE_ELEMENT, node->middle->cost + get_variable_location(scope, node->name)->scopes_up + 1);
+            return;
+        case ND_LAND:
+        case ND_LOR:
+            consider(node, RULE_LOGICAL, node->left->cost + node->right->cost + 5);
+            return;
+        case ND_TERNARY_CONDITIONAL:
+            if(can_select(node)) {
+                consider(node, RULE_SELECT, node->left->cost + node->middle->cost + node->right->cost + 4);
+                return;
+            }
+            break;
+        default:
+            if(is_binary_operation(node->ty)) {
+                label_binary(node, scope);
+                if(SUPEROPTIMIZE) label_superoptimized(node, scope);
+                return;
+            }
+            break;
+    }
+
+    // Everything else is left to the stack machine
+    int cost = 4;
+    if(node->left) cost += node->left->cost;
+    if(node->middle) cost += node->middle->cost;
+    if(node->right) cost += node->right->cost;
+    consider(node, RULE_FALLBACK, cost);
+}
+
+void reduce(Node *node, Scope **local_scope, int width);
+int gen_compare(Node *node, Scope **local_scope);
+
+// Gets the value of a node into rax, using whatever rule was picked for it
+void gen_into_rax(Node *node, Scope **local_scope, int width) {
+    if(node->rule == RULE_FALLBACK) {
+        gen(node, local_scope);
+        emit("\tpop rax\n");
+    } else {
+        reduce(node, local_scope, width);
+    }
+}
+
+// Gets the values of two nodes into rax and rbx, computing the first one first
+void gen_pair(Node *first, Node *second, Scope **local_scope, int width) {
+    gen_into_rax(first, local_scope, width);
+    if(is_operand(second)) {
+        emit("\tmov %s, %s\n", sized_register("rbx", width), operand(second, *local_scope, width));
+        return;
+    }
+    emit("\tpush rax\n");
+    gen_into_rax(second, local_scope, width);
+    emit("\tmov rbx, rax\n");
+    emit("\tpop rax\n");
+}
+
+void reduce_swapped(Node *node, Scope **local_scope, int width) {
+    int op = node->ty;
+    gen_into_rax(node->right, local_scope, width);
+
+    switch(op) {
+        case '+':
+        case '*':
+        case '&':
+        case '|':
+        case '^':
+        case ND_EQUAL:
+        case ND_NEQUAL:
+        case ND_GEQUAL:
+        case ND_LEQUAL:
+        case '<':
+        case '>':
+            gen_operation(swap_comparison(op), node->left, *local_scope, width);
+            return;
+        case '-':
+            // a - b is -b + a
+            emit("\tneg %s\n", sized_register("rax", width));
+            gen_operation('+', node->left, *local_scope, width);
+            return;
+        default:
+            emit("\tmov rbx, rax\n");
+            emit("\tmov rax, %s\n", operand(node->left, *local_scope, 8));
+            gen_operation(op, NULL, *local_scope, 8);
+            return;
+    }
+}
+
+// After a variable is written, its value is reloaded into rax if it is needed
+void reduce_increment(Node *node, Scope **local_scope, int width) {
+    char *instruction = (node->ty == ND_PRE_INCREMENT || node->ty == ND_POST_INCREMENT) ? "inc" : "dec";
+    int size;
+    char *address = variable_address(node->middle, *local_scope, &size);
+    if(node->ty == ND_PRE_INCREMENT || node->ty == ND_PRE_DECREMENT) {
+        emit("\t%s %s PTR %s\n", instruction, size_keyword(size), address);
+        if(width) gen_load(address, size, width);
+    } else {
+        if(width) gen_load(address, size, width);
+        emit("\t%s %s PTR %s\n", instruction, size_keyword(size), address);
+    }
+}
+
+void reduce_update(Node *node, Node *update, Scope **local_scope, int width) {
+    int op = node->right->ty;
+    char *instruction;
+    switch(op) {
+        case '+': instruction = "add"; break;
+        case '-': instruction = "sub"; break;
+        case '&': instruction = "and"; break;
+        case '|': instruction = "or"; break;
+        case '^': instruction = "xor"; break;
+        case ND_LEFT_SHIFT: instruction = "shl"; break;
+        default: instruction = "shr"; break;
+    }
+
+    int size;
+    if(update->ty == ND_NUM) {
+        char *address = variable_address(node->left, *local_scope, &size);
+        if((op == '+' || op == '-') && (update->val == 1 || update->val == -1)) {
+            emit("\t%s %s PTR %s\n", (op == '+') == (update->val == 1) ? "inc" : "dec", size_keyword(size), address);
+        } else if(op == ND_LEFT_SHIFT || op == ND_RIGHT_SHIFT) {
+            if(update->val & 63) emit("\t%s %s PTR %s, %d\n", instruction, size_keyword(size), address, update->val & 63);
+        } else {
+            // Only as many bytes of the immediate as the variable has matter
+            emit("\t%s %s PTR %s, %ld\n", instruction, size_keyword(size), address, truncate_to_size(update->val, size));
+        }
+        if(width) gen_load(address, size, width);
+        return;
+    }
+
+    bool narrow = get_variable_location(*local_scope, node->left->name)->size < 8;
+    gen_into_rax(update, local_scope, narrow ? 4 : 8);
+    char *address = variable_address(node->left, *local_scope, &size);
+    if(op == ND_LEFT_SHIFT || op == ND_RIGHT_SHIFT) {
+        emit("\tmov rcx, rax\n");
+        emit("\t%s %s PTR %s, cl\n", instruction, size_keyword(size), address);
+    } else {
+        emit("\t%s %s PTR %s, %s\n", instruction, size_keyword(size), address, sized_register("rax", size));
+    }
+    if(width) gen_load(address, size, width);
+}
+
+// The value of an assignment is what the variable holds after it, which for a narrower variable
+// is the low bytes of rax sign-extended
+void gen_stored_value(int size, int width) {
+    if(size == 8 || width == 0 || (size == 4 && width == 4)) return;
+    emit("\t%s %s, %s\n", width == 8 && size == 4 ? "movsxd" : "movsx", sized_register("rax", width), sized_register("rax", size));
+}
+
+// Writes 1 into rax if the node's value is nonzero, and 0 otherwise
+void gen_truth(Node *node, Scope **local_scope) {
+    if(is_comparison(node->ty)) {
+        emit("\tset%s al\n", condition_code(gen_compare(node, local_scope)));
+        emit("\tmovzx eax, al\n");
+        return;
+    }
+    gen_into_rax(node, local_scope, 8);
+    // These already are 0 or 1
+    if(node->ty == ND_UNARY_BOOLEAN_NOT || node->ty == ND_LAND || node->ty == ND_LOR || is_known_boolean(node)) return;
+    emit("\ttest rax, rax\n");
+    emit("\tsetne al\n");
+    emit("\tmovzx eax, al\n");
+}
+
+void reduce_logical(Node *node, Scope **local_scope) {
+    int current_label = LABELS_GENERATED++;
+    char decided[32];
+    snprintf(decided, 32, "logic_d_%d", current_label);
+
+    // The left side settles the result when it is false for &&, or true for ||.
+    // Otherwise, the result is whether the right side is true.
+    gen_branch(node->left, node->ty == ND_LOR, decided, local_scope);
+    gen_truth(node->right, local_scope);
+    emit("\tjmp logic_e_%d\n", current_label);
+    emit("%s:\n", decided);
+    emit("\tmov eax, %d\n", node->ty == ND_LOR);
+    emit("logic_e_%d:\n", current_label);
+}
+
+void reduce_select(Node *node, Scope **local_scope) {
+    gen_into_rax(node->middle, local_scope, 8);
+    emit("\tmov r8, rax\n");
+    gen_into_rax(node->right, local_scope, 8);
+    emit("\tmov r9, rax\n");
+
+    char *condition = "nz";
+    if(is_comparison(node->left->ty)) {
+        condition = condition_code(gen_compare(node->left, local_scope));
+    } else {
+        gen_into_rax(node->left, local_scope, 8);
+        emit("\ttest rax, rax\n");
+    }
+    // mov leaves the flags alone
+    emit("\tmov rax, r9\n");
+    emit("\tcmov%s rax, r8\n", condition);
+}
+
+// The second variable goes into rcx first, sign-extended like a load into rax would be
+void reduce_superoptimized(Node *node, Scope **local_scope) {
+    Superoptimized *found = superoptimize(node, *local_scope, SUPEROPT_LENGTH);
+    int size;
+    char *address;
+    if(found->count == 2) {
+        address = variable_address(found->variables[1], *local_scope, &size);
+        if(size == 8) {
+            emit("\tmov rcx, QWORD PTR %s\n", address);
+        } else {
+            emit("\t%s rcx, %s PTR %s\n", size == 4 ? "movsxd" : "movsx", size_keyword(size), address);
+        }
+    }
+    address = variable_address(found->variables[0], *local_scope, &size);
+    gen_load(address, size, 8);
+    for(int i = 0; i < found->code->len; i++) {
+        emit("\t%s\n", (char *)found->code->data[i]);
+    }
+}
+
+// Writes the code for the rules picked for a node and its children
+void reduce(Node *node, Scope **local_scope, int width) {
+    int scale, size;
+    // The width the node's own operation is done at, and its operands are needed at
+    int operation = operation_width(node->ty, width);
+    char *address;
+
+    switch(node->rule) {
+        case RULE_LOAD:
+            if(width == 0) return;
+            if(node->ty == ND_NUM && node->val == 0) {
+                emit("\txor eax, eax\n");
+            } else if(node->ty == ND_NUM) {
+                // Writing eax clears the upper half of rax, which is right for a value that isn't negative
+                emit("\tmov %s, %d\n", width == 8 && node->val < 0 ? "rax" : "eax", node->val);
+            } else {
+                address = variable_address(node, *local_scope, &size);
+                gen_load(address, size, width);
+            }
+            return;
+        case RULE_OP_OPERAND:
+            gen_into_rax(node->left, local_scope, operation);
+            gen_operation(node->ty, node->right, *local_scope, operation);
+            return;
+        case RULE_OP_SWAPPED:
+            reduce_swapped(node, local_scope, operation);
+            return;
+        case RULE_OP_REGISTERS:
+            gen_pair(node->left, node->right, local_scope, operation);
+            gen_operation(node->ty, NULL, *local_scope, operation);
+            return;
+        case RULE_LEA_INDEX:
+            if(scale_of(node->left)) {
+                gen_pair(node->left->left, node->right, local_scope, operation);
+                emit("\tlea %s, [rbx+rax*%d]\n", sized_register("rax", operation), scale_of(node->left));
+            } else {
+                gen_pair(node->left, node->right->left, local_scope, operation);
+                emit("\tlea %s, [rax+rbx*%d]\n", sized_register("rax", operation), scale_of(node->right));
+            }
+            return;
+        case RULE_LEA_SCALED:
+            scale = scale_of(node->left);
+            gen_into_rax(node->left->left, local_scope, operation);
+            emit("\tlea %s, [rax*%d%+d]\n", sized_register("rax", operation), scale, node->ty == '+' ? node->right->val : -node->right->val);
+            return;
+        case RULE_UNARY:
+            gen_into_rax(node->middle, local_scope, operation);
+            if(node->ty == ND_UNARY_NEG) {
+                emit("\tneg %s\n", sized_register("rax", operation));
+            } else if(node->ty == ND_UNARY_BIT_COMPLEMENT) {
+                emit("\tnot %s\n", sized_register("rax", operation));
+            } else if(node->ty == ND_UNARY_BOOLEAN_NOT && is_known_boolean(node->middle)) {
+                emit("\txor eax, 1\n");
+            } else if(node->ty == ND_UNARY_BOOLEAN_NOT) {
+                emit("\ttest rax, rax\n");
+                emit("\tsete al\n");
+                emit("\tmovzx eax, al\n");
+            }
+            return;
+        case RULE_INCREMENT:
+            reduce_increment(node, local_scope, width);
+            return;
+        case RULE_STORE:
+            // A narrower variable only keeps the low bytes of the value
+            size = get_variable_location(*local_scope, node->left->name)->size;
+            gen_into_rax(node->right, local_scope, size < 8 ? 4 : 8);
+            address = variable_address(node->left, *local_scope, &size);
+            emit("\tmov %s PTR %s, %s\n", size_keyword(size), address, sized_register("rax", size));
+            gen_stored_value(size, width);
+            return;
+        case RULE_UPDATE:
+            reduce_update(node, node->right->right, local_scope, width);
+            return;
+        case RULE_UPDATE_COMMUTED:
+            reduce_update(node, node->right->left, local_scope, width);
+            return;
+        case RULE_LOGICAL:
+            reduce_logical(node, local_scope);
+            return;
+        case RULE_SELECT:
+            reduce_select(node, local_scope);
+            return;
+        case RULE_ELEMENT:
+            gen_into_rax(node->middle, local_scope, 8);
+            address = element_address(node, *local_scope, "rax", &size);
+            if(width) gen_load(address, size, width);
+            return;
+        case RULE_STORE_ELEMENT:
+            gen_pair(node->left->middle, node->right, local_scope, 8);
+            address = element_address(node->left, *local_scope, "rax", &size);
+            emit("\tmov %s PTR %s, %s\n", size_keyword(size), address, sized_register("rbx", size));
+            if(width) {
+                emit("\tmov rax, rbx\n");
+                gen_stored_value(size, width);
+            }
+            return;
+        case RULE_SUPEROPT:
+            if(width) reduce_superoptimized(node, local_scope);
+            return;
+        default:
+            fprintf(stderr, "No instructions were selected for node of type %d\n", node->ty);
+            exit(CODEGEN_ERROR);
+    }
+}
+
+// Writes the code that leaves the value of an expression in rax, as wide as it is needed, if some
+// rule does better than the stack machine. Returns false (writing nothing) otherwise.
+bool select_instructions(Node *node, Scope **local_scope, int width) {
+    label(node, *local_scope);
+    if(node->rule == RULE_FALLBACK) return false;
+    reduce(node, local_scope, width);
+    return true;
+}
+
+// Compares the two sides of a comparison the way its rule says to, and returns the comparison that
+// the flags now hold (operands may have traded places)
+int gen_compare(Node *node, Scope **local_scope) {
+    switch(node->rule) {
+        case RULE_OP_OPERAND:
+            gen_into_rax(node->left, local_scope, 8);
+            emit("\tcmp rax, %s\n", operand(node->right, *local_scope, 8));
+            return node->ty;
+        case RULE_OP_SWAPPED:
+            gen_into_rax(node->right, local_scope, 8);
+            emit("\tcmp rax, %s\n", operand(node->left, *local_scope, 8));
+            return swap_comparison(node->ty);
+        default:
+            gen_pair(node->left, node->right, local_scope, 8);
+            emit("\tcmp rax, rbx\n");
+            return node->ty;
+    }
+}
+
+// Writes a jump to the label, taken when the condition is true (or when it is false, if jump_when is
+// false). Comparisons go straight into a conditional jump instead of being turned into 0 or 1 first.
+void select_branch(Node *condition, bool jump_when, char *target, Scope **local_scope) {
+    label(condition, *local_scope);
+
+    if(is_comparison(condition->ty)) {
+        int op = gen_compare(condition, local_scope);
+        emit("\tj%s %s\n", condition_code(jump_when ? op : inverse_comparison(op)), target);
+        return;
+    }
+
+    gen_into_rax(condition, local_scope, 8);
+    emit("\ttest rax, rax\n");
+    emit("\t%s %s\n", jump_when ? "jnz" : "jz", target);
+}
+
+// An if/else that only assigns to the same variable on both sides, or an if that only assigns to a
+// variable, can be written as x = c ? a : b (or x = c ? a : x). Returns the assigned value's side.
+Node *assignment_arm(Node *statement) {
+    if(statement->ty == ND_SCOPE) {
+        // A block only matters for the variables it declares
+        if(statement->statements->len != 1 || statement->scope->variables_declared->keys->len > 0) return NULL;
+        statement = statement->statements->data[0];
+    }
+    if(statement->ty != '=' || statement->left->ty != ND_IDENT || statement->unreachable) return NULL;
+    return statement;
+}
+
+// Writes an if statement as a conditional move, if it is a simple enough assignment. Returns false
+// (writing nothing) otherwise.
+bool select_conditional_assignment(Node *node, Scope **local_scope) {
+    Node *then_arm = assignment_arm(node->middle);
+    if(then_arm == NULL) return false;
+
+    Node *else_value;
+    if(node->right->ty == ND_NOOP) {
+        else_value = then_arm->left;
+    } else {
+        Node *else_arm = assignment_arm(node->right);
+        if(else_arm == NULL || !same_expression(then_arm->left, else_arm->left)) return false;
+        else_value = else_arm->right;
+    }
+
+    Node *select = calloc(1, sizeof(Node));
+    select->ty = ND_TERNARY_CONDITIONAL;
+    select->arity = 3;
+    select->left = node->left;
+    select->middle = then_arm->right;
+    select->right = else_value;
+    select->scope = node->scope;
+
+    Node *assignment = calloc(1, sizeof(Node));
+    assignment->ty = '=';
+    assignment->arity = 2;
+    assignment->left = then_arm->left;
+    assignment->right = select;
+    assignment->scope = node->scope;
+
+    label(assignment, *local_scope);
+    if(select->rule != RULE_SELECT) return false;
+    reduce(assignment, local_scope, 0);
+    return true;
+}
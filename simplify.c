@@ -0,0 +1,355 @@
+#include "yacc.h"
+
+/**
+ ** Algebraic simplification.
+ ** Chains of associative/commutative operators are flattened into a list of operands, the constants
+ ** among them are folded together, algebraic identities are applied (x+0, x*1, x&-1, x^x, x-x, ...)
+ ** and what remains is rebuilt as a balanced tree. The parser builds right-leaning trees, so a long
+ ** chain would otherwise need one stack slot per operand before the first operation can run.
+ **/
+
+typedef struct {
+    Vector *operands;
+    Vector *negated;    // For additive chains, whether each operand is subtracted
+    long constant;      // All of the constants in the chain folded together
+} Chain;
+
+Node *simplify_expression(Node *node);
+
+bool fits_in_int(long val) {
+    return val >= -2147483648L && val <= 2147483647L;
+}
+
+Node *constant_node(long val, Node *original) {
+    Node *node = new_numeric_node(val);
+    node->scope = original->scope;
+    return node;
+}
+
+Node *operation_node(int op, Node *left, Node *right, Node *original) {
+    Node *node = right ? binary_operation_node(op, left, right) : unary_operation_node(op, left);
+    node->scope = original->scope;
+    return node;
+}
+
+bool is_chain_operator(int op, int chain_op) {
+    if(chain_op == '+') return op == '+' || op == '-' || op == ND_UNARY_NEG;
+    return op == chain_op;
+}
+
+// Collects the operands of a chain of the same operator. Subtractions and negations are folded
+// into additive chains by flipping the sign of their operands.
+void collect_chain(Node *node, int chain_op, bool negate, Chain *chain) {
+    if(node->ty == ND_NUM) {
+        long val = node->val;
+        if(chain_op == '+' && negate) val = -(unsigned long)val;
+        fold_binary(chain_op, chain->constant, val, &chain->constant);
+        return;
+    }
+
+    if(is_chain_operator(node->ty, chain_op)) {
+        if(node->ty == ND_UNARY_NEG) {
+            collect_chain(node->middle, chain_op, !negate, chain);
+        } else {
+            collect_chain(node->left, chain_op, negate, chain);
+            collect_chain(node->right, chain_op, node->ty == '-' ? !negate : negate, chain);
+        }
+        return;
+    }
+
+    vec_push(chain->operands, node);
+    vec_push(chain->negated, (void *)(long)negate);
+}
+
+// The value x such that x op y == y for every y
+long identity_of(int op) {
+    switch(op) {
+        case '*': return 1;
+        case '&': return -1;
+        default: return 0;
+    }
+}
+
+void remove_operand(Chain *chain, int i) {
+    for(int j = i + 1; j < chain->operands->len; j++) {
+        chain->operands->data[j - 1] = chain->operands->data[j];
+        chain->negated->data[j - 1] = chain->negated->data[j];
+    }
+    chain->operands->len--;
+    chain->negated->len--;
+}
+
+// Applies the identities between pairs of operands: x-x and x^x cancel out, x&x and x|x are just x
+void combine_duplicates(Chain *chain, int chain_op) {
+    if(chain_op == '*') return;
+
+    for(int i = 0; i < chain->operands->len; i++) {
+        for(int j = i + 1; j < chain->operands->len; j++) {
+            if(!same_expression(chain->operands->data[i], chain->operands->data[j])) continue;
+
+            if(chain_op == '&' || chain_op == '|') {
+                remove_operand(chain, j);
+                j--;
+            } else if(chain_op == '^' || chain->negated->data[i] != chain->negated->data[j]) {
+                remove_operand(chain, j);
+                remove_operand(chain, i);
+                i--;
+                break;
+            }
+        }
+    }
+}
+
+// Builds a balanced tree out of operands[lo, hi)
+Node *balance(int op, Vector *operands, int lo, int hi, Node *original) {
+    if(hi - lo == 1) return operands->data[lo];
+    int mid = lo + (hi - lo) / 2;
+    return operation_node(op, balance(op, operands, lo, mid, original), balance(op, operands, mid, hi, original), original);
+}
+
+Node *rebuild_additive_chain(Chain *chain, Node *original) {
+    Vector *added = new_vector();
+    Vector *subtracted = new_vector();
+    for(int i = 0; i < chain->operands->len; i++) {
+        vec_push(chain->negated->data[i] ? subtracted : added, chain->operands->data[i]);
+    }
+
+    long constant = chain->constant;
+    Node *result;
+    if(added->len == 0 && subtracted->len == 0) {
+        return constant_node(constant, original);
+    } else if(added->len == 0) {
+        Node *subtrahend = balance('+', subtracted, 0, subtracted->len, original);
+        if(constant == 0) return operation_node(ND_UNARY_NEG, subtrahend, NULL, original);
+        return operation_node('-', constant_node(constant, original), subtrahend, original);
+    }
+
+    result = balance('+', added, 0, added->len, original);
+    if(subtracted->len > 0) {
+        result = operation_node('-', result, balance('+', subtracted, 0, subtracted->len, original), original);
+    }
+    if(constant > 0) {
+        result = operation_node('+', result, constant_node(constant, original), original);
+    } else if(constant < 0) {
+        result = operation_node('-', result, constant_node(-constant, original), original);
+    }
+    return result;
+}
+
+Node *rebuild_chain(int chain_op, Chain *chain, Node *original) {
+    if(chain_op == '+') return rebuild_additive_chain(chain, original);
+
+    long constant = chain->constant;
+    // Absorbing elements: x*0, x&0 and x|-1 don't depend on x at all
+    if((chain_op == '*' && constant == 0) || (chain_op == '&' && constant == 0) || (chain_op == '|' && constant == -1)) {
+        return constant_node(constant, original);
+    }
+
+    if(chain->operands->len == 0) return constant_node(constant, original);
+
+    bool negate = false;
+    if(chain_op == '*' && constant == -1) {
+        negate = true;
+        constant = 1;
+    }
+    if(constant != identity_of(chain_op)) {
+        vec_push(chain->operands, constant_node(constant, original));
+    }
+
+    Node *result = balance(chain_op, chain->operands, 0, chain->operands->len, original);
+    return negate ? operation_node(ND_UNARY_NEG, result, NULL, original) : result;
+}
+
+Node *simplify_chain(Node *node, int chain_op) {
+    Chain chain;
+    chain.operands = new_vector();
+    chain.negated = new_vector();
+    chain.constant = identity_of(chain_op);
+    collect_chain(node, chain_op, false, &chain);
+
+    // Reordering operands is only safe when none of them change anything
+    for(int i = 0; i < chain.operands->len; i++) {
+        if(has_side_effects(chain.operands->data[i])) return node;
+    }
+    if(!fits_in_int(chain.constant) || !fits_in_int(-chain.constant)) return node;
+
+    combine_duplicates(&chain, chain_op);
+    return rebuild_chain(chain_op, &chain, node);
+}
+
+bool is_comparison(int op) {
+    switch(op) {
+        case ND_EQUAL:
+        case ND_NEQUAL:
+        case ND_GEQUAL:
+        case ND_LEQUAL:
+        case '<':
+        case '>':
+            return true;
+        default:
+            return false;
+    }
+}
+
+// The comparison that is true exactly when the given one is false
+int inverse_comparison(int op) {
+    switch(op) {
+        case ND_EQUAL: return ND_NEQUAL;
+        case ND_NEQUAL: return ND_EQUAL;
+        case ND_GEQUAL: return '<';
+        case ND_LEQUAL: return '>';
+        case '<': return ND_GEQUAL;
+        default: return ND_LEQUAL;
+    }
+}
+
+Node *simplify_unary(Node *node) {
+    Node *operand = node->middle;
+    switch(node->ty) {
+        case ND_UNARY_POS:
+            return operand;
+        case ND_UNARY_BIT_COMPLEMENT:
+            if(operand->ty == ND_UNARY_BIT_COMPLEMENT) return operand->middle;
+            return node;
+        case ND_UNARY_BOOLEAN_NOT:
+            // !(a < b) is a >= b, which also turns !!(a < b) back into a < b. Three nots are the same as one.
+            if(is_comparison(operand->ty)) {
+                return operation_node(inverse_comparison(operand->ty), operand->left, operand->right, node);
+            }
+            if(operand->ty == ND_UNARY_BOOLEAN_NOT && operand->middle->ty == ND_UNARY_BOOLEAN_NOT) {
+                return operand->middle;
+            }
+            return node;
+        default:
+            return node;
+    }
+}
+
+Node *simplify_binary(Node *node) {
+    Node *left = node->left;
+    Node *right = node->right;
+
+    switch(node->ty) {
+        case '+':
+        case '-':
+        case '*':
+        case '&':
+        case '|':
+        case '^':
+            return simplify_chain(node, node->ty == '-' ? '+' : node->ty);
+        case ND_LEFT_SHIFT:
+        case ND_RIGHT_SHIFT:
+            if(right->ty == ND_NUM && (right->val & 63) == 0) return left;
+            if(left->ty == ND_NUM && left->val == 0 && !has_side_effects(right)) return left;
+            return node;
+        case '/':
+            if(right->ty == ND_NUM && right->val == 1) return left;
+            return node;
+        case '%':
+            if(right->ty == ND_NUM && right->val == 1 && !has_side_effects(left)) return constant_node(0, node);
+            return node;
+        case ND_EQUAL:
+        case ND_GEQUAL:
+        case ND_LEQUAL:
+            if(same_expression(left, right) && !has_side_effects(left)) return constant_node(1, node);
+            return node;
+        case ND_NEQUAL:
+        case '<':
+        case '>':
+            if(same_expression(left, right) && !has_side_effects(left)) return constant_node(0, node);
+            return node;
+        default:
+            return node;
+    }
+}
+
+Node *simplify_expression(Node *node) {
+    if(node == NULL) return NULL;
+
+    switch(node->ty) {
+        case ND_NUM:
+        case ND_IDENT:
+            return node;
+        case ND_INDEX:
+            node->middle = simplify_expression(node->middle);
+            return node;
+        // The targets of assignments and increments have to stay lvals, though an index can change
+        case '=':
+            if(node->left->ty == ND_INDEX) node->left = simplify_expression(node->left);
+            node->right = simplify_expression(node->right);
+            return node;
+        case ND_PRE_INCREMENT:
+        case ND_PRE_DECREMENT:
+        case ND_POST_INCREMENT:
+        case ND_POST_DECREMENT:
+            return node;
+        case ND_UNARY_NEG:
+            node->middle = simplify_expression(node->middle);
+            return simplify_chain(node, '+');
+        case ND_UNARY_POS:
+        case ND_UNARY_BIT_COMPLEMENT:
+        case ND_UNARY_BOOLEAN_NOT:
+            node->middle = simplify_expression(node->middle);
+            return simplify_unary(node);
+        case ND_TERNARY_CONDITIONAL:
+        case ND_LAND:
+        case ND_LOR:
+            node->left = simplify_expression(node->left);
+            node->middle = simplify_expression(node->middle);
+            node->right = simplify_expression(node->right);
+            return node;
+        case ND_CALL:
+            node->middle = simplify_expression(node->middle);
+            return node;
+        default:
+            node->left = simplify_expression(node->left);
+            node->right = simplify_expression(node->right);
+            return simplify_binary(node);
+    }
+}
+
+// Simplifies every expression found in a statement
+Node *simplify_statement(Node *node) {
+    switch(node->ty) {
+        case ND_SCOPE:
+            for(int i = 0; i < node->statements->len; i++) {
+                node->statements->data[i] = simplify_statement(node->statements->data[i]);
+            }
+            return node;
+        case ND_NOOP:
+        case ND_LABEL:
+        case ND_GOTO:
+        case ND_BREAK:
+        case ND_CONTINUE:
+            return node;
+        case ND_SWITCH:
+        case ND_RETURN:
+            node->middle = simplify_expression(node->middle);
+            return node;
+        case ND_IF:
+            node->left = simplify_expression(node->left);
+            node->middle = simplify_statement(node->middle);
+            node->right = simplify_statement(node->right);
+            return node;
+        case ND_WHILE:
+            node->left = simplify_expression(node->left);
+            node->right = simplify_statement(node->right);
+            return node;
+        case ND_DO:
+            node->left = simplify_statement(node->left);
+            node->right = simplify_expression(node->right);
+            return node;
+        case ND_FOR:
+            node->left = simplify_statement(node->left);
+            node->middle = simplify_statement(node->middle);
+            node->right = simplify_statement(node->right);
+            node->extra = simplify_statement(node->extra);
+            return node;
+        default:
+            return simplify_expression(node);
+    }
+}
+
+void simplify(Node *program) {
+    simplify_statement(program);
+}
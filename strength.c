@@ -0,0 +1,149 @@
+#include "yacc.h"
+
+/**
+ ** Strength reduction of multiplication, division and modulo by constants.
+ ** `mul` and especially `div` are some of the slowest instructions there are, so when the right
+ ** operand is a literal we work out a cheaper sequence instead. Multiplies become shifts, `lea`s
+ ** and adds. Unsigned division by a power of two is a shift (and its remainder a mask), and any
+ ** other divisor is turned into a multiplication by a "magic" reciprocal, keeping the high half.
+ ** Everything here works on rax, the left operand, and leaves the result there.
+ **/
+
+bool is_power_of_two(unsigned long val) {
+    return val != 0 && (val & (val - 1)) == 0;
+}
+
+int log_2(unsigned long val) {
+    return 63 - __builtin_clzl(val);
+}
+
+// Multiplies that a single lea can do: x*3, x*5 and x*9
+int lea_scale(unsigned long val) {
+    switch(val) {
+        case 3: return 2;
+        case 5: return 4;
+        case 9: return 8;
+        default: return 0;
+    }
+}
+
+// Writes rax * val using shifts, leas and adds. Returns false if there's no short sequence.
+bool gen_multiply_sequence(unsigned long val) {
+    if(val == 0) {
+        emit("\txor eax, eax\n");
+        return true;
+    }
+    if(val == 1) return true;
+    if(is_power_of_two(val)) {
+        emit("\tshl rax, %d\n", log_2(val));
+        return true;
+    }
+
+    // x*3, x*5 and x*9, possibly followed by a shift: x*6, x*40, x*72...
+    int shift = __builtin_ctzl(val);
+    int scale = lea_scale(val >> shift);
+    if(scale) {
+        emit("\tlea rax, [rax+rax*%d]\n", scale);
+        if(shift) emit("\tshl rax, %d\n", shift);
+        return true;
+    }
+
+    // One shift away from a power of two: x*17 is (x<<4)+x, x*15 is (x<<4)-x
+    if(is_power_of_two(val - 1)) {
+        emit("\tmov rbx, rax\n");
+        emit("\tshl rax, %d\n", log_2(val - 1));
+        emit("\tadd rax, rbx\n");
+        return true;
+    }
+    if(is_power_of_two(val + 1)) {
+        emit("\tmov rbx, rax\n");
+        emit("\tshl rax, %d\n", log_2(val + 1));
+        emit("\tsub rax, rbx\n");
+        return true;
+    }
+    return false;
+}
+
+void gen_multiply(long constant) {
+    if(gen_multiply_sequence(constant)) return;
+    // Multiplying by -n is the same as multiplying by n and negating
+    if(constant < 0 && gen_multiply_sequence(-(unsigned long)constant)) {
+        emit("\tneg rax\n");
+        return;
+    }
+    // The low 64 bits of the product don't depend on signedness, so imul gives the same result as mul
+    emit("\timul rax, rax, %ld\n", constant);
+}
+
+// Finds m and s such that x / divisor == ((x * m) >> 64) >> s for every 64 bit x, following Granlund
+// and Montgomery. Sometimes m needs 65 bits. When that happens, needs_add is set and the top bit is
+// left implicit: the quotient is then (((x - hi) >> 1) + hi) >> s, where hi = (x * m) >> 64.
+void magic_number(unsigned long divisor, unsigned long *magic, int *shift, bool *needs_add) {
+    int floor_log = log_2(divisor);
+    unsigned __int128 dividend = (unsigned __int128)1 << (64 + floor_log);
+    unsigned long proposed = dividend / divisor;
+    unsigned long remainder = dividend - (unsigned __int128)proposed * divisor;
+
+    if(divisor - remainder < (1UL << floor_log)) {
+        // A ceil(2^(64+s) / divisor) that fits in 64 bits is close enough
+        *needs_add = false;
+    } else {
+        proposed += proposed;
+        unsigned long twice_remainder = remainder + remainder;
+        if(twice_remainder >= divisor || twice_remainder < remainder) proposed++;
+        *needs_add = true;
+    }
+    *magic = proposed + 1;
+    *shift = floor_log;
+}
+
+// Writes rax / divisor into rax. The original value of rax is left in rcx.
+void gen_divide_by_magic(unsigned long divisor) {
+    unsigned long magic;
+    int shift;
+    bool needs_add;
+    magic_number(divisor, &magic, &shift, &needs_add);
+
+    emit("\tmov rcx, rax\n");
+    emit("\tmovabs rbx, %lu\n", magic);
+    emit("\tmul rbx\n");
+    if(needs_add) {
+        emit("\tmov rax, rcx\n");
+        emit("\tsub rax, rdx\n");
+        emit("\tshr rax, 1\n");
+        emit("\tadd rax, rdx\n");
+    } else {
+        emit("\tmov rax, rdx\n");
+    }
+    if(shift) emit("\tshr rax, %d\n", shift);
+}
+
+// Writes the code for rax op constant, where op is one of *, / and %
+void gen_constant_operation(int op, long constant) {
+    // Division is unsigned, so a negative literal is a divisor of at least 2^63
+    unsigned long divisor = constant;
+
+    if(op == '*') {
+        gen_multiply(constant);
+    } else if(constant <= 0) {
+        // Nothing cheaper to do for these (and dividing by zero should still fault)
+        emit("\tmov rbx, %ld\n", constant);
+        emit("\tmov rdx, 0\n");
+        emit("\tdiv rbx\n");
+        if(op == '%') emit("\tmov rax, rdx\n");
+    } else if(is_power_of_two(divisor)) {
+        if(op == '%') {
+            emit("\tand rax, %ld\n", constant - 1);
+        } else if(divisor > 1) {
+            emit("\tshr rax, %d\n", log_2(divisor));
+        }
+    } else {
+        gen_divide_by_magic(divisor);
+        if(op == '%') {
+            // x % d is x - (x / d) * d
+            emit("\timul rax, rax, %ld\n", constant);
+            emit("\tsub rcx, rax\n");
+            emit("\tmov rax, rcx\n");
+        }
+    }
+}
@@ -0,0 +1,700 @@
+#include "yacc.h"
+
+/**
+ ** Superoptimization of small expression trees (-fsuperopt).
+ ** A tree of + - * & | ^ << >> ~ and negation over literals and at most two variables is matched
+ ** against every short sequence of register instructions, shortest first, until one computes the
+ ** same value. The variables are loaded into rax and rcx, rdx is free to use, and the sequence has
+ ** to leave the value in rax. A sequence is only looked at closely once it agrees with the tree on
+ ** a handful of random inputs. It is then checked on every input when the variables are narrow
+ ** enough to try them all, and otherwise on a few thousand: the usual edge cases, the literals of
+ ** the tree and the values next to them, and random values of every density of bits.
+ ** Searching takes a while, so what it finds is kept in a table on disk (-fsuperopt-table=FILE).
+ ** The table is keyed by a hash of the tree written out in a canonical form, where the operands of
+ ** commutative operations are sorted and the variables are numbered whichever way writes it out
+ ** first in order. A tree that nothing was found for is kept too, along with how long the sequences it
+ ** was searched up to were. Later compiles look trees up and check what they find again, which
+ ** takes no time next to the search.
+ **/
+
+bool SUPEROPTIMIZE = false;
+int SUPEROPT_LENGTH = 3;
+char *SUPEROPT_TABLE = "yacc.superopt";
+
+#define SUPEROPT_MAX_LENGTH 4       // Longest sequences -fsuperopt=N searches, however big N is
+#define SUPEROPT_MAX_OPERATIONS 8   // Bigger trees aren't searched
+#define SUPEROPT_REGISTERS 3        // rax, rcx and rdx
+#define QUICK_TESTS 8               // Inputs every sequence is tried on while searching
+#define RANDOM_TESTS 4096           // Random inputs a sequence is checked on, besides the chosen ones
+
+char *SUPEROPT_REGISTER_NAMES[] = {"rax", "rcx", "rdx"};
+
+enum {
+    SO_MOV,         // dst, src
+    SO_ADD,
+    SO_SUB,
+    SO_AND,
+    SO_OR,
+    SO_XOR,
+    SO_MOV_IMM,     // dst, imm
+    SO_ADD_IMM,
+    SO_AND_IMM,
+    SO_OR_IMM,
+    SO_XOR_IMM,
+    SO_SHL,         // dst, count
+    SO_SHR,
+    SO_SAR,
+    SO_SHL_CL,      // dst, cl
+    SO_SHR_CL,
+    SO_SAR_CL,
+    SO_NOT,         // dst
+    SO_NEG,
+    SO_LEA,         // dst, [src+index*scale]
+    SO_IMUL,        // dst, src
+    SO_IMUL_IMM,    // dst, src, imm
+};
+
+char *SUPEROPT_MNEMONICS[] = {"mov", "add", "sub", "and", "or", "xor", "mov", "add", "and", "or", "xor",
+                              "shl", "shr", "sar", "shl", "shr", "sar", "not", "neg", "lea", "imul", "imul"};
+
+typedef struct {
+    int op;
+    int dst;
+    int src;
+    int index;
+    int scale;
+    long imm;
+    int reads;      // Mask of the registers the result depends on
+    int number;     // Position in the list of candidates
+    char *text;
+} SuperInstruction;
+
+typedef struct {
+    Node *root;
+    Scope *scope;
+    int ids[2];             // Of the variables, in the order they are numbered in the canonical form
+    int sizes[2];
+    int count;
+    Vector *constants;      // Distinct literals of the tree
+    char *canonical;
+    Vector *candidates;     // Every instruction a sequence for the tree can be made of
+} SuperTree;
+
+// What is known about a canonical tree in this compile
+typedef struct {
+    Vector *sequence;       // The shortest one found, or NULL
+    int searched;           // Length below which no sequence was found
+} SuperResult;
+
+Map *SUPEROPT_RESULTS = NULL;   // By canonical form
+Map *SUPEROPT_ENTRIES = NULL;   // Lines of the table on disk, by hash
+
+// Whether the tree is made of operations a sequence can compute, and how many of them it has.
+// Returns -1 if it isn't.
+int superopt_operations(Node *node) {
+    int left, right;
+    switch(node->ty) {
+        case ND_NUM:
+        case ND_IDENT:
+            return 0;
+        case ND_UNARY_POS:
+            return superopt_operations(node->middle);
+        case ND_UNARY_NEG:
+        case ND_UNARY_BIT_COMPLEMENT:
+            left = superopt_operations(node->middle);
+            return left < 0 ? -1 : left + 1;
+        case '+':
+        case '-':
+        case '*':
+        case '&':
+        case '|':
+        case '^':
+        case ND_LEFT_SHIFT:
+        case ND_RIGHT_SHIFT:
+            left = superopt_operations(node->left);
+            right = superopt_operations(node->right);
+            return left < 0 || right < 0 ? -1 : left + right + 1;
+        default:
+            return -1;
+    }
+}
+
+// Numbers the variables and gathers the literals. Returns false if there are more than two variables.
+bool gather_operands(SuperTree *tree, Node *node) {
+    if(node == NULL) return true;
+    if(node->ty == ND_NUM) {
+        for(int i = 0; i < tree->constants->len; i++) {
+            if((long)tree->constants->data[i] == node->val) return true;
+        }
+        vec_push(tree->constants, (void *)(long)node->val);
+        return true;
+    }
+    if(node->ty == ND_IDENT) {
+        int id = get_variable_id(tree->scope, node->name);
+        for(int i = 0; i < tree->count; i++) {
+            if(tree->ids[i] == id) return true;
+        }
+        if(tree->count == 2) return false;
+        tree->ids[tree->count] = id;
+        tree->sizes[tree->count++] = variable_size(id);
+        return true;
+    }
+    return gather_operands(tree, node->left) && gather_operands(tree, node->middle) && gather_operands(tree, node->right);
+}
+
+int operand_number(SuperTree *tree, Node *node) {
+    int id = get_variable_id(tree->scope, node->name);
+    return tree->ids[0] == id ? 0 : 1;
+}
+
+char *operator_name(int op) {
+    switch(op) {
+        case ND_LEFT_SHIFT: return "<<";
+        case ND_RIGHT_SHIFT: return ">>";
+        case ND_UNARY_NEG: return "neg";
+        case ND_UNARY_BIT_COMPLEMENT: return "~";
+        case '+': return "+";
+        case '-': return "-";
+        case '*': return "*";
+        case '&': return "&";
+        case '|': return "|";
+        default: return "^";
+    }
+}
+
+// Writes the tree out in prefix form, with the variables numbered the other way around if swapped
+char *canonical_text(SuperTree *tree, Node *node, bool swapped) {
+    char *text;
+    if(node->ty == ND_NUM || node->ty == ND_IDENT) {
+        text = malloc(sizeof(char) * 24);
+        if(node->ty == ND_NUM) {
+            snprintf(text, 24, "%d", node->val);
+        } else {
+            int number = operand_number(tree, node);
+            snprintf(text, 24, "x%d:%d", swapped ? 1 - number : number, tree->sizes[number]);
+        }
+        return text;
+    }
+    if(node->ty == ND_UNARY_POS) return canonical_text(tree, node->middle, swapped);
+    if(node->middle) {
+        char *operand = canonical_text(tree, node->middle, swapped);
+        int len = strlen(operand) + 8;
+        text = malloc(sizeof(char) * len);
+        snprintf(text, len, "(%s %s)", operator_name(node->ty), operand);
+        return text;
+    }
+
+    char *left = canonical_text(tree, node->left, swapped);
+    char *right = canonical_text(tree, node->right, swapped);
+    if(is_commutative(node->ty) && strcmp(left, right) > 0) {
+        char *first = right;
+        right = left;
+        left = first;
+    }
+    int len = strlen(left) + strlen(right) + 8;
+    text = malloc(sizeof(char) * len);
+    snprintf(text, len, "(%s %s %s)", operator_name(node->ty), left, right);
+    return text;
+}
+
+// FNV-1a
+unsigned long canonical_hash(char *text) {
+    unsigned long hash = 14695981039346656037UL;
+    for(; *text; text++) {
+        hash ^= (unsigned char)*text;
+        hash *= 1099511628211UL;
+    }
+    return hash;
+}
+
+void add_candidate(SuperTree *tree, int op, int dst, int src, int index, int scale, long imm) {
+    SuperInstruction *instruction = malloc(sizeof(SuperInstruction));
+    instruction->op = op;
+    instruction->dst = dst;
+    instruction->src = src;
+    instruction->index = index;
+    instruction->scale = scale;
+    instruction->imm = imm;
+
+    char *mnemonic = SUPEROPT_MNEMONICS[op];
+    char *destination = SUPEROPT_REGISTER_NAMES[dst];
+    char *source = src >= 0 ? SUPEROPT_REGISTER_NAMES[src] : NULL;
+    instruction->text = malloc(sizeof(char) * 48);
+    switch(op) {
+        case SO_MOV:
+            instruction->reads = 1 << src;
+            snprintf(instruction->text, 48, "%s %s, %s", mnemonic, destination, source);
+            break;
+        case SO_MOV_IMM:
+            instruction->reads = 0;
+            snprintf(instruction->text, 48, "%s %s, %ld", mnemonic, destination, imm);
+            break;
+        case SO_ADD_IMM:
+        case SO_AND_IMM:
+        case SO_OR_IMM:
+        case SO_XOR_IMM:
+        case SO_SHL:
+        case SO_SHR:
+        case SO_SAR:
+            instruction->reads = 1 << dst;
+            snprintf(instruction->text, 48, "%s %s, %ld", mnemonic, destination, imm);
+            break;
+        case SO_SHL_CL:
+        case SO_SHR_CL:
+        case SO_SAR_CL:
+            // cl is the low byte of rcx
+            instruction->reads = 1 << dst | 1 << 1;
+            snprintf(instruction->text, 48, "%s %s, cl", mnemonic, destination);
+            break;
+        case SO_NOT:
+        case SO_NEG:
+            instruction->reads = 1 << dst;
+            snprintf(instruction->text, 48, "%s %s", mnemonic, destination);
+            break;
+        case SO_LEA:
+            instruction->reads = 1 << src | 1 << index;
+            if(scale == 1) {
+                snprintf(instruction->text, 48, "lea %s, [%s+%s]", destination, source, SUPEROPT_REGISTER_NAMES[index]);
+            } else {
+                snprintf(instruction->text, 48, "lea %s, [%s+%s*%d]", destination, source, SUPEROPT_REGISTER_NAMES[index], scale);
+            }
+            break;
+        case SO_IMUL_IMM:
+            instruction->reads = 1 << src;
+            snprintf(instruction->text, 48, "%s %s, %s, %ld", mnemonic, destination, source, imm);
+            break;
+        default:
+            instruction->reads = 1 << dst | 1 << src;
+            snprintf(instruction->text, 48, "%s %s, %s", mnemonic, destination, source);
+            break;
+    }
+    instruction->number = tree->candidates->len;
+    vec_push(tree->candidates, instruction);
+}
+
+void add_immediate(Vector *immediates, long value) {
+    if(value == 0 || !fits_in_immediate(value)) return;
+    for(int i = 0; i < immediates->len; i++) {
+        if((long)immediates->data[i] == value) return;
+    }
+    vec_push(immediates, (void *)value);
+}
+
+// Immediates come from the literals of the tree, their negations and complements, and 1 and -1.
+// Shift counts are the ones the literals give, and 1 and 63. The cheap instructions come first, so
+// that of two sequences that are as long, the one without an imul is found.
+void list_candidates(SuperTree *tree) {
+    Vector *immediates = new_vector();
+    Vector *counts = new_vector();
+    vec_push(immediates, (void *)1L);
+    vec_push(immediates, (void *)-1L);
+    vec_push(counts, (void *)1L);
+    vec_push(counts, (void *)63L);
+    for(int i = 0; i < tree->constants->len; i++) {
+        long constant = (long)tree->constants->data[i];
+        add_immediate(immediates, constant);
+        add_immediate(immediates, -constant);
+        add_immediate(immediates, ~constant);
+        if((constant & 63) > 1 && (constant & 63) < 63) vec_push(counts, (void *)(constant & 63));
+    }
+
+    tree->candidates = new_vector();
+    for(int dst = 0; dst < SUPEROPT_REGISTERS; dst++) {
+        for(int src = 0; src < SUPEROPT_REGISTERS; src++) {
+            if(src == dst) continue;
+            for(int op = SO_MOV; op <= SO_XOR; op++) add_candidate(tree, op, dst, src, 0, 1, 0);
+        }
+        add_candidate(tree, SO_ADD, dst, dst, 0, 1, 0);
+        for(int op = SO_NOT; op <= SO_NEG; op++) add_candidate(tree, op, dst, -1, 0, 1, 0);
+        for(int i = 0; i < counts->len; i++) {
+            for(int op = SO_SHL; op <= SO_SAR; op++) add_candidate(tree, op, dst, -1, 0, 1, (long)counts->data[i]);
+        }
+        for(int i = 0; i < immediates->len; i++) {
+            long imm = (long)immediates->data[i];
+            for(int op = SO_MOV_IMM; op <= SO_XOR_IMM; op++) add_candidate(tree, op, dst, -1, 0, 1, imm);
+        }
+        for(int op = SO_SHL_CL; op <= SO_SAR_CL; op++) add_candidate(tree, op, dst, -1, 0, 1, 0);
+        for(int src = 0; src < SUPEROPT_REGISTERS; src++) {
+            for(int index = 0; index < SUPEROPT_REGISTERS; index++) {
+                for(int scale = 1; scale <= 8; scale *= 2) {
+                    // [a+b] is [b+a], and [a+a] is [a*2]
+                    if(scale == 1 && src >= index) continue;
+                    add_candidate(tree, SO_LEA, dst, src, index, scale, 0);
+                }
+            }
+        }
+    }
+    for(int dst = 0; dst < SUPEROPT_REGISTERS; dst++) {
+        for(int src = 0; src < SUPEROPT_REGISTERS; src++) {
+            add_candidate(tree, SO_IMUL, dst, src, 0, 1, 0);
+            for(int i = 0; i < immediates->len; i++) add_candidate(tree, SO_IMUL_IMM, dst, src, 0, 1, (long)immediates->data[i]);
+        }
+    }
+}
+
+// Describes an expression the superoptimizer can work on, or returns NULL
+SuperTree *describe_tree(Node *node, Scope *scope) {
+    int operations = superopt_operations(node);
+    if(operations < 2 || operations > SUPEROPT_MAX_OPERATIONS) return NULL;
+
+    SuperTree *tree = malloc(sizeof(SuperTree));
+    tree->root = node;
+    tree->scope = scope;
+    tree->count = 0;
+    tree->constants = new_vector();
+    tree->candidates = NULL;
+    if(!gather_operands(tree, node) || tree->count == 0) return NULL;
+
+    tree->canonical = canonical_text(tree, node, false);
+    if(tree->count == 2) {
+        char *swapped = canonical_text(tree, node, true);
+        if(strcmp(swapped, tree->canonical) < 0) {
+            tree->canonical = swapped;
+            int id = tree->ids[0], size = tree->sizes[0];
+            tree->ids[0] = tree->ids[1];
+            tree->sizes[0] = tree->sizes[1];
+            tree->ids[1] = id;
+            tree->sizes[1] = size;
+        }
+    }
+    return tree;
+}
+
+long evaluate_super_tree(SuperTree *tree, Node *node, long *inputs) {
+    long result;
+    switch(node->ty) {
+        case ND_NUM:
+            return node->val;
+        case ND_IDENT:
+            return inputs[operand_number(tree, node)];
+        case ND_UNARY_POS:
+        case ND_UNARY_NEG:
+        case ND_UNARY_BIT_COMPLEMENT:
+            fold_unary(node->ty, evaluate_super_tree(tree, node->middle, inputs), &result);
+            return result;
+        default:
+            fold_binary(node->ty, evaluate_super_tree(tree, node->left, inputs), evaluate_super_tree(tree, node->right, inputs), &result);
+            return result;
+    }
+}
+
+long superopt_step(SuperInstruction *instruction, long *registers) {
+    unsigned long dst = registers[instruction->dst];
+    unsigned long src = instruction->src >= 0 ? registers[instruction->src] : 0;
+    switch(instruction->op) {
+        case SO_MOV: return src;
+        case SO_ADD: return dst + src;
+        case SO_SUB: return dst - src;
+        case SO_AND: return dst & src;
+        case SO_OR: return dst | src;
+        case SO_XOR: return dst ^ src;
+        case SO_MOV_IMM: return instruction->imm;
+        case SO_ADD_IMM: return dst + instruction->imm;
+        case SO_AND_IMM: return dst & instruction->imm;
+        case SO_OR_IMM: return dst | instruction->imm;
+        case SO_XOR_IMM: return dst ^ instruction->imm;
+        case SO_SHL: return dst << instruction->imm;
+        case SO_SHR: return dst >> instruction->imm;
+        case SO_SAR: return (long)dst >> instruction->imm;
+        case SO_SHL_CL: return dst << (registers[1] & 63);
+        case SO_SHR_CL: return dst >> (registers[1] & 63);
+        case SO_SAR_CL: return (long)dst >> (registers[1] & 63);
+        case SO_NOT: return ~dst;
+        case SO_NEG: return -dst;
+        case SO_LEA: return src + (unsigned long)registers[instruction->index] * instruction->scale;
+        case SO_IMUL: return dst * src;
+        default: return src * instruction->imm;
+    }
+}
+
+long run_super_sequence(SuperInstruction **sequence, int length, long *inputs) {
+    long registers[SUPEROPT_REGISTERS] = {inputs[0], inputs[1], 0};
+    for(int i = 0; i < length; i++) {
+        registers[sequence[i]->dst] = superopt_step(sequence[i], registers);
+    }
+    return registers[0];
+}
+
+// xorshift, seeded from the canonical form so a tree is always checked the same way
+unsigned long SUPEROPT_RANDOM_STATE = 1;
+
+long superopt_random() {
+    SUPEROPT_RANDOM_STATE ^= SUPEROPT_RANDOM_STATE << 13;
+    SUPEROPT_RANDOM_STATE ^= SUPEROPT_RANDOM_STATE >> 7;
+    SUPEROPT_RANDOM_STATE ^= SUPEROPT_RANDOM_STATE << 17;
+    return SUPEROPT_RANDOM_STATE;
+}
+
+// Random values with few bits set, many of them, or about half, and small ones of either sign
+long superopt_random_value() {
+    long value = superopt_random();
+    switch(superopt_random() & 3) {
+        case 0: return value & superopt_random() & superopt_random();
+        case 1: return value | superopt_random() | superopt_random();
+        case 2: return value >> (superopt_random() & 63);
+        default: return value;
+    }
+}
+
+bool passes_test(SuperTree *tree, SuperInstruction **sequence, int length, long first, long second) {
+    long inputs[2] = {truncate_to_size(first, tree->sizes[0]), tree->count == 2 ? truncate_to_size(second, tree->sizes[1]) : 0};
+    return run_super_sequence(sequence, length, inputs) == evaluate_super_tree(tree, tree->root, inputs);
+}
+
+// Checks a sequence on every input of variables no wider than a short, taken together, or else on
+// edge cases, the literals and their neighbours, and random values
+bool verify_sequence(SuperTree *tree, SuperInstruction **sequence, int length) {
+    if(length > 0 && sequence[length - 1]->dst != 0) return false;
+    SUPEROPT_RANDOM_STATE = canonical_hash(tree->canonical) | 1;
+    int bits = tree->sizes[0] * 8 + (tree->count == 2 ? tree->sizes[1] * 8 : 0);
+    if(bits <= 16) {
+        for(long value = 0; value < 1L << bits; value++) {
+            if(!passes_test(tree, sequence, length, value, value >> (tree->sizes[0] * 8))) return false;
+        }
+        return true;
+    }
+
+    Vector *interesting = new_vector();
+    long edges[] = {0, 1, 2, 3, -1, -2, -3, 0x5555555555555555L, (long)0xaaaaaaaaaaaaaaaaUL, LONG_MIN, LONG_MAX, INT_MIN, INT_MAX, SHRT_MIN, SHRT_MAX, SCHAR_MIN, SCHAR_MAX};
+    for(int i = 0; i < sizeof(edges) / sizeof(long); i++) vec_push(interesting, (void *)edges[i]);
+    for(int i = 0; i < tree->constants->len; i++) {
+        long constant = (long)tree->constants->data[i];
+        long neighbours[] = {constant, constant - 1, constant + 1, -constant, ~constant};
+        for(int j = 0; j < 5; j++) vec_push(interesting, (void *)neighbours[j]);
+    }
+    for(int k = 0; k < 64; k++) {
+        unsigned long bit = 1UL << k;
+        vec_push(interesting, (void *)bit);
+        vec_push(interesting, (void *)(bit - 1));
+        vec_push(interesting, (void *)-bit);
+    }
+
+    for(int i = 0; i < interesting->len; i++) {
+        long value = (long)interesting->data[i];
+        if(!passes_test(tree, sequence, length, value, superopt_random_value())) return false;
+        if(!passes_test(tree, sequence, length, superopt_random_value(), value)) return false;
+        for(int j = 0; j < sizeof(edges) / sizeof(long) && tree->count == 2; j++) {
+            if(!passes_test(tree, sequence, length, value, edges[j])) return false;
+            if(!passes_test(tree, sequence, length, edges[j], value)) return false;
+        }
+    }
+    for(int i = 0; i < RANDOM_TESTS; i++) {
+        if(!passes_test(tree, sequence, length, superopt_random_value(), superopt_random_value())) return false;
+    }
+    return true;
+}
+
+typedef struct {
+    SuperTree *tree;
+    int length;
+    SuperInstruction *sequence[SUPEROPT_MAX_LENGTH];
+    int defined[SUPEROPT_MAX_LENGTH + 1];   // Mask of the registers holding a value before each instruction
+    long registers[SUPEROPT_MAX_LENGTH + 1][QUICK_TESTS][SUPEROPT_REGISTERS];
+    long expected[QUICK_TESTS];
+} SuperSearch;
+
+// Two instructions in a row that don't touch what the other writes can go either way, so only
+// the order they are listed in is tried. Only instructions writing registers that already hold a
+// value are swapped, so the order registers start being used in stays the same.
+bool is_out_of_order(SuperSearch *search, int position, SuperInstruction *instruction) {
+    if(position == 0) return false;
+    SuperInstruction *previous = search->sequence[position - 1];
+    if(previous->number < instruction->number || previous->dst == instruction->dst) return false;
+    if(instruction->reads & 1 << previous->dst || previous->reads & 1 << instruction->dst) return false;
+    int before = search->defined[position - 1];
+    return (before & 1 << previous->dst) && (before & 1 << instruction->dst);
+}
+
+// Tries every instruction at the position, then the ones after it. Only registers that hold a
+// value are read, and a register that doesn't yet is only written if it is the first such one.
+// An instruction whose result goes unused or that changes nothing can't be part of the shortest
+// sequence, so the last instruction writes rax and reads what the one before it wrote.
+bool search_sequences(SuperSearch *search, int position) {
+    Vector *candidates = search->tree->candidates;
+    int defined = search->defined[position];
+    int unused = __builtin_ctz(~defined);
+    bool last = position == search->length - 1;
+    for(int i = 0; i < candidates->len; i++) {
+        SuperInstruction *instruction = candidates->data[i];
+        if(instruction->reads & ~defined) continue;
+        if(!(defined & 1 << instruction->dst) && instruction->dst != unused) continue;
+        if(is_out_of_order(search, position, instruction)) continue;
+        search->sequence[position] = instruction;
+
+        // The last instruction only has to be tried until an input gives the wrong value
+        if(last) {
+            if(instruction->dst != 0) continue;
+            if(position > 0 && !(instruction->reads & 1 << search->sequence[position - 1]->dst)) continue;
+            int lane = 0;
+            while(lane < QUICK_TESTS && superopt_step(instruction, search->registers[position][lane]) == search->expected[lane]) lane++;
+            if(lane == QUICK_TESTS && verify_sequence(search->tree, search->sequence, search->length)) return true;
+            continue;
+        }
+
+        memcpy(search->registers[position + 1], search->registers[position], sizeof(search->registers[0]));
+        bool changes = false;
+        for(int lane = 0; lane < QUICK_TESTS; lane++) {
+            long *registers = search->registers[position + 1][lane];
+            long value = superopt_step(instruction, registers);
+            if(value != registers[instruction->dst] || !(defined & 1 << instruction->dst)) changes = true;
+            registers[instruction->dst] = value;
+        }
+        if(!changes) continue;
+        search->defined[position + 1] = defined | 1 << instruction->dst;
+        if(search_sequences(search, position + 1)) return true;
+    }
+    return false;
+}
+
+// Looks for a sequence of exactly length instructions. With none, the tree is its first variable.
+Vector *find_sequence(SuperTree *tree, int length) {
+    SuperSearch search;
+    search.tree = tree;
+    search.length = length;
+    search.defined[0] = tree->count == 2 ? 3 : 1;
+    SUPEROPT_RANDOM_STATE = canonical_hash(tree->canonical) | 1;
+    for(int lane = 0; lane < QUICK_TESTS; lane++) {
+        long inputs[2] = {truncate_to_size(superopt_random(), tree->sizes[0]), tree->count == 2 ? truncate_to_size(superopt_random(), tree->sizes[1]) : 0};
+        search.registers[0][lane][0] = inputs[0];
+        search.registers[0][lane][1] = inputs[1];
+        search.registers[0][lane][2] = 0;
+        search.expected[lane] = evaluate_super_tree(tree, tree->root, inputs);
+    }
+
+    bool found;
+    if(length == 0) {
+        int lane = 0;
+        while(lane < QUICK_TESTS && search.registers[0][lane][0] == search.expected[lane]) lane++;
+        found = lane == QUICK_TESTS && verify_sequence(tree, search.sequence, 0);
+    } else {
+        found = search_sequences(&search, 0);
+    }
+    if(!found) return NULL;
+
+    Vector *sequence = new_vector();
+    for(int i = 0; i < length; i++) vec_push(sequence, search.sequence[i]);
+    return sequence;
+}
+
+// Lines of the table are the hash, the canonical form and then either the sequence, its
+// instructions separated by semicolons (nothing, if the tree is its first variable), or -N if none
+// is shorter than N
+void load_superopt_table() {
+    SUPEROPT_RESULTS = new_map(NULL);
+    SUPEROPT_ENTRIES = new_map(NULL);
+    FILE *table = fopen(SUPEROPT_TABLE, "r");
+    if(!table) return;
+
+    char line[1024];
+    while(fgets(line, sizeof(line), table)) {
+        char *canonical = strchr(line, ' ');
+        char *result = canonical ? strchr(canonical, '\t') : NULL;
+        char *end = result ? strchr(result, '\n') : NULL;
+        if(!end) continue;
+        *canonical++ = '\0';
+        *result++ = '\0';
+        *end = '\0';
+        char **entry = malloc(sizeof(char *) * 2);
+        entry[0] = strdup(canonical);
+        entry[1] = strdup(result);
+        map_put(SUPEROPT_ENTRIES, strdup(line), entry);
+    }
+    fclose(table);
+}
+
+void record_superopt_result(SuperTree *tree, SuperResult *result) {
+    FILE *table = fopen(SUPEROPT_TABLE, "a");
+    if(!table) return;
+    fprintf(table, "%016lx %s\t", canonical_hash(tree->canonical), tree->canonical);
+    if(result->sequence == NULL) {
+        fprintf(table, "-%d\n", result->searched);
+    } else {
+        for(int i = 0; i < result->sequence->len; i++) {
+            fprintf(table, "%s%s", i ? "; " : "", ((SuperInstruction *)result->sequence->data[i])->text);
+        }
+        fprintf(table, "\n");
+    }
+    fclose(table);
+}
+
+// Reads back a sequence from the table. Its instructions have to be ones the search could have
+// picked, and it has to pass the same checks again.
+Vector *parse_super_sequence(SuperTree *tree, char *text) {
+    Vector *sequence = new_vector();
+    SuperInstruction *instructions[SUPEROPT_MAX_LENGTH];
+    for(char *part = strtok(text, ";"); part != NULL; part = strtok(NULL, ";")) {
+        while(*part == ' ') part++;
+        SuperInstruction *found = NULL;
+        for(int i = 0; i < tree->candidates->len && !found; i++) {
+            SuperInstruction *instruction = tree->candidates->data[i];
+            if(strcmp(instruction->text, part) == 0) found = instruction;
+        }
+        if(!found || sequence->len == SUPEROPT_MAX_LENGTH) return NULL;
+        instructions[sequence->len] = found;
+        vec_push(sequence, found);
+    }
+    if(!verify_sequence(tree, instructions, sequence->len)) return NULL;
+    return sequence;
+}
+
+Node *find_super_variable(SuperTree *tree, Node *node, int id) {
+    if(node == NULL) return NULL;
+    if(node->ty == ND_IDENT) return get_variable_id(tree->scope, node->name) == id ? node : NULL;
+    Node *found = find_super_variable(tree, node->left, id);
+    if(!found) found = find_super_variable(tree, node->middle, id);
+    if(!found) found = find_super_variable(tree, node->right, id);
+    return found;
+}
+
+// What the table on disk says about the tree, if anything
+SuperResult *stored_superopt_result(SuperTree *tree) {
+    SuperResult *result = malloc(sizeof(SuperResult));
+    result->sequence = NULL;
+    result->searched = 0;
+
+    char hash[24];
+    snprintf(hash, 24, "%016lx", canonical_hash(tree->canonical));
+    char **entry = map_get(SUPEROPT_ENTRIES, hash);
+    if(entry == NULL || strcmp(entry[0], tree->canonical) != 0) return result;
+    if(entry[1][0] == '-') {
+        result->searched = atoi(entry[1] + 1);
+    } else {
+        result->sequence = parse_super_sequence(tree, strdup(entry[1]));
+    }
+    return result;
+}
+
+// Finds the shortest sequence of at most length instructions that computes the expression, once
+// its variables are in rax and rcx. Returns NULL if there is none.
+Superoptimized *superoptimize(Node *node, Scope *scope, int length) {
+    if(SUPEROPT_RESULTS == NULL) load_superopt_table();
+    SuperTree *tree = describe_tree(node, scope);
+    if(tree == NULL) return NULL;
+    if(length > SUPEROPT_LENGTH) length = SUPEROPT_LENGTH;
+    if(length > SUPEROPT_MAX_LENGTH) length = SUPEROPT_MAX_LENGTH;
+
+    SuperResult *result = map_get(SUPEROPT_RESULTS, tree->canonical);
+    if(result == NULL) {
+        list_candidates(tree);
+        result = stored_superopt_result(tree);
+        map_put(SUPEROPT_RESULTS, tree->canonical, result);
+    }
+    if(result->sequence == NULL && result->searched <= length) {
+        if(tree->candidates == NULL) list_candidates(tree);
+        while(result->sequence == NULL && result->searched <= length) {
+            result->sequence = find_sequence(tree, result->searched);
+            if(result->sequence == NULL) result->searched++;
+        }
+        record_superopt_result(tree, result);
+    }
+    if(result->sequence == NULL || result->sequence->len > length) return NULL;
+
+    Superoptimized *found = malloc(sizeof(Superoptimized));
+    found->count = tree->count;
+    found->code = new_vector();
+    for(int i = 0; i < result->sequence->len; i++) {
+        vec_push(found->code, ((SuperInstruction *)result->sequence->data[i])->text);
+    }
+    for(int i = 0; i < tree->count; i++) found->variables[i] = find_super_variable(tree, node, tree->ids[i]);
+    return found;
+}
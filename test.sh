@@ -13,6 +13,34 @@ try() {
         echo "$expected expected for input $input, but got $actual"
         exit 1
     fi
+
+    # The built-in assembler has to behave the same
+    ./yacc -o tmp -l "$input" || exit 1
+    ./tmp
+    actual="$?"
+
+    if [ "$actual" != "$expected" ]; then
+        echo "$expected expected for input $input with the built-in assembler, but got $actual"
+        exit 1
+    fi
+
+    # and so does running it straight from memory
+    ./yacc -run -l "$input"
+    actual="$?"
+
+    if [ "$actual" != "$expected" ]; then
+        echo "$expected expected for input $input run from memory, but got $actual"
+        exit 1
+    fi
+
+    # and the bytecode interpreter
+    ./yacc -interp -l "$input"
+    actual="$?"
+
+    if [ "$actual" != "$expected" ]; then
+        echo "$expected expected for input $input in the interpreter, but got $actual"
+        exit 1
+    fi
 }
 
 try_file() {
@@ -28,8 +56,81 @@ try_file() {
         echo "$expected expected for file $file_name, but got $actual"
         exit 1
     fi
+
+    ./yacc -o tmp "$file_name" || exit 1
+    ./tmp
+    actual="$?"
+
+    if [ "$actual" != "$expected" ]; then
+        echo "$expected expected for file $file_name with the built-in assembler, but got $actual"
+        exit 1
+    fi
+
+    ./yacc -interp "$file_name"
+    actual="$?"
+
+    if [ "$actual" != "$expected" ]; then
+        echo "$expected expected for file $file_name in the interpreter, but got $actual"
+        exit 1
+    fi
 }
 
+try_flags() {
+    expected="$1"
+    flags="$2"
+    input="$3"
+
+    ./yacc $flags -l "$input" > tmp.s
+    gcc -o tmp tmp.s || exit 1
+    ./tmp
+    actual="$?"
+
+    if [ "$actual" != "$expected" ]; then
+        echo "$expected expected for input $input with $flags, but got $actual"
+        exit 1
+    fi
+
+    ./yacc $flags -o tmp -l "$input" || exit 1
+    ./tmp
+    actual="$?"
+
+    if [ "$actual" != "$expected" ]; then
+        echo "$expected expected for input $input with $flags and the built-in assembler, but got $actual"
+        exit 1
+    fi
+
+    ./yacc $flags -run -l "$input"
+    actual="$?"
+
+    if [ "$actual" != "$expected" ]; then
+        echo "$expected expected for input $input with $flags run from memory, but got $actual"
+        exit 1
+    fi
+
+    ./yacc $flags -interp -l "$input"
+    actual="$?"
+
+    if [ "$actual" != "$expected" ]; then
+        echo "$expected expected for input $input with $flags in the interpreter, but got $actual"
+        exit 1
+    fi
+}
+
+# Links an object file written by the built-in assembler with gcc
+try_object() {
+    expected="$1"
+    input="$2"
+
+    ./yacc -c -o tmp.o -l "$input" || exit 1
+    gcc -o tmp tmp.o || exit 1
+    ./tmp
+    actual="$?"
+
+    if [ "$actual" != "$expected" ]; then
+        echo "$expected expected for input $input linked from an object file, but got $actual"
+        exit 1
+    fi
+}
 
 
 
@@ -161,4 +262,246 @@ try 5 "a = 2; b = 3; c = 0; if (b > a || (b / c) > 3) a = 5; else a = 3; a;"
 # Case 22: GOTOs and labels
 try_file 7 "test_programs/labels_and_goto.yacc"
 
+# Case 23: Constant propagation and dead branches
+try 2 "a = 4; b = 0; if (a == 20) { b = 1; } else b = 2; b;"
+try 7 "a = 3; while (a > 5) a = 100; a = a + 4; a;"
+try 3 "a = 2; do a++; while (0); a;"
+try 10 "a = 0; i = 0; while (i < 5) { a = a + 2; i++; } a;"
+try 5 "a = 1; b = 0; top: b++; if (b < 5) goto top; if (a == 1) a = b; a;"
+try 9 "a = 4; for (i = 0; a < 3; i++) a = 1; if (a != 4) a = 0; else { b = a + 5; a = b; } a;"
+try 5 "a = 0; for (i = 0; i < 10; i++) { if (i % 2 == 0) continue; a++; } a;"
+try 6 "a = 0; for (i = 0; i < 3; i++) { j = 0; while (1) if (++j == 2) break; a = a + j; } a;"
+
+# Case 24: Algebraic simplification
+try 6 "x = 0; for (i = 0; i < 3; i++) x = x + i; y = 1 + x + 2 + x - x; y * 1 + 0 + (x - x) + (x ^ x);"
+try 5 "x = 0; while (x < 5) x++; ~~x & -1;"
+try 1 "x = 0; while (x < 5) x++; !!(x > 3);"
+try 0 "x = 0; while (x < 5) x++; !(x > 3) * x;"
+try 4 "x = 0; while (x < 4) x++; (x * 1) | (x | 0) | (x ^ x) + x;"
+try 246 "x = 0; while (x < 5) x++; 1 - x + 6;"
+try 10 "x = 0; while (x < 5) x++; x * 3 * 2 - x * 4;"
+
+# Case 25: Common subexpressions
+try 50 "a = 0; while (a < 2) a++; b = a + 1; c = (a + b) * 3; d = (a + b) * 3; c + d + (a + b) * 4;"
+try 18 "a = 0; while (a < 3) a++; b = -a; c = -a + b; c * -a;"
+try 19 "a = 0; while (a < 3) a++; b = a * a; a = 4; b + a * a - 6;"
+try 21 "a = 0; while (a < 3) a++; b = a * 5; a++; b + a * 5 - 14;"
+try 11 "a = 0; while (a < 3) a++; b = -(--a); c = -(a--); a + 10 - b - c;"
+try 16 "a = 0; while (a < 3) a++; b = (a > 2) ? a * 5 : 0; c = a * 5; b + c - 14;"
+
+# Case 26: Multiplying, dividing and taking remainders by constants
+try 200 "x = 0; while (x < 1000) x = x + 100; (x % 600) / 2;"
+try 90 "x = 0; while (x < 10) x++; x * 9;"
+try 170 "x = 0; while (x < 10) x++; x * 17;"
+try 206 "x = 0; while (x < 10) x++; x * -5;"
+try 142 "x = 0; while (x < 1000) x++; x / 7;"
+try 6 "x = 0; while (x < 1000) x++; x % 7;"
+try 125 "x = 0; while (x < 1000) x++; x / 8;"
+try 7 "x = 0; while (x < 1007) x++; x % 8;"
+try 154 "x = 0; while (x < 3) x++; y = -x; (y / 10) % 256 + (y / -3);"
+try 3 "x = 0; while (x < 3) x++; y = -x; (y % 10 == 3) + (y % -1) * 0 + (x / -5) + 2;"
+
+# Case 27: Instruction selection
+try 56 "s = 0; for (i = 0; i < 8; i++) { s = s + i; x = 0; } s + s;"
+try 48 "s = 0; for (i = 0; i < 4; i++) { s = i * 2 + s; { s = s + (i << 1); } } s + (s << 1) - 24;"
+try 7 "a = 0; while (a < 5) a++; b = 3 - a; c = 10 / a; d = 17 % a; e = 1 << a; f = 100 >> a; b + c + d + e + f - 30;"
+try 4 "a = 0; while (a < 5) a++; (3 < a) + (3 <= a) + (a > 3) + (5 >= a) + (5 > a) + (a != 5);"
+try 8 "a = 0; while (a < 5) a++; b = a; b = b - 2; b = b ^ 1; b = b | 8; b = b & 13; b = b << 1; b = b >> 1; b;"
+try 54 "a = 0; while (a < 5) a++; b = a; c = 0; { { b++; ++b; b--; } c = b * 8 + 6; } c;"
+try 4 "a = 0; while (a < 5) a++; b = a; c = 2; b = b + c++; b = c - b; -b;"
+
+# Case 28: Conditions that branch directly on comparisons
+try 10 "i = 0; while (i < 10) i++; i;"
+try 12 "i = 20; do i = i - 2; while (12 < i); i;"
+try 6 "n = 0; for (i = 0; 5 >= i; i++) n++; n;"
+try 3 "n = 0; for (i = 0; i < 9; i++) if (!(i % 3 != 0)) n++; n;"
+try 14 "n = 0; for (i = 0; i < 9; i++) { if (i <= 4) n++; if (4 == i) n = n + 10; } n - 1;"
+try 21 "n = 0; for (i = 0; i < 6; i++) n = (i > n) ? n + i : n + 1; n + 15;"
+try 8 "a = 0; while (a < 8) a++; b = 0; while (!(a == b)) b++; b;"
+
+# Case 29: Short circuiting && and ||
+try 1 "a = 0; while (a < 3) a++; a && 5;"
+try 0 "a = 0; while (a < 3) a++; (a - 3) && 5;"
+try 1 "a = 0; while (a < 3) a++; 0 || a;"
+try 0 "a = 0; while (a < 3) a++; b = 0; (a == 4) || b;"
+try 3 "a = 0; b = 0; (a && b++) || a++ || b++; a + b * 2;"
+try 7 "a = 0; while (a < 3) a++; b = 0; if (a > 2 && a < 4 || b) b = 7; b;"
+try 2 "a = 0; while (a < 3) a++; b = 0; if (a > 5 || !(a == 3 && b == 0)) b = 1; else b = 2; b;"
+try 6 "n = 0; for (i = 0; i < 10 && n < 6; i++) n++; n;"
+
+# Case 30: Conditional moves
+try 9 "a = 0; while (a < 9) a++; b = a > 5 ? a : 5; b;"
+try 5 "a = 0; while (a < 3) a++; b = a > 5 ? a : 5; b;"
+try 12 "n = 0; for (i = 0; i < 6; i++) { if (i % 2) n = n + i; else n = n - 1; } n + 6;"
+try 4 "n = 0; for (i = 0; i < 6; i++) if (i > n) n = i; n - 1;"
+try 3 "a = 0; while (a < 3) a++; b = 1; if (!(a == 3)) { b = 2; } else { b = 3; } b;"
+try 2 "a = 0; while (a < 3) a++; b = a == 3 ? (a < 2 ? 1 : 2) : 3; b;"
+
+# Case 31: Loop rotation
+try 47 "s = 0; for (i = 0; i < 10; i++) { if (i == 3) continue; s = s + i; } w = 0; while (w < 5) w++; s + w;"
+try 7 "n = 7; while (n < 5) n++; n;"
+try 0 "s = 0; for (i = 5; i < 5; i++) s++; s;"
+try 12 "i = 0; s = 0; while (i < 8) { i++; if (i % 2) continue; if (i > 6) break; s = s + i; } s;"
+try 22 "s = 0; for (i = 0; i < 4; i++) for (j = 0; j < i; j++) s = s + i + j; s + 4;"
+try 6 "i = 0; for (;;) { if (i++ > 5) break; } i - 1;"
+
+# Case 32: Loop-invariant code motion
+try 3 "n = 0; while (n < 5) n++; z = 0; s = 0; while (s < 3) { s++; if (z) s = s + n / z; } s;"
+try 90 "n = 0; while (n < 5) n++; m = n + 1; s = 0; i = 0; do { s = s + n * m; i++; if (i > 2) break; } while (i < n * 2); s;"
+try 112 "n = 0; while (n < 5) n++; s = 0; for (i = 0; i < 3; i++) { for (j = 0; j < n * n; j++) { if (j == 2) continue; s = s + (n + n) * 3; } } s;"
+try 20 "n = 0; while (n < 5) n++; s = 0; i = 0; top: i++; while (s < n * 3) { s = s + n * 2; if (s > 40) goto out; } if (i < 3) goto top; out: s;"
+try 40 "n = 0; while (n < 5) n++; s = 0; for (i = 0; i < 4; i++) { k = n * 2; s = s + k; } s;"
+try 7 "n = 0; while (n < 5) n++; i = 0; while (i < n + 2) { i++; n = n + 0; } i;"
+
+# Case 33: Induction variables
+try 100 "a = 0; while (a < 100) a++; a;"
+try 105 "n = 0; while (n < 5) n++; s = 0; for (i = 0; i < n * 7; i++) s = s + 3; s;"
+try 15 "m = 1; while (m < 4) m = m * 3 + 1; s = 0; i = 0; while (i != m) { i++; s = s + i; } s + 5;"
+try 144 "s = 0; for (i = 0; i < 30; i = i + 4) s = s - i; s;"
+try 78 "n = 0; while (n < 5) n++; s = 0; for (i = 40; i >= n; i = i - 3) s = s + i * 3; s;"
+try 29 "n = 0; while (n < 5) n++; s = 0; for (i = 0; i < n * 3; i++) { s = s + i * 7; if (s > 100) s = s - 50; } s;"
+try 195 "n = 0; while (n < 5) n++; s = 0; for (i = 0; i < n * 3; i++) { if (i == 4) continue; s = s + i * 7; } s;"
+try 9 "m = 1; while (m < 40) m = m * 3 + 1; c = 0; i = m; while (i > 3) { i--; c++; } c - 28;"
+
+# Case 34: Loop unrolling
+try 45 "s = 1; for (i = 0; i < 5; i++) s = s * 3 + i; s;"
+try 32 "s = 1; for (i = 0; i < 4; i++) { if (i == 1) { s = s + 5; continue; } if (s > 20) { s = s - 1; break; } s = s * 2; } s + i;"
+try 36 "s = 0; i = 0; while (i < 3) { j = 0; while (j < 3) { s = s * 2 + j; j++; } i++; } s;"
+try 3 "s = 0; { { s = 3; goto out; } } s = 9; out: s;"
+try_flags 47 -funroll=4 "m = 1; while (m < 50) m = m * 3 + 1; s = 1; for (i = 0; i < m; i++) { s = s * 3 + i; } s;"
+try_flags 47 -funroll=3 "m = 1; while (m < 50) m = m * 3 + 1; s = 1; for (i = 0; i < m; i++) s = s * 3 + i; s;"
+try_flags 167 -funroll=4 "m = 1; while (m < 50) m = m * 3 + 1; s = 1; i = m; while (i > 2) { s = s * 5 + i; i = i - 1; } s;"
+try_flags 10 -funroll=4 "m = 1; while (m < 50) m = m * 3 + 1; s = 1; for (i = 0; i < m; i++) { if (i == 1) { s = s + 5; continue; } if (s > 2000) { s = s - 1; break; } s = s * 2; } s + i;"
+
+# Case 35: Dead store elimination
+try 6 "a = 1; b = 2; a = 3; c = a + b; d = c * 7; d = a++; a + b;"
+try 7 "x = 0; y = 5; y * 2; x = y = 7; x--; y;"
+try 30 "n = 0; while (n < 5) n++; s = 0; t = 0; for (i = 0; i < n; i++) { t = i * i; u = t + 1; s = s + t; } s;"
+try 10 "n = 0; while (n < 5) n++; i = 0; s = 0; x = 9; top: x = i; s = s + x; i++; if (i < n) goto top; x = 1; s;"
+try 26 "n = 0; while (n < 5) n++; k = 3; i = 0; do { k = k + i; k; i++; } while (i < n); k = k * 2; k;"
+
+# Case 36: Control flow graph cleanup
+try 25 "i = 0; s = 0; while (i < 10) { if (i == 3) { i++; continue; } s = s + i; if (s > 20) break; i++; } s;"
+try 20 "s = 0; a: goto b; s = 99; b: goto c; c: s = s + 4; if (s < 20) goto a; s;"
+try 20 "s = 0; for (i = 0; i < 5; i++) { for (j = 0; j < 5; j++) { if (j > i) break; s = s + j; } } s;"
+try 7 "n = 0; while (1) { n++; if (n == 7) goto done; } done: n;"
+
+# Case 37: Block layout
+try 6 "a = 3; b = 0; d = 1; { w = 5; do { w--; if ((d || b)) { d = 0; } else { d = 2; b = 3; } } while (w > 0); } a + b + d;"
+try 149 "s = 0; for (i = 0; i < 50; i++) { if (i == 7) s = s + 100; else s = s + 1; } s;"
+try 120 "s = 0; i = 0; while (i < 100) { s = s + i; if (s > 50) { s = s * 2; break; } i++; } s + i;"
+try 9 "x = 4; if (x == 4) { x = 9; } x;"
+
+# Case 38: Value ranges
+try 206 "m = 1; while (m < 50) m = m * 3 + 1; s = 0; for (i = 0; i < m; i++) { b = i < 7; if (i < 0) s = s + 1000; s = s + (i % 256 & 255) + !b; } s;"
+try 45 "s = 0; for (i = 0; i < 10; i++) { x = i & 15; if (x > 20) s = s + 100; s = s + x % 16; } s;"
+try 3 "a = 5; b = a > 3; c = !b + !!b * 2; x = 0; while (x < 9) x++; if (x > 100) c = 50; c + (x & 7);"
+
+# Case 39: Compile-time evaluation
+try_flags 217 -Oeval "s = 1; n = 0; top: if (n < 6) { { s = s * 3; n++; goto top; } } s % 256;"
+try_flags 41 -Oeval "x = 1; goto e; if (x) x = 5; else e: x = x + 40; x;"
+try_flags 42 -Oeval "k = 0; do { k = k + 7; if (k > 40) break; } while (1); k;"
+try_flags 170 "-Oeval -feval-steps=100" "s = 0; for (i = 0; i < 300; i++) s = s + i * i; s;"
+
+# Case 40: Built-in assembler
+try 41 "x = 1; goto e; if (x) x = 5; else e: x = x + 40; x;"
+try_object 45 "s = 1; for (i = 0; i < 5; i++) s = s * 3 + i; s;"
+try_object 120 "s = 0; i = 0; while (i < 100) { s = s + i; if (s > 50) { s = s * 2; break; } i++; } s + i;"
+try_flags 121 -O0 "s = 0; for (i = 0; i < 12; i++) { a = i * 3; b = a << 2; c = b >> 1; d = c % 7; e = d ^ a; f = e | 16; g = f & 255; s = s + g - a * 2 + !d + ~e + (a > b) + (a <= c) + (b != d); } s;"
+
+# Case 41: Bytecode interpreter
+try_flags 45 -O0 "s = 0; for (i = 0; i < 10; i++) s = s + i; s;"
+try_flags 50 -O0 "s = 0; i = 10; do { s = s + i; } while (--i > 0); s + i - 5;"
+try_flags 15 -O0 "s = 0; for (i = 5; i != 0; i = i - 1) s = s + i; s;"
+try_flags 7 -O0 "x = 7; x = x++; x;"
+try_flags 9 -O0 "x = 2; y = x + x++ * 2 + x; y;"
+try_flags 3 -O0 "n = 0; a: n++; if (n < 3) goto a; n;"
+try_flags 12 -O0 "x = -1; (x >> 60) - (x / 3 > 5) + (3 - 10 < 0) * 3 - -x;"
+
+# Case 42: Switch statements
+try 125 "s = 0; for (i = 0; i < 12; i++) { switch (i) { case 0: case 1: s = s + 1; break; case 2: s = s + 20; case 3: s = s + 3; break; case 4: case 5: case 6: case 7: s = s + i * 2; break; case 9: s = s + 9; break; default: s = s + 100; } } s % 256;"
+try 21 "s = 0; for (i = 0; i < 2000; i = i + 7) { switch (i % 1000) { case 7: s = s + 1; break; case 70: s = s + 2; break; case 700: s = s + 3; break; case 994: s = s + 4; break; case 301: s = s + 5; break; case 14: s = s + 6; } } s;"
+try 35 "x = 3; y = 0; switch (x) { case 1: y = 10; break; case 3: y = 30; case 5: y = y + 5; } y;"
+try 11 "x = -2; y = 0; switch (x + 1) { case -1: y = 11; break; case 0: y = 22; break; default: y = 33; } y;"
+try 85 "s = 0; i = 0; while (i < 10) { i++; switch (i & 3) { case 0: continue; case 1: s = s + 1; break; default: s = s + 10; } s = s + 100; } s % 256;"
+try 131 "s = 0; for (i = 0; i < 4; i++) for (j = 0; j < 4; j++) switch (i) { case 1: switch (j) { case 1: s = s + 1; break; case 2: s = s + 2; break; default: s = s + 50; } break; case 2: s = s + 7; break; } s;"
+try 9 "x = 0; switch (4) { case 3: x = 3; break; case 4: x = 4; case 5: x = x + 5; break; } x;"
+try 236 "st = 0; n = 0; for (i = 0; i < 50; i++) { switch (st) { case 0: st = 5; break; case 5: st = 2; n++; break; case 2: st = 7; break; case 7: st = 0; n = n + 3; break; } } n * 10 + st;"
+try 3 "x = 9; switch (x) { default: x = 1; case 8: x = x + 2; } x;"
+try 5 "x = 5; switch (x) { } x;"
+try 53 "x = 0; y = 0; switch ((x - 2147483647) - 1) { case -2147483648: y = 3; break; case 2147483647: y = 5; } switch (x + 2147483647) { case -2147483648: y = y + 10; break; case 2147483647: y = y + 50; } y;"
+try_flags 131 -O0 "s = 0; for (i = 0; i < 4; i++) for (j = 0; j < 4; j++) switch (i) { case 1: switch (j) { case 1: s = s + 1; break; case 2: s = s + 2; break; default: s = s + 50; } break; case 2: s = s + 7; break; } s;"
+try_flags 236 -O0 "st = 0; n = 0; for (i = 0; i < 50; i++) { switch (st) { case 0: st = 5; break; case 5: st = 2; n++; break; case 2: st = 7; break; case 7: st = 0; n = n + 3; break; } } n * 10 + st;"
+try 72 "s = 0; st = 0; for (i = 0; i < 300; i++) { switch (st) { case 0: s = s + 0; st = 3; break; case 1: s = s + 7; st = 8; break; case 2: s = s + 1; st = 13; break; case 3: s = s + 8; st = 18; break; case 4: s = s + 2; st = 23; break; case 5: s = s + 9; st = 28; break; case 6: s = s + 3; st = 33; break; case 7: s = s + 10; st = 38; break; case 8: s = s + 4; st = 3; break; case 9: s = s + 11; st = 8; break; case 10: s = s + 5; st = 13; break; case 11: s = s + 12; st = 18; break; case 12: s = s + 6; st = 23; break; case 13: s = s + 0; st = 28; break; case 14: s = s + 7; st = 33; break; case 15: s = s + 1; st = 38; break; case 16: s = s + 8; st = 3; break; case 17: s = s + 2; st = 8; break; case 18: s = s + 9; st = 13; break; case 19: s = s + 3; st = 18; break; case 20: s = s + 10; st = 23; break; case 21: s = s + 4; st = 28; break; case 22: s = s + 11; st = 33; break; case 23: s = s + 5; st = 38; break; case 24: s = s + 12; st = 3; break; case 25: s = s + 6; st = 8; break; case 26: s = s + 0; st = 13; break; case 27: s = s + 7; st = 18; break; case 28: s = s + 1; st = 23; break; case 29: s = s + 8; st = 28; break; case 30: s = s + 2; st = 33; break; case 31: s = s + 9; st = 38; break; case 32: s = s + 3; st = 3; break; case 33: s = s + 10; st = 8; break; case 34: s = s + 4; st = 13; break; case 35: s = s + 11; st = 18; break; case 36: s = s + 5; st = 23; break; case 37: s = s + 12; st = 28; break; case 38: s = s + 6; st = 33; break; case 39: s = s + 0; st = 38; break; } } s % 256;"
+
+# Case 43: Functions
+try 55 "fib(n) { if (n < 2) return n; return fib(n - 1) + fib(n - 2); } fib(10);"
+try 9 "ack(m, n) { if (m == 0) return n + 1; if (n == 0) return ack(m - 1, 1); return ack(m - 1, ack(m, n - 1)); } ack(2, 3);"
+try 4 "big(a, b, c, d, e, f, g, h, i) { return a - b + c - d + e - f + g - h + i * 2; } big(9, 8, 7, 6, 5, 4, 3, 2, 1) + big(1, 1, 1, 1, 1, 1, 1, 1, 1);"
+try 11 "even(n) { if (n == 0) return 1; return odd(n - 1); } odd(n) { if (n == 0) return 0; return even(n - 1); } even(10) * 10 + odd(7);"
+try 156 "f(n) { while (1) { n = n + 3; if (n > 50) return n; } } x = 0; for (i = 0; i < 3; i++) x = x + f(i); x;"
+try 11 "f(x) { { y = x + 1; { z = y * 2; if (z > 5) { return z; } } } return 0 - 1; } f(1) + f(5);"
+try 25 "f(x) { a: if (x > 10) goto b; x = x * 2; goto a; b: return x; } g(x) { a: x--; if (x > 3) goto a; return x; } f(1) + f(3) - g(9) + g(1);"
+try 232 "g(x) { switch (x & 3) { case 0: return 1; case 1: x = x * 2; break; default: return x; } return x + 100; } s = 0; for (i = 0; i < 8; i++) s = s + g(i); s;"
+try 15 "f(a, b) { return a * 10 + b; } x = 1; y = f(x++, x++); y + x;"
+try 4 "f(a) { return a + 1; } x = 0; y = 0 && f(x); z = 1 || f(3); w = x ? f(1) : f(2); y + z + w;"
+try 32 "h(x) { return x + 1; } g(x) { return h(x) * h(x + 1); } f(x) { return g(x) + g(h(x)); } f(2);"
+try 5 "f(x) { if (x) return 5; } f(0) + f(1);"
+try 16 "f(x) { return x * 3; } x = 5; return f(x) + 1;"
+try_flags 55 -O0 "fib(n) { if (n < 2) return n; return fib(n - 1) + fib(n - 2); } fib(10);"
+try_flags 230 -O0 "c(a, b, c2, d, e, f2, g, h) { return h * 100 + a; } s = 0; for (i = 0; i < 5; i++) s = s + c(i, 0, 0, 0, 0, 0, 0, i + 1); s % 256;"
+try_flags 65 -Oeval "f(n) { t = 0; do { t = t + n; n--; } while (n > 0); return t; } a = f(4); b = f(a); a + b;"
+try 40 "one() { return 1; } s = 0; for (i = 0; i < 10; i++) s = s + one() * 4; s;"
+try_object 88 "f(x) { s = 0; for (i = 0; i < 4; i++) { s = s + x; } return s; } n = 0; for (j = 0; j < 100; j++) n = n + f(j); n % 256;"
+try 12 "f(x, y) { return x + y; } h(x) { if (x) return h(x - 1) + 1; return 0; } b = h(3); r = f(b * 2, b * 2); r;"
+try 7 "f(x) { } n = 0; while (n < 2) { n++; f(b * b + b * b); } 7;"
+
+
+# Case 44: Sized integer types
+try 44 "char c = 300; c;"
+try 127 "char c = 127; c++; c + 0 < 0 ? 0 - c + 1 : 0;"
+try 255 "char c = 0; c--; short s = c; s & 255;"
+try 1 "short s = 40000; int i = s; i < 0;"
+try 1 "x = 1; { char x = 255; } x;"
+try 144 "char c = 0; for (int i = 0; i < 300; i++) c++; c + 100;"
+try 2 "int a = 1, b; b = a + 1; b;"
+try 1 "int i; i = 2147483647; i = i + 1; long l = i; l < 0;"
+try 172 "f(x) { char c = 0; for (long i = 0; i < x; i++) c = c + 3; return c; } f(100) + 128;"
+try 114 "long a = 0; char b = 0; for (int i = 0; i < 10; i++) { b = b + 30; a = a + b; } a & 255;"
+try 255 "short s = 0 - 1; s = s >> 4; s & 255;"
+try 16 "char c = 100; c = c * c; c + 0;"
+try_flags 44 -O0 "char c = 300; c;"
+try_flags 144 -O0 "char c = 0; for (int i = 0; i < 300; i++) c++; c + 100;"
+try_flags 16 -Oeval "char c = 100; c = c * c; c + 0;"
+try_object 172 "f(x) { char c = 0; for (long i = 0; i < x; i++) c = c + 3; return c; } f(100) + 128;"
+
+
+# Case 45: Arrays
+try 15 "long a[4]; a[0] = 5; a[3] = a[0] * 2; a[3] + a[0];"
+try 45 "char c[3]; c[1] = 300; c[2] = c[1] + 1; c[2];"
+try 72 "long a[10]; for (i = 0; i < 10; i++) a[i] = i * i; a[9] - a[3];"
+try 56 "long a[5]; { a[2] = 7; { a[1] = a[2] + 1; } } a[1] * a[2];"
+try 196 "long a[3]; long i = 0; a[i++] = 4; a[i++] = 5; a[i] = i; a[0] * 100 + a[1] * 10 + a[2];"
+try 204 "long a[100]; long b[100]; for (long i = 0; i < 100; i++) b[i] = i; for (long i = 0; i < 99; i++) a[i] = b[i] + b[i] - 3; a[98] + a[7];"
+try 4 "int a[37]; int b[37]; long k = 3; for (long i = 0; i < 37; i++) b[i] = i * 1000000000; for (long i = 0; i < 37; i++) a[i] = (b[i] << 1) ^ ~b[i] + k; (a[36] + a[1]) & 255;"
+try 215 "long a[50]; long i; long n = 47; for (i = 0; i < 50; i++) a[i] = i; for (i = 3; i < n; i++) a[i] = (a[i] << 3) | (a[i] >> 1); a[46] + a[47] + a[2] + i;"
+try 2 "f(n) { long a[40]; for (long i = 0; i < 40; i++) a[i] = i + n; for (long i = 0; i < n; i++) a[i] = -a[i]; return a[n - 1] + a[n]; } f(33) + f(2);"
+try_flags 204 -O0 "long a[100]; long b[100]; for (long i = 0; i < 100; i++) b[i] = i; for (long i = 0; i < 99; i++) a[i] = b[i] + b[i] - 3; a[98] + a[7];"
+try_flags 4 -fno-vectorize "int a[37]; int b[37]; long k = 3; for (long i = 0; i < 37; i++) b[i] = i * 1000000000; for (long i = 0; i < 37; i++) a[i] = (b[i] << 1) ^ ~b[i] + k; (a[36] + a[1]) & 255;"
+try_flags 4 -mavx2 "int a[37]; int b[37]; long k = 3; for (long i = 0; i < 37; i++) b[i] = i * 1000000000; for (long i = 0; i < 37; i++) a[i] = (b[i] << 1) ^ ~b[i] + k; (a[36] + a[1]) & 255;"
+try_flags 215 -mavx2 "long a[50]; long i; long n = 47; for (i = 0; i < 50; i++) a[i] = i; for (i = 3; i < n; i++) a[i] = (a[i] << 3) | (a[i] >> 1); a[46] + a[47] + a[2] + i;"
+try_flags 196 -Oeval "long a[3]; long i = 0; a[i++] = 4; a[i++] = 5; a[i] = i; a[0] * 100 + a[1] * 10 + a[2];"
+try_flags 251 -Oeval "f(n) { long a[1000]; a[0] = n; if (n == 0) return 0; return f(n - 1) + a[0]; } f(50) & 255;"
+try_flags 251 "-Oeval -feval-memory=10000" "f(n) { long a[1000]; a[0] = n; if (n == 0) return 0; return f(n - 1) + a[0]; } f(50) & 255;"
+try_object 2 "f(n) { long a[40]; for (long i = 0; i < 40; i++) a[i] = i + n; for (long i = 0; i < n; i++) a[i] = -a[i]; return a[n - 1] + a[n]; } f(33) + f(2);"
+
+# Case 46: Superoptimizer
+# The table starts out empty, so the first compile of each program searches and the others reuse what it found
+rm -f tmp.superopt
+try_flags 142 "-fsuperopt -fsuperopt-table=tmp.superopt" "s = 0; for (i = 0; i < 50; i++) { x = i * 37; y = i * 11; z = (x | y) - (x & y); s = s + z; } s & 255;"
+try_flags 18 "-fsuperopt -fsuperopt-table=tmp.superopt" "char c = 0; s = 0; for (i = 0; i < 300; i++) { c = c + 7; long z = (c << 3) + c - (c & 12); s = s + z; } s & 255;"
+try_flags 166 "-fsuperopt -fsuperopt-table=tmp.superopt" "s = 0; for (i = 0; i < 20; i++) { x = i * i; int z = x * 2 - x; s = s + z; } s;"
+try_flags 110 "-fsuperopt -fsuperopt-table=tmp.superopt" "short h = 1; s = 0; for (i = 0; i < 90; i++) { h = h * 3 + i; s = s + (-(h & 255) ^ (h >> 2)); } s & 255;"
+try_flags 17 "-fsuperopt=4 -fsuperopt-table=tmp.superopt" "s = 0; x = 3; for (i = 0; i < 40; i++) { x = x * 5 + i; y = i & 15; long z = (x << y) ^ ~x; s = s + z; } s & 255;"
+
 echo "OK"
\ No newline at end of file
@@ -0,0 +1,54 @@
+.intel_syntax noprefix
+.global main
+main:
+	push rbp
+	mov rbp, rsp
+	sub rsp, 32
+	xor eax, eax
+	mov QWORD PTR [rbp-8], rax
+	mov eax, 3
+	mov QWORD PTR [rbp-16], rax
+	xor eax, eax
+	mov QWORD PTR [rbp-24], rax
+	mov rax, QWORD PTR [rbp-24]
+	cmp rax, 40
+	jge fle_0
+	.p2align 4
+flb_0:
+	push rbp
+	mov rbp, rsp
+	sub rsp, 16
+	mov r11, [rbp]
+	mov rax, QWORD PTR [r11-16]
+	lea rax, [rax+rax*4]
+	mov r11, [rbp]
+	add rax, QWORD PTR [r11-24]
+	mov r11, [rbp]
+	mov QWORD PTR [r11-16], rax
+	mov r11, [rbp]
+	mov rax, QWORD PTR [r11-24]
+	and rax, 15
+	mov QWORD PTR [rbp-8], rax
+	mov rcx, QWORD PTR [rbp-8]
+	mov r11, [rbp]
+	mov rax, QWORD PTR [r11-16]
+	mov rdx, rax
+	not rax
+	shl rdx, cl
+	xor rax, rdx
+	mov QWORD PTR [rbp-16], rax
+	mov rax, QWORD PTR [rbp-16]
+	mov r11, [rbp]
+	add QWORD PTR [r11-8], rax
+	mov rsp, rbp
+	pop rbp
+	inc QWORD PTR [rbp-24]
+	mov rax, QWORD PTR [rbp-24]
+	cmp rax, 40
+	jl flb_0
+fle_0:
+	mov rax, QWORD PTR [rbp-8]
+	and rax, 255
+	mov rsp, rbp
+	pop rbp
+	ret
@@ -30,6 +30,14 @@ Map *get_reserved_words() {
     map_put(reserved_word_map, "break", (void *)(long)TK_BREAK);
     map_put(reserved_word_map, "continue", (void *)(long)TK_CONTINUE);
     map_put(reserved_word_map, "goto", (void *)(long)TK_GOTO);
+    map_put(reserved_word_map, "switch", (void *)(long)TK_SWITCH);
+    map_put(reserved_word_map, "case", (void *)(long)TK_CASE);
+    map_put(reserved_word_map, "default", (void *)(long)TK_DEFAULT);
+    map_put(reserved_word_map, "return", (void *)(long)TK_RETURN);
+    map_put(reserved_word_map, "char", (void *)(long)TK_CHAR);
+    map_put(reserved_word_map, "short", (void *)(long)TK_SHORT);
+    map_put(reserved_word_map, "int", (void *)(long)TK_INT);
+    map_put(reserved_word_map, "long", (void *)(long)TK_LONG);
 
     return reserved_word_map;
 }
@@ -119,17 +127,19 @@ Vector *tokenize(FILE *stream) {
             // Close string and put back the character that isn't part of our string
             identifier_name[i] = 0;
 
+            // Look up any potential reserved word this maps to. A reserved word is never a label,
+            // so `default:` keeps its colon.
+            int word_code = (long)map_get(reserved_word_map, identifier_name);
+
             // Replace the character back in the stream unless this was a colon (indicates a label)
-            if(c == ':' && line_state == START_OF_LINE) {
+            if(c == ':' && line_state == START_OF_LINE && word_code == -1) {
                 vec_push(tokens, new_token(TK_LABEL, 0, identifier_name));
                 line_state = MID_LINE;
                 continue;
             }
             ungetc(c, stream);
 
-
-            // Look up any potential reserved word this maps to, and if it doesn't set it as an identifier
-            int word_code = (long)map_get(reserved_word_map, identifier_name);
+            // If it isn't a reserved word, set it as an identifier
             if(word_code != -1) {
                 vec_push(tokens, new_token(word_code, 0, NULL));
             } else {
@@ -244,6 +254,9 @@ Vector *tokenize(FILE *stream) {
             case ':':
             case '?':
             case '^':
+            case ',':
+            case '[':
+            case ']':
                 vec_push(tokens, new_token(c, 0, NULL));
                 continue;
             default:
@@ -0,0 +1,262 @@
+#include "yacc.h"
+
+/**
+ ** Loop unrolling.
+ ** A for or while loop with a loop counter that runs a small, constant number of times is fully
+ ** unrolled: its body is copied once per iteration and the loop disappears. With -funroll=N, the
+ ** other loops with a loop counter are unrolled N times. A main loop runs N iterations' worth of
+ ** copies for as long as at least N iterations are left, and the original loop runs the rest.
+ ** Copies that would grow the code by more than a fixed budget aren't made.
+ ** In the copies, a continue becomes a goto to the end of its copy, and a break a goto to past the
+ ** whole loop. Codegen still unwinds the scopes a goto leaves, just like for a break or continue.
+ **/
+
+#define MAX_FULL_UNROLL 16      // Most iterations a loop is fully unrolled for
+#define UNROLL_BUDGET 256       // Most nodes unrolling a single loop may add
+
+int UNROLL_FACTOR = 1;
+int UNROLLED_NAMES = 0;
+
+typedef struct {
+    Node *loop;             // The loop being unrolled
+    Vector *originals;      // Loops nested in its body
+    Vector *copies;         // and their copies, so their breaks and continues can follow them
+    char *continue_label;   // Where a continue in the current copy goes
+    char *break_label;      // Where a break goes
+    bool used_continue;
+    bool used_break;
+    Scope *spliced_from;    // Scope of a body whose statements are copied into another scope
+    Scope *spliced_into;
+} Unrolling;
+
+char *unrolled_name(char *prefix) {
+    char *name = malloc(sizeof(char) * 32);
+    snprintf(name, 32, "%s.%d", prefix, UNROLLED_NAMES++);
+    return name;
+}
+
+int count_nodes(Node *node) {
+    if(node == NULL) return 0;
+    int count = 1 + count_nodes(node->left) + count_nodes(node->middle) + count_nodes(node->right) + count_nodes(node->extra);
+    if(node->ty == ND_SCOPE) {
+        for(int i = 0; i < node->statements->len; i++) count += count_nodes(node->statements->data[i]);
+    }
+    return count;
+}
+
+bool contains_scope(Node *node) {
+    if(node == NULL) return false;
+    if(node->ty == ND_SCOPE) return true;
+    return contains_scope(node->left) || contains_scope(node->middle) || contains_scope(node->right) || contains_scope(node->extra);
+}
+
+bool has_inner_scope(Node *body) {
+    for(int i = 0; i < body->statements->len; i++) {
+        if(contains_scope(body->statements->data[i])) return true;
+    }
+    return false;
+}
+
+Node *in_unrolled_scope(Node *node, Scope *scope) {
+    node->scope = scope;
+    return node;
+}
+
+Node *goto_node(char *label, Scope *scope) {
+    Node *node = unary_operation_node(ND_GOTO, identifier(label, scope));
+    node->scope = scope;
+    return node;
+}
+
+Node *label_node(char *label, Scope *scope) {
+    declare_label(scope, label);
+    Node *node = unary_operation_node(ND_LABEL, identifier(label, scope));
+    node->scope = scope;
+    return node;
+}
+
+Node *copy_statement(Unrolling *unrolling, Node *node) {
+    if(node == NULL) return NULL;
+
+    if((node->ty == ND_BREAK || node->ty == ND_CONTINUE) && node->jump_target == unrolling->loop) {
+        if(node->ty == ND_BREAK) {
+            unrolling->used_break = true;
+            return goto_node(unrolling->break_label, node->scope);
+        }
+        unrolling->used_continue = true;
+        return goto_node(unrolling->continue_label, node->scope);
+    }
+
+    Node *copy = malloc(sizeof(Node));
+    memcpy(copy, node, sizeof(Node));
+    if(copy->scope == unrolling->spliced_from) copy->scope = unrolling->spliced_into;
+    if(node->ty == ND_WHILE || node->ty == ND_DO || node->ty == ND_FOR) {
+        vec_push(unrolling->originals, node);
+        vec_push(unrolling->copies, copy);
+    }
+    if(node->ty == ND_BREAK || node->ty == ND_CONTINUE) {
+        for(int i = 0; i < unrolling->originals->len; i++) {
+            if(unrolling->originals->data[i] == node->jump_target) copy->jump_target = unrolling->copies->data[i];
+        }
+    }
+
+    copy->left = copy_statement(unrolling, node->left);
+    copy->middle = copy_statement(unrolling, node->middle);
+    copy->right = copy_statement(unrolling, node->right);
+    copy->extra = copy_statement(unrolling, node->extra);
+    if(node->ty == ND_SCOPE) {
+        copy->statements = new_vector();
+        for(int i = 0; i < node->statements->len; i++) {
+            vec_push(copy->statements, copy_statement(unrolling, node->statements->data[i]));
+        }
+    }
+    return copy;
+}
+
+// Adds one iteration's worth of statements to a list. The body is spliced in without its scope
+// when into is the scope the body opens, or when that scope has nothing to allocate and no scopes
+// of its own expecting to find it on the stack.
+void copy_iteration(Unrolling *unrolling, Node *node, Vector *statements, Scope *into) {
+    Node *body = node->ty == ND_FOR ? node->extra : node->right;
+    unrolling->continue_label = unrolled_name("unroll");
+    unrolling->used_continue = false;
+
+    if(body->ty == ND_SCOPE && (body->scope == into || (body->scope->variables_declared->keys->len == 0 && !has_inner_scope(body)))) {
+        unrolling->spliced_from = body->scope;
+        unrolling->spliced_into = into;
+        for(int i = 0; i < body->statements->len; i++) vec_push(statements, copy_statement(unrolling, body->statements->data[i]));
+        unrolling->spliced_from = unrolling->spliced_into = NULL;
+    } else {
+        vec_push(statements, copy_statement(unrolling, body));
+    }
+    if(unrolling->used_continue) vec_push(statements, label_node(unrolling->continue_label, into));
+    if(node->ty == ND_FOR) vec_push(statements, copy_statement(unrolling, node->right));
+}
+
+// Runs the loop condition at compile time, when the counter starts out at a known value
+int constant_trip_count(LoopCounter *counter, Node *start) {
+    if(start == NULL || start->ty != '=' || start->left->ty != ND_IDENT || start->right->ty != ND_NUM || counter->bound->ty != ND_NUM) return -1;
+    if(get_variable_id(start->left->scope, start->left->name) != get_variable_id(counter->iv->scope, counter->iv->name)) return -1;
+
+    long iv = start->right->val, holds;
+    for(int trips = 0; trips <= MAX_FULL_UNROLL; trips++) {
+        fold_binary(counter->op, iv, counter->bound->val, &holds);
+        if(!holds) return trips;
+        iv = (unsigned long)iv + counter->step;
+    }
+    return -1;
+}
+
+// Replaces a loop with one copy of its body per iteration
+void unroll_fully(Unrolling *unrolling, Node *node, int trips, Scope *scope, Vector *out) {
+    if(node->ty == ND_FOR) vec_push(out, node->left);
+    for(int i = 0; i < trips; i++) copy_iteration(unrolling, node, out, scope);
+    if(unrolling->used_break) vec_push(out, label_node(unrolling->break_label, scope));
+}
+
+// Puts a main loop that runs factor iterations at a time in front of the loop, which is left to
+// run whatever iterations remain
+void unroll_partially(Unrolling *unrolling, Node *node, LoopCounter *counter, int factor, Scope *scope, Vector *out) {
+    Node *body = node->ty == ND_FOR ? node->extra : node->right;
+    Node *trips = trip_count(counter->op, counter->iv, counter->bound, counter->step, scope);
+    if(trips == NULL) {
+        vec_push(out, node);
+        return;
+    }
+
+    // The main loop's body runs in the frame of the original body, or in a new one with nothing in it
+    Scope *main_scope = body->ty == ND_SCOPE ? body->scope : new_scope(scope);
+    Node *main_body = in_unrolled_scope(new_scope_node(true), main_scope);
+    for(int i = 0; i < factor; i++) copy_iteration(unrolling, node, main_body->statements, main_scope);
+
+    // The count of iterations left is unsigned. If it doesn't fit in a signed compare, the
+    // original loop runs every iteration.
+    char *remaining = unrolled_name("trips");
+    declare_variable(scope, remaining);
+    Node *decrement = binary_operation_node('-', identifier(remaining, main_scope), in_unrolled_scope(new_numeric_node(factor), main_scope));
+    vec_push(main_body->statements, in_unrolled_scope(binary_operation_node('=', identifier(remaining, main_scope), in_unrolled_scope(decrement, main_scope)), main_scope));
+    Node *enough_left = binary_operation_node(ND_GEQUAL, identifier(remaining, scope), in_unrolled_scope(new_numeric_node(factor), scope));
+    Node *main_loop = binary_operation_node(ND_WHILE, in_unrolled_scope(enough_left, scope), main_body);
+
+    if(node->ty == ND_FOR) {
+        vec_push(out, node->left);
+        node->left = in_unrolled_scope(nullary_operation_node(ND_NOOP), scope);
+    }
+    vec_push(out, in_unrolled_scope(binary_operation_node('=', identifier(remaining, scope), trips), scope));
+    vec_push(out, in_unrolled_scope(main_loop, scope));
+    vec_push(out, node);
+    if(unrolling->used_break) vec_push(out, label_node(unrolling->break_label, scope));
+}
+
+// Unrolls a loop if it can, pushing whatever replaces it onto out
+bool unroll_loop(Node *node, Node *previous, Scope *scope, Vector *out) {
+    LoopCounter counter;
+    Node *body = node->ty == ND_FOR ? node->extra : node->right;
+    if(node->unreachable || !find_loop_counter(node, scope, &counter)) {
+        vec_push(out, node);
+        return false;
+    }
+
+    Unrolling unrolling = { node, new_vector(), new_vector(), NULL, unrolled_name("unroll"), false, false, NULL, NULL };
+    int size = count_nodes(body) + (node->ty == ND_FOR ? count_nodes(node->right) : 0);
+    int trips = constant_trip_count(&counter, node->ty == ND_FOR ? node->left : previous);
+    if(trips >= 0 && trips * size <= UNROLL_BUDGET) {
+        unroll_fully(&unrolling, node, trips, scope, out);
+        return true;
+    }
+
+    int factor = UNROLL_FACTOR;
+    if(factor * size > UNROLL_BUDGET) factor = UNROLL_BUDGET / size;
+    // Without a scope of its own to run in, the main loop needs one that the copies' scopes don't know about
+    // A loop the vectorizer takes already runs several iterations at a time
+    if(factor < 2 || (body->ty != ND_SCOPE && contains_scope(body)) || is_vectorizable(node, scope)) {
+        vec_push(out, node);
+        return false;
+    }
+    unroll_partially(&unrolling, node, &counter, factor, scope, out);
+    return false;
+}
+
+bool unroll_in_statement(Node *node);
+
+bool unroll_in_statements(Node *node) {
+    bool unrolled = false;
+    Vector *statements = new_vector();
+
+    for(int i = 0; i < node->statements->len; i++) {
+        Node *statement = node->statements->data[i];
+        unrolled |= unroll_in_statement(statement);
+
+        if(statement->ty == ND_WHILE || statement->ty == ND_FOR) {
+            Node *previous = statements->len > 0 ? statements->data[statements->len - 1] : NULL;
+            unrolled |= unroll_loop(statement, previous, node->scope, statements);
+        } else {
+            vec_push(statements, statement);
+        }
+    }
+    node->statements = statements;
+    return unrolled;
+}
+
+// Inner loops are unrolled first, so the size of what gets copied is known
+bool unroll_in_statement(Node *node) {
+    switch(node->ty) {
+        case ND_SCOPE:
+            return unroll_in_statements(node);
+        case ND_IF:
+            return unroll_in_statement(node->middle) | unroll_in_statement(node->right);
+        case ND_WHILE:
+            return unroll_in_statement(node->right);
+        case ND_DO:
+            return unroll_in_statement(node->left);
+        case ND_FOR:
+            return unroll_in_statement(node->extra);
+        default:
+            return false;
+    }
+}
+
+// Returns true if any loop was fully unrolled
+bool unroll_loops(Node *program) {
+    return unroll_in_statement(program);
+}
@@ -36,4 +36,27 @@ void *map_get(Map *map, char *key) {
         }
     }
     return map->default_value;
-}
\ No newline at end of file
+}
+
+Bytes *new_bytes() {
+    Bytes *bytes = malloc(sizeof(Bytes));
+    bytes->data = malloc(64);
+    bytes->capacity = 64;
+    bytes->len = 0;
+    return bytes;
+}
+
+void bytes_push(Bytes *bytes, int byte) {
+    if(bytes->capacity == bytes->len) {
+        bytes->capacity *= 2;
+        bytes->data = realloc(bytes->data, bytes->capacity);
+    }
+    bytes->data[bytes->len++] = byte;
+}
+
+// Appends the lowest size bytes of val, in little-endian order
+void bytes_push_value(Bytes *bytes, long val, int size) {
+    for(int i = 0; i < size; i++) {
+        bytes_push(bytes, (unsigned long)val >> (i * 8));
+    }
+}
@@ -72,6 +72,10 @@ void test_scope() {
     expect(__LINE__, 8, bazz_location->offset);
     expect(__LINE__, 0, bazz_location2->scopes_up);
     expect(__LINE__, 8, bazz_location2->offset);
+
+    // Variables of the same name in sibling scopes are still different variables
+    expect(__LINE__, 1, get_variable_id(child_scope, "bazz") != get_variable_id(second_child_scope, "bazz"));
+    expect(__LINE__, get_variable_id(top_level_scope, "bar"), get_variable_id(child_scope, "bar"));
 }
 
 void test_scope_resolution() {
@@ -109,10 +113,124 @@ void test_scope_resolution() {
     remove(filename);
 }
 
+// Assembles a single line and checks it against the bytes an assembler would produce
+void expect_encoding(int line, char *assembly, char *expected, int len) {
+    Vector *lines = new_vector();
+    vec_push(lines, assembly);
+    Bytes *code = assemble(lines);
+    expect(line, len, code->len);
+    for(int i = 0; i < len; i++) {
+        expect(line, (unsigned char)expected[i], code->data[i]);
+    }
+}
+
+void test_assembler() {
+    expect_encoding(__LINE__, "\tpush rbp", "\x55", 1);
+    expect_encoding(__LINE__, "\tmov rbp, rsp", "\x48\x89\xe5", 3);
+    expect_encoding(__LINE__, "\tmov rax, QWORD PTR [rbp-8]", "\x48\x8b\x45\xf8", 4);
+    expect_encoding(__LINE__, "\tmov r11, [rbp]", "\x4c\x8b\x5d\x00", 4);
+    expect_encoding(__LINE__, "\tadd QWORD PTR [r11-16], 1", "\x49\x83\x43\xf0\x01", 5);
+    expect_encoding(__LINE__, "\tsub rsp, 256", "\x48\x81\xec\x00\x01\x00\x00", 7);
+    expect_encoding(__LINE__, "\tlea rax, [rax+rax*4]", "\x48\x8d\x04\x80", 4);
+    expect_encoding(__LINE__, "\timul rax, rax, 10", "\x48\x6b\xc0\x0a", 4);
+    expect_encoding(__LINE__, "\tmovzb rcx, bl", "\x48\x0f\xb6\xcb", 4);
+    expect_encoding(__LINE__, "\tsetle al", "\x0f\x9e\xc0", 3);
+    expect_encoding(__LINE__, "\tcmovnz rax, r8", "\x49\x0f\x45\xc0", 4);
+    expect_encoding(__LINE__, "\tshr rax, cl", "\x48\xd3\xe8", 3);
+    expect_encoding(__LINE__, "\tshr QWORD PTR [r11-32], cl", "\x49\xd3\x6b\xe0", 4);
+    expect_encoding(__LINE__, "\tpush [rax]", "\xff\x30", 2);
+    expect_encoding(__LINE__, "\tmovabs rbx, 81985529216486895", "\x48\xbb\xef\xcd\xab\x89\x67\x45\x23\x01", 10);
+    expect_encoding(__LINE__, "\tlea rcx, [rip+8]", "\x48\x8d\x0d\x08\x00\x00\x00", 7);
+    expect_encoding(__LINE__, "\tmovsxd rax, DWORD PTR [rcx+rax*4]", "\x48\x63\x04\x81", 4);
+    expect_encoding(__LINE__, "\tjmp rax", "\xff\xe0", 2);
+    expect_encoding(__LINE__, "\tmov BYTE PTR [rbp-1], al", "\x88\x45\xff", 3);
+    expect_encoding(__LINE__, "\tmov WORD PTR [rbp-4], ax", "\x66\x89\x45\xfc", 4);
+    expect_encoding(__LINE__, "\tmovsx rax, BYTE PTR [rbp-3]", "\x48\x0f\xbe\x45\xfd", 5);
+    expect_encoding(__LINE__, "\tmovsx rax, WORD PTR [rbp-6]", "\x48\x0f\xbf\x45\xfa", 5);
+    expect_encoding(__LINE__, "\tadd BYTE PTR [rbp-1], 5", "\x80\x45\xff\x05", 4);
+    expect_encoding(__LINE__, "\tinc WORD PTR [rbp-2]", "\x66\xff\x45\xfe", 4);
+    expect_encoding(__LINE__, "\tadd eax, ebx", "\x01\xd8", 2);
+    expect_encoding(__LINE__, "\tmov eax, 7", "\xb8\x07\x00\x00\x00", 5);
+    expect_encoding(__LINE__, "\tmovdqu xmm0, [rbp+rax*8-1600]", "\xf3\x0f\x6f\x84\xc5\xc0\xf9\xff\xff", 9);
+    expect_encoding(__LINE__, "\tmovdqu [rbp+rax*8-800], xmm0", "\xf3\x0f\x7f\x84\xc5\xe0\xfc\xff\xff", 9);
+    expect_encoding(__LINE__, "\tmovdqu xmm9, [r11+rax*4-64]", "\xf3\x45\x0f\x6f\x4c\x83\xc0", 7);
+    expect_encoding(__LINE__, "\tmovdqa xmm1, xmm8", "\x66\x41\x0f\x6f\xc8", 5);
+    expect_encoding(__LINE__, "\tpaddq xmm0, xmm1", "\x66\x0f\xd4\xc1", 4);
+    expect_encoding(__LINE__, "\tpaddd xmm0, xmm9", "\x66\x41\x0f\xfe\xc1", 5);
+    expect_encoding(__LINE__, "\tpsubq xmm0, xmm8", "\x66\x41\x0f\xfb\xc0", 5);
+    expect_encoding(__LINE__, "\tpand xmm2, xmm3", "\x66\x0f\xdb\xd3", 4);
+    expect_encoding(__LINE__, "\tpor xmm2, xmm3", "\x66\x0f\xeb\xd3", 4);
+    expect_encoding(__LINE__, "\tpxor xmm2, xmm3", "\x66\x0f\xef\xd3", 4);
+    expect_encoding(__LINE__, "\tpcmpeqd xmm1, xmm1", "\x66\x0f\x76\xc9", 4);
+    expect_encoding(__LINE__, "\tpsllq xmm0, 3", "\x66\x0f\x73\xf0\x03", 5);
+    expect_encoding(__LINE__, "\tpsrlq xmm10, 1", "\x66\x41\x0f\x73\xd2\x01", 6);
+    expect_encoding(__LINE__, "\tpslld xmm0, 31", "\x66\x0f\x72\xf0\x1f", 5);
+    expect_encoding(__LINE__, "\tmovq xmm8, rax", "\x66\x4c\x0f\x6e\xc0", 5);
+    expect_encoding(__LINE__, "\tmovd xmm9, eax", "\x66\x44\x0f\x6e\xc8", 5);
+    expect_encoding(__LINE__, "\tpunpcklqdq xmm8, xmm8", "\x66\x45\x0f\x6c\xc0", 5);
+    expect_encoding(__LINE__, "\tpshufd xmm9, xmm9, 0", "\x66\x45\x0f\x70\xc9\x00", 6);
+    expect_encoding(__LINE__, "\tvmovdqu ymm0, [rbp+rax*8-1600]", "\xc5\xfe\x6f\x84\xc5\xc0\xf9\xff\xff", 9);
+    expect_encoding(__LINE__, "\tvmovdqu [rbp+rax*8-800], ymm0", "\xc5\xfe\x7f\x84\xc5\xe0\xfc\xff\xff", 9);
+    expect_encoding(__LINE__, "\tvmovdqu ymm1, [r11+rax*4-64]", "\xc4\xc1\x7e\x6f\x4c\x83\xc0", 7);
+    expect_encoding(__LINE__, "\tvmovdqa ymm1, ymm8", "\xc5\x7d\x7f\xc1", 4);
+    expect_encoding(__LINE__, "\tvpaddq ymm0, ymm0, ymm1", "\xc5\xfd\xd4\xc1", 4);
+    expect_encoding(__LINE__, "\tvpaddd ymm0, ymm0, ymm9", "\xc4\xc1\x7d\xfe\xc1", 5);
+    expect_encoding(__LINE__, "\tvpsubq ymm9, ymm9, ymm8", "\xc4\x41\x35\xfb\xc8", 5);
+    expect_encoding(__LINE__, "\tvpxor ymm0, ymm0, ymm0", "\xc5\xfd\xef\xc0", 4);
+    expect_encoding(__LINE__, "\tvpcmpeqd ymm1, ymm1, ymm1", "\xc5\xf5\x76\xc9", 4);
+    expect_encoding(__LINE__, "\tvpsllq ymm0, ymm0, 3", "\xc5\xfd\x73\xf0\x03", 5);
+    expect_encoding(__LINE__, "\tvpsrlq ymm10, ymm10, 1", "\xc4\xc1\x2d\x73\xd2\x01", 6);
+    expect_encoding(__LINE__, "\tvpslld ymm9, ymm9, 31", "\xc4\xc1\x35\x72\xf1\x1f", 6);
+    expect_encoding(__LINE__, "\tvmovq xmm8, rax", "\xc4\x61\xf9\x6e\xc0", 5);
+    expect_encoding(__LINE__, "\tvmovd xmm9, eax", "\xc5\x79\x6e\xc8", 4);
+    expect_encoding(__LINE__, "\tvpbroadcastq ymm8, xmm8", "\xc4\x42\x7d\x59\xc0", 5);
+    expect_encoding(__LINE__, "\tvpbroadcastd ymm9, xmm9", "\xc4\x42\x7d\x58\xc9", 5);
+    expect_encoding(__LINE__, "\tvzeroupper", "\xc5\xf8\x77", 3);
+    expect_encoding(__LINE__, "\tlea rax, [rcx+rdx*8]", "\x48\x8d\x04\xd1", 4);
+    expect_encoding(__LINE__, "\tlea rdx, [rax+rcx]", "\x48\x8d\x14\x08", 4);
+    expect_encoding(__LINE__, "\tsar rdx, 63", "\x48\xc1\xfa\x3f", 4);
+    expect_encoding(__LINE__, "\tsar rax, cl", "\x48\xd3\xf8", 3);
+    expect_encoding(__LINE__, "\timul rcx, rax, -1", "\x48\x6b\xc8\xff", 4);
+    expect_encoding(__LINE__, "\tnot rdx", "\x48\xf7\xd2", 3);
+    expect_encoding(__LINE__, "\tneg rcx", "\x48\xf7\xd9", 3);
+    expect_encoding(__LINE__, "\tmovsxd rcx, DWORD PTR [rbp-4]", "\x48\x63\x4d\xfc", 4);
+    expect_encoding(__LINE__, "\tmovsx rcx, WORD PTR [rbp-2]", "\x48\x0f\xbf\x4d\xfe", 5);
+
+    // A jump starts out short, and only becomes long when its target is too far away
+    Vector *lines = new_vector();
+    vec_push(lines, "top:");
+    vec_push(lines, "\tjmp top");
+    for(int i = 0; i < 130; i++) vec_push(lines, "\tpush rax");
+    vec_push(lines, "\tjne top");
+    Bytes *code = assemble(lines);
+    expect(__LINE__, 2 + 130 + 6, code->len);
+    expect(__LINE__, 0xeb, code->data[0]);
+    expect(__LINE__, 0xfe, code->data[1]);
+    expect(__LINE__, 0x0f, code->data[132]);
+    expect(__LINE__, 0x85, code->data[133]);
+    expect(__LINE__, -138, *(int *)(code->data + 134));
+
+    // Entries of a jump table are distances from the table, and rip-relative addresses are from
+    // the end of the instruction
+    lines = new_vector();
+    vec_push(lines, "\tlea rcx, [rip+table]");
+    vec_push(lines, "first:\tpush rax");
+    vec_push(lines, "table:");
+    vec_push(lines, "\t.long first-table");
+    vec_push(lines, "\t.long last-table");
+    vec_push(lines, "last:\tpush rax");
+    code = assemble(lines);
+    expect(__LINE__, 7 + 1 + 8 + 1, code->len);
+    expect(__LINE__, 1, *(int *)(code->data + 3));
+    expect(__LINE__, -1, *(int *)(code->data + 8));
+    expect(__LINE__, 8, *(int *)(code->data + 12));
+}
+
 void run_test() {
     test_vector();
     test_map();
     test_scope();
     test_scope_resolution();
+    test_assembler();
     printf("OK\n");
 }
\ No newline at end of file
@@ -0,0 +1,264 @@
+#include "yacc.h"
+
+/**
+ ** Loop vectorization.
+ ** A for loop that counts up by one, and whose body only stores to elements at its counter values
+ ** computed from other elements at its counter, runs as many of its iterations as it can a vector
+ ** at a time before codegen emits it as usual. The loop it emits then only runs whatever is left.
+ ** Every iteration only touches its own element of each array, so iterations can't see each other
+ ** and the order they run in doesn't matter.
+ ** Vectors are 16 bytes of SSE2, or 32 bytes of AVX2 with -mavx2, and hold elements of one size,
+ ** longs or ints. The arithmetic is the kind whose low bytes only depend on the low bytes of its
+ ** operands, so ints can be worked on as ints. Parts of the value that are the same in every
+ ** iteration are computed once before the loop, and copied to every lane of a register of their own.
+ **/
+
+bool VECTORIZE_LOOPS = true;
+bool USE_AVX2 = false;
+
+#define VECTOR_TEMPORARIES 8    // xmm0 to xmm7 hold what is being computed
+#define VECTOR_INVARIANTS 8     // and xmm8 to xmm15 the values the same in every iteration
+
+typedef struct {
+    LoopCounter counter;
+    int iv;                 // Id of the loop counter
+    int size;               // Size of the elements of every array the loop uses
+    Vector *stores;         // The statements of the body, each a store to an element
+    Vector *invariants;     // Values computed before the loop
+} VectorLoop;
+
+bool is_counter_index(VectorLoop *vector, Node *element) {
+    return element->middle->ty == ND_IDENT && get_variable_id(element->middle->scope, element->middle->name) == vector->iv;
+}
+
+// Whether a value is computed the same in every iteration, without any risk of trapping
+bool is_broadcast_value(VectorLoop *vector, Node *node) {
+    switch(node->ty) {
+        case ND_NUM:
+            return true;
+        case ND_IDENT:
+            return get_variable_id(node->scope, node->name) != vector->iv;
+        case '+':
+        case '-':
+        case '*':
+        case '&':
+        case '|':
+        case '^':
+        case ND_LEFT_SHIFT:
+        case ND_RIGHT_SHIFT:
+            return is_broadcast_value(vector, node->left) && is_broadcast_value(vector, node->right);
+        case ND_UNARY_NEG:
+        case ND_UNARY_POS:
+        case ND_UNARY_BIT_COMPLEMENT:
+            return is_broadcast_value(vector, node->middle);
+        default:
+            return false;
+    }
+}
+
+// Finds the register a value the same in every iteration is copied to. Returns -1 if there is none yet.
+int invariant_register(VectorLoop *vector, Node *node) {
+    for(int i = 0; i < vector->invariants->len; i++) {
+        if(same_expression(vector->invariants->data[i], node)) return VECTOR_TEMPORARIES + i;
+    }
+    return -1;
+}
+
+bool uses_element(VectorLoop *vector, Node *element) {
+    int id = get_variable_id(element->scope, element->name);
+    if(!is_counter_index(vector, element)) return false;
+    if(vector->size == 0) vector->size = variable_size(id);
+    return variable_size(id) == vector->size;
+}
+
+// Whether an expression can be computed a vector at a time into the temporary at depth
+bool vectorizes(VectorLoop *vector, Node *node, int depth) {
+    if(depth >= VECTOR_TEMPORARIES) return false;
+    if(is_broadcast_value(vector, node)) {
+        if(invariant_register(vector, node) == -1) vec_push(vector->invariants, node);
+        return vector->invariants->len <= VECTOR_INVARIANTS;
+    }
+
+    switch(node->ty) {
+        case ND_INDEX:
+            return uses_element(vector, node);
+        case '+':
+        case '-':
+        case '&':
+        case '|':
+        case '^':
+            return vectorizes(vector, node->left, depth) && vectorizes(vector, node->right, depth + 1);
+        // The lanes of ints don't have the high bytes a shift to the right would bring down
+        case ND_RIGHT_SHIFT:
+            if(vector->size != 8) return false;
+        case ND_LEFT_SHIFT:
+            return node->right->ty == ND_NUM && vectorizes(vector, node->left, depth);
+        case ND_UNARY_POS:
+            return vectorizes(vector, node->middle, depth);
+        case ND_UNARY_NEG:
+        case ND_UNARY_BIT_COMPLEMENT:
+            return vectorizes(vector, node->middle, depth + 1);
+        default:
+            return false;
+    }
+}
+
+bool vectorizes_store(VectorLoop *vector, Node *statement) {
+    if(statement->unreachable || statement->ty != '=' || statement->left->ty != ND_INDEX) return false;
+    if(!uses_element(vector, statement->left)) return false;
+    if(vector->size != 8 && vector->size != 4) return false;
+    vec_push(vector->stores, statement);
+    return vectorizes(vector, statement->right, 0);
+}
+
+// Checks the shape of the loop, and gathers what emitting it needs
+bool analyze_vector_loop(Node *loop, Scope *scope, VectorLoop *vector) {
+    if(!VECTORIZE_LOOPS || loop->ty != ND_FOR || loop->unreachable) return false;
+    if(!find_loop_counter(loop, scope, &vector->counter)) return false;
+    if(vector->counter.op != '<' || vector->counter.step != 1 || has_side_effects(vector->counter.bound)) return false;
+    vector->iv = get_variable_id(vector->counter.iv->scope, vector->counter.iv->name);
+    if(variable_size(vector->iv) != 8) return false;
+    vector->size = 0;
+    vector->stores = new_vector();
+    vector->invariants = new_vector();
+
+    // The body's scope can't have variables of its own, since the vector loop runs outside of it
+    Node *body = loop->extra;
+    if(body->ty != ND_SCOPE) return vectorizes_store(vector, body);
+    if(body->scope->variable_ids->vals->len > 0) return false;
+    for(int i = 0; i < body->statements->len; i++) {
+        Node *statement = body->statements->data[i];
+        if(statement->ty == ND_NOOP) continue;
+        if(!vectorizes_store(vector, statement)) return false;
+    }
+    return vector->stores->len > 0;
+}
+
+bool is_vectorizable(Node *loop, Scope *scope) {
+    VectorLoop vector;
+    return analyze_vector_loop(loop, scope, &vector);
+}
+
+char *vector_register(int n) {
+    char *name = malloc(sizeof(char) * 8);
+    snprintf(name, 8, "%s%d", USE_AVX2 ? "ymm" : "xmm", n);
+    return name;
+}
+
+// Emits an operation on a temporary and another operand, in the SSE2 form that overwrites the
+// temporary, or the AVX2 one that names it twice
+void emit_packed(char *op, int dst, char *src) {
+    if(USE_AVX2) {
+        emit("\tv%s ymm%d, ymm%d, %s\n", op, dst, dst, src);
+    } else {
+        emit("\t%s xmm%d, %s\n", op, dst, src);
+    }
+}
+
+// The name of an instruction that works on lanes as wide as the elements, like paddq or paddd
+char *lane_operation(VectorLoop *vector, char *op) {
+    char *name = malloc(sizeof(char) * 16);
+    snprintf(name, 16, "%s%c", op, vector->size == 8 ? 'q' : 'd');
+    return name;
+}
+
+void gen_vector(VectorLoop *vector, Node *node, int depth, Scope **local_scope) {
+    int reg = invariant_register(vector, node);
+    int size;
+    if(reg != -1) {
+        emit("\t%smovdqa %s, %s\n", USE_AVX2 ? "v" : "", vector_register(depth), vector_register(reg));
+        return;
+    }
+
+    switch(node->ty) {
+        case ND_INDEX:
+            emit("\t%smovdqu %s, %s\n", USE_AVX2 ? "v" : "", vector_register(depth), element_address(node, *local_scope, "rax", &size));
+            return;
+        case ND_UNARY_POS:
+            gen_vector(vector, node->middle, depth, local_scope);
+            return;
+        case ND_UNARY_NEG:
+            gen_vector(vector, node->middle, depth + 1, local_scope);
+            emit_packed("pxor", depth, vector_register(depth));
+            emit_packed(lane_operation(vector, "psub"), depth, vector_register(depth + 1));
+            return;
+        case ND_UNARY_BIT_COMPLEMENT:
+            gen_vector(vector, node->middle, depth, local_scope);
+            emit_packed("pcmpeqd", depth + 1, vector_register(depth + 1));
+            emit_packed("pxor", depth, vector_register(depth + 1));
+            return;
+        case ND_LEFT_SHIFT:
+        case ND_RIGHT_SHIFT:
+            gen_vector(vector, node->left, depth, local_scope);
+            char count[8];
+            snprintf(count, 8, "%d", node->right->val & 63);
+            emit_packed(lane_operation(vector, node->ty == ND_LEFT_SHIFT ? "psll" : "psrl"), depth, count);
+            return;
+        default:
+            break;
+    }
+
+    gen_vector(vector, node->left, depth, local_scope);
+    reg = invariant_register(vector, node->right);
+    if(reg == -1) {
+        gen_vector(vector, node->right, depth + 1, local_scope);
+        reg = depth + 1;
+    }
+    char *op;
+    switch(node->ty) {
+        case '+': op = lane_operation(vector, "padd"); break;
+        case '-': op = lane_operation(vector, "psub"); break;
+        case '&': op = "pand"; break;
+        case '|': op = "por"; break;
+        default: op = "pxor"; break;
+    }
+    emit_packed(op, depth, vector_register(reg));
+}
+
+// Copies the value in rax to every lane of the register
+void gen_broadcast(VectorLoop *vector, int reg) {
+    bool wide = vector->size == 8;
+    if(USE_AVX2) {
+        emit("\tvmov%c xmm%d, %s\n", wide ? 'q' : 'd', reg, wide ? "rax" : "eax");
+        emit("\tvpbroadcast%c ymm%d, xmm%d\n", wide ? 'q' : 'd', reg, reg);
+    } else if(wide) {
+        emit("\tmovq xmm%d, rax\n", reg);
+        emit("\tpunpcklqdq xmm%d, xmm%d\n", reg, reg);
+    } else {
+        emit("\tmovd xmm%d, eax\n", reg);
+        emit("\tpshufd xmm%d, xmm%d, 0\n", reg, reg);
+    }
+}
+
+// The counter is kept in rax and the bound in r10. A vector's worth of iterations runs for as long
+// as all of them are below the bound, and the counter is stored back for the loop that follows.
+void gen_vectorized_loop(Node *loop, Scope **local_scope) {
+    VectorLoop vector;
+    if(!analyze_vector_loop(loop, *local_scope, &vector)) return;
+    int lanes = (USE_AVX2 ? 32 : 16) / vector.size;
+    int label = LABELS_GENERATED++;
+
+    for(int i = 0; i < vector.invariants->len; i++) {
+        gen_value(vector.invariants->data[i], local_scope);
+        gen_broadcast(&vector, VECTOR_TEMPORARIES + i);
+    }
+    gen_value(vector.counter.bound, local_scope);
+    emit("\tmov r10, rax\n");
+    emit("\tmov rax, %s\n", variable_memory(vector.counter.iv, *local_scope));
+    emit("vlc_%d:\n", label);
+    emit("\tlea rcx, [rax+%d]\n", lanes);
+    emit("\tcmp rcx, r10\n");
+    emit("\tjg vle_%d\n", label);
+    for(int i = 0; i < vector.stores->len; i++) {
+        Node *store = vector.stores->data[i];
+        int size;
+        gen_vector(&vector, store->right, 0, local_scope);
+        emit("\t%smovdqu %s, %s\n", USE_AVX2 ? "v" : "", element_address(store->left, *local_scope, "rax", &size), vector_register(0));
+    }
+    emit("\tmov rax, rcx\n");
+    emit("\tjmp vlc_%d\n", label);
+    emit("vle_%d:\n", label);
+    emit("\tmov %s, rax\n", variable_memory(vector.counter.iv, *local_scope));
+    // Leaving the upper halves of the ymm registers dirty slows down any SSE code that follows
+    if(USE_AVX2) emit("\tvzeroupper\n");
+}
@@ -0,0 +1,183 @@
+#include "yacc.h"
+#include <signal.h>
+
+/**
+ ** Bytecode interpreter (-interp).
+ ** Dispatch is threaded: every handler ends in a jump of its own, through a table of label
+ ** addresses (a GNU C extension), rather than going back around a switch. Each handler then has
+ ** its own indirect branch, which the processor can predict from the handler it's in.
+ ** Arithmetic behaves like the generated code: it wraps around, division and shifts are unsigned,
+ ** the shift count is masked to 6 bits, comparisons are signed, and dividing by zero raises the
+ ** same signal the div instruction would.
+ ** Frames live on a stack of registers that grows as calls need it. Calls nested too deep raise the
+ ** signal running out of stack would, and so does an index that takes an element out of its frame.
+ **/
+
+#define MAX_CALL_DEPTH (1 << 20)
+
+typedef struct {
+    Instruction *call;      // The call to return from, whose a is where the value goes
+    long base;              // Where the caller's frame starts
+} CallFrame;
+
+long run_bytecode(Bytecode *bytecode) {
+    static void *dispatch[BC_OPERATIONS] = {
+        [BC_HALT] = &&halt, [BC_MOVE] = &&move, [BC_LOAD] = &&load,
+        [BC_NEG] = &&neg, [BC_NOT] = &&not, [BC_LNOT] = &&lnot,
+        [BC_ADD] = &&add, [BC_SUB] = &&sub, [BC_MUL] = &&mul, [BC_DIV] = &&div, [BC_MOD] = &&mod,
+        [BC_SHL] = &&shl, [BC_SHR] = &&shr, [BC_AND] = &&and, [BC_OR] = &&or, [BC_XOR] = &&xor,
+        [BC_EQ] = &&eq, [BC_NE] = &&ne, [BC_LT] = &&lt, [BC_LE] = &&le, [BC_GT] = &&gt, [BC_GE] = &&ge,
+        [BC_ADDI] = &&addi, [BC_SUBI] = &&subi, [BC_MULI] = &&muli, [BC_DIVI] = &&divi, [BC_MODI] = &&modi,
+        [BC_SHLI] = &&shli, [BC_SHRI] = &&shri, [BC_ANDI] = &&andi, [BC_ORI] = &&ori, [BC_XORI] = &&xori,
+        [BC_EQI] = &&eqi, [BC_NEI] = &&nei, [BC_LTI] = &&lti, [BC_LEI] = &&lei, [BC_GTI] = &&gti, [BC_GEI] = &&gei,
+        [BC_EXT8] = &&ext8, [BC_EXT16] = &&ext16, [BC_EXT32] = &&ext32,
+        [BC_JMP] = &&jmp, [BC_JZ] = &&jz, [BC_JNZ] = &&jnz,
+        [BC_JEQ] = &&jeq, [BC_JNE] = &&jne, [BC_JLT] = &&jlt, [BC_JLE] = &&jle, [BC_JGT] = &&jgt, [BC_JGE] = &&jge,
+        [BC_JEQI] = &&jeqi, [BC_JNEI] = &&jnei, [BC_JLTI] = &&jlti, [BC_JLEI] = &&jlei, [BC_JGTI] = &&jgti, [BC_JGEI] = &&jgei,
+        [BC_INCJLT] = &&incjlt, [BC_INCJLE] = &&incjle, [BC_INCJNE] = &&incjne,
+        [BC_DECJGT] = &&decjgt, [BC_DECJGE] = &&decjge, [BC_DECJNE] = &&decjne,
+        [BC_INCJLTI] = &&incjlti, [BC_INCJLEI] = &&incjlei, [BC_INCJNEI] = &&incjnei,
+        [BC_DECJGTI] = &&decjgti, [BC_DECJGEI] = &&decjgei, [BC_DECJNEI] = &&decjnei,
+        [BC_TABLE] = &&table, [BC_LOADX] = &&loadx, [BC_STOREX] = &&storex,
+        [BC_CALL] = &&call, [BC_RET] = &&ret,
+    };
+    Instruction *code = bytecode->code;
+    Instruction *pc = code;
+    long capacity = bytecode->registers * 2 + 1;
+    long *stack = calloc(capacity, sizeof(long));
+    long *r = stack;
+    CallFrame *frames = malloc(sizeof(CallFrame) * 16);
+    int depth = 0, frames_capacity = 16;
+    unsigned long divisor, entry, element;
+    long result, base;
+
+// r[a] = r[b] op r[c], and r[a] = r[b] op c for the I form
+#define NEXT() goto *dispatch[pc->op]
+#define OPERATION(name, expr) name: r[pc->a] = (expr); pc++; NEXT();
+#define BINARY(name, type, op) \
+    OPERATION(name, (type)r[pc->b] op (type)r[pc->c]) \
+    OPERATION(name##i, (type)r[pc->b] op (type)pc->c)
+#define BRANCH(name, op) \
+    name: pc = r[pc->a] op r[pc->b] ? code + pc->c : pc + 1; NEXT(); \
+    name##i: pc = r[pc->a] op pc->b ? code + pc->c : pc + 1; NEXT();
+// Wrapping, like the generated code
+#define STEP(name, step, op) \
+    name: r[pc->a] = (unsigned long)r[pc->a] + step; pc = r[pc->a] op r[pc->b] ? code + pc->c : pc + 1; NEXT(); \
+    name##i: r[pc->a] = (unsigned long)r[pc->a] + step; pc = r[pc->a] op pc->b ? code + pc->c : pc + 1; NEXT();
+#define DIVISION(name, op, divisor_expr) \
+    name: divisor = divisor_expr; \
+    if(divisor == 0) raise(SIGFPE); \
+    r[pc->a] = (unsigned long)r[pc->b] op divisor; pc++; NEXT();
+
+    NEXT();
+
+    OPERATION(move, r[pc->b])
+    OPERATION(load, pc->b)
+    OPERATION(neg, -(unsigned long)r[pc->b])
+    OPERATION(not, ~r[pc->b])
+    OPERATION(lnot, r[pc->b] == 0)
+    OPERATION(ext8, (signed char)r[pc->b])
+    OPERATION(ext16, (short)r[pc->b])
+    OPERATION(ext32, (int)r[pc->b])
+    BINARY(add, unsigned long, +)
+    BINARY(sub, unsigned long, -)
+    BINARY(mul, unsigned long, *)
+    BINARY(and, long, &)
+    BINARY(or, long, |)
+    BINARY(xor, long, ^)
+    BINARY(eq, long, ==)
+    BINARY(ne, long, !=)
+    BINARY(lt, long, <)
+    BINARY(le, long, <=)
+    BINARY(gt, long, >)
+    BINARY(ge, long, >=)
+    OPERATION(shl, (unsigned long)r[pc->b] << (r[pc->c] & 63))
+    OPERATION(shli, (unsigned long)r[pc->b] << (pc->c & 63))
+    OPERATION(shr, (unsigned long)r[pc->b] >> (r[pc->c] & 63))
+    OPERATION(shri, (unsigned long)r[pc->b] >> (pc->c & 63))
+    DIVISION(div, /, r[pc->c])
+    DIVISION(divi, /, (long)pc->c)
+    DIVISION(mod, %, r[pc->c])
+    DIVISION(modi, %, (long)pc->c)
+
+jmp:
+    pc = code + pc->c;
+    NEXT();
+jz:
+    pc = r[pc->a] == 0 ? code + pc->c : pc + 1;
+    NEXT();
+jnz:
+    pc = r[pc->a] != 0 ? code + pc->c : pc + 1;
+    NEXT();
+    BRANCH(jeq, ==)
+    BRANCH(jne, !=)
+    BRANCH(jlt, <)
+    BRANCH(jle, <=)
+    BRANCH(jgt, >)
+    BRANCH(jge, >=)
+    STEP(incjlt, 1, <)
+    STEP(incjle, 1, <=)
+    STEP(incjne, 1, !=)
+    STEP(decjgt, -1, >)
+    STEP(decjge, -1, >=)
+    STEP(decjne, -1, !=)
+
+// The entries of the table are the JMPs right after it
+table:
+    entry = r[pc->a];
+    pc = entry < (unsigned long)pc->b ? code + pc[1 + entry].c : code + pc->c;
+    NEXT();
+
+// Like the generated code, an index past the end of its array reaches whatever comes next
+loadx:
+    element = pc->b + (unsigned long)r[pc->c];
+    if(element >= (unsigned long)bytecode->registers) raise(SIGSEGV);
+    r[pc->a] = r[element];
+    pc++;
+    NEXT();
+storex:
+    element = pc->b + (unsigned long)r[pc->c];
+    if(element >= (unsigned long)bytecode->registers) raise(SIGSEGV);
+    r[element] = r[pc->a];
+    pc++;
+    NEXT();
+
+// The callee's frame starts at r[c], so its parameters are the arguments already there
+call:
+    if(depth == MAX_CALL_DEPTH) raise(SIGSEGV);
+    if(depth == frames_capacity) {
+        frames_capacity *= 2;
+        frames = realloc(frames, sizeof(CallFrame) * frames_capacity);
+    }
+    base = r - stack;
+    frames[depth++] = (CallFrame){pc, base};
+    base += pc->c;
+    if(base + bytecode->registers > capacity) {
+        capacity = (base + bytecode->registers) * 2;
+        stack = realloc(stack, sizeof(long) * capacity);
+    }
+    r = stack + base;
+    pc = code + pc->b;
+    NEXT();
+ret:
+    result = r[pc->a];
+    depth--;
+    r = stack + frames[depth].base;
+    pc = frames[depth].call;
+    r[pc->a] = result;
+    pc++;
+    NEXT();
+
+halt:
+    result = r[pc->a];
+    free(stack);
+    free(frames);
+    return result;
+
+#undef NEXT
+#undef OPERATION
+#undef BINARY
+#undef BRANCH
+#undef STEP
+#undef DIVISION
+}
@@ -1,4 +1,9 @@
+// For fmemopen and anonymous mappings
+#define _DEFAULT_SOURCE
+
 #include <ctype.h>
+#include <stdarg.h>
+#include <limits.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -28,12 +33,23 @@ Map *new_map(void *default_value);
 void map_put(Map *map, char *key, void *val);
 void *map_get(Map *map, char *key);
 
+typedef struct {
+    unsigned char *data;
+    int capacity;
+    int len;
+} Bytes;
+
+Bytes *new_bytes();
+void bytes_push(Bytes *bytes, int byte);
+void bytes_push_value(Bytes *bytes, long val, int size);
+
 enum {
     TOKENIZE_ERROR = 1,
     PARSE_ERROR = 2,
     CODEGEN_ERROR = 3,
     SCOPE_ERROR = 4,
     EXTERNAL_ERROR = 5,
+    ASSEMBLY_ERROR = 6,
 };
 
 enum {
@@ -59,6 +75,14 @@ enum {
     TK_LOR,
     TK_GOTO,
     TK_LABEL,
+    TK_SWITCH,
+    TK_CASE,
+    TK_DEFAULT,
+    TK_RETURN,
+    TK_CHAR,        // The types a variable can be declared with
+    TK_SHORT,
+    TK_INT,
+    TK_LONG,
 };
 
 typedef struct {
@@ -99,48 +123,280 @@ enum {
     ND_LOR,
     ND_GOTO,
     ND_LABEL,
+    ND_SWITCH,                  // Jumps to the label of the case the selector matches
+    ND_CALL,                    // Calls the function in name, with the chain of arguments in middle
+    ND_ARG,                     // An argument (left) and the ones after it (right)
+    ND_RETURN,
+    ND_FUNCTION,                // A definition: its parameters in statements, its body in middle
+    ND_INDEX,                   // An element of the array in name, at the index in middle
+};
+
+enum {
+    LAT_UNDEF = 0,      // Never evaluated (the node is unreachable)
+    LAT_CONST,          // Always evaluates to the same value
+    LAT_VARYING,        // Value can't be determined at compile time
+};
+
+typedef struct {
+    int state;
+    long val;           // Value if state is LAT_CONST
+} LatticeValue;
+
+enum {
+    RANGE_UNKNOWN = 0,  // Nothing is known about the node's value
+    RANGE_EMPTY,        // No value was seen (the node is unreachable)
+    RANGE_BOUNDED,      // Always between lo and hi, inclusive
+};
+
+typedef struct {
+    int state;
+    long lo;
+    long hi;
+} Range;
+
+enum {
+    COND_UNKNOWN = 0,
+    COND_ALWAYS_TRUE,
+    COND_ALWAYS_FALSE,
 };
 
 typedef struct Node {
     int ty;                 // Node type
     int arity;
-    int val;                // Integer value if node is of type ND_NUM
-    char *name;             // Name of the identifier if type is ND_IDENT or ND_LABEL
+    int val;                // Integer value if node is of type ND_NUM, or the value of a case label
+    char *name;             // Name of the identifier if type is ND_IDENT or ND_LABEL, of the function for ND_CALL and ND_FUNCTION, or of the array for ND_INDEX
     struct Node *left;      // Left child. First arg in binary/ternary operations
     struct Node *middle;    // Middle child. First arg in unary operations. Second arg in ternary operations
     struct Node *right;     // Right child. Second arg in binary operations. Third arg in ternary operations
     struct Node *extra;     // Used only for for-loops
-    Vector *statements;     // Used for scope nodes
+    Vector *statements;     // Used for scope nodes, the case labels of a switch and the parameters of a function
     struct Node *parent;    // Used for scope node navigation
     bool descend;
     char *break_label;      // Used to keep track of which label a break/continue statement should jump to
     char *continue_label;   
+    struct Node *jump_target;   // The loop a break/continue statement belongs to, or where a switch goes without a match
+    struct Scope *scope;    // Innermost scope the node is evaluated in (for scope nodes, the scope they open)
+    LatticeValue lattice;   // Constant propagation result for this node
+    int static_cond;        // Whether the condition of an if/loop/ternary is known at compile time
+    bool unreachable;       // Set on statements that can never be executed
+    int rule;               // Instruction selection: cheapest rule to compute the node into rax
+    int cost;               // and roughly how many instructions that takes
+    Range range;            // Every value the node was seen to take
+    long *live_after;       // Dead store elimination: variables that may be read after the statement runs
 } Node;
 
 Node *parse_code(Vector *tokens);
+// Functions are defined at the top level, K&R style without types: name(a, b) { ... }
+extern Vector *FUNCTIONS;
+bool is_function_definition(Vector *tokens, int pos);
+Node *find_function(char *name);
+Node *binary_operation_node(int op, Node *left, Node *right);
+Node *unary_operation_node(int op, Node *child);
+Node *ternary_operation_node(int op, Node *left, Node *middle, Node *right);
+Node *nullary_operation_node(int op);
+Node *new_scope_node(bool descend);
+Node *new_numeric_node(int val);
+// Variables are longs unless declared otherwise: char c = 1, d; int i;
+int size_of_type(int token_type);
+#define ARRAY_LENGTH_LIMIT 65536    // Most elements an array can have
 
 typedef struct Scope {
     Vector *sub_scopes; 
     Map *variables_declared;
     Vector *labels_declared;
+    Map *variable_ids;      // Unique ids of each variable declared, used by the optimizer
     struct Scope *parent_scope;
     int scopes_traversed;
-    char *break_label;      // Used to keep track of which label a break/continue statement should jump to
-    char *continue_label;   
+    int frame_size;         // Bytes its variables take on the stack, a multiple of 8
 } Scope;
 
 typedef struct {
     int offset;     // How far away is the variable from the base pointer of its scope
     int scopes_up;  // How many base pointers have to be climbed to reach the variable
+    int size;       // How many bytes the variable takes (an element of it, for an array)
+    int length;     // How many elements the variable has if it is an array, or 0
 } VariableAddress;
 
 Scope *new_scope(Scope *parent_scope);
 void declare_variable(Scope *target_scope, char *variable_name);
+void declare_sized_variable(Scope *target_scope, char *variable_name, int size);
+int variable_size(int id);
+// Arrays have a fixed length, and are only used through their elements: long a[8]; a[i] = a[i] + 1;
+void declare_array(Scope *target_scope, char *variable_name, int size, int length);
+int variable_length(int id);
+long truncate_to_size(long val, int size);
+
+void declare_label(Scope *target_scope, char *label_name);
 VariableAddress *get_variable_location(Scope *current_scope, char *variable_name);
 Scope *construct_scope_from_token_stream(Vector *tokens);
+extern Vector *FUNCTION_SCOPES;
 Scope *get_next_child_scope(Scope *current_scope);
+int get_variable_id(Scope *current_scope, char *variable_name);
+bool variable_already_declared(Scope *target_scope, char *variable_name);
+int variable_count();
+void bind_scopes(Node *node, Scope *current_scope);
+void bind_function(Node *function, Scope *scope);
+
+bool has_side_effects(Node *node);
+bool reads_element(Node *node);
+Node *identifier(char *name, Scope *scope);
+Node *copy_expression(Node *node);
+bool is_commutative(int op);
+bool same_expression(Node *a, Node *b);
+bool fold_unary(int op, long operand, long *result);
+bool fold_binary(int op, long left, long right, long *result);
+Node *matching_case(Node *node, long value);
+void propagate_constants(Node *program);
+int variable_of(Node *node);
+bool fits_in_immediate(long val);
+void analyze_ranges(Node *program);
+bool narrow_ranges(Node *program);
+Range range_of(Node *node);
+bool is_known_boolean(Node *node);
+void simplify(Node *program);
+bool is_comparison(int op);
+int inverse_comparison(int op);
+int swap_comparison(int op);
+bool reduce_induction_variables(Node *program);
 
-// void gen(Node *statement_tree, Map *local_variables);
+// The induction variable that decides how many times a loop runs, compared as `iv op bound`
+typedef struct {
+    Node *iv;
+    int op;
+    Node *bound;
+    long step;
+} LoopCounter;
+
+bool find_loop_counter(Node *node, Scope *scope, LoopCounter *counter);
+Node *trip_count(int op, Node *iv, Node *bound, long step, Scope *scope);
+extern int UNROLL_FACTOR;
+bool unroll_loops(Node *program);
+int count_nodes(Node *node);
+Node *goto_node(char *label, Scope *scope);
+Node *label_node(char *label, Scope *scope);
+void hoist_loop_invariants(Node *program);
+void eliminate_dead_stores(Node *program, bool is_function);
+Node *result_statement(Node *program);
+void eliminate_common_subexpressions(Node *program);
+Vector *called_functions(Node *program);
+void inline_functions(Node *program);
+void optimize(Node *program);
+
+// -Oeval: run the program at compile time, within a budget of -feval-steps=N steps and
+// -feval-memory=N variables
+extern bool EVALUATE_PROGRAM;
+extern long EVAL_STEP_BUDGET;
+extern long EVAL_MEMORY_BUDGET;
+bool evaluate_program(Node *program, long *result);
+
+// Whether codegen may pick faster instructions than the straightforward ones (turned off by -O0)
+extern bool OPTIMIZATIONS_ENABLED;
+extern int LABELS_GENERATED;
+bool is_power_of_two(unsigned long val);
+void gen_constant_operation(int op, long constant);
+bool select_instructions(Node *node, Scope **local_scope, int width);
+void select_branch(Node *condition, bool jump_when, char *target, Scope **local_scope);
+bool select_conditional_assignment(Node *node, Scope **local_scope);
+
+bool places_on_stack(int ty);
+void gen(Node *statement_tree, Scope **local_scope);
+void gen_branch(Node *condition, bool jump_when, char *target, Scope **local_scope);
 void gen_scope(Node *node, Scope **local_scope);
+Vector *gen_functions(Node *program);
+int scopes_to_clear_on_jump(Scope *starting_scope, char *label_name, int acc);
+char *sized_register(char *name, int size);
+char *size_keyword(int size);
+extern Node *RESULT_STATEMENT;
+void gen_value(Node *node, Scope **local_scope);
+char *variable_memory(Node *node, Scope *scope);
+char *element_address(Node *node, Scope *scope, char *index, int *size);
+
+// Loop vectorization, with SSE2 or with AVX2 for -mavx2 (turned off by -fno-vectorize)
+extern bool VECTORIZE_LOOPS;
+extern bool USE_AVX2;
+bool is_vectorizable(Node *loop, Scope *scope);
+void gen_vectorized_loop(Node *loop, Scope **local_scope);
+
+// Superoptimization of small expressions (-fsuperopt=N for sequences of up to N instructions),
+// with what it finds kept in the table on disk -fsuperopt-table=FILE
+extern bool SUPEROPTIMIZE;
+extern int SUPEROPT_LENGTH;
+extern char *SUPEROPT_TABLE;
+typedef struct {
+    Node *variables[2];     // Loaded into rax and rcx before the code runs
+    int count;
+    Vector *code;           // The instructions, which leave the value in rax
+} Superoptimized;
+Superoptimized *superoptimize(Node *node, Scope *scope, int length);
+
+// How a switch gets to its case: compares one after the other, a binary search over the values, or
+// a jump table indexed by the value
+enum {
+    SWITCH_CHAIN,
+    SWITCH_TREE,
+    SWITCH_TABLE,
+};
+
+#define SWITCH_CHAIN_LENGTH 3   // Most cases compared one after the other
+
+Vector *sorted_cases(Node *node);
+int switch_lowering(Vector *cases);
+void emit(char *format, ...);
+Vector *emitted_lines();
+Vector *optimize_control_flow(Vector *lines);
+Vector *optimize_sections(Vector *lines, Vector *entries);
+
+// Built-in assembler, with ELF output for -c and -o, and in-memory execution for -run
+Bytes *assemble(Vector *lines);
+void write_object(char *filename, Bytes *code);
+void write_executable(char *filename, Bytes *code);
+typedef long (*NativeProgram)();
+NativeProgram load_in_memory(Vector *assembly);
+
+// Bytecode for the interpreter (-interp). Registers are numbered from the frame of the function
+// running: its parameters come first, then its other variables, then temporaries. An operation
+// computes r[a] = r[b] op r[c], or r[b] op c in its I form. Jumps go to the instruction at c: a fused
+// compare-and-branch jumps when r[a] op r[b] (op b in its I form), and INCJ/DECJ step r[a] by one
+// before comparing it.
+enum {
+    BC_HALT,                    // Returns r[a]
+    BC_MOVE,                    // r[a] = r[b]
+    BC_LOAD,                    // r[a] = b
+    BC_NEG, BC_NOT, BC_LNOT,    // r[a] = op r[b]
+    BC_ADD, BC_SUB, BC_MUL, BC_DIV, BC_MOD, BC_SHL, BC_SHR, BC_AND, BC_OR, BC_XOR,
+    BC_EQ, BC_NE, BC_LT, BC_LE, BC_GT, BC_GE,
+    BC_ADDI, BC_SUBI, BC_MULI, BC_DIVI, BC_MODI, BC_SHLI, BC_SHRI, BC_ANDI, BC_ORI, BC_XORI,
+    BC_EQI, BC_NEI, BC_LTI, BC_LEI, BC_GTI, BC_GEI,
+    BC_EXT8, BC_EXT16, BC_EXT32,    // r[a] = the low 1, 2 or 4 bytes of r[b], sign-extended
+    BC_LOADX,                   // r[a] = r[b + r[c]], the element at index r[c] of the array starting at r[b]
+    BC_STOREX,                  // r[b + r[c]] = r[a]
+    BC_CALL,                    // r[a] = the function at b, called with its frame starting at r[c], where its arguments are
+    BC_RET,                     // Returns r[a] to the caller
+    BC_JMP,                     // Everything from here on jumps
+    BC_JZ, BC_JNZ,              // When r[a] is zero, or isn't
+    BC_JEQ, BC_JNE, BC_JLT, BC_JLE, BC_JGT, BC_JGE,
+    BC_JEQI, BC_JNEI, BC_JLTI, BC_JLEI, BC_JGTI, BC_JGEI,
+    BC_INCJLT, BC_INCJLE, BC_INCJNE, BC_DECJGT, BC_DECJGE, BC_DECJNE,
+    BC_INCJLTI, BC_INCJLEI, BC_INCJNEI, BC_DECJGTI, BC_DECJGEI, BC_DECJNEI,
+    BC_TABLE,                   // Through the b JMPs after it, indexed by r[a] unsigned, or to c past them
+    BC_OPERATIONS
+};
+
+typedef struct {
+    int op;
+    int a;
+    int b;
+    int c;
+} Instruction;
+
+typedef struct {
+    Instruction *code;
+    int len;
+    int capacity;
+    int registers;              // Most registers a frame uses
+} Bytecode;
+
+Bytecode *compile_bytecode(Node *program);
+long run_bytecode(Bytecode *bytecode);
 
 void run_test();
\ No newline at end of file